@@ -0,0 +1,118 @@
+/*
+   petpvcAllocationHooks.h
+
+   Author:      Benjamin A. Thomas
+
+   Copyright 2026 Institute of Nuclear Medicine, University College London.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+ */
+
+/*
+   Replaces the global array new and delete so that AllocationTracker sees
+   every pixel buffer that ITK allocates. Include in exactly one source file
+   of an executable.
+
+   Each block has a header holding its size, so delete[] knows how much is
+   freed. Counters are only thread-safe with C++11 atomics, so the hooks
+   are not installed without them.
+ */
+
+#ifndef __PETPVCALLOCATIONHOOKS_H
+#define __PETPVCALLOCATIONHOOKS_H
+
+#include "petpvcAllocationTracker.h"
+
+#ifdef PETPVC_HAVE_ATOMIC_COUNTERS
+
+#include <cstdlib>
+#include <new>
+
+namespace petpvc
+{
+
+//Keeps the returned memory aligned for any type.
+const size_t nAllocationHeaderSize = 16;
+
+inline void * TrackedAllocate( size_t nBytes )
+{
+    void * pBlock = std::malloc( nBytes + nAllocationHeaderSize );
+    if ( pBlock == NULL ) {
+        return NULL;
+    }
+
+    *static_cast< size_t * >( pBlock ) = nBytes;
+    AllocationTracker::GetInstance().Allocated( nBytes );
+
+    return static_cast< char * >( pBlock ) + nAllocationHeaderSize;
+}
+
+inline void TrackedFree( void * pData )
+{
+    if ( pData == NULL ) {
+        return;
+    }
+
+    void * pBlock = static_cast< char * >( pData ) - nAllocationHeaderSize;
+    AllocationTracker::GetInstance().Freed( *static_cast< size_t * >( pBlock ) );
+    std::free( pBlock );
+}
+
+} //namespace petpvc
+
+void * operator new[]( size_t nBytes )
+{
+    void * pData = petpvc::TrackedAllocate( nBytes );
+    if ( pData == NULL ) {
+        throw std::bad_alloc();
+    }
+    return pData;
+}
+
+void * operator new[]( size_t nBytes, const std::nothrow_t & ) noexcept
+{
+    return petpvc::TrackedAllocate( nBytes );
+}
+
+void operator delete[]( void * pData ) noexcept
+{
+    petpvc::TrackedFree( pData );
+}
+
+void operator delete[]( void * pData, const std::nothrow_t & ) noexcept
+{
+    petpvc::TrackedFree( pData );
+}
+
+#ifdef __cpp_sized_deallocation
+void operator delete[]( void * pData, size_t ) noexcept
+{
+    petpvc::TrackedFree( pData );
+}
+#endif
+
+//Marks the hooks as present.
+namespace petpvc
+{
+struct AllocationHooksInstaller {
+    AllocationHooksInstaller() {
+        AllocationTracker::GetInstance().SetInstalled();
+    }
+};
+static AllocationHooksInstaller allocationHooksInstaller;
+} //namespace petpvc
+
+#endif // PETPVC_HAVE_ATOMIC_COUNTERS
+
+#endif // __PETPVCALLOCATIONHOOKS_H
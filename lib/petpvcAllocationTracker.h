@@ -0,0 +1,132 @@
+/*
+   petpvcAllocationTracker.h
+
+   Author:      Benjamin A. Thomas
+
+   Copyright 2026 Institute of Nuclear Medicine, University College London.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+ */
+
+#ifndef __PETPVCALLOCATIONTRACKER_H
+#define __PETPVCALLOCATIONTRACKER_H
+
+#include <cstddef>
+
+#if __cplusplus >= 201103L || ( defined(_MSC_VER) && _MSC_VER >= 1900 )
+#define PETPVC_HAVE_ATOMIC_COUNTERS
+#include <atomic>
+#endif
+
+namespace petpvc
+{
+
+/** \class AllocationTracker
+ *
+ * \brief Counts the bytes currently held in image buffers and their
+ * high-water mark.
+ *
+ * ITK allocates pixel buffers with operator new[], which is replaced by
+ * petpvcAllocationHooks.h in executables that include it. Without the
+ * hooks, nothing is counted and IsInstalled() returns false.
+ *
+ * The peak can be reset at the start of a stage and restored at its end,
+ * which gives the high-water mark of each stage, including nested ones.
+ *
+ */
+class AllocationTracker
+{
+public:
+#ifdef PETPVC_HAVE_ATOMIC_COUNTERS
+    typedef std::atomic< size_t > CounterType;
+#else
+    typedef size_t CounterType;
+#endif
+
+    static AllocationTracker & GetInstance() {
+        //Zero-initialised static storage, with nothing to destroy, so it can
+        //be used before main() and during exit.
+        static AllocationTracker instance;
+        return instance;
+    }
+
+    static bool IsInstalled() {
+        return GetInstance().m_bInstalled;
+    }
+
+    void SetInstalled() {
+        this->m_bInstalled = true;
+    }
+
+    void Allocated( size_t nBytes ) {
+        const size_t nCurrent = ( this->m_nCurrent += nBytes );
+        this->m_nTotal += nBytes;
+        this->RaisePeak( nCurrent );
+    }
+
+    void Freed( size_t nBytes ) {
+        this->m_nCurrent -= nBytes;
+    }
+
+    size_t GetCurrentBytes() const {
+        return this->m_nCurrent;
+    }
+
+    size_t GetPeakBytes() const {
+        return this->m_nPeak;
+    }
+
+    //Total bytes allocated so far, ignoring frees.
+    size_t GetTotalBytes() const {
+        return this->m_nTotal;
+    }
+
+    //Starts a new high-water mark at the current usage. Returns the old
+    //mark, to be passed to RestorePeak().
+    size_t ResetPeak() {
+#ifdef PETPVC_HAVE_ATOMIC_COUNTERS
+        return this->m_nPeak.exchange( this->m_nCurrent );
+#else
+        const size_t nOld = this->m_nPeak;
+        this->m_nPeak = this->m_nCurrent;
+        return nOld;
+#endif
+    }
+
+    void RestorePeak( size_t nOldPeak ) {
+        this->RaisePeak( nOldPeak );
+    }
+
+private:
+    void RaisePeak( size_t nValue ) {
+#ifdef PETPVC_HAVE_ATOMIC_COUNTERS
+        size_t nPeak = this->m_nPeak;
+        while ( nValue > nPeak && !this->m_nPeak.compare_exchange_weak( nPeak, nValue ) ) {
+        }
+#else
+        if ( nValue > this->m_nPeak ) {
+            this->m_nPeak = nValue;
+        }
+#endif
+    }
+
+    bool m_bInstalled;
+    CounterType m_nCurrent;
+    CounterType m_nPeak;
+    CounterType m_nTotal;
+};
+
+} //namespace petpvc
+
+#endif // __PETPVCALLOCATIONTRACKER_H
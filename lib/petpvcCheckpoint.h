@@ -0,0 +1,440 @@
+/*
+   petpvcCheckpoint.h
+
+   Author:      Benjamin A. Thomas
+
+   Copyright 2026 Institute of Nuclear Medicine, University College London.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+ */
+
+/*
+   Checkpoints of the iterative filters (IY, RL and VC), so that a run that
+   is stopped can be resumed.
+
+   Each of these iterations only depends on the estimate before it, so the
+   state is the estimate, the number of iterations done and, for IY, the
+   regional means. Checksums of the input and the mask, the PSF and the VC
+   settings are kept with it, so that it is only resumed on the run it came
+   from. It is kept in one file: a short text header followed by the voxels
+   in binary. The file is written to a temporary name and then renamed, so
+   a run stopped during a write leaves the last checkpoint whole. Writes run
+   on a thread of their own, from a copy of the estimate.
+ */
+
+#ifndef __PETPVCCHECKPOINT_H
+#define __PETPVCCHECKPOINT_H
+
+#include <itkCommand.h>
+#include <itkRealTimeClock.h>
+#include <vnl/vnl_vector.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+#include "petpvcChecksum.h"
+#include "petpvcImageExpression.h"
+#include "petpvcParallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace itk;
+
+namespace petpvc
+{
+
+template< class TInputImage, typename TMaskImage > class IterativeYangPVCImageFilter;
+
+//What a checkpoint must have been made from to be resumed: the input, the
+//mask (for IY), the variance of the PSF and the settings that change the
+//VC iterations.
+struct CheckpointSource {
+    itk::uint64_t nInputChecksum;
+    //Zero for the methods without a mask.
+    itk::uint64_t nMaskChecksum;
+    double vecVariance[3];
+    //VC step size and non-negativity. Zero and false for IY and RL.
+    double fAlpha;
+    bool bDisableNonNeg;
+
+    CheckpointSource() {
+        nInputChecksum = 0;
+        nMaskChecksum = 0;
+        vecVariance[0] = vecVariance[1] = vecVariance[2] = 0.0;
+        fAlpha = 0.0;
+        bDisableNonNeg = false;
+    }
+
+    template< class TImage, class TVector >
+    CheckpointSource( const TImage * input, const TVector & variance ) {
+        nInputChecksum = ChecksumImage( input );
+        nMaskChecksum = 0;
+        for ( unsigned int d = 0; d < 3; d++ ) {
+            vecVariance[d] = variance[d];
+        }
+        fAlpha = 0.0;
+        bDisableNonNeg = false;
+    }
+
+    //Values are compared to the precision they are written with.
+    bool Matches( const CheckpointSource & other ) const {
+        for ( unsigned int d = 0; d < 3; d++ ) {
+            if ( !IsClose( this->vecVariance[d], other.vecVariance[d] ) ) {
+                return false;
+            }
+        }
+        return this->nInputChecksum == other.nInputChecksum && this->nMaskChecksum == other.nMaskChecksum &&
+               IsClose( this->fAlpha, other.fAlpha ) && this->bDisableNonNeg == other.bDisableNonNeg;
+    }
+
+    static bool IsClose( double fA, double fB ) {
+        return std::fabs( fA - fB ) <= 1e-9 * std::max( 1.0, std::fabs( fA ) );
+    }
+};
+
+/** \class Checkpoint
+ *
+ * \brief The state of an iterative filter after some iterations.
+ *
+ */
+template< class TImage >
+class Checkpoint
+{
+public:
+    typedef typename TImage::PixelType PixelType;
+    typedef typename TImage::SizeType SizeType;
+    typedef typename TImage::Pointer ImagePointer;
+    typedef vnl_vector<float> VectorType;
+
+    Checkpoint() {
+        this->nIteration = 0;
+        this->size.Fill( 0 );
+    }
+
+    //Takes a copy of the estimate.
+    void SetEstimate( const TImage * image ) {
+        this->size = image->GetBufferedRegion().GetSize();
+        const SizeValueType nVoxels = image->GetBufferedRegion().GetNumberOfPixels();
+        this->vecData.resize( nVoxels );
+        if ( nVoxels > 0 ) {
+            std::memcpy( &this->vecData[0], image->GetBufferPointer(), nVoxels * sizeof( PixelType ) );
+        }
+    }
+
+    //The estimate, with the geometry of reference.
+    ImagePointer GetEstimate( const TImage * reference ) const {
+        ImagePointer image = NewImageLike( reference );
+        if ( !this->vecData.empty() ) {
+            std::memcpy( image->GetBufferPointer(), &this->vecData[0], this->vecData.size() * sizeof( PixelType ) );
+        }
+        return image;
+    }
+
+    //Writes to sFileName through a temporary file. Returns false if it
+    //cannot be written.
+    bool Write( const std::string & sFileName ) const {
+        const std::string sTempFileName = sFileName + ".tmp";
+        {
+            std::ofstream file( sTempFileName.c_str(), std::ios::binary );
+            if ( !file.is_open() ) {
+                return false;
+            }
+
+            file << "PETPVC_CHECKPOINT 3" << std::endl;
+            file << "method " << this->sMethod << std::endl;
+            file << "input " << this->source.nInputChecksum << std::endl;
+            file << "mask " << this->source.nMaskChecksum << std::endl;
+            file.precision( 17 );
+            file << "psf " << this->source.vecVariance[0] << " " << this->source.vecVariance[1] << " "
+                 << this->source.vecVariance[2] << std::endl;
+            file << "alpha " << this->source.fAlpha << std::endl;
+            file << "nonneg " << ( this->source.bDisableNonNeg ? 0 : 1 ) << std::endl;
+            file << "iteration " << this->nIteration << std::endl;
+            file << "size " << this->size[0] << " " << this->size[1] << " " << this->size[2] << std::endl;
+            file << "means " << this->vecMeans.size();
+            for ( unsigned int n = 0; n < this->vecMeans.size(); n++ ) {
+                file << " " << this->vecMeans[n];
+            }
+            file << std::endl;
+            file << "data " << sizeof( PixelType ) << std::endl;
+            if ( !this->vecData.empty() ) {
+                file.write( reinterpret_cast< const char * >( &this->vecData[0] ),
+                            this->vecData.size() * sizeof( PixelType ) );
+            }
+
+            if ( !file.good() ) {
+                return false;
+            }
+        }
+
+        //POSIX rename() replaces the old checkpoint in one step, so there is
+        //always a whole one. On Windows it cannot replace a file.
+#ifdef _WIN32
+        return MoveFileExA( sTempFileName.c_str(), sFileName.c_str(), MOVEFILE_REPLACE_EXISTING ) != 0;
+#else
+        return std::rename( sTempFileName.c_str(), sFileName.c_str() ) == 0;
+#endif
+    }
+
+    //Reads a file written by Write(). Returns false if it cannot be read.
+    bool Read( const std::string & sFileName ) {
+        std::ifstream file( sFileName.c_str(), std::ios::binary );
+        std::string sTag;
+        int nVersion = 0;
+
+        if ( !( file >> sTag >> nVersion ) || sTag != "PETPVC_CHECKPOINT" || nVersion != 3 ) {
+            return false;
+        }
+
+        SizeValueType nMeans = 0;
+        SizeValueType nBytes = 0;
+        int nNonNeg = 1;
+        file >> sTag >> this->sMethod;
+        file >> sTag >> this->source.nInputChecksum;
+        file >> sTag >> this->source.nMaskChecksum;
+        file >> sTag >> this->source.vecVariance[0] >> this->source.vecVariance[1] >> this->source.vecVariance[2];
+        file >> sTag >> this->source.fAlpha;
+        file >> sTag >> nNonNeg;
+        this->source.bDisableNonNeg = ( nNonNeg == 0 );
+        file >> sTag >> this->nIteration;
+        file >> sTag >> this->size[0] >> this->size[1] >> this->size[2];
+        file >> sTag >> nMeans;
+        if ( !file ) {
+            return false;
+        }
+
+        this->vecMeans.set_size( nMeans );
+        for ( SizeValueType n = 0; n < nMeans; n++ ) {
+            file >> this->vecMeans[n];
+        }
+
+        file >> sTag >> nBytes;
+        if ( !file || sTag != "data" || nBytes != sizeof( PixelType ) ) {
+            return false;
+        }
+        file.ignore( 1 );
+
+        this->vecData.resize( this->size[0] * this->size[1] * this->size[2] );
+        if ( !this->vecData.empty() ) {
+            file.read( reinterpret_cast< char * >( &this->vecData[0] ), this->vecData.size() * sizeof( PixelType ) );
+        }
+
+        return !file.fail();
+    }
+
+    //Name of the method, so that a checkpoint is not resumed by another.
+    std::string sMethod;
+    CheckpointSource source;
+    unsigned int nIteration;
+    SizeType size;
+    VectorType vecMeans;
+    std::vector< PixelType > vecData;
+};
+
+//When to write checkpoints, and where.
+struct CheckpointSettings {
+    std::string sFileName;
+    //Write every nIterations iterations, or every fSeconds seconds. Zero
+    //turns either off.
+    unsigned int nIterations;
+    double fSeconds;
+    //Input, mask, PSF and settings of the run, written with each checkpoint.
+    CheckpointSource source;
+
+    CheckpointSettings() {
+        nIterations = 0;
+        fSeconds = 0.0;
+    }
+};
+
+//Reads an interval such as "10" (iterations) or "600s" (seconds). Returns
+//false if it is not one.
+inline bool ParseCheckpointInterval( const std::string & sInterval, CheckpointSettings & settings )
+{
+    char * pEnd = NULL;
+    const double fValue = std::strtod( sInterval.c_str(), &pEnd );
+
+    if ( pEnd == sInterval.c_str() || fValue <= 0.0 ) {
+        return false;
+    }
+
+    if ( std::string( pEnd ) == "s" ) {
+        settings.nIterations = 0;
+        settings.fSeconds = fValue;
+        return true;
+    }
+
+    if ( *pEnd != '\0' || fValue != (unsigned int) fValue ) {
+        return false;
+    }
+
+    settings.nIterations = (unsigned int) fValue;
+    settings.fSeconds = 0.0;
+    return true;
+}
+
+//Regional means of the filters that have them.
+template< class TFilter >
+vnl_vector<float> GetCheckpointMeans( const TFilter * )
+{
+    return vnl_vector<float>();
+}
+
+template< class TInputImage, class TMaskImage >
+vnl_vector<float> GetCheckpointMeans( const IterativeYangPVCImageFilter< TInputImage, TMaskImage > * filter )
+{
+    return filter->GetCurrentMeans();
+}
+
+/** \class CheckpointCommand
+ *
+ * \brief Writes checkpoints of an iterative PVC filter as it runs.
+ *
+ * Observes itk::IterationEvent and, when one is due, copies the estimate
+ * and writes it in the background. A write only holds up the iterations if
+ * the one before it has not finished. The last write is waited for at the
+ * end of the filter.
+ *
+ */
+template< class TFilter >
+class CheckpointCommand : public itk::Command
+{
+public:
+    typedef CheckpointCommand Self;
+    typedef itk::Command Superclass;
+    typedef itk::SmartPointer< Self > Pointer;
+
+    itkNewMacro( Self );
+
+    typedef typename TFilter::InputImageType ImageType;
+    typedef Checkpoint< ImageType > CheckpointType;
+
+    void SetSettings( const CheckpointSettings & settings ) {
+        this->m_settings = settings;
+        this->m_checkpoint.source = settings.source;
+    }
+
+    void SetMethod( const std::string & sMethod ) {
+        this->m_checkpoint.sMethod = sMethod;
+    }
+
+    void Execute( itk::Object *caller, const itk::EventObject & event ) ITK_OVERRIDE {
+        this->Execute( (const itk::Object *) caller, event );
+    }
+
+    void Execute( const itk::Object *caller, const itk::EventObject & event ) ITK_OVERRIDE {
+        if ( itk::StartEvent().CheckEvent( &event ) ) {
+            this->m_fLastTime = this->m_clock->GetTimeInSeconds();
+            return;
+        }
+
+        if ( itk::EndEvent().CheckEvent( &event ) ) {
+            this->Wait();
+            return;
+        }
+
+        if ( !itk::IterationEvent().CheckEvent( &event ) ) {
+            return;
+        }
+
+        const TFilter * filter = dynamic_cast< const TFilter * >( caller );
+        if ( filter == NULL ) {
+            return;
+        }
+
+        const unsigned int nIter = filter->GetCurrentIteration();
+        const double fTime = this->m_clock->GetTimeInSeconds();
+
+        const bool bDue = ( this->m_settings.nIterations > 0 && nIter % this->m_settings.nIterations == 0 ) ||
+                          ( this->m_settings.fSeconds > 0.0 && fTime - this->m_fLastTime >= this->m_settings.fSeconds );
+        if ( !bDue ) {
+            return;
+        }
+
+        //The copy is only changed once the write before it has finished.
+        this->Wait();
+
+        this->m_checkpoint.nIteration = nIter;
+        this->m_checkpoint.vecMeans = GetCheckpointMeans( filter );
+        this->m_checkpoint.SetEstimate( filter->GetCurrentEstimate() );
+        this->m_fLastTime = fTime;
+
+        this->m_task.Start( WriteCallback, this );
+    }
+
+protected:
+    CheckpointCommand() {
+        this->m_clock = itk::RealTimeClock::New();
+        this->m_fLastTime = this->m_clock->GetTimeInSeconds();
+        this->m_bWritten = true;
+    }
+
+private:
+    CheckpointCommand(const Self &); //purposely not implemented
+    void operator=(const Self &);  //purposely not implemented
+
+    static void WriteCallback( void * data ) {
+        Self * self = static_cast< Self * >( data );
+        self->m_bWritten = self->m_checkpoint.Write( self->m_settings.sFileName );
+    }
+
+    //Waits for the last write, and warns if it failed.
+    void Wait() {
+        this->m_task.Wait();
+        if ( !this->m_bWritten ) {
+            std::cerr << "[Warning]\tCannot write checkpoint: " << this->m_settings.sFileName << std::endl;
+            this->m_bWritten = true;
+        }
+    }
+
+    CheckpointSettings m_settings;
+    CheckpointType m_checkpoint;
+    itk::RealTimeClock::Pointer m_clock;
+    double m_fLastTime;
+    bool m_bWritten;
+    BackgroundTask m_task;
+};
+
+//Attaches a checkpoint writer to an iterative filter. Does nothing if no
+//file name or interval is given.
+template< class TFilter >
+void AddCheckpoints( TFilter * filter, const std::string & sMethod, const CheckpointSettings & settings )
+{
+    if ( settings.sFileName.empty() || ( settings.nIterations == 0 && settings.fSeconds <= 0.0 ) ) {
+        return;
+    }
+
+    typename CheckpointCommand< TFilter >::Pointer checkpointCmd = CheckpointCommand< TFilter >::New();
+    checkpointCmd->SetSettings( settings );
+    checkpointCmd->SetMethod( sMethod );
+    filter->AddObserver( itk::StartEvent(), checkpointCmd );
+    filter->AddObserver( itk::IterationEvent(), checkpointCmd );
+    filter->AddObserver( itk::EndEvent(), checkpointCmd );
+}
+
+} //namespace petpvc
+
+#endif // __PETPVCCHECKPOINT_H
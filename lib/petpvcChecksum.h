@@ -0,0 +1,55 @@
+/*
+   petpvcChecksum.h
+
+   Author:      Benjamin A. Thomas
+
+   Copyright 2026 Institute of Nuclear Medicine, University College London.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+ */
+
+/*
+   Checksums of images, kept in the files that a later run reads back
+   (checkpoints and region indexes), so that a file made from one image is
+   not used with another of the same size.
+ */
+
+#ifndef __PETPVCCHECKSUM_H
+#define __PETPVCCHECKSUM_H
+
+#include <itkIntTypes.h>
+
+namespace petpvc
+{
+
+//Start value of an FNV-1a hash.
+const itk::uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+
+//FNV-1a hash of the voxels of image. Several images can be hashed in turn
+//by passing the hash of the ones before as nHash.
+template< class TImage >
+itk::uint64_t ChecksumImage( const TImage * image, itk::uint64_t nHash = FNV_OFFSET_BASIS )
+{
+    const unsigned char * pData = reinterpret_cast< const unsigned char * >( image->GetBufferPointer() );
+    const itk::SizeValueType nBytes = image->GetBufferedRegion().GetNumberOfPixels() * sizeof( typename TImage::PixelType );
+
+    for ( itk::SizeValueType n = 0; n < nBytes; n++ ) {
+        nHash = ( nHash ^ pData[n] ) * 1099511628211ULL;
+    }
+    return nHash;
+}
+
+} //namespace petpvc
+
+#endif // __PETPVCCHECKSUM_H
@@ -0,0 +1,129 @@
+/*
+   petpvcCounterRandom.h
+
+   Author:      Benjamin A. Thomas
+
+   Copyright 2026 Institute of Nuclear Medicine, University College London.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+ */
+
+/*
+   Counter-based random numbers for noise simulation.
+
+   Each number is a hash of (seed, stream, counter), so any stream can be
+   started anywhere without generating the ones before it. Giving every
+   voxel of every replicate its own stream makes the noise the same whatever
+   the number of threads and however the voxels are split between them.
+ */
+
+#ifndef __PETPVCCOUNTERRANDOM_H
+#define __PETPVCCOUNTERRANDOM_H
+
+#include <itkIntTypes.h>
+
+#include <cmath>
+
+namespace petpvc
+{
+
+/** \class CounterRandom
+ *
+ * \brief Uniform, Gaussian and Poisson deviates from one stream of a
+ * counter-based generator.
+ *
+ */
+class CounterRandom
+{
+public:
+    CounterRandom( itk::uint64_t nSeed, itk::uint64_t nStream ) {
+        this->m_nKey = Mix( Mix( nSeed ) + nStream * GOLDEN );
+        this->m_nCounter = 0;
+    }
+
+    //Uniform in (0,1).
+    double NextUniform() {
+        const itk::uint64_t nValue = Mix( this->m_nKey + ( ++this->m_nCounter ) * GOLDEN );
+        return ( ( nValue >> 11 ) + 0.5 ) * ( 1.0 / 9007199254740992.0 );
+    }
+
+    //Standard normal, by the Box-Muller transform.
+    double NextGaussian() {
+        const double u = this->NextUniform();
+        const double v = this->NextUniform();
+        return std::sqrt( -2.0 * std::log( u ) ) * std::cos( 6.283185307179586 * v );
+    }
+
+    //Poisson with mean fMean. Small means use Knuth's product method and
+    //larger ones Hormann's transformed rejection (PTRS), which needs about
+    //two uniforms per deviate.
+    double NextPoisson( double fMean ) {
+        if ( fMean <= 0.0 ) {
+            return 0.0;
+        }
+
+        if ( fMean < 10.0 ) {
+            const double fLimit = std::exp( -fMean );
+            double fProduct = this->NextUniform();
+            double k = 0.0;
+            while ( fProduct > fLimit ) {
+                fProduct *= this->NextUniform();
+                k += 1.0;
+            }
+            return k;
+        }
+
+        const double fRoot = std::sqrt( fMean );
+        const double fLogMean = std::log( fMean );
+        const double b = 0.931 + 2.53 * fRoot;
+        const double a = -0.059 + 0.02483 * b;
+        const double fInvAlpha = 1.1239 + 1.1328 / ( b - 3.4 );
+        const double vr = 0.9277 - 3.6224 / ( b - 2.0 );
+
+        for ( ;; ) {
+            const double u = this->NextUniform() - 0.5;
+            const double v = this->NextUniform();
+            const double us = 0.5 - std::fabs( u );
+            const double k = std::floor( ( 2.0 * a / us + b ) * u + fMean + 0.43 );
+
+            if ( us >= 0.07 && v <= vr ) {
+                return k;
+            }
+            if ( k < 0.0 || ( us < 0.013 && v > us ) ) {
+                continue;
+            }
+            if ( std::log( v * fInvAlpha / ( a / ( us * us ) + b ) ) <=
+                 -fMean + k * fLogMean - lgamma( k + 1.0 ) ) {
+                return k;
+            }
+        }
+    }
+
+private:
+    //SplitMix64 finaliser.
+    static itk::uint64_t Mix( itk::uint64_t x ) {
+        x = ( x ^ ( x >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+        x = ( x ^ ( x >> 27 ) ) * 0x94d049bb133111ebULL;
+        return x ^ ( x >> 31 );
+    }
+
+    static const itk::uint64_t GOLDEN = 0x9e3779b97f4a7c15ULL;
+
+    itk::uint64_t m_nKey;
+    itk::uint64_t m_nCounter;
+};
+
+} //namespace petpvc
+
+#endif // __PETPVCCOUNTERRANDOM_H
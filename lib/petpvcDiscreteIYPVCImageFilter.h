@@ -31,10 +31,10 @@
 #include <itkAddImageFilter.h>
 #include <itkDiscreteGaussianImageFilter.h>
 #include <itkStatisticsImageFilter.h>
-#include <itkLabelStatisticsImageFilter.h>
 #include <itkBinaryThresholdImageFilter.h>
 
-#include <itkImageDuplicator.h>
+#include "petpvcLabelCompaction.h"
+#include "petpvcTimeBudget.h"
 
 #include <algorithm>
 
@@ -78,9 +78,8 @@ public:
     typedef itk::StatisticsImageFilter<TInputImage> StatisticsFilterType;
 
     //For getting information about the mask labels
-    typedef itk::LabelStatisticsImageFilter<TInputImage, TMaskImage> LabelStatisticsFilterType;
-    typedef typename LabelStatisticsFilterType::ValidLabelValuesContainerType ValidLabelValuesType;
-    typedef typename LabelStatisticsFilterType::LabelPixelType               LabelPixelType;
+    typedef LabelCompaction<TMaskImage> LabelCompactionType;
+    typedef typename LabelCompactionType::LabelType LabelPixelType;
     
     typedef itk::BinaryThresholdImageFilter<TMaskImage, TInputImage> BinaryThresholdImageFilterType;
 
@@ -88,7 +87,6 @@ public:
     typedef itk::DivideImageFilter<TInputImage,TInputImage, TInputImage> DivideFilterType;
     typedef itk::AddImageFilter<TInputImage, TInputImage> AddFilterType;
     typedef itk::DiscreteGaussianImageFilter<TInputImage, TInputImage> BlurringFilterType;
-    typedef itk::ImageDuplicator<TInputImage> DuplicatorType;
 
     typedef itk::Vector<float, 3> ITKVectorType;
 
@@ -138,6 +136,34 @@ public:
         this->m_bVerbose = bVerbose;
     }
 
+    //Wall-clock time, from GetWallClockTime(), by which the iterations must
+    //end. 0, the default, sets no limit.
+    void SetDeadline( double fDeadline ) {
+        this->m_fDeadline = fDeadline;
+    }
+
+    /** How the iterations ended, after Update(). */
+    const IterationReport & GetIterationReport() const {
+        return this->m_report;
+    }
+
+    /** Number of the iteration just completed. Valid while observers of
+     * itk::IterationEvent are executed. */
+    unsigned int GetCurrentIteration() const {
+        return this->m_nCurrentIteration;
+    }
+
+    /** Image estimate after the iteration just completed. Valid while
+     * observers of itk::IterationEvent are executed. */
+    const InputImageType * GetCurrentEstimate() const {
+        return this->m_imageCurrentEstimate;
+    }
+
+    /** Regional mean estimates used in the iteration just completed. */
+    VectorType GetCurrentMeans() const {
+        return this->m_vecRegMeansPVCorr;
+    }
+
 
 protected:
     DiscreteIYPVCImageFilter();
@@ -151,6 +177,10 @@ protected:
     ITKVectorType m_vecVariance;
     unsigned int m_nIterations;
     bool m_bVerbose;
+    double m_fDeadline;
+    IterationReport m_report;
+    unsigned int m_nCurrentIteration;
+    const TInputImage * m_imageCurrentEstimate;
 
 private:
     DiscreteIYPVCImageFilter(const Self &); //purposely not implemented
@@ -27,6 +27,10 @@
 #include "itkObjectFactory.h"
 #include "itkImageRegionIterator.h"
 #include "itkImageRegionConstIterator.h"
+#include "petpvcProfiler.h"
+#include "petpvcReduction.h"
+#include "petpvcImageExpression.h"
+#include <vector>
 
 using namespace itk;
 
@@ -39,6 +43,9 @@ DiscreteIYPVCImageFilter< TInputImage, TMaskImage>
 {
     this->m_nIterations = 10;
     this->m_bVerbose = false;
+    this->m_fDeadline = 0.0;
+    this->m_nCurrentIteration = 0;
+    this->m_imageCurrentEstimate = NULL;
 }
 
 template< class TInputImage, class TMaskImage >
@@ -71,26 +78,13 @@ void DiscreteIYPVCImageFilter< TInputImage, TMaskImage>
     desiredStart.Fill(0);
     MaskSizeType desiredSize = imageSize;
 
-    //Stats. filter used to calculate statistics for an image.
-    typename StatisticsFilterType::Pointer statsFilter = StatisticsFilterType::New();
+    //Replace the labels by dense indices, so that per-label sums and the
+    //Yang image use the index directly instead of a map lookup.
+    typename LabelCompactionType::Pointer labelCompaction = LabelCompactionType::New();
+    labelCompaction->Compact( pMask.GetPointer() );
+    typename LabelCompactionType::IndexImageType * imageIndex = labelCompaction->GetIndexImage();
 
-    //Multiplies two images together.
-    typename MultiplyFilterType::Pointer multiplyFilter = MultiplyFilterType::New();
-
-    typename TInputImage::Pointer imageExtractedRegion;// = InputImagePointer::New();
-
-    typename LabelStatisticsFilterType::Pointer labelStatsFilter = LabelStatisticsFilterType::New();
-    typename BinaryThresholdImageFilterType::Pointer binThreshFilter = BinaryThresholdImageFilterType::New();
-
-    binThreshFilter->SetInput( pMask );
-    binThreshFilter->SetInsideValue(1);
-    binThreshFilter->SetOutsideValue(0);
-
-    labelStatsFilter->SetLabelInput( pMask );
-    labelStatsFilter->SetInput( pPET );
-    labelStatsFilter->Update();
-
-    int numOfLabels = labelStatsFilter->GetNumberOfLabels();
+    int numOfLabels = labelCompaction->GetNumberOfLabels();
     nClasses = numOfLabels;
 
     if ( this->m_bVerbose )
@@ -115,26 +109,26 @@ void DiscreteIYPVCImageFilter< TInputImage, TMaskImage>
 
     typename TInputImage::Pointer imageYang;
     typename TInputImage::Pointer imageEstimate;
-    typename AddFilterType::Pointer addFilter = AddFilterType::New();
-    typename DuplicatorType::Pointer duplicator = DuplicatorType::New();
 
-    typename MultiplyFilterType::Pointer multiplyFilter2 = MultiplyFilterType::New();
-    typename DivideFilterType::Pointer divideFilter = DivideFilterType::New();
     typename BlurringFilterType::Pointer pBlurFilter = BlurringFilterType::New();
+    ProfileFilter( pBlurFilter.GetPointer(), this, "blur" );
 
 
-    duplicator->SetInputImage( pPET );
-    duplicator->Update();
-
-    //Set image estimate to the original PET data for the first iteration.
-    imageEstimate = duplicator->GetOutput();
+    //The estimate is kept in the output buffer, so it does not have to be
+    //copied at the end. Start from the original PET data.
+    this->AllocateOutputs();
+    imageEstimate = output;
+    Evaluate( imageEstimate.GetPointer(), Expr( pPET ) );
 
     int nNumOfIters =  this->m_nIterations;
 
+    this->m_report = IterationReport();
+    IterationBudget budget;
+    budget.Start( this->m_fDeadline );
+
     for (int k = 1; k <= nNumOfIters; k++) {
 
-        labelStatsFilter->SetInput( imageEstimate );
-        labelStatsFilter->Update();
+        ScopedStageTimer iterationTimer( this, "iteration", k );
 
         if ( this->m_bVerbose ) {
             if (k == 1) {
@@ -146,20 +140,15 @@ void DiscreteIYPVCImageFilter< TInputImage, TMaskImage>
         }
 
         int i = 0;
-        float fNewRegMean = 0;
 
-        for( typename ValidLabelValuesType::const_iterator vIt=labelStatsFilter->GetValidLabelValues().begin();
-                vIt != labelStatsFilter->GetValidLabelValues().end(); ++vIt)
+        std::vector< double > vecMeans;
         {
-            if ( labelStatsFilter->HasLabel(*vIt) )
-            {
-                LabelPixelType labelValue = *vIt;
-                //std::cout << "Label: " << labelValue << "\t";
-                fNewRegMean = std::max( labelStatsFilter->GetMean( labelValue ), 0.0 );
-                //std::cout << fNewRegMean << " ";
-                vecRegMeansCurrent.put(i, fNewRegMean);
-                i++;
-            }
+            ScopedStageTimer statsTimer( this, "regional statistics" );
+            vecMeans = IndexMeans( imageEstimate.GetPointer(), imageIndex, numOfLabels );
+        }
+
+        for ( i = 0; i < numOfLabels; i++ ) {
+            vecRegMeansCurrent.put(i, std::max( vecMeans[i], 0.0 ) );
         }
 
         vecRegMeansUpdated = vecRegMeansCurrent;
@@ -176,76 +165,52 @@ void DiscreteIYPVCImageFilter< TInputImage, TMaskImage>
 
         //std::cout << vecRegMeansUpdated << std::endl;
 
-        i=0;
-
-        for( typename ValidLabelValuesType::const_iterator vIt=labelStatsFilter->GetValidLabelValues().begin();
-                vIt != labelStatsFilter->GetValidLabelValues().end(); ++vIt)
-        {
-            if ( labelStatsFilter->HasLabel(*vIt) )
-            {
-                LabelPixelType labelValue = *vIt;
-                binThreshFilter->SetLowerThreshold( labelValue );
-                binThreshFilter->SetUpperThreshold( labelValue );
-                binThreshFilter->Update();
-
-                imageExtractedRegion = binThreshFilter->GetOutput();
-                imageExtractedRegion->SetDirection( pPET->GetDirection() );
-                imageExtractedRegion->UpdateOutputData();
-
-                //Multiply current image estimate by region mask. To clip PET values
-                //to mask.
-                multiplyFilter->SetInput1( vecRegMeansUpdated.get(i) );
-                multiplyFilter->SetInput2( imageExtractedRegion );
-                multiplyFilter->Update();
-
-                //If this is the first region, create imageYang,
-                //else add the current region to the previous contents of imageYang.
-                if (i == 0) {
-                    imageYang = multiplyFilter->GetOutput();
-                    imageYang->DisconnectPipeline();
-                } else {
-                    addFilter->SetInput1(imageYang);
-                    addFilter->SetInput2(multiplyFilter->GetOutput());
-                    addFilter->Update();
-
-                    imageYang = addFilter->GetOutput();
-                }
-
-                i++;
-            }
-        }        
+        //Fill the voxels of each label with its mean, in one pass. The same
+        //buffer is used in every iteration.
+        if ( imageYang.IsNull() ) {
+            imageYang = NewImageLike( pPET.GetPointer() );
+        }
+        const std::vector< float > vecYang( vecRegMeansUpdated.begin(), vecRegMeansUpdated.end() );
+        LookupImage( imageYang.GetPointer(), imageIndex, vecYang );
 
         //Takes the original PET data and the pseudo PET image, calculates the
         //correction factors  and returns the PV-corrected PET image.
 
         pBlurFilter->SetInput(imageYang);
         pBlurFilter->SetVariance( this->GetPSF() );
+        pBlurFilter->Update();
+
+        //Multiply original PET by the correction factors, the ratio of pseudo
+        //PET and smoothed pseudo PET.
+        Evaluate( imageEstimate.GetPointer(),
+                  Expr( pPET ) * ( Expr( imageYang ) / Expr( pBlurFilter->GetOutput() ) ) );
+
+        //Relative change of the means since the last iteration.
+        if ( k > 1 ) {
+            const float fNorm = vecRegMeansUpdated.two_norm();
+            const float fChange = ( vecRegMeansUpdated - this->m_vecRegMeansPVCorr ).two_norm();
+            this->m_report.fConvergence = ( fNorm > 0.0 ) ? fChange / fNorm : 0.0;
+        }
+        this->m_report.nIterations = k;
 
-        //Take ratio of pseudo PET and smoothed pseudo PET. These are the correction
-        //factors.
-        divideFilter->SetInput1( imageYang );
-        divideFilter->SetInput2( pBlurFilter->GetOutput() );
-
-        //Multiply original PET by correction factors.
-        multiplyFilter2->SetInput1( pPET );
-        multiplyFilter2->SetInput2( divideFilter->GetOutput() );
-        multiplyFilter2->Update();
-
+        //Let any observers see the estimate and means of this iteration.
+        this->m_vecRegMeansPVCorr = vecRegMeansUpdated;
+        this->m_nCurrentIteration = k;
+        this->m_imageCurrentEstimate = imageEstimate.GetPointer();
+        this->InvokeEvent( itk::IterationEvent() );
 
-        imageEstimate = multiplyFilter2->GetOutput();
-        imageEstimate->UpdateOutputData();
-        imageEstimate->DisconnectPipeline();
+        if ( k < nNumOfIters && !budget.AllowsNextIteration() ) {
+            this->m_report.bOutOfTime = true;
+            break;
+        }
     }
 
+    this->m_imageCurrentEstimate = NULL;
+
     if ( this->m_bVerbose ) {
         std::cout << std::endl;
     }
 
-    this->AllocateOutputs();
-
-    ImageAlgorithm::Copy( imageEstimate.GetPointer(), output.GetPointer(), output->GetRequestedRegion(),
-                          output->GetRequestedRegion() );
-
 }
 
 }// end namespace
@@ -0,0 +1,160 @@
+/*
+   petpvcDistanceTransform.h
+
+   Author:      Benjamin A. Thomas
+
+   Copyright 2026 Institute of Nuclear Medicine, University College London.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+ */
+
+/*
+   Exact squared Euclidean distance transform, in voxels, by the separable
+   lower-envelope method of Felzenszwalb and Huttenlocher (2012). Each
+   dimension is one pass over independent lines, which are split between
+   threads. The cost does not depend on the distances, so eroding by a ball
+   of any radius costs the same as thresholding the distance.
+ */
+
+#ifndef __PETPVCDISTANCETRANSFORM_H
+#define __PETPVCDISTANCETRANSFORM_H
+
+#include <itkImage.h>
+
+#include "petpvcParallel.h"
+
+#include <vector>
+
+namespace petpvc
+{
+
+//Distance of voxels with no background voxel in their line.
+const float DISTANCE_INFINITY = 1e30f;
+
+//Replaces the squared distances along each line of one dimension by the
+//smallest (x - q)^2 + f(q) along the line.
+struct DistanceLinesFunctor {
+    float * pDistance;
+    itk::SizeValueType nLength;
+    itk::SizeValueType nStride;
+    //Lines are numbered over the other two dimensions. A line starts at
+    //(n % nInner) * nInnerStride + (n / nInner) * nOuterStride.
+    itk::SizeValueType nInner;
+    itk::SizeValueType nInnerStride;
+    itk::SizeValueType nOuterStride;
+
+    //Where the parabolas of p and q cross.
+    static double Intersect( const std::vector< double > & f, itk::SizeValueType p, itk::SizeValueType q ) {
+        return ( ( f[q] + (double) q * q ) - ( f[p] + (double) p * p ) ) / ( 2.0 * ( (double) q - p ) );
+    }
+
+    void operator()( itk::SizeValueType nFirst, itk::SizeValueType nLast, itk::SizeValueType ) const {
+        std::vector< double > f( this->nLength );
+        std::vector< double > z( this->nLength + 1 );
+        std::vector< itk::SizeValueType > v( this->nLength );
+
+        for ( itk::SizeValueType n = nFirst; n < nLast; n++ ) {
+            float * pLine = this->pDistance + ( n % this->nInner ) * this->nInnerStride
+                            + ( n / this->nInner ) * this->nOuterStride;
+
+            for ( itk::SizeValueType q = 0; q < this->nLength; q++ ) {
+                f[q] = pLine[q * this->nStride];
+            }
+
+            //Lower envelope of the parabolas of the finite values.
+            int k = -1;
+            for ( itk::SizeValueType q = 0; q < this->nLength; q++ ) {
+                if ( f[q] >= DISTANCE_INFINITY ) {
+                    continue;
+                }
+                if ( k < 0 ) {
+                    k = 0;
+                    v[0] = q;
+                    z[0] = -DISTANCE_INFINITY;
+                    z[1] = DISTANCE_INFINITY;
+                    continue;
+                }
+
+                //z[0] is below any intersection, so k stays at least 0.
+                double s = Intersect( f, v[k], q );
+                while ( s <= z[k] ) {
+                    k--;
+                    s = Intersect( f, v[k], q );
+                }
+
+                k++;
+                v[k] = q;
+                z[k] = s;
+                z[k + 1] = DISTANCE_INFINITY;
+            }
+
+            //No finite values: the line stays at infinity.
+            if ( k < 0 ) {
+                continue;
+            }
+
+            k = 0;
+            for ( itk::SizeValueType q = 0; q < this->nLength; q++ ) {
+                while ( z[k + 1] < (double) q ) {
+                    k++;
+                }
+                const double fDiff = (double) q - v[k];
+                pLine[q * this->nStride] = static_cast< float >( fDiff * fDiff + f[v[k]] );
+            }
+        }
+    }
+};
+
+//Sets vecDistance to the squared distance, in voxels, from each voxel to
+//the nearest voxel of image that is not equal to foreground. Voxels outside
+//the image do not count, so with no such voxel every distance is
+//DISTANCE_INFINITY.
+template< class TImage >
+void SquaredDistanceToBackground( const TImage * image, typename TImage::PixelType foreground,
+                                  std::vector< float > & vecDistance )
+{
+    const typename TImage::SizeType size = image->GetBufferedRegion().GetSize();
+    const itk::SizeValueType nVoxels = image->GetBufferedRegion().GetNumberOfPixels();
+    const typename TImage::PixelType * pImage = image->GetBufferPointer();
+
+    vecDistance.resize( nVoxels );
+    for ( itk::SizeValueType i = 0; i < nVoxels; i++ ) {
+        vecDistance[i] = ( pImage[i] == foreground ) ? DISTANCE_INFINITY : 0.0f;
+    }
+
+    if ( nVoxels == 0 ) {
+        return;
+    }
+
+    const itk::SizeValueType vecStride[3] = { 1, size[0], size[0] * size[1] };
+
+    for ( unsigned int d = 0; d < 3; d++ ) {
+        const unsigned int nInnerDim = ( d == 0 ) ? 1 : 0;
+        const unsigned int nOuterDim = ( d == 2 ) ? 1 : 2;
+
+        DistanceLinesFunctor functor;
+        functor.pDistance = &vecDistance[0];
+        functor.nLength = size[d];
+        functor.nStride = vecStride[d];
+        functor.nInner = size[nInnerDim];
+        functor.nInnerStride = vecStride[nInnerDim];
+        functor.nOuterStride = vecStride[nOuterDim];
+
+        ParallelFor( 0, nVoxels / size[d], functor );
+    }
+}
+
+} //namespace petpvc
+
+#endif // __PETPVCDISTANCETRANSFORM_H
@@ -28,10 +28,11 @@
 #include "itkObjectFactory.h"
 #include "itkImageRegionIterator.h"
 #include "itkImageRegionConstIterator.h"
-#include <itkStatisticsImageFilter.h>
-#include <itkExtractImageFilter.h>
-#include <itkMultiplyImageFilter.h>
+#include "petpvcVolumeView.h"
+#include "petpvcProfiler.h"
+#include "petpvcReduction.h"
 #include "vnl/vnl_matrix.h"
+#include <algorithm>
 
 using namespace itk;
 
@@ -53,13 +54,13 @@ void FuzzyCorrectionFilter<TImage>::GenerateData()
 
     this->SetGlobalDefaultCoordinateTolerance( 1e-2 );
     this->SetGlobalDefaultDirectionTolerance( 1e-2 );
+
+    ScopedStageTimer timer( this, "matrix construction" );
     
     //Get pointers to input and output.
     typename TImage::ConstPointer input = this->GetInput();
     typename TImage::Pointer output = this->GetOutput();
 
-    this->AllocateOutputs();
-
     //Get region size.
     typename TImage::SizeType imageSize =
         input->GetLargestPossibleRegion().GetSize();
@@ -80,26 +81,8 @@ void FuzzyCorrectionFilter<TImage>::GenerateData()
 
     typedef itk::Image<float, 3> MaskImageType;
 
-    typedef itk::StatisticsImageFilter<MaskImageType> StatisticsFilterType;
-    typedef itk::ExtractImageFilter<TImage, MaskImageType> ExtractFilterType;
-    typedef itk::MultiplyImageFilter<MaskImageType, MaskImageType> MultiplyFilterType;
-
-    typename TImage::IndexType desiredStart;
-    desiredStart.Fill(0);
-
-    typename TImage::SizeType desiredSize =
-        input->GetLargestPossibleRegion().GetSize();
-
-    typename TImage::RegionType desiredRegion;
-
-    StatisticsFilterType::Pointer statsFilter = StatisticsFilterType::New();
-
-    typename ExtractFilterType::Pointer extractTargetFilter =
-        ExtractFilterType::New();
-    typename ExtractFilterType::Pointer extractNeighbourFilter =
-        ExtractFilterType::New();
-    typename MultiplyFilterType::Pointer multiplyFilter =
-        MultiplyFilterType::New();
+    MaskImageType::Pointer imageTarget;
+    MaskImageType::Pointer imageNeighbour;
 
     float fSumTarget;
     float fSumNeighbour;
@@ -107,54 +90,33 @@ void FuzzyCorrectionFilter<TImage>::GenerateData()
     for (int i = 1; i <= nClasses; i++) {
 
         fSumTarget = 0.0;
-        desiredStart[3] = i - 1;
-        desiredSize[3] = 0;
 
-        //Extract 3D brain mask volume i from 4D image.
-        extractTargetFilter->SetExtractionRegion(
-            typename TImage::RegionType(desiredStart, desiredSize));
-        extractTargetFilter->SetInput(input);
-        extractTargetFilter->SetDirectionCollapseToIdentity(); // This is required.
-        extractTargetFilter->Update();
+        //Get 3D brain mask volume i from 4D image, without copying it.
+        imageTarget = GetVolumeView< MaskImageType >( input.GetPointer(), i - 1 );
 
-        statsFilter->SetInput(extractTargetFilter->GetOutput());
-        statsFilter->Update();
+        ScopedStageTimer statsTimer( this, "regional statistics" );
 
         //Calculate the sum of non-zero voxels.
-        fSumTarget = statsFilter->GetSum();
+        fSumTarget = ImageSum( imageTarget.GetPointer() );
         if (fSumTarget == 0) {
           itkExceptionMacro("Region " << i << " has zero sum, i.e. no voxels in mask. Remove this region.");
         }
-        if (statsFilter->GetMinimum() < 0) {
+        const float * pTarget = imageTarget->GetBufferPointer();
+        if (*std::min_element( pTarget, pTarget + imageTarget->GetBufferedRegion().GetNumberOfPixels() ) < 0) {
           itkExceptionMacro("Region " << i << "contains negative voxels in mask. Remove this region.");
         }
         std::cerr << "sum in region " << i << " = " << fSumTarget << std::endl;
 
         vecSumOfRegions->put(i - 1, fSumTarget);
 
-        //Set region i as first input.
-        multiplyFilter->SetInput1(extractTargetFilter->GetOutput());
-
         for (int j = 1; j <= nClasses; j++) {
             fSumNeighbour = 0.0;
-            desiredStart[3] = j - 1;
-            desiredSize[3] = 0;
-
-            //Extract 3D brain mask volume j from 4D image.
-            extractNeighbourFilter->SetExtractionRegion(
-                typename TImage::RegionType(desiredStart, desiredSize));
-            extractNeighbourFilter->SetInput(input);
-            extractNeighbourFilter->SetDirectionCollapseToIdentity(); // This is required.
-            extractNeighbourFilter->Update();
-
-            //Multiply i by j.
-            multiplyFilter->SetInput2(extractNeighbourFilter->GetOutput());
 
-            statsFilter->SetInput(multiplyFilter->GetOutput());
-            statsFilter->Update();
+            //Get 3D brain mask volume j from 4D image, without copying it.
+            imageNeighbour = GetVolumeView< MaskImageType >( input.GetPointer(), j - 1 );
 
-            //Calculate the sum of the remaining voxels.
-            fSumNeighbour = statsFilter->GetSum();
+            //Multiply i by j and sum the remaining voxels.
+            fSumNeighbour = ImageProductSum( imageTarget.GetPointer(), imageNeighbour.GetPointer() );
 
             //Fill location in matrix with sum of remaining voxels
             //normalised by size of i.
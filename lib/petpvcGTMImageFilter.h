@@ -28,6 +28,8 @@
 #include <vnl/algo/vnl_matrix_inverse.h>
 #include <itkImage.h>
 
+#include "petpvcMaskContext.h"
+
 //A class to perform GTM.
 
 using namespace itk;
@@ -52,6 +54,9 @@ public:
     typedef vnl_vector<float> VectorType;
     typedef itk::Vector<float, 3> ITKVectorType;
 
+    //Regions of the mask, possibly shared with other filters.
+    typedef MaskContext< itk::Image<float, 3> > MaskContextType;
+
     itkNewMacro(Self);
 
     itkTypeMacro(GTMImageFilter, ImageToImageFilter);
@@ -75,6 +80,14 @@ public:
         return this->vecVariance;
     };
 
+    //Takes the regions, and any blurred regions, from context instead of
+    //extracting and blurring them here. The context must hold the regions
+    //of the input mask.
+    void SetMaskContext( MaskContextType * context ) {
+        this->m_maskContext = context;
+        this->Modified();
+    };
+
 
 protected:
     GTMImageFilter();
@@ -90,6 +103,7 @@ private:
     MatrixType *matCorrFactors;
     VectorType *vecSumOfRegions;
     ITKVectorType vecVariance;
+    typename MaskContextType::Pointer m_maskContext;
 };
 } //namespace PETPVC
 
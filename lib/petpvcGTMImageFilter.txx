@@ -26,12 +26,15 @@
 #include "itkObjectFactory.h"
 #include "itkImageRegionIterator.h"
 #include "itkImageRegionConstIterator.h"
-#include <itkStatisticsImageFilter.h>
-#include <itkExtractImageFilter.h>
+#include "petpvcVolumeView.h"
+#include "petpvcProfiler.h"
+#include "petpvcReduction.h"
+#include "petpvcRegionIndex.h"
 #include <itkMultiplyImageFilter.h>
 #include <itkDiscreteGaussianImageFilter.h>
 #include <itkImageDuplicator.h>
 #include "vnl/vnl_matrix.h"
+#include <vector>
 
 using namespace itk;
 
@@ -57,6 +60,8 @@ void GTMImageFilter<TImage>::GenerateData()
     this->SetGlobalDefaultCoordinateTolerance( 1e-2 );
     this->SetGlobalDefaultDirectionTolerance( 1e-2 );
 
+    ScopedStageTimer timer( this, "matrix construction" );
+
     //Get pointers to input and output.
     typename TImage::ConstPointer input = this->GetInput();
 
@@ -80,33 +85,25 @@ void GTMImageFilter<TImage>::GenerateData()
 
     typedef itk::Image<float, 3> MaskImageType;
 
-    typedef itk::StatisticsImageFilter<MaskImageType> StatisticsFilterType;
-    typedef itk::ExtractImageFilter<TImage, MaskImageType> ExtractFilterType;
-    typedef itk::MultiplyImageFilter<MaskImageType, MaskImageType> MultiplyFilterType;
-    typedef itk::DiscreteGaussianImageFilter<MaskImageType, MaskImageType> BlurringFilterType;
-
-    typedef itk::ImageDuplicator<MaskImageType> DuplicatorType;
-
-    typename TImage::IndexType desiredStart;
-    desiredStart.Fill(0);
-
-    typename TImage::SizeType desiredSize =
-        input->GetLargestPossibleRegion().GetSize();
-
-    typename TImage::RegionType desiredRegion;
+    //Get each 3D brain mask volume from the 4D image once, without copying
+    //it, unless another filter has already done so.
+    typename MaskContextType::Pointer context = this->m_maskContext;
+    if ( context.IsNull() ) {
+        context = MaskContextType::New();
+        context->SetMask( input.GetPointer() );
+    }
+    context->SetPSF( this->GetPSF() );
 
-    StatisticsFilterType::Pointer statsFilter = StatisticsFilterType::New();
+    //The matrix only depends on the regions and the PSF, so a filter
+    //correcting another image with this context may have found it.
+    if ( context->GetMatrix( "GTM", *matCorrFactors, *vecSumOfRegions ) ) {
+        return;
+    }
 
-    typename ExtractFilterType::Pointer extractTargetFilter =
-        ExtractFilterType::New();
-    typename ExtractFilterType::Pointer extractNeighbourFilter =
-        ExtractFilterType::New();
-    typename MultiplyFilterType::Pointer multiplyFilter =
-        MultiplyFilterType::New();
-    typename BlurringFilterType::Pointer blurringFilter =
-        BlurringFilterType::New();
+    //Regions too far apart to interact have a zero entry in the matrix.
+    const typename MaskContextType::RegionIndexType * index = context->GetRegionIndex();
 
-    blurringFilter->SetVariance((this->GetPSF()));
+    MaskImageType::Pointer imageBlurred;
 
     float fSumTarget;
     float fSumNeighbour;
@@ -114,47 +111,25 @@ void GTMImageFilter<TImage>::GenerateData()
     for (int i = 1; i <= nClasses; i++) {
 
         fSumTarget = 0.0;
-        desiredStart[3] = i - 1;
-        desiredSize[3] = 0;
-
-        //Extract 3D brain mask volume i from 4D image.
-        extractTargetFilter->SetExtractionRegion(
-            typename TImage::RegionType(desiredStart, desiredSize));
-        extractTargetFilter->SetInput(input);
-        extractTargetFilter->SetDirectionCollapseToIdentity(); // This is required.
-        extractTargetFilter->Update();
 
-        blurringFilter->SetInput(extractTargetFilter->GetOutput());
+        imageBlurred = context->GetBlurredRegion( i - 1 );
 
-        statsFilter->SetInput(blurringFilter->GetOutput());
-        statsFilter->Update();
+        ScopedStageTimer statsTimer( this, "regional statistics" );
 
         //Calculate the sum of non-zero voxels.
-        fSumTarget = statsFilter->GetSum();
+        fSumTarget = ImageSum( imageBlurred.GetPointer() );
 
         vecSumOfRegions->put(i - 1, fSumTarget);
 
         for (int j = 1; j <= nClasses; j++) {
-            fSumNeighbour = 0.0;
-            desiredStart[3] = j - 1;
-            desiredSize[3] = 0;
-
-            //Extract 3D brain mask volume j from 4D image.
-            extractNeighbourFilter->SetExtractionRegion(
-                typename TImage::RegionType(desiredStart, desiredSize));
-            extractNeighbourFilter->SetInput(input);
-            extractNeighbourFilter->SetDirectionCollapseToIdentity(); // This is required.
-            extractNeighbourFilter->Update();
+            if ( i != j && !index->AreAdjacent( i - 1, j - 1 ) ) {
+                continue;
+            }
 
-            //Multiply i by j.
-            multiplyFilter->SetInput1(blurringFilter->GetOutput());
-            multiplyFilter->SetInput2(extractNeighbourFilter->GetOutput());
-
-            statsFilter->SetInput(multiplyFilter->GetOutput());
-            statsFilter->Update();
-
-            //Calculate the sum of the remaining voxels.
-            fSumNeighbour = statsFilter->GetSum();
+            //Multiply i by j and sum the remaining voxels, which are those of
+            //region j.
+            fSumNeighbour = RunProductSum( imageBlurred.GetPointer(), context->GetRegion( j - 1 ),
+                                           index->GetRuns( j - 1 ) );
 
             //Fill location in matrix with sum of remaining voxels
             //normalised by size of i.
@@ -164,6 +139,8 @@ void GTMImageFilter<TImage>::GenerateData()
         }
 
     }
+
+    context->SetMatrix( "GTM", *matCorrFactors, *vecSumOfRegions );
 }
 
 template<class TImage>
@@ -0,0 +1,295 @@
+/*
+   petpvcImageExpression.h
+
+   Author:      Benjamin A. Thomas
+
+   Copyright 2026 Institute of Nuclear Medicine, University College London.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+ */
+
+/*
+   Voxel-wise image arithmetic without temporary images.
+
+   Expr() wraps an image, and the usual operators combine images and
+   numbers into an expression that is only evaluated when it is assigned
+   with Evaluate() or EvaluateImage(). The whole expression is then worked
+   out in a single parallel loop over the voxels, e.g.
+
+       Evaluate( output, Expr( pPET ) * Expr( imageYang ) / Expr( blurred ) );
+
+   reads three images and writes one, where a chain of ITK filters would
+   write an intermediate image at every step. Anything that is not
+   voxel-wise, such as a blur, must still be run on an image.
+
+   All images in an expression must have the same buffered region. Values
+   are worked out in double and cast to the output pixel type.
+ */
+
+#ifndef __PETPVCIMAGEEXPRESSION_H
+#define __PETPVCIMAGEEXPRESSION_H
+
+#include <itkImage.h>
+#include <itkNumericTraits.h>
+
+#include "petpvcParallel.h"
+
+#include <algorithm>
+
+namespace petpvc
+{
+
+template< class TPixel >
+struct ImageTerm {
+    const TPixel * pData;
+
+    double operator[]( itk::SizeValueType i ) const {
+        return this->pData[i];
+    }
+};
+
+struct ScalarTerm {
+    double value;
+
+    double operator[]( itk::SizeValueType ) const {
+        return this->value;
+    }
+};
+
+template< class TLeft, class TRight, class TOp >
+struct BinaryTerm {
+    TLeft left;
+    TRight right;
+
+    double operator[]( itk::SizeValueType i ) const {
+        return TOp::Apply( this->left[i], this->right[i] );
+    }
+};
+
+//Picks a where condition is non-zero, otherwise b.
+template< class TCondition, class TLeft, class TRight >
+struct SelectTerm {
+    TCondition condition;
+    TLeft left;
+    TRight right;
+
+    double operator[]( itk::SizeValueType i ) const {
+        return ( this->condition[i] != 0.0 ) ? this->left[i] : this->right[i];
+    }
+};
+
+//An unevaluated voxel-wise expression.
+template< class TTerm >
+struct Expression {
+    TTerm term;
+
+    double operator[]( itk::SizeValueType i ) const {
+        return this->term[i];
+    }
+};
+
+struct AddOp {
+    static double Apply( double a, double b ) {
+        return a + b;
+    }
+};
+
+struct SubtractOp {
+    static double Apply( double a, double b ) {
+        return a - b;
+    }
+};
+
+struct MultiplyOp {
+    static double Apply( double a, double b ) {
+        return a * b;
+    }
+};
+
+//As DivideImageFilter: division by zero gives the largest float.
+struct DivideOp {
+    static double Apply( double a, double b ) {
+        return ( b != 0.0 ) ? a / b : (double) itk::NumericTraits< float >::max();
+    }
+};
+
+struct MaxOp {
+    static double Apply( double a, double b ) {
+        return std::max( a, b );
+    }
+};
+
+struct MinOp {
+    static double Apply( double a, double b ) {
+        return std::min( a, b );
+    }
+};
+
+//1 where the values are equal, otherwise 0, e.g. to pick out a label.
+struct EqualOp {
+    static double Apply( double a, double b ) {
+        return ( a == b ) ? 1.0 : 0.0;
+    }
+};
+
+struct GreaterOp {
+    static double Apply( double a, double b ) {
+        return ( a > b ) ? 1.0 : 0.0;
+    }
+};
+
+//Wraps an image for use in an expression.
+template< class TImage >
+Expression< ImageTerm< typename TImage::PixelType > > Expr( const TImage * image )
+{
+    Expression< ImageTerm< typename TImage::PixelType > > expr;
+    expr.term.pData = image->GetBufferPointer();
+    return expr;
+}
+
+template< class TImage >
+Expression< ImageTerm< typename TImage::PixelType > > Expr( const itk::SmartPointer< TImage > & image )
+{
+    return Expr( image.GetPointer() );
+}
+
+inline Expression< ScalarTerm > Expr( double value )
+{
+    Expression< ScalarTerm > expr;
+    expr.term.value = value;
+    return expr;
+}
+
+template< class TOp, class TLeft, class TRight >
+Expression< BinaryTerm< TLeft, TRight, TOp > > MakeBinary( const TLeft & left, const TRight & right )
+{
+    Expression< BinaryTerm< TLeft, TRight, TOp > > expr;
+    expr.term.left = left;
+    expr.term.right = right;
+    return expr;
+}
+
+//Defines a binary function or operator for expression-expression,
+//expression-number and number-expression arguments.
+#define PETPVC_EXPRESSION_BINARY( name, op ) \
+    template< class TLeft, class TRight > \
+    Expression< BinaryTerm< TLeft, TRight, op > > \
+    name( const Expression< TLeft > & left, const Expression< TRight > & right ) \
+    { \
+        return MakeBinary< op >( left.term, right.term ); \
+    } \
+    template< class TLeft > \
+    Expression< BinaryTerm< TLeft, ScalarTerm, op > > \
+    name( const Expression< TLeft > & left, double right ) \
+    { \
+        return MakeBinary< op >( left.term, Expr( right ).term ); \
+    } \
+    template< class TRight > \
+    Expression< BinaryTerm< ScalarTerm, TRight, op > > \
+    name( double left, const Expression< TRight > & right ) \
+    { \
+        return MakeBinary< op >( Expr( left ).term, right.term ); \
+    }
+
+PETPVC_EXPRESSION_BINARY( operator+, AddOp )
+PETPVC_EXPRESSION_BINARY( operator-, SubtractOp )
+PETPVC_EXPRESSION_BINARY( operator*, MultiplyOp )
+PETPVC_EXPRESSION_BINARY( operator/, DivideOp )
+PETPVC_EXPRESSION_BINARY( Max, MaxOp )
+PETPVC_EXPRESSION_BINARY( Min, MinOp )
+PETPVC_EXPRESSION_BINARY( Equal, EqualOp )
+PETPVC_EXPRESSION_BINARY( Greater, GreaterOp )
+
+#undef PETPVC_EXPRESSION_BINARY
+
+template< class TCondition, class TLeft, class TRight >
+Expression< SelectTerm< TCondition, TLeft, TRight > >
+Where( const Expression< TCondition > & condition, const Expression< TLeft > & left, const Expression< TRight > & right )
+{
+    Expression< SelectTerm< TCondition, TLeft, TRight > > expr;
+    expr.term.condition = condition.term;
+    expr.term.left = left.term;
+    expr.term.right = right.term;
+    return expr;
+}
+
+template< class TCondition, class TLeft >
+Expression< SelectTerm< TCondition, TLeft, ScalarTerm > >
+Where( const Expression< TCondition > & condition, const Expression< TLeft > & left, double right )
+{
+    return Where( condition, left, Expr( right ) );
+}
+
+template< class TCondition, class TRight >
+Expression< SelectTerm< TCondition, ScalarTerm, TRight > >
+Where( const Expression< TCondition > & condition, double left, const Expression< TRight > & right )
+{
+    return Where( condition, Expr( left ), right );
+}
+
+template< class TPixel, class TTerm >
+struct EvaluateFunctor {
+    const Expression< TTerm > * expr;
+    TPixel * pOutput;
+
+    void operator()( itk::SizeValueType nFirst, itk::SizeValueType nLast, itk::SizeValueType ) const {
+        for ( itk::SizeValueType i = nFirst; i < nLast; i++ ) {
+            this->pOutput[i] = static_cast< TPixel >( ( *this->expr )[i] );
+        }
+    }
+};
+
+//Writes an expression into every buffered voxel of output. The output may
+//appear in the expression, e.g. to accumulate into it.
+template< class TImage, class TTerm >
+void Evaluate( TImage * output, const Expression< TTerm > & expr )
+{
+    EvaluateFunctor< typename TImage::PixelType, TTerm > functor;
+    functor.expr = &expr;
+    functor.pOutput = output->GetBufferPointer();
+
+    ParallelFor( 0, output->GetBufferedRegion().GetNumberOfPixels(), functor );
+
+    //So that filters reading output run again.
+    output->Modified();
+}
+
+//Allocates an image with the geometry of reference, without filling it.
+template< class TImage >
+typename itk::Image< typename TImage::PixelType, TImage::ImageDimension >::Pointer
+NewImageLike( const TImage * reference )
+{
+    typedef itk::Image< typename TImage::PixelType, TImage::ImageDimension > ImageType;
+
+    typename ImageType::Pointer image = ImageType::New();
+    image->CopyInformation( reference );
+    image->SetRegions( reference->GetBufferedRegion() );
+    image->Allocate();
+    return image;
+}
+
+//Evaluates an expression into a new image with the geometry of reference.
+template< class TImage, class TTerm >
+typename itk::Image< typename TImage::PixelType, TImage::ImageDimension >::Pointer
+EvaluateImage( const TImage * reference, const Expression< TTerm > & expr )
+{
+    typename itk::Image< typename TImage::PixelType, TImage::ImageDimension >::Pointer image =
+        NewImageLike( reference );
+    Evaluate( image.GetPointer(), expr );
+    return image;
+}
+
+} //namespace petpvc
+
+#endif // __PETPVCIMAGEEXPRESSION_H
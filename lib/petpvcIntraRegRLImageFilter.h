@@ -31,8 +31,10 @@
 #include <itkDivideImageFilter.h>
 #include <itkAddImageFilter.h>
 #include <itkSubtractImageFilter.h>
+#include <itkThresholdImageFilter.h>
 #include "petpvcRegionConvolutionImageFilter.h"
-#include <itkImageDuplicator.h>
+#include "petpvcMaskContext.h"
+#include "petpvcTimeBudget.h"
 
 #include <algorithm>
 
@@ -80,8 +82,8 @@ public:
     typedef itk::AddImageFilter<TInputImage, TInputImage> AddFilterType;
     typedef itk::SubtractImageFilter<TInputImage, TInputImage> SubFilterType;
     typedef petpvc::RegionConvolutionPVCImageFilter<TInputImage, TInputImage> IntraRegBlurFilterType;
+    typedef MaskContext<TInputImage> MaskContextType;
 	typedef itk::ThresholdImageFilter<TInputImage> ThresholdFilterType;
-    typedef itk::ImageDuplicator<TInputImage> DuplicatorType;
 
     typedef itk::Vector<float, 3> ITKVectorType;
 
@@ -122,6 +124,24 @@ public:
         this->m_bVerbose = bVerbose;
     }
 
+    //Wall-clock time, from GetWallClockTime(), by which the iterations must
+    //end. 0, the default, sets no limit.
+    void SetDeadline( double fDeadline ) {
+        this->m_fDeadline = fDeadline;
+    }
+
+    /** How the iterations ended, after Update(). */
+    const IterationReport & GetIterationReport() const {
+        return this->m_report;
+    }
+
+    //Takes the regions, and any blurred regions, from context instead of
+    //the mask input, e.g. to reuse those of a previous correction.
+    void SetMaskContext( MaskContextType * context ) {
+        this->m_maskContext = context;
+        this->Modified();
+    }
+
 
 protected:
     IntraRegRLImageFilter();
@@ -133,6 +153,9 @@ protected:
     ITKVectorType m_vecVariance;
     unsigned int m_nIterations;
     bool m_bVerbose;
+    double m_fDeadline;
+    IterationReport m_report;
+    typename MaskContextType::Pointer m_maskContext;
 
 private:
     IntraRegRLImageFilter(const Self &); //purposely not implemented
@@ -27,6 +27,10 @@
 #include "itkObjectFactory.h"
 #include "itkImageRegionIterator.h"
 #include "itkImageRegionConstIterator.h"
+#include "petpvcVolumeView.h"
+#include "petpvcProfiler.h"
+#include "petpvcReduction.h"
+#include "petpvcImageExpression.h"
 
 using namespace itk;
 
@@ -39,6 +43,7 @@ IntraRegRLImageFilter< TInputImage, TMaskImage>
 {
     this->m_nIterations = 10;
     this->m_bVerbose = false;
+    this->m_fDeadline = 0.0;
 }
 
 template< class TInputImage, class TMaskImage >
@@ -55,63 +60,35 @@ void IntraRegRLImageFilter< TInputImage, TMaskImage>
     InputImagePointer pPET = dynamic_cast<const TInputImage*> (ProcessObject::GetInput(0));
     MaskImagePointer pMask = dynamic_cast<const TMaskImage*> (ProcessObject::GetInput(1));
 
-    //Get mask image size.
-    typename MaskImageType::SizeType imageSize =
-        pMask->GetLargestPossibleRegion().GetSize();
-
-    int nClasses = 0;
-
-    //If mask is not 4D, then quit.
-    if (imageSize.Dimension == 4) {
-        nClasses = imageSize[3];
-    } else {
-        std::cerr << "[Error]\tMask file must be 4-D!"
-                  << std::endl;
+    //Get the regions of the mask, unless another filter already has.
+    typename MaskContextType::Pointer context = this->m_maskContext;
+    if ( context.IsNull() ) {
+        context = MaskContextType::New();
+        context->SetMask( pMask.GetPointer(), pPET.GetPointer() );
     }
+    context->SetPSF( this->GetPSF() );
 
-    MaskSizeType desiredStart;
-    desiredStart.Fill(0);
-    MaskSizeType desiredSize = imageSize;
-
-    //Extract filter used to extract 3D volume from 4D file.
-    typename ExtractFilterType::Pointer extractFilter = ExtractFilterType::New();
-    extractFilter->SetInput( pMask );
-    extractFilter->SetDirectionCollapseToIdentity(); // This is required.
+    int nClasses = context->GetNumberOfRegions();
 
     typename TInputImage::Pointer imageExtractedRegion;// = InputImagePointer::New();
+    typename TInputImage::Pointer imageBlurredRegion;
 
     //Applying the Intra-regional Richardson-Lucy:
-    typename AddFilterType::Pointer addFilter = AddFilterType::New();
-	typename AddFilterType::Pointer addFilter2 = AddFilterType::New();
-    typename SubFilterType::Pointer subFilter = SubFilterType::New();
-    typename DivideFilterType::Pointer divideFilter = DivideFilterType::New();
     typename IntraRegBlurFilterType::Pointer blurFilter = IntraRegBlurFilterType::New();
+    ProfileFilter( blurFilter.GetPointer(), this, "blur" );
 	typename IntraRegBlurFilterType::Pointer blurFilter2 = IntraRegBlurFilterType::New();
-    typename MultiplyFilterType::Pointer multiplyFilter = MultiplyFilterType::New();
-    typename MultiplyFilterType::Pointer multiplyFilter2 = MultiplyFilterType::New();
-	typename MultiplyFilterType::Pointer clipToRegionFilter = MultiplyFilterType::New();
-	typename MultiplyFilterType::Pointer clipToRegionFilter2 = MultiplyFilterType::New();
-    typename DuplicatorType::Pointer duplicator = DuplicatorType::New();
-    typename ThresholdFilterType::Pointer thresholdFilter = ThresholdFilterType::New();
-
-    thresholdFilter->ThresholdBelow( 0 );
-    thresholdFilter->SetOutsideValue( 0 );
-	thresholdFilter->SetInput( pPET );  
-	thresholdFilter->Update();
-	duplicator->SetInputImage( thresholdFilter->GetOutput() );
-    duplicator->Update();
-
-    typename TInputImage::Pointer imageThresholded;
-    //Set image to the original PET data after non-negativity constraint.
-    imageThresholded = duplicator->GetOutput();
+    ProfileFilter( blurFilter2.GetPointer(), this, "blur" );
+
+    //Original PET data after non-negativity constraint.
+    typename TInputImage::Pointer imageThresholded = EvaluateImage( pPET.GetPointer(), Max( Expr( pPET ), 0.0 ) );
+
+    //PET data clipped to the current region.
+    typename TInputImage::Pointer imageClipped;
 
     typename TInputImage::Pointer imageEstimate;
-    //Set image estimate to the original PET data for the first iteration.
-    imageEstimate = duplicator->GetOutput();
 
+    //Image to hold output.
     typename TInputImage::Pointer imageOutput;
-    //Create image to hold output.
-    imageOutput = duplicator->GetOutput();
 
     blurFilter->SetPSF( this->GetPSF() );
     blurFilter2->SetPSF( this->GetPSF() );
@@ -119,94 +96,89 @@ void IntraRegRLImageFilter< TInputImage, TMaskImage>
     int nMaxNumOfIters =  this->m_nIterations;
     int n=1;
 
-    bool bStopped = false;
-
-    int nNumOfIters =  this->m_nIterations;
+    //The iterations reported are the fewest of any region.
+    this->m_report = IterationReport();
+    this->m_report.nIterations = nMaxNumOfIters;
+    IterationBudget budget;
 
 	for (int i = 1; i <= nClasses; i++) {
 
 		std::cout << "Region " << i << " : ";
 
-		//Starts reading from 4D volume at index (0,0,0,i) through to
-		//(maxX, maxY, maxZ,0), i.e. one 3D brain mask.
-		desiredStart[3] = i - 1;
-		desiredSize[3] = 0;
-
-		//Get region mask.
-		MaskRegionType maskReg;
-		maskReg.SetSize( desiredSize );
-		maskReg.SetIndex(0,desiredStart[0] );
-		maskReg.SetIndex(1,desiredStart[1] );
-		maskReg.SetIndex(2,desiredStart[2] );
-		maskReg.SetIndex(3,desiredStart[3] );
+		//Once the deadline has passed, the regions left are not iterated and
+		//keep the clipped PET data.
+		const bool bSkipRegion = this->m_fDeadline > 0.0 && GetWallClockTime() >= this->m_fDeadline;
+		if ( bSkipRegion ) {
+			this->m_report.bOutOfTime = true;
+		}
 
-		extractFilter->SetExtractionRegion( maskReg );
-		extractFilter->Update();
+		//Each region gets an even share of the time left.
+		budget.Start( this->m_fDeadline, nClasses - i + 1 );
 
-		imageExtractedRegion = extractFilter->GetOutput();
-		imageExtractedRegion->SetDirection(imageEstimate->GetDirection());
-		imageExtractedRegion->UpdateOutputData();
+		//Get region mask, and the region blurred by the PSF, which is the
+		//same for every iteration.
+		imageExtractedRegion = context->GetRegion( i - 1 );
+		imageBlurredRegion = NULL;
+		if ( !bSkipRegion ) {
+			imageBlurredRegion = context->GetBlurredRegion( i - 1 );
+		}
 
 		blurFilter->SetMaskInput( imageExtractedRegion );
+		blurFilter->SetBlurredMask( imageBlurredRegion );
 		blurFilter2->SetMaskInput( imageExtractedRegion );
+		blurFilter2->SetBlurredMask( imageBlurredRegion );
 
-		clipToRegionFilter->SetInput1( imageThresholded );
-		clipToRegionFilter->SetInput2( imageExtractedRegion );
+		//Only the dilated bounding box of the region is convolved.
+		const typename TInputImage::RegionType box = context->GetRegionIndex()->GetDilatedBoundingBox( i - 1 );
+		blurFilter->SetRegionOfInterest( box );
+		blurFilter2->SetRegionOfInterest( box );
 
-		clipToRegionFilter2->SetInput1( imageThresholded );
-		clipToRegionFilter2->SetInput2( imageExtractedRegion );
-		
-		imageEstimate= clipToRegionFilter2->GetOutput();
+		imageClipped = EvaluateImage( pPET.GetPointer(), Expr( imageThresholded ) * Expr( imageExtractedRegion ) );
+
+		//Set image estimate to the clipped PET data for the first iteration.
+		imageEstimate = EvaluateImage( pPET.GetPointer(), Expr( imageClipped ) );
 	
-    while ( ( n <= nMaxNumOfIters ) ) {
-            float fLog = 0.0;  
+    while ( ( n <= nMaxNumOfIters ) && !bSkipRegion ) {
+
+            ScopedStageTimer iterationTimer( this, "iteration", n );
+
+            double fLog = 0.0;  
             blurFilter->SetInput( imageEstimate );
-			divideFilter->SetInput1( clipToRegionFilter->GetOutput() );
-			divideFilter->SetInput2( blurFilter->GetOutput() );
-			multiplyFilter->SetInput1( imageEstimate );
-			multiplyFilter->SetInput2( divideFilter->GetOutput() );
-            multiplyFilter->Update();
-
-            imageEstimate = multiplyFilter->GetOutput();
-            imageEstimate->DisconnectPipeline();
+            blurFilter->Update();
+
+            //Multiply the estimate by the ratio of the data and the blurred
+            //estimate, in place.
+            Evaluate( imageEstimate.GetPointer(),
+                      Expr( imageEstimate ) * ( Expr( imageClipped ) / Expr( blurFilter->GetOutput() ) ) );
             
 			blurFilter2->SetInput( imageEstimate );
 			blurFilter2->Update();
 
-            ConstImageIterator origIt( clipToRegionFilter->GetOutput(),  clipToRegionFilter->GetOutput()->GetLargestPossibleRegion() );
-            ConstImageIterator currIt(  blurFilter2->GetOutput(), blurFilter2->GetOutput()->GetLargestPossibleRegion() );
-
-            origIt.GoToBegin();
-            currIt.GoToBegin();
-
-            while ( !currIt.IsAtEnd() )
-    	    {
-				if (currIt.Get() > 0.0) {
-                	float diff = origIt.Get() * log(currIt.Get()) - currIt.Get();
-	                fLog += diff;
-				}
-        		++currIt;
-                ++origIt;
-        	}
+            PoissonLogLikelihoodFunctor< typename TInputImage::PixelType > logFunctor;
+            logFunctor.pMeasured = imageClipped->GetBufferPointer();
+            logFunctor.pEstimate = blurFilter2->GetOutput()->GetBufferPointer();
+            fLog = ParallelSum( 0, blurFilter2->GetOutput()->GetLargestPossibleRegion().GetNumberOfPixels(), logFunctor );
 
             //float fCurrentEval = fLog;
             //std::cout << n << "\t" << fCurrentEval << std::endl;
 			std::cout << n << " " << std::flush;         
+            this->m_report.fConvergence = fLog;
 			n++;
 
+            if ( n <= nMaxNumOfIters && !budget.AllowsNextIteration() ) {
+                this->m_report.bOutOfTime = true;
+                break;
+            }
     }
 
+		this->m_report.nIterations = std::min( this->m_report.nIterations, (unsigned int) ( n - 1 ) );
+
 			//If this is the first region, create imageOutput,
             //else add the current region to the previous contents of imageOutput.
             if (i == 1) {
                 imageOutput = imageEstimate;
-                imageOutput->DisconnectPipeline();
             } else {
-                addFilter2->SetInput1( imageOutput );
-                addFilter2->SetInput2( imageEstimate );
-                addFilter2->Update();
-
-                imageOutput = addFilter2->GetOutput();
+                Evaluate( imageOutput.GetPointer(), Expr( imageOutput ) + Expr( imageEstimate ) );
             }
 		
 		n=1;
@@ -220,10 +192,8 @@ void IntraRegRLImageFilter< TInputImage, TMaskImage>
         std::cout << std::endl;
     }
 
-    this->AllocateOutputs();
-
-    ImageAlgorithm::Copy( imageOutput.GetPointer(), output.GetPointer(), output->GetRequestedRegion(),
-                          output->GetRequestedRegion() );
+    //The final estimate becomes the output, without copying it.
+    this->GraftOutput( imageOutput.GetPointer() );
 
 }
 
@@ -27,6 +27,10 @@
 #include "itkObjectFactory.h"
 #include "itkImageRegionIterator.h"
 #include "itkImageRegionConstIterator.h"
+#include "petpvcVolumeView.h"
+#include "petpvcProfiler.h"
+#include "petpvcReduction.h"
+#include "petpvcImageExpression.h"
 
 using namespace itk;
 
@@ -39,6 +43,7 @@ IntraRegVCImageFilter< TInputImage, TMaskImage>
 {
     this->m_nIterations = 10;
     this->m_bVerbose = false;
+    this->m_fDeadline = 0.0;
     this->m_bDisableNonNeg = false;
 }
 
@@ -56,69 +61,44 @@ void IntraRegVCImageFilter< TInputImage, TMaskImage>
     InputImagePointer pPET = dynamic_cast<const TInputImage*> (ProcessObject::GetInput(0));
     MaskImagePointer pMask = dynamic_cast<const TMaskImage*> (ProcessObject::GetInput(1));
 
-    //Get mask image size.
-    typename MaskImageType::SizeType imageSize =
-        pMask->GetLargestPossibleRegion().GetSize();
-
-    int nClasses = 0;
-
-    //If mask is not 4D, then quit.
-    if (imageSize.Dimension == 4) {
-        nClasses = imageSize[3];
-    } else {
-        std::cerr << "[Error]\tMask file must be 4-D!"
-                  << std::endl;
+    //Get the regions of the mask, unless another filter already has.
+    typename MaskContextType::Pointer context = this->m_maskContext;
+    if ( context.IsNull() ) {
+        context = MaskContextType::New();
+        context->SetMask( pMask.GetPointer(), pPET.GetPointer() );
     }
+    context->SetPSF( this->GetPSF() );
 
-    MaskSizeType desiredStart;
-    desiredStart.Fill(0);
-    MaskSizeType desiredSize = imageSize;
-
-    //Extract filter used to extract 3D volume from 4D file.
-    typename ExtractFilterType::Pointer extractFilter = ExtractFilterType::New();
-    extractFilter->SetInput( pMask );
-    extractFilter->SetDirectionCollapseToIdentity(); // This is required.
+    int nClasses = context->GetNumberOfRegions();
 
     typename TInputImage::Pointer imageExtractedRegion;// = InputImagePointer::New();
+    typename TInputImage::Pointer imageBlurredRegion;
 
     //Applying the Intra-regional reblurred Van-Cittert:
-    typename AddFilterType::Pointer addFilter = AddFilterType::New();
-    typename SubFilterType::Pointer subFilter = SubFilterType::New();
-    typename MultiplyFilterType::Pointer multiplyFilter2 = MultiplyFilterType::New();
-    typename DivideFilterType::Pointer divideFilter = DivideFilterType::New();
     typename IntraRegBlurFilterType::Pointer blurFilter = IntraRegBlurFilterType::New();
+    ProfileFilter( blurFilter.GetPointer(), this, "blur" );
 	typename IntraRegBlurFilterType::Pointer blurFilter2 = IntraRegBlurFilterType::New();
-    typename MultiplyFilterType::Pointer multiplyFilter = MultiplyFilterType::New();
-    typename DuplicatorType::Pointer duplicator = DuplicatorType::New();
-    typename ThresholdFilterType::Pointer thresholdFilter = ThresholdFilterType::New();
-
-    duplicator->SetInputImage( pPET );
-    duplicator->Update();
+    ProfileFilter( blurFilter2.GetPointer(), this, "blur" );
 
     typename TInputImage::Pointer imageEstimate;
     //Set image estimate to the original PET data for the first iteration.
-    imageEstimate = duplicator->GetOutput();
+    imageEstimate = EvaluateImage( pPET.GetPointer(), Expr( pPET ) );
+
+    //The previous estimate, whose buffer the next estimate is written to, so
+    //that no image is allocated in the iterations.
+    typename TInputImage::Pointer imagePrev = NewImageLike( pPET.GetPointer() );
 
-    typename TInputImage::Pointer imagePrev;
-    //Set imagePrev to the original PET data for the first iteration.
-    imagePrev = duplicator->GetOutput();
+    //Difference between the PET data and the blurred estimate.
+    typename TInputImage::Pointer imageResidual = NewImageLike( pPET.GetPointer() );
 
     blurFilter->SetPSF( this->GetPSF() );
     blurFilter2->SetPSF( this->GetPSF() );
 
-    thresholdFilter->ThresholdBelow( 0 );
-    thresholdFilter->SetOutsideValue( 0 );
-
-    float fSumOfPETsq = 0.0;
+    const SizeValueType nVoxels = pPET->GetLargestPossibleRegion().GetNumberOfPixels();
 
-	ConstImageIterator inputIt( pPET, pPET->GetLargestPossibleRegion() );
-    inputIt.GoToBegin();
-
-	while ( !inputIt.IsAtEnd() )
-	{
-        fSumOfPETsq += inputIt.Get()*inputIt.Get();
-		++inputIt;
-	}
+    SumOfSquaresFunctor< typename TInputImage::PixelType > sumOfPETsqFunctor;
+    sumOfPETsqFunctor.pData = pPET->GetBufferPointer();
+    double fSumOfPETsq = ParallelSum( 0, nVoxels, sumOfPETsqFunctor );
 
     int nMaxNumOfIters =  this->m_nIterations;
     int n=1;
@@ -127,87 +107,89 @@ void IntraRegVCImageFilter< TInputImage, TMaskImage>
 
     int nNumOfIters =  this->m_nIterations;
 
-	for (int i = 1; i <= nClasses; i++) {
-
-		std::cout << "Region " << i << " : ";
+    //The iterations reported are the fewest of any region.
+    this->m_report = IterationReport();
+    this->m_report.nIterations = nMaxNumOfIters;
+    IterationBudget budget;
 
+	for (int i = 1; i <= nClasses; i++) {
 
-		//Starts reading from 4D volume at index (0,0,0,i) through to
-		//(maxX, maxY, maxZ,0), i.e. one 3D brain mask.
-		desiredStart[3] = i - 1;
-		desiredSize[3] = 0;
+		//Once the deadline has passed, the regions left keep their estimate.
+		if ( this->m_fDeadline > 0.0 && GetWallClockTime() >= this->m_fDeadline ) {
+			this->m_report.bOutOfTime = true;
+			this->m_report.nIterations = 0;
+			break;
+		}
 
-		//Get region mask.
-		MaskRegionType maskReg;
-		maskReg.SetSize( desiredSize );
-		maskReg.SetIndex(0,desiredStart[0] );
-		maskReg.SetIndex(1,desiredStart[1] );
-		maskReg.SetIndex(2,desiredStart[2] );
-		maskReg.SetIndex(3,desiredStart[3] );
+		std::cout << "Region " << i << " : ";
 
-		extractFilter->SetExtractionRegion( maskReg );
-		extractFilter->Update();
+		//Each region gets an even share of the time left.
+		budget.Start( this->m_fDeadline, nClasses - i + 1 );
 
-		imageExtractedRegion = extractFilter->GetOutput();
-		imageExtractedRegion->SetDirection(imageEstimate->GetDirection());
-		imageExtractedRegion->UpdateOutputData();
+		//Get region mask, and the region blurred by the PSF, which is the
+		//same for every iteration.
+		imageExtractedRegion = context->GetRegion( i - 1 );
+		imageBlurredRegion = context->GetBlurredRegion( i - 1 );
 
 		blurFilter->SetMaskInput( imageExtractedRegion );
+		blurFilter->SetBlurredMask( imageBlurredRegion );
 		blurFilter2->SetMaskInput( imageExtractedRegion );
+		blurFilter2->SetBlurredMask( imageBlurredRegion );
+
+		//Only the dilated bounding box of the region is convolved.
+		const typename TInputImage::RegionType box = context->GetRegionIndex()->GetDilatedBoundingBox( i - 1 );
+		blurFilter->SetRegionOfInterest( box );
+		blurFilter2->SetRegionOfInterest( box );
 	
 
     	while ( ( n <= nMaxNumOfIters ) && ( !bStopped ) ) {
+
+            ScopedStageTimer iterationTimer( this, "iteration", n );
             
-            float fSumOfDiffsq = 0.0;
+            double fSumOfDiffsq = 0.0;
+
+            //The new estimate is written to the spare buffer, so the previous
+            //one can be kept without copying it.
+            std::swap( imagePrev, imageEstimate );
 
-            duplicator->SetInputImage( imageEstimate );
-            duplicator->Update();
-            imagePrev = duplicator->GetOutput();
+            blurFilter->SetInput( imagePrev );
+            blurFilter->Update();
 
-            blurFilter->SetInput( imageEstimate );
-            subFilter->SetInput1( pPET );
-            subFilter->SetInput2( blurFilter->GetOutput() );
-            blurFilter2->SetInput( subFilter->GetOutput() ); 
-            multiplyFilter->SetConstant( this->m_fAlpha );
-            multiplyFilter->SetInput( blurFilter2->GetOutput() );
-            addFilter->SetInput1( imageEstimate );
-            addFilter->SetInput2( multiplyFilter->GetOutput() );
+            Evaluate( imageResidual.GetPointer(), Expr( pPET ) - Expr( blurFilter->GetOutput() ) );
+
+            blurFilter2->SetInput( imageResidual ); 
+            blurFilter2->Update();
 
             if (!m_bDisableNonNeg) {
-                thresholdFilter->SetInput( addFilter->GetOutput() );  
-                thresholdFilter->Update();
-                imageEstimate = thresholdFilter->GetOutput();
+                Evaluate( imageEstimate.GetPointer(),
+                          Max( Expr( imagePrev ) + this->m_fAlpha * Expr( blurFilter2->GetOutput() ), 0.0 ) );
             }
             else {
-                addFilter->Update();
-                imageEstimate = addFilter->GetOutput();
+                Evaluate( imageEstimate.GetPointer(),
+                          Expr( imagePrev ) + this->m_fAlpha * Expr( blurFilter2->GetOutput() ) );
             }
-
-            imageEstimate = thresholdFilter->GetOutput();
-            imageEstimate->DisconnectPipeline();
             
-            ConstImageIterator currIt( imageEstimate, imageEstimate->GetLargestPossibleRegion() );
-            ConstImageIterator prevIt( imagePrev, imagePrev->GetLargestPossibleRegion() );
-
-            currIt.GoToBegin();
-            prevIt.GoToBegin();
-
-            while ( !currIt.IsAtEnd() )
-    	    {
-                float diff = currIt.Get() - prevIt.Get();
-                fSumOfDiffsq += diff*diff;
-        		++currIt;
-                ++prevIt;
-        	}
+            SumOfSquaredDifferencesFunctor< typename TInputImage::PixelType > sumOfDiffsqFunctor;
+            sumOfDiffsqFunctor.pData1 = imageEstimate->GetBufferPointer();
+            sumOfDiffsqFunctor.pData2 = imagePrev->GetBufferPointer();
+            fSumOfDiffsq = ParallelSum( 0, nVoxels, sumOfDiffsqFunctor );
 
             float fCurrentEval = sqrt( fSumOfDiffsq ) / sqrt( fSumOfPETsq );
             //std::cout << n << "\t" << fCurrentEval << std::endl;
 		    std::cout << n << " " << std::flush; 
+            this->m_report.fConvergence = fCurrentEval;
             n++;
 
             if ( fCurrentEval < this->m_fStopCriterion )
                 bStopped = true;
+
+            if ( !bStopped && n <= nMaxNumOfIters && !budget.AllowsNextIteration() ) {
+                this->m_report.bOutOfTime = true;
+                bStopped = true;
+            }
     	}
+
+		this->m_report.nIterations = std::min( this->m_report.nIterations, (unsigned int) ( n - 1 ) );
 		
 		n=1;
 		bStopped = false;
@@ -222,10 +204,8 @@ void IntraRegVCImageFilter< TInputImage, TMaskImage>
         std::cout << std::endl;
     }
 
-    this->AllocateOutputs();
-
-    ImageAlgorithm::Copy( imageEstimate.GetPointer(), output.GetPointer(), output->GetRequestedRegion(),
-                          output->GetRequestedRegion() );
+    //The final estimate becomes the output, without copying it.
+    this->GraftOutput( imageEstimate.GetPointer() );
 
 }
 
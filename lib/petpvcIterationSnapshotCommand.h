@@ -0,0 +1,279 @@
+/*
+   petpvcIterationSnapshotCommand.h
+
+   Author:      Benjamin A. Thomas
+
+   Copyright 2026 Institute of Nuclear Medicine, University College London.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+ */
+
+#ifndef __PETPVCITERATIONSNAPSHOTCOMMAND_H
+#define __PETPVCITERATIONSNAPSHOTCOMMAND_H
+
+#include <itkCommand.h>
+#include <itkImageFileWriter.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace itk;
+
+namespace petpvc
+{
+
+//Returns a sorted list of iteration numbers from a string such as "2,5,10,20".
+//Entries that are not positive integers are ignored.
+inline std::vector<unsigned int> ParseIterationList( const std::string & sList )
+{
+    std::vector<unsigned int> vecIters;
+    std::istringstream ss( sList );
+    std::string field;
+
+    while ( std::getline( ss, field, ',' ) ) {
+        const int nIter = atoi( field.c_str() );
+        if ( nIter > 0 ) {
+            vecIters.push_back( nIter );
+        }
+    }
+
+    std::sort( vecIters.begin(), vecIters.end() );
+    vecIters.erase( std::unique( vecIters.begin(), vecIters.end() ), vecIters.end() );
+
+    return vecIters;
+}
+
+//Inserts a suffix before the file extension, e.g. "pvc.nii.gz" and "_iter5"
+//gives "pvc_iter5.nii.gz".
+inline std::string AddFileNameSuffix( const std::string & sFileName, const std::string & sSuffix )
+{
+    const std::string::size_type nSlash = sFileName.find_last_of( "/\\" );
+    std::string::size_type nDot = sFileName.find_last_of( '.' );
+
+    if ( nDot == std::string::npos || ( nSlash != std::string::npos && nDot < nSlash ) ) {
+        return sFileName + sSuffix;
+    }
+
+    //Keep compressed extensions such as ".nii.gz" together.
+    if ( sFileName.substr( nDot ) == ".gz" && nDot > 0 ) {
+        const std::string::size_type nPrevDot = sFileName.find_last_of( '.', nDot - 1 );
+        if ( nPrevDot != std::string::npos && ( nSlash == std::string::npos || nPrevDot > nSlash ) ) {
+            nDot = nPrevDot;
+        }
+    }
+
+    return sFileName.substr( 0, nDot ) + sSuffix + sFileName.substr( nDot );
+}
+
+/** \class IterationSnapshotCommand
+ *
+ * \brief Writes the current estimate of an iterative PVC filter to disk.
+ *
+ * Observes itk::IterationEvent on one of the iterative filters and writes
+ * GetCurrentEstimate() at each of the requested iterations. The file name is
+ * that of the final output with "_iter<N>" inserted before the extension.
+ *
+ */
+template< class TFilter >
+class IterationSnapshotCommand : public itk::Command
+{
+public:
+    typedef IterationSnapshotCommand Self;
+    typedef itk::Command Superclass;
+    typedef itk::SmartPointer< Self > Pointer;
+
+    itkNewMacro( Self );
+
+    typedef typename TFilter::InputImageType ImageType;
+    typedef itk::ImageFileWriter< ImageType > WriterType;
+
+    void SetIterations( const std::vector<unsigned int> & vecIters ) {
+        this->m_vecIterations = vecIters;
+        std::sort( this->m_vecIterations.begin(), this->m_vecIterations.end() );
+    }
+
+    void SetFileName( const std::string & sFileName ) {
+        this->m_sFileName = sFileName;
+    }
+
+    void Execute( itk::Object *caller, const itk::EventObject & event ) ITK_OVERRIDE {
+        this->Execute( (const itk::Object *) caller, event );
+    }
+
+    void Execute( const itk::Object *caller, const itk::EventObject & event ) ITK_OVERRIDE {
+        if ( !itk::IterationEvent().CheckEvent( &event ) ) {
+            return;
+        }
+
+        const TFilter * filter = dynamic_cast< const TFilter * >( caller );
+        if ( filter == NULL ) {
+            return;
+        }
+
+        const unsigned int nIter = filter->GetCurrentIteration();
+        if ( !std::binary_search( this->m_vecIterations.begin(), this->m_vecIterations.end(), nIter ) ) {
+            return;
+        }
+
+        std::stringstream suffix;
+        suffix << "_iter" << nIter;
+
+        typename WriterType::Pointer writer = WriterType::New();
+        writer->SetFileName( AddFileNameSuffix( this->m_sFileName, suffix.str() ) );
+        writer->SetInput( filter->GetCurrentEstimate() );
+        writer->Update();
+    }
+
+protected:
+    IterationSnapshotCommand() {}
+
+private:
+    IterationSnapshotCommand(const Self &); //purposely not implemented
+    void operator=(const Self &);  //purposely not implemented
+
+    std::vector<unsigned int> m_vecIterations;
+    std::string m_sFileName;
+};
+
+/** \class IterationMeansCommand
+ *
+ * \brief Appends the regional means of an iterative PVC filter to a table.
+ *
+ * For the region-based iterative filters (IY, DIY and STC). One row is
+ * appended to a tab-separated file at each requested iteration, holding the
+ * regional mean estimates returned by GetCurrentMeans(). If no iterations
+ * are set, a row is written at every iteration.
+ *
+ */
+template< class TFilter >
+class IterationMeansCommand : public itk::Command
+{
+public:
+    typedef IterationMeansCommand Self;
+    typedef itk::Command Superclass;
+    typedef itk::SmartPointer< Self > Pointer;
+
+    itkNewMacro( Self );
+
+    void SetIterations( const std::vector<unsigned int> & vecIters ) {
+        this->m_vecIterations = vecIters;
+        std::sort( this->m_vecIterations.begin(), this->m_vecIterations.end() );
+    }
+
+    void SetFileName( const std::string & sFileName ) {
+        this->m_sFileName = sFileName;
+        this->m_bHeaderWritten = false;
+    }
+
+    void Execute( itk::Object *caller, const itk::EventObject & event ) ITK_OVERRIDE {
+        this->Execute( (const itk::Object *) caller, event );
+    }
+
+    void Execute( const itk::Object *caller, const itk::EventObject & event ) ITK_OVERRIDE {
+        if ( !itk::IterationEvent().CheckEvent( &event ) ) {
+            return;
+        }
+
+        const TFilter * filter = dynamic_cast< const TFilter * >( caller );
+        if ( filter == NULL ) {
+            return;
+        }
+
+        const unsigned int nIter = filter->GetCurrentIteration();
+        if ( !this->m_vecIterations.empty() &&
+                !std::binary_search( this->m_vecIterations.begin(), this->m_vecIterations.end(), nIter ) ) {
+            return;
+        }
+
+        typename TFilter::VectorType vecMeans = filter->GetCurrentMeans();
+
+        std::ofstream outputTextFile;
+        outputTextFile.open( this->m_sFileName.c_str(),
+                             this->m_bHeaderWritten ? std::ios::app : std::ios::trunc );
+
+        if ( !outputTextFile.is_open() ) {
+            itkGenericExceptionMacro( "Cannot write regional means to " << this->m_sFileName );
+        }
+
+        if ( !this->m_bHeaderWritten ) {
+            outputTextFile << "ITERATION";
+            for (unsigned int n = 0; n < vecMeans.size(); n++) {
+                outputTextFile << "\tREGION" << n+1;
+            }
+            outputTextFile << std::endl;
+            this->m_bHeaderWritten = true;
+        }
+
+        outputTextFile << nIter;
+        for (unsigned int n = 0; n < vecMeans.size(); n++) {
+            outputTextFile << "\t" << vecMeans[n];
+        }
+        outputTextFile << std::endl;
+    }
+
+protected:
+    IterationMeansCommand() {
+        this->m_bHeaderWritten = false;
+    }
+
+private:
+    IterationMeansCommand(const Self &); //purposely not implemented
+    void operator=(const Self &);  //purposely not implemented
+
+    std::vector<unsigned int> m_vecIterations;
+    std::string m_sFileName;
+    bool m_bHeaderWritten;
+};
+
+//Attaches a snapshot writer for the given iterations to an iterative filter.
+//Does nothing if the list is empty, so the filter runs without observers.
+template< class TFilter >
+void AddIterationSnapshots( TFilter * filter, const std::vector<unsigned int> & vecIters,
+                            const std::string & sOutputFileName )
+{
+    if ( vecIters.empty() ) {
+        return;
+    }
+
+    typename IterationSnapshotCommand< TFilter >::Pointer snapshotCmd =
+        IterationSnapshotCommand< TFilter >::New();
+    snapshotCmd->SetIterations( vecIters );
+    snapshotCmd->SetFileName( sOutputFileName );
+    filter->AddObserver( itk::IterationEvent(), snapshotCmd );
+}
+
+//Attaches a regional means writer to an iterative filter. Does nothing if no
+//file name is given.
+template< class TFilter >
+void AddIterationMeans( TFilter * filter, const std::vector<unsigned int> & vecIters,
+                        const std::string & sMeansFileName )
+{
+    if ( sMeansFileName.empty() ) {
+        return;
+    }
+
+    typename IterationMeansCommand< TFilter >::Pointer meansCmd =
+        IterationMeansCommand< TFilter >::New();
+    meansCmd->SetIterations( vecIters );
+    meansCmd->SetFileName( sMeansFileName );
+    filter->AddObserver( itk::IterationEvent(), meansCmd );
+}
+
+} //namespace petpvc
+
+#endif // __PETPVCITERATIONSNAPSHOTCOMMAND_H
@@ -25,14 +25,14 @@
 #include "itkImage.h"
 #include "itkImageToImageFilter.h"
 #include "petpvcFuzzyCorrectionFilter.h"
+#include "petpvcRegionIndex.h"
 
 #include <itkExtractImageFilter.h>
 #include <itkMultiplyImageFilter.h>
 #include <itkDivideImageFilter.h>
 #include <itkAddImageFilter.h>
 #include <itkDiscreteGaussianImageFilter.h>
-#include <itkStatisticsImageFilter.h>
-#include <itkImageDuplicator.h>
+#include "petpvcTimeBudget.h"
 
 #include <algorithm>
 
@@ -71,18 +71,16 @@ public:
     typedef typename TMaskImage::IndexType  MaskIndexType;
     typedef typename TMaskImage::PixelType  MaskPixelType;
 
-    //For calculating mean values from image
-    typedef itk::StatisticsImageFilter<TInputImage> StatisticsFilterType;
     //Extracts a 3D volume from 4D file.
     typedef itk::ExtractImageFilter<TMaskImage, TInputImage> ExtractFilterType;
     typedef itk::MultiplyImageFilter<TInputImage, TInputImage> MultiplyFilterType;
     typedef itk::DivideImageFilter<TInputImage,TInputImage, TInputImage> DivideFilterType;
     typedef itk::AddImageFilter<TInputImage, TInputImage> AddFilterType;
     typedef itk::DiscreteGaussianImageFilter<TInputImage, TInputImage> BlurringFilterType;
-    typedef itk::ImageDuplicator<TInputImage> DuplicatorType;
 
     typedef FuzzyCorrectionFilter<TMaskImage> FuzzyCorrFilterType;
     typedef itk::Vector<float, 3> ITKVectorType;
+    typedef RegionIndex<TInputImage> RegionIndexType;
 
     /** Image related typedefs. */
     itkStaticConstMacro(InputImageDimension, unsigned int,
@@ -126,10 +124,73 @@ public:
         this->m_nIterations = nIters;
     }
 
+    //Number of iterations already done, e.g. by a run resumed from a
+    //checkpoint. Iterations are numbered on from it, up to the total set by
+    //SetIterations().
+    void SetStartIteration( unsigned int nIter ) {
+        this->m_nStartIteration = nIter;
+    }
+
+    //Stops early once the corrected means change by less than this fraction
+    //between iterations. 0, the default, runs every iteration.
+    void SetStoppingCond( float stop ) {
+        this->m_fStopCriterion = stop;
+    }
+
+    //Image to start from instead of the PET data, e.g. the correction of
+    //the previous frame. It must have the size of the PET image.
+    void SetInitialEstimate( const InputImageType * image ) {
+        this->m_imageInitialEstimate = image;
+        this->Modified();
+    }
+
     void SetVerbose( bool bVerbose ) {
         this->m_bVerbose = bVerbose;
     }
 
+    //Wall-clock time, from GetWallClockTime(), by which the iterations must
+    //end. 0, the default, sets no limit.
+    void SetDeadline( double fDeadline ) {
+        this->m_fDeadline = fDeadline;
+    }
+
+    /** How the iterations ended, after Update(). */
+    const IterationReport & GetIterationReport() const {
+        return this->m_report;
+    }
+
+    //Index of the regions of the mask. If not set, it is built from the mask.
+    void SetRegionIndex( RegionIndexType * index ) {
+        this->m_regionIndex = index;
+        this->Modified();
+    }
+
+    //Fuzziness matrix of the mask and its region sums, e.g. found once for
+    //several images. If not set, they are found from the mask.
+    void SetFuzzyMatrix( const MatrixType & mat, const VectorType & vecSums ) {
+        this->m_matFuzzy = mat;
+        this->m_vecFuzzySums = vecSums;
+        this->m_bHaveFuzzyMatrix = true;
+        this->Modified();
+    }
+
+    /** Number of the iteration just completed. Valid while observers of
+     * itk::IterationEvent are executed. */
+    unsigned int GetCurrentIteration() const {
+        return this->m_nCurrentIteration;
+    }
+
+    /** Image estimate after the iteration just completed. Valid while
+     * observers of itk::IterationEvent are executed. */
+    const InputImageType * GetCurrentEstimate() const {
+        return this->m_imageCurrentEstimate;
+    }
+
+    /** Regional mean estimates used in the iteration just completed. */
+    VectorType GetCurrentMeans() const {
+        return this->m_vecRegMeansPVCorr;
+    }
+
 
 protected:
     IterativeYangPVCImageFilter();
@@ -142,7 +203,18 @@ protected:
     MatrixType m_matGTM;
     ITKVectorType m_vecVariance;
     unsigned int m_nIterations;
+    unsigned int m_nStartIteration;
+    float m_fStopCriterion;
+    InputImagePointer m_imageInitialEstimate;
     bool m_bVerbose;
+    double m_fDeadline;
+    IterationReport m_report;
+    unsigned int m_nCurrentIteration;
+    const TInputImage * m_imageCurrentEstimate;
+    typename RegionIndexType::Pointer m_regionIndex;
+    MatrixType m_matFuzzy;
+    VectorType m_vecFuzzySums;
+    bool m_bHaveFuzzyMatrix;
 
 private:
     IterativeYangPVCImageFilter(const Self &); //purposely not implemented
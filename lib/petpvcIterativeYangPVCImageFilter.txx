@@ -27,6 +27,10 @@
 #include "itkObjectFactory.h"
 #include "itkImageRegionIterator.h"
 #include "itkImageRegionConstIterator.h"
+#include "petpvcVolumeView.h"
+#include "petpvcProfiler.h"
+#include "petpvcReduction.h"
+#include "petpvcImageExpression.h"
 
 using namespace itk;
 
@@ -38,7 +42,13 @@ IterativeYangPVCImageFilter< TInputImage, TMaskImage>
 ::IterativeYangPVCImageFilter()
 {
     this->m_nIterations = 10;
+    this->m_nStartIteration = 0;
+    this->m_fStopCriterion = 0.0;
     this->m_bVerbose = false;
+    this->m_fDeadline = 0.0;
+    this->m_nCurrentIteration = 0;
+    this->m_imageCurrentEstimate = NULL;
+    this->m_bHaveFuzzyMatrix = false;
 }
 
 template< class TInputImage, class TMaskImage >
@@ -52,27 +62,31 @@ void IterativeYangPVCImageFilter< TInputImage, TMaskImage>
     typename TInputImage::ConstPointer input = this->GetInput();
     typename TInputImage::Pointer output = this->GetOutput();
 
-    typename FuzzyCorrFilterType::Pointer pFuzzyCorrFilter = FuzzyCorrFilterType::New();
-
     InputImagePointer pPET = dynamic_cast<const TInputImage*> (ProcessObject::GetInput(0));
     MaskImagePointer pMask = dynamic_cast<const TMaskImage*> (ProcessObject::GetInput(1));
 
-    pFuzzyCorrFilter->SetInput( pMask );
+    //Get fuzziness correction factors.
+    vnl_matrix<float> matFuzzyCorr = this->m_matFuzzy;
+    vnl_vector<float> vecRegSize = this->m_vecFuzzySums;
 
-    //Calculate Fuzziness.
-    if ( this->m_bVerbose ) {
-      std::cout << "Start fuzziness calculation" << std::endl;
-    }
+    if ( !this->m_bHaveFuzzyMatrix ) {
+        typename FuzzyCorrFilterType::Pointer pFuzzyCorrFilter = FuzzyCorrFilterType::New();
+        pFuzzyCorrFilter->SetInput( pMask );
 
-    pFuzzyCorrFilter->Update();
+        //Calculate Fuzziness.
+        if ( this->m_bVerbose ) {
+          std::cout << "Start fuzziness calculation" << std::endl;
+        }
 
-    if ( this->m_bVerbose ) {
-      std::cout << "matrix:\n" << pFuzzyCorrFilter->GetMatrix() << std::endl;
+        pFuzzyCorrFilter->Update();
+
+        matFuzzyCorr = pFuzzyCorrFilter->GetMatrix();
+        vecRegSize = pFuzzyCorrFilter->GetSumOfRegions();
     }
 
-    //Get fuzziness correction factors.
-    vnl_matrix<float> matFuzzyCorr = pFuzzyCorrFilter->GetMatrix();
-    vnl_vector<float> vecRegSize = pFuzzyCorrFilter->GetSumOfRegions();
+    if ( this->m_bVerbose ) {
+      std::cout << "matrix:\n" << matFuzzyCorr << std::endl;
+    }
 
     /////////////////////////////////////////////
 
@@ -90,23 +104,15 @@ void IterativeYangPVCImageFilter< TInputImage, TMaskImage>
                   << std::endl;
     }
 
-    MaskSizeType desiredStart;
-    desiredStart.Fill(0);
-    MaskSizeType desiredSize = imageSize;
-
-    //Extract filter used to extract 3D volume from 4D file.
-    typename ExtractFilterType::Pointer extractFilter = ExtractFilterType::New();
-    extractFilter->SetInput( pMask );
-    extractFilter->SetDirectionCollapseToIdentity(); // This is required.
-
-    //Stats. filter used to calculate statistics for an image.
-    typename StatisticsFilterType::Pointer statsFilter = StatisticsFilterType::New();
-
-    //Multiplies two images together.
-    typename MultiplyFilterType::Pointer multiplyFilter = MultiplyFilterType::New();
-
     typename TInputImage::Pointer imageExtractedRegion;// = InputImagePointer::New();
 
+    //Only the voxels of each region are visited.
+    typename RegionIndexType::Pointer index = this->m_regionIndex;
+    if ( index.IsNull() ) {
+        index = RegionIndexType::New();
+        index->SetMask( pMask.GetPointer() );
+    }
+
     float fSumOfPETReg;
 
     //Vector to contain the current estimate of the regional mean values.
@@ -122,26 +128,43 @@ void IterativeYangPVCImageFilter< TInputImage, TMaskImage>
 
     typename TInputImage::Pointer imageYang;
     typename TInputImage::Pointer imageEstimate;
-    typename AddFilterType::Pointer addFilter = AddFilterType::New();
-    typename DuplicatorType::Pointer duplicator = DuplicatorType::New();
 
-    typename MultiplyFilterType::Pointer multiplyFilter2 = MultiplyFilterType::New();
-    typename DivideFilterType::Pointer divideFilter = DivideFilterType::New();
     typename BlurringFilterType::Pointer pBlurFilter = BlurringFilterType::New();
 
+    ProfileFilter( pBlurFilter.GetPointer(), this, "blur" );
+
 
-    duplicator->SetInputImage( pPET );
-    duplicator->Update();
+    //The estimate is kept in the output buffer, so it does not have to be
+    //copied at the end. Start from the original PET data, or from the
+    //initial estimate if one was given.
+    this->AllocateOutputs();
+    imageEstimate = output;
 
-    //Set image estimate to the original PET data for the first iteration.
-    imageEstimate = duplicator->GetOutput();
+    if ( this->m_imageInitialEstimate.IsNotNull() ) {
+        if ( this->m_imageInitialEstimate->GetLargestPossibleRegion().GetSize() !=
+             pPET->GetLargestPossibleRegion().GetSize() ) {
+            itkExceptionMacro( << "The initial estimate must have the size of the PET image" );
+        }
+        Evaluate( imageEstimate.GetPointer(), Expr( this->m_imageInitialEstimate ) );
+    } else {
+        Evaluate( imageEstimate.GetPointer(), Expr( pPET ) );
+    }
 
     int nNumOfIters =  this->m_nIterations;
+    bool bStopped = false;
+
+    const int nFirstIter = this->m_nStartIteration + 1;
+
+    this->m_report = IterationReport();
+    IterationBudget budget;
+    budget.Start( this->m_fDeadline );
+
+    for (int k = nFirstIter; k <= nNumOfIters && !bStopped; k++) {
 
-    for (int k = 1; k <= nNumOfIters; k++) {
+        ScopedStageTimer iterationTimer( this, "iteration", k );
 
         if ( this->m_bVerbose ) {
-            if (k == 1) {
+            if (k == nFirstIter) {
                 std::cout << std::endl << "Iteration:  " << std::endl;
             }
 
@@ -151,37 +174,18 @@ void IterativeYangPVCImageFilter< TInputImage, TMaskImage>
 
         for (int i = 1; i <= nClasses; i++) {
 
-            //Starts reading from 4D volume at index (0,0,0,i) through to
-            //(maxX, maxY, maxZ,0), i.e. one 3D brain mask.
-            desiredStart[3] = i - 1;
-            desiredSize[3] = 0;
-
-            //Get region mask.
-            MaskRegionType maskReg;
-            maskReg.SetSize(desiredSize );
-            maskReg.SetIndex(0,desiredStart[0] );
-            maskReg.SetIndex(1,desiredStart[1] );
-            maskReg.SetIndex(2,desiredStart[2] );
-            maskReg.SetIndex(3,desiredStart[3] );
-
-            extractFilter->SetExtractionRegion( maskReg );
-            extractFilter->Update();
-
-            imageExtractedRegion = extractFilter->GetOutput();
+            //Get region mask i, i.e. volume i-1 of the 4D mask, without copying it.
+            imageExtractedRegion = GetVolumeView< TInputImage >( pMask.GetPointer(), i - 1 );
             imageExtractedRegion->SetDirection(imageEstimate->GetDirection());
-            imageExtractedRegion->UpdateOutputData();
 
 
             //Multiply current image estimate by region mask. To clip PET values
             //to mask.
-            multiplyFilter->SetInput1(imageEstimate);
-            multiplyFilter->SetInput2(imageExtractedRegion);
-
-            statsFilter->SetInput(multiplyFilter->GetOutput());
-            statsFilter->Update();
-
-            //Get sum of the clipped image.
-            fSumOfPETReg = statsFilter->GetSum();
+            {
+                ScopedStageTimer statsTimer( this, "regional statistics" );
+                fSumOfPETReg = RunProductSum( imageEstimate.GetPointer(), imageExtractedRegion.GetPointer(),
+                                              index->GetRuns( i - 1 ) );
+            }
 
             //Place regional mean into vector.
 			float fNewRegMean = std::max( (float) (fSumOfPETReg / vecRegSize.get(i - 1)), (float)0.0);
@@ -193,8 +197,11 @@ void IterativeYangPVCImageFilter< TInputImage, TMaskImage>
 
 
         //Apply fuzziness correction to current mean value estimates.
-        vecRegMeansUpdated = vnl_matrix_inverse<float>( matFuzzyCorr )
-                             * vecRegMeansCurrent;
+        {
+            ScopedStageTimer solverTimer( this, "solver" );
+            vecRegMeansUpdated = vnl_matrix_inverse<float>( matFuzzyCorr )
+                                 * vecRegMeansCurrent;
+        }
 
         //std::cout << vecRegMeansCurrent << std::endl;
         if ( this->m_bVerbose ) {
@@ -208,46 +215,20 @@ void IterativeYangPVCImageFilter< TInputImage, TMaskImage>
 
         //std::cout << vecRegMeansUpdated << std::endl;
 
-        for (int i = 1; i <= nClasses; i++) {
-
-            //Starts reading from 4D volume at index (0,0,0,i) through to
-            //(maxX, maxY, maxZ,0), i.e. one 3D brain mask.
-            desiredStart[3] = i - 1;
-            desiredSize[3] = 0;
+        //The same buffer is used in every iteration.
+        if (imageYang.IsNull()) {
+            imageYang = NewImageLike( pPET.GetPointer() );
+        }
+        imageYang->FillBuffer( 0 );
 
-            //Get region mask.
-            MaskRegionType maskReg;
-            maskReg.SetSize(desiredSize );
-            maskReg.SetIndex(0,desiredStart[0] );
-            maskReg.SetIndex(1,desiredStart[1] );
-            maskReg.SetIndex(2,desiredStart[2] );
-            maskReg.SetIndex(3,desiredStart[3] );
+        for (int i = 1; i <= nClasses; i++) {
 
-            extractFilter->SetExtractionRegion( maskReg );
-            extractFilter->Update();
+            //Get region mask i, i.e. volume i-1 of the 4D mask, without copying it.
+            imageExtractedRegion = GetVolumeView< TInputImage >( pMask.GetPointer(), i - 1 );
 
-            imageExtractedRegion = extractFilter->GetOutput();
-            imageExtractedRegion->SetDirection( pPET->GetDirection() );
-            imageExtractedRegion->UpdateOutputData();
-
-            //Multiply current image estimate by region mask. To clip PET values
-            //to mask.
-            multiplyFilter->SetInput1( vecRegMeansUpdated.get(i-1) );
-            multiplyFilter->SetInput2( imageExtractedRegion );
-            multiplyFilter->Update();
-
-            //If this is the first region, create imageYang,
-            //else add the current region to the previous contents of imageYang.
-            if (i == 1) {
-                imageYang = multiplyFilter->GetOutput();
-                imageYang->DisconnectPipeline();
-            } else {
-                addFilter->SetInput1(imageYang);
-                addFilter->SetInput2(multiplyFilter->GetOutput());
-                addFilter->Update();
-
-                imageYang = addFilter->GetOutput();
-            }
+            //Fill the region with its corrected mean, only visiting its voxels.
+            AddScaledRuns( imageYang.GetPointer(), imageExtractedRegion.GetPointer(),
+                           vecRegMeansUpdated.get(i-1), index->GetRuns( i - 1 ) );
 
         }
 
@@ -256,32 +237,45 @@ void IterativeYangPVCImageFilter< TInputImage, TMaskImage>
 
         pBlurFilter->SetInput(imageYang);
         pBlurFilter->SetVariance( this->GetPSF() );
+        pBlurFilter->Update();
+
+        //Multiply original PET by the correction factors, the ratio of pseudo
+        //PET and smoothed pseudo PET.
+        Evaluate( imageEstimate.GetPointer(),
+                  Expr( pPET ) * ( Expr( imageYang ) / Expr( pBlurFilter->GetOutput() ) ) );
+
+        //Relative change of the corrected means since the last iteration.
+        if ( k > nFirstIter ) {
+            const float fNorm = vecRegMeansUpdated.two_norm();
+            const float fChange = ( vecRegMeansUpdated - this->m_vecRegMeansPVCorr ).two_norm();
+            this->m_report.fConvergence = ( fNorm > 0.0 ) ? fChange / fNorm : 0.0;
+            if ( this->m_bVerbose && this->m_fStopCriterion > 0.0 ) {
+                std::cout << "(" << fChange / fNorm << ") ";
+            }
+            if ( this->m_fStopCriterion > 0.0 && fChange < this->m_fStopCriterion * fNorm ) {
+                bStopped = true;
+            }
+        }
 
-        //Take ratio of pseudo PET and smoothed pseudo PET. These are the correction
-        //factors.
-        divideFilter->SetInput1( imageYang );
-        divideFilter->SetInput2(pBlurFilter->GetOutput());
-
-        //Multiply original PET by correction factors.
-        multiplyFilter2->SetInput1( pPET );
-        multiplyFilter2->SetInput2(divideFilter->GetOutput());
-        multiplyFilter2->Update();
-
+        this->m_report.nIterations = k;
+        if ( !bStopped && k < nNumOfIters && !budget.AllowsNextIteration() ) {
+            this->m_report.bOutOfTime = true;
+            bStopped = true;
+        }
 
-        imageEstimate = multiplyFilter2->GetOutput();
-        imageEstimate->UpdateOutputData();
-        imageEstimate->DisconnectPipeline();
+        //Let any observers see the estimate and means of this iteration.
+        this->m_vecRegMeansPVCorr = vecRegMeansUpdated;
+        this->m_nCurrentIteration = k;
+        this->m_imageCurrentEstimate = imageEstimate.GetPointer();
+        this->InvokeEvent( itk::IterationEvent() );
     }
 
+    this->m_imageCurrentEstimate = NULL;
+
     if ( this->m_bVerbose ) {
         std::cout << std::endl;
     }
 
-    this->AllocateOutputs();
-
-    ImageAlgorithm::Copy( imageEstimate.GetPointer(), output.GetPointer(), output->GetRequestedRegion(),
-                          output->GetRequestedRegion() );
-
 }
 
 }// end namespace
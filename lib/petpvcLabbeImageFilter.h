@@ -29,6 +29,8 @@
 #include <vnl/algo/vnl_matrix_inverse.h>
 #include <itkImage.h>
 
+#include "petpvcMaskContext.h"
+
 //A class to perform Labbe PVC.
 
 using namespace itk;
@@ -53,6 +55,9 @@ public:
     typedef vnl_vector<float> VectorType;
     typedef itk::Vector<float, 3> ITKVectorType;
 
+    //Regions of the mask, possibly shared with other filters.
+    typedef MaskContext< itk::Image<float, 3> > MaskContextType;
+
     itkNewMacro(Self);
 
     itkTypeMacro(LabbeImageFilter, ImageToImageFilter);
@@ -76,6 +81,14 @@ public:
         return this->vecVariance;
     };
 
+    //Takes the regions, and any blurred regions, from context instead of
+    //extracting and blurring them here. The context must hold the regions
+    //of the input mask.
+    void SetMaskContext( MaskContextType * context ) {
+        this->m_maskContext = context;
+        this->Modified();
+    };
+
 
 protected:
     LabbeImageFilter();
@@ -91,6 +104,7 @@ private:
     MatrixType *matCorrFactors;
     VectorType *vecSumOfRegions;
     ITKVectorType vecVariance;
+    typename MaskContextType::Pointer m_maskContext;
 };
 } //namespace PETPVC
 
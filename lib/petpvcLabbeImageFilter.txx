@@ -27,9 +27,10 @@
 #include "itkObjectFactory.h"
 #include "itkImageRegionIterator.h"
 #include "itkImageRegionConstIterator.h"
-#include <itkStatisticsImageFilter.h>
-#include <itkExtractImageFilter.h>
-#include <itkMultiplyImageFilter.h>
+#include "petpvcVolumeView.h"
+#include "petpvcProfiler.h"
+#include "petpvcReduction.h"
+#include "petpvcRegionIndex.h"
 #include <itkDiscreteGaussianImageFilter.h>
 #include <itkImageDuplicator.h>
 #include "vnl/vnl_matrix.h"
@@ -58,6 +59,8 @@ void LabbeImageFilter<TImage>::GenerateData()
     this->SetGlobalDefaultCoordinateTolerance( 1e-2 );
     this->SetGlobalDefaultDirectionTolerance( 1e-2 );
 
+    ScopedStageTimer timer( this, "matrix construction" );
+
     //Get pointers to input and output.
     typename TImage::ConstPointer input = this->GetInput();
 
@@ -81,38 +84,27 @@ void LabbeImageFilter<TImage>::GenerateData()
 
     typedef itk::Image<float, 3> MaskImageType;
 
-    typedef itk::StatisticsImageFilter<MaskImageType> StatisticsFilterType;
-    typedef itk::ExtractImageFilter<TImage, MaskImageType> ExtractFilterType;
-    typedef itk::MultiplyImageFilter<MaskImageType, MaskImageType> MultiplyFilterType;
-    typedef itk::DiscreteGaussianImageFilter<MaskImageType, MaskImageType> BlurringFilterType;
-
-    typedef itk::ImageDuplicator<MaskImageType> DuplicatorType;
-
-    typename TImage::IndexType desiredStart;
-    desiredStart.Fill(0);
-
-    typename TImage::SizeType desiredSize =
-        input->GetLargestPossibleRegion().GetSize();
-
-    typename TImage::RegionType desiredRegion;
-
-    StatisticsFilterType::Pointer statsFilter = StatisticsFilterType::New();
-
-    typename ExtractFilterType::Pointer extractTargetFilter =
-        ExtractFilterType::New();
-    typename ExtractFilterType::Pointer extractNeighbourFilter =
-        ExtractFilterType::New();
-    typename MultiplyFilterType::Pointer multiplyFilter =
-        MultiplyFilterType::New();
-    typename BlurringFilterType::Pointer blurringFilter =
-        BlurringFilterType::New();
+    //Every pair of blurred regions is needed, so keep each blurred region
+    //rather than blurring it again for every target.
+    typename MaskContextType::Pointer context = this->m_maskContext;
+    if ( context.IsNull() ) {
+        context = MaskContextType::New();
+        context->SetMask( input.GetPointer() );
+        context->SetCacheBlurredRegions( true );
+    }
+    context->SetPSF( this->GetPSF() );
 
-    blurringFilter->SetVariance((this->GetPSF()));
+    //The matrix only depends on the regions and the PSF, so a filter
+    //correcting another image with this context may have found it.
+    if ( context->GetMatrix( "Labbe", *matCorrFactors, *vecSumOfRegions ) ) {
+        return;
+    }
 
-	typename BlurringFilterType::Pointer blurringFilter2 =
-        BlurringFilterType::New();
+    //Blurred regions that do not overlap have a zero entry in the matrix.
+    const typename MaskContextType::RegionIndexType * index = context->GetRegionIndex();
 
-    blurringFilter2->SetVariance((this->GetPSF()));
+    MaskImageType::Pointer imageTarget;
+    MaskImageType::Pointer imageNeighbour;
 
     float fSumTarget;
     float fSumNeighbour;
@@ -120,49 +112,36 @@ void LabbeImageFilter<TImage>::GenerateData()
     for (int i = 1; i <= nClasses; i++) {
 
         fSumTarget = 0.0;
-        desiredStart[3] = i - 1;
-        desiredSize[3] = 0;
-
-        //Extract 3D brain mask volume i from 4D image.
-        extractTargetFilter->SetExtractionRegion(
-            typename TImage::RegionType(desiredStart, desiredSize));
-        extractTargetFilter->SetInput(input);
-        extractTargetFilter->SetDirectionCollapseToIdentity(); // This is required.
-        extractTargetFilter->Update();
-
-        blurringFilter->SetInput(extractTargetFilter->GetOutput());
 
-        statsFilter->SetInput(blurringFilter->GetOutput());
-        statsFilter->Update();
+        imageTarget = context->GetBlurredRegion( i - 1 );
 
         //Calculate the sum of non-zero voxels.
-        fSumTarget = statsFilter->GetSum();
+        {
+            ScopedStageTimer statsTimer( this, "regional statistics" );
+            fSumTarget = RunSum( imageTarget.GetPointer(),
+                                 BoxRuns( index->GetDilatedBoundingBox( i - 1 ), index->GetVolumeRegion() ) );
+        }
 
         vecSumOfRegions->put(i - 1, fSumTarget);
 
         for (int j = 1; j <= nClasses; j++) {
             fSumNeighbour = 0.0;
-            desiredStart[3] = j - 1;
-            desiredSize[3] = 0;
-
-            //Extract 3D brain mask volume j from 4D image.
-            extractNeighbourFilter->SetExtractionRegion(
-                typename TImage::RegionType(desiredStart, desiredSize));
-            extractNeighbourFilter->SetInput(input);
-            extractNeighbourFilter->SetDirectionCollapseToIdentity(); // This is required.
-            extractNeighbourFilter->Update();
 
-			blurringFilter2->SetInput(extractNeighbourFilter->GetOutput());
+            if ( i != j && !index->AreAdjacent( i - 1, j - 1 ) ) {
+                continue;
+            }
 
-            //Multiply i by j.
-            multiplyFilter->SetInput1(blurringFilter->GetOutput());
-            multiplyFilter->SetInput2(blurringFilter2->GetOutput());
+            imageNeighbour = context->GetBlurredRegion( j - 1 );
 
-            statsFilter->SetInput(multiplyFilter->GetOutput());
-            statsFilter->Update();
-
-            //Calculate the sum of the remaining voxels.
-            fSumNeighbour = statsFilter->GetSum();
+            //Multiply i by j and sum the remaining voxels, which lie where
+            //the two dilated boxes overlap.
+            {
+                ScopedStageTimer statsTimer( this, "regional statistics" );
+                typename MaskContextType::RegionIndexType::RegionType overlap = index->GetDilatedBoundingBox( i - 1 );
+                overlap.Crop( index->GetDilatedBoundingBox( j - 1 ) );
+                fSumNeighbour = RunProductSum( imageTarget.GetPointer(), imageNeighbour.GetPointer(),
+                                               BoxRuns( overlap, index->GetVolumeRegion() ) );
+            }
 
             //Fill location in matrix with sum of remaining voxels
             //normalised by size of i.
@@ -172,6 +151,8 @@ void LabbeImageFilter<TImage>::GenerateData()
         }
 
     }
+
+    context->SetMatrix( "Labbe", *matCorrFactors, *vecSumOfRegions );
 }
 
 template<class TImage>
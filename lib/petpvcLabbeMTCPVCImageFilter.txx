@@ -24,9 +24,14 @@
 #define __PETPVCLABBEMTCPVCImageFilter_TXX
 
 #include "petpvcLabbeMTCPVCImageFilter.h"
+#include "petpvcRegionIndex.h"
 #include "itkObjectFactory.h"
 #include "itkImageRegionIterator.h"
 #include "itkImageRegionConstIterator.h"
+#include "petpvcVolumeView.h"
+#include "petpvcProfiler.h"
+#include "petpvcReduction.h"
+#include "petpvcImageExpression.h"
 
 using namespace itk;
 
@@ -57,8 +62,17 @@ void LabbeMTCPVCImageFilter< TInputImage, TMaskImage>
     InputImagePointer pPET = dynamic_cast<const TInputImage*> (ProcessObject::GetInput(0));
     MaskImagePointer pMask = dynamic_cast<const TMaskImage*> (ProcessObject::GetInput(1));
 
+    //Share the regions, and their index, with the Labbe filter.
+    typename MaskContextType::Pointer context = this->m_maskContext;
+    if ( context.IsNull() ) {
+        context = MaskContextType::New();
+        context->SetMask( pMask.GetPointer(), pPET.GetPointer() );
+        context->SetCacheBlurredRegions( true );
+    }
+
     pLabbe->SetInput( pMask );
     pLabbe->SetPSF( this->GetPSF() );
+    pLabbe->SetMaskContext( context );
     //Calculate Labbe.
     try {
         pLabbe->Update();
@@ -86,31 +100,10 @@ void LabbeMTCPVCImageFilter< TInputImage, TMaskImage>
                   << std::endl;
     }
 
-    MaskSizeType desiredStart;
-    desiredStart.Fill(0);
-    MaskSizeType desiredSize = imageSize;
-
-    //Extract filter used to extract 3D volume from 4D file.
-    typename ExtractFilterType::Pointer extractFilter = ExtractFilterType::New();
-    extractFilter->SetInput( pMask );
-    extractFilter->SetDirectionCollapseToIdentity(); // This is required.
-
-    typename ExtractFilterType::Pointer extractIFilter = ExtractFilterType::New();
-    extractIFilter->SetInput( pMask );
-    extractIFilter->SetDirectionCollapseToIdentity(); // This is required.
-
-    typename ExtractFilterType::Pointer extractJFilter = ExtractFilterType::New();
-    extractJFilter->SetInput( pMask );
-    extractJFilter->SetDirectionCollapseToIdentity(); // This is required.
-
-    //Stats. filter used to calculate statistics for an image.
-    typename StatisticsFilterType::Pointer statsFilter = StatisticsFilterType::New();
-
-    //Multiplies two images together.
-    typename MultiplyFilterType::Pointer multiplyFilter = MultiplyFilterType::New();
-
     typename TInputImage::Pointer imageExtractedRegion;// = InputImagePointer::New();
 
+    const typename MaskContextType::RegionIndexType * index = context->GetRegionIndex();
+
     float fSumOfPETReg;
 
     //Vector to contain the current estimate of the regional mean values.
@@ -121,44 +114,19 @@ void LabbeMTCPVCImageFilter< TInputImage, TMaskImage>
     vnl_vector<float> vecRegMeansUpdated;
     vecRegMeansUpdated.set_size(nClasses);
 
-    typename BlurringFilterType::Pointer gaussFilter = BlurringFilterType::New();
-    gaussFilter->SetVariance( this->GetPSF() );
-
     for (int i = 1; i <= nClasses; i++) {
 
-        //Starts reading from 4D volume at index (0,0,0,i) through to
-        //(maxX, maxY, maxZ,0), i.e. one 3D brain mask.
-        desiredStart[3] = i - 1;
-        desiredSize[3] = 0;
-
-        //Get region mask.
-        MaskRegionType maskReg;
-        maskReg.SetSize(desiredSize );
-        maskReg.SetIndex(0,desiredStart[0] );
-        maskReg.SetIndex(1,desiredStart[1] );
-        maskReg.SetIndex(2,desiredStart[2] );
-        maskReg.SetIndex(3,desiredStart[3] );
-
-        extractFilter->SetExtractionRegion( maskReg );
-        extractFilter->Update();
-
-	gaussFilter->SetInput( extractFilter->GetOutput() );
-	gaussFilter->Update();
-
-        imageExtractedRegion = gaussFilter->GetOutput();
-        imageExtractedRegion->SetDirection( pPET->GetDirection() );
-        imageExtractedRegion->UpdateOutputData();
+        //Get the blurred region mask, which the Labbe filter has already
+        //worked out.
+        imageExtractedRegion = context->GetBlurredRegion( i - 1 );
 
         //Multiply current image estimate by region mask. To clip PET values
         //to mask.
-        multiplyFilter->SetInput1( pPET );
-        multiplyFilter->SetInput2( imageExtractedRegion );
-
-        statsFilter->SetInput(multiplyFilter->GetOutput());
-        statsFilter->Update();
-
-        //Get sum of the clipped image.
-        fSumOfPETReg = statsFilter->GetSum();
+        {
+            ScopedStageTimer statsTimer( this, "regional statistics" );
+            fSumOfPETReg = RunProductSum( pPET.GetPointer(), imageExtractedRegion.GetPointer(),
+                                          BoxRuns( index->GetDilatedBoundingBox( i - 1 ), index->GetVolumeRegion() ) );
+        }
 
         //Place regional mean into vector.
         vecRegMeansCurrent.put(i - 1, fSumOfPETReg / pLabbe->GetSumOfRegions().get(i - 1));
@@ -167,7 +135,10 @@ void LabbeMTCPVCImageFilter< TInputImage, TMaskImage>
     }
 
     //Apply Labbe to regional mean values.
-    vecRegMeansUpdated = vnl_matrix_inverse<float>(pLabbe->GetMatrix()) * vecRegMeansCurrent;
+    {
+        ScopedStageTimer solverTimer( this, "solver" );
+        vecRegMeansUpdated = vnl_matrix_inverse<float>(pLabbe->GetMatrix()) * vecRegMeansCurrent;
+    }
 
     if ( this->m_bVerbose ) {
         std::cout << std::endl << "Regional means:" << std::endl;
@@ -184,124 +155,64 @@ void LabbeMTCPVCImageFilter< TInputImage, TMaskImage>
     //Applying the MTC correction step:
 
     typename TInputImage::Pointer imageCorrected;
-   
-    typename AddFilterType::Pointer addFilter = AddFilterType::New();
-	typename AddFilterType::Pointer addFilter2 = AddFilterType::New();
-
-    typename BlurringFilterType::Pointer blurFilter = BlurringFilterType::New();
-    blurFilter->SetVariance( this->GetPSF() );
-
-    typename BlurringFilterType::Pointer blurFilter2 = BlurringFilterType::New();
-    blurFilter2->SetVariance( this->GetPSF() );
+    typename TInputImage::Pointer imageNeighbours;
+    typename TInputImage::Pointer imageScaledRegion;
 
     for (int j = 1; j <= nClasses; j++) {
-        typename TInputImage::Pointer imageNeighbours = TInputImage::New();
-
-        //Starts reading from 4D volume at index (0,0,0,i) through to
-        //(maxX, maxY, maxZ,0), i.e. one 3D brain mask.
-        desiredStart[3] = j - 1;
-        desiredSize[3] = 0;
-
-        //Get region mask.
-        MaskRegionType maskReg;
-        maskReg.SetSize(desiredSize );
-        maskReg.SetIndex(0,desiredStart[0] );
-        maskReg.SetIndex(1,desiredStart[1] );
-        maskReg.SetIndex(2,desiredStart[2] );
-        maskReg.SetIndex(3,desiredStart[3] );
-
-        extractJFilter->SetExtractionRegion( maskReg );
-        extractJFilter->Update();
-
-        typename TInputImage::Pointer imageRegionJ;
-        imageRegionJ = extractJFilter->GetOutput();
-        imageRegionJ->SetDirection( pPET->GetDirection() );
-        imageRegionJ->UpdateOutputData();
-    
-        int neighbourCount = 0;
-
-        for (int i = 1; i <= nClasses; i++) {
-            
-            if ( j != i ) {
 
-                desiredStart[3] = i - 1;
-                maskReg.SetSize(desiredSize );
-                maskReg.SetIndex(0,desiredStart[0] );
-                maskReg.SetIndex(1,desiredStart[1] );
-                maskReg.SetIndex(2,desiredStart[2] );
-                maskReg.SetIndex(3,desiredStart[3] );
-
-                extractIFilter->SetExtractionRegion( maskReg );
-                extractIFilter->Update();
-
-                typename TInputImage::Pointer imageRegionI;
-                imageRegionI = extractIFilter->GetOutput();
-                imageRegionI->SetDirection( pPET->GetDirection() );
-                imageRegionI->UpdateOutputData();
-                
-                multiplyFilter->SetInput1( vecRegMeansUpdated.get(i-1) );
-                multiplyFilter->SetInput2( imageRegionI );
-                //multiplyFilter->Update();
-
-        	blurFilter->SetInput( multiplyFilter->GetOutput() );
-	        blurFilter->Update();
-
-                //If this is the first neighbour region, create imageNeighbours,
-                //else add the current region to the previous contents of imageNeighbours.
-                if (neighbourCount == 0) {
-                    imageNeighbours = blurFilter->GetOutput();
-                    imageNeighbours->DisconnectPipeline();
-                } else {
-                    addFilter->SetInput1( imageNeighbours );
-                    addFilter->SetInput2( blurFilter->GetOutput() );
-                    addFilter->Update();
-
-                    imageNeighbours = addFilter->GetOutput();
-                }
-                
-                neighbourCount++;
-            }
+        //Get region mask j, i.e. one volume of the 4D mask, without copying it.
+        typename TInputImage::Pointer imageRegionJ = context->GetRegion( j - 1 );
+
+        //Add up the spill-in from the neighbours of region j. Regions too far
+        //away to reach region j are skipped, and each neighbour is only
+        //filled and blurred within its dilated bounding box.
+        if ( imageNeighbours.IsNull() ) {
+            imageNeighbours = NewImageLike( pPET.GetPointer() );
+            imageScaledRegion = NewImageLike( pPET.GetPointer() );
         }
+        imageNeighbours->FillBuffer( 0 );
 
-	
+        const std::vector< unsigned int > & vecNeighbours = index->GetNeighbours( j - 1 );
 
-        typename SubtractFilterType::Pointer subFilter = SubtractFilterType::New();
-        subFilter->SetInput1( pPET );
-        subFilter->SetInput2( imageNeighbours );
-        subFilter->Update();
+        for (unsigned int n = 0; n < vecNeighbours.size(); n++) {
 
-        blurFilter2->SetInput( imageRegionJ );
-        blurFilter2->Update();
+            const int i = vecNeighbours[n] + 1;
 
-        typename DivideFilterType::Pointer divideFilter = DivideFilterType::New();
-        divideFilter->SetInput1( subFilter->GetOutput() );
-        divideFilter->SetInput2( blurFilter2->GetOutput() );
-        divideFilter->Update();
+            if ( j != i ) {
 
-        multiplyFilter->SetInput1( imageRegionJ );
-        multiplyFilter->SetInput2( divideFilter->GetOutput() );
-        multiplyFilter->Update();
-   
-        //If this is the first region, create imageCorrected,
-        //else add the current region to the previous contents of imageCorrected.
-        if (j == 1) {
-            imageCorrected = multiplyFilter->GetOutput();
-            imageCorrected->DisconnectPipeline();
-        } else {
-            addFilter2->SetInput1( imageCorrected );
-            addFilter2->SetInput2( multiplyFilter->GetOutput());
-            addFilter2->Update();
+                const typename TInputImage::RegionType box = index->GetDilatedBoundingBox( i - 1 );
+
+                //Fill region i with its corrected mean, reusing one buffer.
+                SetScaledRuns( imageScaledRegion.GetPointer(), context->GetRegion( i - 1 ),
+                               vecRegMeansUpdated.get(i-1), BoxRuns( box, index->GetVolumeRegion() ) );
 
-            imageCorrected = addFilter2->GetOutput();
+                typename TInputImage::Pointer imageBlurredBox =
+                    BlurInBox( imageScaledRegion.GetPointer(), box, this->GetPSF(), this );
+
+                AddBox( imageBlurredBox.GetPointer(), imageNeighbours.GetPointer() );
+            }
         }
 
-        
+        //Region j blurred by the PSF.
+        typename TInputImage::Pointer imageBlurredJ = context->GetBlurredRegion( j - 1 );
+
+        //Remove the spill-in from the neighbours, correct for the spill-out of
+        //region j and keep the result inside region j. If this is the first
+        //region, create imageCorrected, else add to its previous contents.
+        if (j == 1) {
+            imageCorrected = EvaluateImage( pPET.GetPointer(),
+                                            Expr( imageRegionJ ) * ( ( Expr( pPET ) - Expr( imageNeighbours ) )
+                                                    / Expr( imageBlurredJ ) ) );
+        } else {
+            Evaluate( imageCorrected.GetPointer(),
+                      Expr( imageCorrected ) + Expr( imageRegionJ ) * ( ( Expr( pPET ) - Expr( imageNeighbours ) )
+                              / Expr( imageBlurredJ ) ) );
         }
 
-    this->AllocateOutputs();
+    }
 
-    ImageAlgorithm::Copy( imageCorrected.GetPointer(), output.GetPointer(), output->GetRequestedRegion(),
-                          output->GetRequestedRegion() );
+    //The final estimate becomes the output, without copying it.
+    this->GraftOutput( imageCorrected.GetPointer() );
 
 
 }
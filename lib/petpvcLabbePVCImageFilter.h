@@ -29,7 +29,6 @@
 
 #include <itkExtractImageFilter.h>
 #include <itkMultiplyImageFilter.h>
-#include <itkStatisticsImageFilter.h>
 #include <itkDiscreteGaussianImageFilter.h>
 
 
@@ -68,14 +67,13 @@ public:
     typedef typename TMaskImage::IndexType  MaskIndexType;
     typedef typename TMaskImage::PixelType  MaskPixelType;
 
-    //For calculating mean values from image
-    typedef itk::StatisticsImageFilter<TInputImage> StatisticsFilterType;
     //Extracts a 3D volume from 4D file.
     typedef itk::ExtractImageFilter<TMaskImage, TInputImage> ExtractFilterType;
     typedef itk::MultiplyImageFilter<InputImageType, TInputImage> MultiplyFilterType;
 	typedef itk::DiscreteGaussianImageFilter<TInputImage, TInputImage> BlurringFilterType;
 
     typedef LabbeImageFilter<TMaskImage> LabbeImageFilterType;
+    typedef typename LabbeImageFilterType::MaskContextType MaskContextType;
     typedef itk::Vector<float, 3> ITKVectorType;
 
     /** Image related typedefs. */
@@ -120,6 +118,12 @@ public:
         this->m_bVerbose = bVerbose;
     }
 
+    //Shares the regions, and any blurred regions, with other filters.
+    void SetMaskContext( MaskContextType * context ) {
+        this->m_maskContext = context;
+        this->Modified();
+    }
+
 protected:
     LabbePVCImageFilter();
     ~LabbePVCImageFilter() {}
@@ -131,6 +135,7 @@ protected:
     MatrixType m_matLabbe;
     ITKVectorType m_vecVariance;
     bool m_bVerbose;
+    typename MaskContextType::Pointer m_maskContext;
 
 private:
     LabbePVCImageFilter(const Self &); //purposely not implemented
@@ -27,6 +27,9 @@
 #include "itkObjectFactory.h"
 #include "itkImageRegionIterator.h"
 #include "itkImageRegionConstIterator.h"
+#include "petpvcVolumeView.h"
+#include "petpvcProfiler.h"
+#include "petpvcReduction.h"
 
 using namespace itk;
 
@@ -58,6 +61,7 @@ void LabbePVCImageFilter< TInputImage, TMaskImage>
 
     pLabbe->SetInput( pMask );
     pLabbe->SetPSF( this->GetPSF() );
+    pLabbe->SetMaskContext( this->m_maskContext );
     //Calculate Labbe.
     try {
         pLabbe->Update();
@@ -86,23 +90,9 @@ void LabbePVCImageFilter< TInputImage, TMaskImage>
                   << std::endl;
     }
 
-    MaskSizeType desiredStart;
-    desiredStart.Fill(0);
-    MaskSizeType desiredSize = imageSize;
-
-    //Extract filter used to extract 3D volume from 4D file.
-    typename ExtractFilterType::Pointer extractFilter = ExtractFilterType::New();
-    extractFilter->SetInput( pMask );
-    extractFilter->SetDirectionCollapseToIdentity(); // This is required.
-
-    //Stats. filter used to calculate statistics for an image.
-    typename StatisticsFilterType::Pointer statsFilter = StatisticsFilterType::New();
-
-    //Multiplies two images together.
-    typename MultiplyFilterType::Pointer multiplyFilter = MultiplyFilterType::New();
-
 	//Smooth the pseudo PET by the PSF.
     typename BlurringFilterType::Pointer blurFilter = BlurringFilterType::New();
+    ProfileFilter( blurFilter.GetPointer(), this, "blur" );
 
     blurFilter->SetVariance( this->GetPSF() );
 
@@ -120,38 +110,19 @@ void LabbePVCImageFilter< TInputImage, TMaskImage>
 
     for (int i = 1; i <= nClasses; i++) {
 
-        //Starts reading from 4D volume at index (0,0,0,i) through to
-        //(maxX, maxY, maxZ,0), i.e. one 3D brain mask.
-        desiredStart[3] = i - 1;
-        desiredSize[3] = 0;
-
-        //Get region mask.
-        MaskRegionType maskReg;
-        maskReg.SetSize(desiredSize );
-        maskReg.SetIndex(0,desiredStart[0] );
-        maskReg.SetIndex(1,desiredStart[1] );
-        maskReg.SetIndex(2,desiredStart[2] );
-        maskReg.SetIndex(3,desiredStart[3] );
-
-        extractFilter->SetExtractionRegion( maskReg );
-        extractFilter->Update();
-
-        imageExtractedRegion = extractFilter->GetOutput();
+        //Get region mask, i.e. one volume of the 4D mask, without copying it.
+        imageExtractedRegion = GetVolumeView< TInputImage >( pMask.GetPointer(), i - 1 );
         imageExtractedRegion->SetDirection( pPET->GetDirection() );
-        imageExtractedRegion->UpdateOutputData();
 
 		blurFilter->SetInput( imageExtractedRegion );
+        blurFilter->Update();
 
         //Multiply current image estimate by smoothed region mask. To clip PET values
         //to mask.
-        multiplyFilter->SetInput1( pPET );
-        multiplyFilter->SetInput2( blurFilter->GetOutput() );
-
-        statsFilter->SetInput(multiplyFilter->GetOutput());
-        statsFilter->Update();
-
-        //Get sum of the clipped image.
-        fSumOfPETReg = statsFilter->GetSum();
+        {
+            ScopedStageTimer statsTimer( this, "regional statistics" );
+            fSumOfPETReg = ImageProductSum( pPET.GetPointer(), blurFilter->GetOutput() );
+        }
 
         //Place regional mean into vector.
         vecRegMeansCurrent.put(i - 1, fSumOfPETReg / pLabbe->GetSumOfRegions().get(i - 1));
@@ -160,7 +131,10 @@ void LabbePVCImageFilter< TInputImage, TMaskImage>
     }
 
     //Apply Labbe to regional mean values.
-    vecRegMeansUpdated = vnl_matrix_inverse<float>(pLabbe->GetMatrix()) * vecRegMeansCurrent;
+    {
+        ScopedStageTimer solverTimer( this, "solver" );
+        vecRegMeansUpdated = vnl_matrix_inverse<float>(pLabbe->GetMatrix()) * vecRegMeansCurrent;
+    }
 
     if ( this->m_bVerbose ) {
         std::cout << std::endl << "Regional means:" << std::endl;
@@ -176,10 +150,9 @@ void LabbePVCImageFilter< TInputImage, TMaskImage>
     std::cout << vecRegMeansUpdated << std::endl;
 	this->m_vecRegMeansPVCorr = vecRegMeansUpdated;
 
-    this->AllocateOutputs();
-
-    ImageAlgorithm::Copy(input.GetPointer(), output.GetPointer(), output->GetRequestedRegion(),
-                         output->GetRequestedRegion() );
+    //The image itself is not corrected, so the output shares the input's
+    //buffer rather than a copy of it.
+    this->GraftOutput( const_cast< TInputImage * >( input.GetPointer() ) );
 
 
 }
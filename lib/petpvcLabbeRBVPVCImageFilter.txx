@@ -24,9 +24,14 @@
 #define __PETPVCLABBERBVIMAGEFILTER_TXX
 
 #include "petpvcLabbeRBVPVCImageFilter.h"
+#include "petpvcRegionIndex.h"
 #include "itkObjectFactory.h"
 #include "itkImageRegionIterator.h"
 #include "itkImageRegionConstIterator.h"
+#include "petpvcVolumeView.h"
+#include "petpvcProfiler.h"
+#include "petpvcReduction.h"
+#include "petpvcImageExpression.h"
 
 using namespace itk;
 
@@ -57,8 +62,17 @@ void LabbeRBVPVCImageFilter< TInputImage, TMaskImage>
     InputImagePointer pPET = dynamic_cast<const TInputImage*> (ProcessObject::GetInput(0));
     MaskImagePointer pMask = dynamic_cast<const TMaskImage*> (ProcessObject::GetInput(1));
 
+    //Share the regions, and their index, with the Labbe filter.
+    typename MaskContextType::Pointer context = this->m_maskContext;
+    if ( context.IsNull() ) {
+        context = MaskContextType::New();
+        context->SetMask( pMask.GetPointer(), pPET.GetPointer() );
+        context->SetCacheBlurredRegions( true );
+    }
+
     pLabbe->SetInput( pMask );
     pLabbe->SetPSF( this->GetPSF() );
+    pLabbe->SetMaskContext( context );
     //Calculate Labbe.
     try {
         pLabbe->Update();
@@ -86,23 +100,10 @@ void LabbeRBVPVCImageFilter< TInputImage, TMaskImage>
                   << std::endl;
     }
 
-    MaskSizeType desiredStart;
-    desiredStart.Fill(0);
-    MaskSizeType desiredSize = imageSize;
-
-    //Extract filter used to extract 3D volume from 4D file.
-    typename ExtractFilterType::Pointer extractFilter = ExtractFilterType::New();
-    extractFilter->SetInput( pMask );
-    extractFilter->SetDirectionCollapseToIdentity(); // This is required.
-
-    //Stats. filter used to calculate statistics for an image.
-    typename StatisticsFilterType::Pointer statsFilter = StatisticsFilterType::New();
-
-    //Multiplies two images together.
-    typename MultiplyFilterType::Pointer multiplyFilter = MultiplyFilterType::New();
-
     typename TInputImage::Pointer imageExtractedRegion;// = InputImagePointer::New();
 
+    const typename MaskContextType::RegionIndexType * index = context->GetRegionIndex();
+
     float fSumOfPETReg;
 
     //Vector to contain the current estimate of the regional mean values.
@@ -113,44 +114,19 @@ void LabbeRBVPVCImageFilter< TInputImage, TMaskImage>
     vnl_vector<float> vecRegMeansUpdated;
     vecRegMeansUpdated.set_size(nClasses);
 
-    typename BlurringFilterType::Pointer gaussFilter = BlurringFilterType::New();
-    gaussFilter->SetVariance( this->GetPSF() );
-
     for (int i = 1; i <= nClasses; i++) {
 
-        //Starts reading from 4D volume at index (0,0,0,i) through to
-        //(maxX, maxY, maxZ,0), i.e. one 3D brain mask.
-        desiredStart[3] = i - 1;
-        desiredSize[3] = 0;
-
-        //Get region mask.
-        MaskRegionType maskReg;
-        maskReg.SetSize(desiredSize );
-        maskReg.SetIndex(0,desiredStart[0] );
-        maskReg.SetIndex(1,desiredStart[1] );
-        maskReg.SetIndex(2,desiredStart[2] );
-        maskReg.SetIndex(3,desiredStart[3] );
-
-        extractFilter->SetExtractionRegion( maskReg );
-	extractFilter->Update();
-
-	gaussFilter->SetInput( extractFilter->GetOutput() );
-	gaussFilter->Update();
-
-        imageExtractedRegion = gaussFilter->GetOutput();
-        imageExtractedRegion->SetDirection( pPET->GetDirection() );
-        imageExtractedRegion->UpdateOutputData();
+        //Get the blurred region mask, which the Labbe filter has already
+        //worked out.
+        imageExtractedRegion = context->GetBlurredRegion( i - 1 );
 
         //Multiply current image estimate by region mask. To clip PET values
         //to mask.
-        multiplyFilter->SetInput1( pPET );
-        multiplyFilter->SetInput2( imageExtractedRegion );
-
-        statsFilter->SetInput(multiplyFilter->GetOutput());
-        statsFilter->Update();
-
-        //Get sum of the clipped image.
-        fSumOfPETReg = statsFilter->GetSum();
+        {
+            ScopedStageTimer statsTimer( this, "regional statistics" );
+            fSumOfPETReg = RunProductSum( pPET.GetPointer(), imageExtractedRegion.GetPointer(),
+                                          BoxRuns( index->GetDilatedBoundingBox( i - 1 ), index->GetVolumeRegion() ) );
+        }
 
         //Place regional mean into vector.
         vecRegMeansCurrent.put(i - 1, fSumOfPETReg / pLabbe->GetSumOfRegions().get(i - 1));
@@ -159,7 +135,10 @@ void LabbeRBVPVCImageFilter< TInputImage, TMaskImage>
     }
 
     //Apply Labbe to regional mean values.
-    vecRegMeansUpdated = vnl_matrix_inverse<float>(pLabbe->GetMatrix()) * vecRegMeansCurrent;
+    {
+        ScopedStageTimer solverTimer( this, "solver" );
+        vecRegMeansUpdated = vnl_matrix_inverse<float>(pLabbe->GetMatrix()) * vecRegMeansCurrent;
+    }
 
     if ( this->m_bVerbose ) {
         std::cout << std::endl << "Regional means:" << std::endl;
@@ -176,80 +155,35 @@ void LabbeRBVPVCImageFilter< TInputImage, TMaskImage>
     //Applying the Yang correction step:
 
     typename TInputImage::Pointer imageYang;
-    typename AddFilterType::Pointer addFilter = AddFilterType::New();
-
-    for (int i = 1; i <= nClasses; i++) {
-
-        //Starts reading from 4D volume at index (0,0,0,i) through to
-        //(maxX, maxY, maxZ,0), i.e. one 3D brain mask.
-        desiredStart[3] = i - 1;
-        desiredSize[3] = 0;
 
-        //Get region mask.
-        MaskRegionType maskReg;
-        maskReg.SetSize(desiredSize );
-        maskReg.SetIndex(0,desiredStart[0] );
-        maskReg.SetIndex(1,desiredStart[1] );
-        maskReg.SetIndex(2,desiredStart[2] );
-        maskReg.SetIndex(3,desiredStart[3] );
+    imageYang = NewImageLike( pPET.GetPointer() );
+    imageYang->FillBuffer( 0 );
 
-        extractFilter->SetExtractionRegion( maskReg );
-        extractFilter->Update();
-
-        imageExtractedRegion = extractFilter->GetOutput();
-        imageExtractedRegion->SetDirection( pPET->GetDirection() );
-        imageExtractedRegion->UpdateOutputData();
+    for (int i = 1; i <= nClasses; i++) {
 
-        //Multiply current image estimate by region mask. To clip PET values
-        //to mask.
-        multiplyFilter->SetInput1( vecRegMeansUpdated.get(i-1) );
-        multiplyFilter->SetInput2( imageExtractedRegion );
-        multiplyFilter->Update();
-
-        //If this is the first region, create imageYang,
-        //else add the current region to the previous contents of imageYang.
-        if (i == 1) {
-            imageYang = multiplyFilter->GetOutput();
-            imageYang->DisconnectPipeline();
-        } else {
-            addFilter->SetInput1(imageYang);
-            addFilter->SetInput2(multiplyFilter->GetOutput());
-            addFilter->Update();
-
-            imageYang = addFilter->GetOutput();
-        }
+        //Fill the region with its corrected mean, only visiting its voxels.
+        AddScaledRuns( imageYang.GetPointer(), context->GetRegion( i - 1 ),
+                       vecRegMeansUpdated.get(i-1), index->GetRuns( i - 1 ) );
 
     }
 
     //Takes the original PET data and the pseudo PET image, calculates the
     //correction factors  and returns the PV-corrected PET image.
 
-    typename MultiplyFilterType::Pointer multiplyFilter2 = MultiplyFilterType::New();
-    typename DivideFilterType::Pointer divideFilter = DivideFilterType::New();
-
     //Smooth the pseudo PET by the PSF.
     typename BlurringFilterType::Pointer pBlurFilter = BlurringFilterType::New();
+    ProfileFilter( pBlurFilter.GetPointer(), this, "blur" );
 
     pBlurFilter->SetInput(imageYang);
     pBlurFilter->SetVariance( this->GetPSF() );
+    pBlurFilter->Update();
 
-    //Take ratio of pseudo PET and smoothed pseudo PET. These are the correction
-    //factors.
-    divideFilter->SetInput1( imageYang );
-    divideFilter->SetInput2(pBlurFilter->GetOutput());
-
-    //Multiply original PET by correction factors.
-    multiplyFilter2->SetInput1( pPET );
-    multiplyFilter2->SetInput2(divideFilter->GetOutput());
-    multiplyFilter2->Update();
-
-
-    /////////////////////////////////////////////
-
+    //Multiply original PET by the correction factors, the ratio of pseudo PET
+    //and smoothed pseudo PET, writing straight into the output.
     this->AllocateOutputs();
 
-    ImageAlgorithm::Copy( multiplyFilter2->GetOutput(), output.GetPointer(), output->GetRequestedRegion(),
-                          output->GetRequestedRegion() );
+    Evaluate( output.GetPointer(),
+              Expr( pPET ) * ( Expr( imageYang ) / Expr( pBlurFilter->GetOutput() ) ) );
 
 
 }
@@ -0,0 +1,243 @@
+/*
+   petpvcLabelCompaction.h
+
+   Author:      Benjamin A. Thomas
+
+   Copyright 2026 Institute of Nuclear Medicine, University College London.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+ */
+
+/*
+   Replaces the label values of a parcellation by dense indices.
+
+   Label values are often sparse (FreeSurfer uses values up to 2035 for
+   about 110 regions), so code that works per label has to look each voxel
+   up in a map. LabelCompaction maps the K labels present, in ascending
+   order, to 0..K-1 and writes an unsigned short index image, together with
+   the table from index back to label. Per-label loops can then use the
+   index directly as an array subscript.
+ */
+
+#ifndef __PETPVCLABELCOMPACTION_H
+#define __PETPVCLABELCOMPACTION_H
+
+#include <itkObject.h>
+#include <itkObjectFactory.h>
+#include <itkImage.h>
+#include <itkNumericTraits.h>
+
+#include "petpvcParallel.h"
+#include "petpvcProfiler.h"
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+using namespace itk;
+
+namespace petpvc
+{
+
+/** \class LabelCompaction
+ *
+ * \brief Dense index image and lookup table of the labels of an image.
+ *
+ */
+template< class TLabelImage >
+class LabelCompaction : public Object
+{
+public:
+    typedef LabelCompaction Self;
+    typedef Object Superclass;
+    typedef SmartPointer< Self > Pointer;
+    typedef SmartPointer< const Self > ConstPointer;
+
+    itkNewMacro( Self );
+
+    itkTypeMacro( LabelCompaction, Object );
+
+    typedef typename TLabelImage::PixelType LabelType;
+    typedef unsigned short IndexPixelType;
+    typedef Image< IndexPixelType, TLabelImage::ImageDimension > IndexImageType;
+    typedef typename IndexImageType::Pointer IndexImagePointer;
+
+    //Finds the labels of the image and writes the index image.
+    void Compact( const TLabelImage * labels ) {
+        ScopedStageTimer timer( this, "label compaction" );
+
+        const SizeValueType nVoxels = labels->GetBufferedRegion().GetNumberOfPixels();
+        const LabelType * pLabels = labels->GetBufferPointer();
+
+        //Labels seen by each thread, merged in ascending order.
+        std::vector< std::set< LabelType > > vecFound( GetNumberOfThreads() );
+        FindLabelsFunctor findFunctor;
+        findFunctor.pLabels = pLabels;
+        findFunctor.vecFound = &vecFound;
+        ParallelFor( 0, nVoxels, findFunctor );
+
+        std::set< LabelType > setLabels;
+        for ( unsigned int n = 0; n < vecFound.size(); n++ ) {
+            setLabels.insert( vecFound[n].begin(), vecFound[n].end() );
+        }
+
+        if ( setLabels.size() > (SizeValueType) NumericTraits< IndexPixelType >::max() + 1 ) {
+            itkExceptionMacro( << "Too many labels to compact: " << setLabels.size() );
+        }
+
+        this->m_vecLabels.assign( setLabels.begin(), setLabels.end() );
+
+        //Write the index of every voxel, counting voxels per label.
+        this->m_imageIndex = IndexImageType::New();
+        this->m_imageIndex->CopyInformation( labels );
+        this->m_imageIndex->SetRegions( labels->GetBufferedRegion() );
+        this->m_imageIndex->Allocate();
+
+        std::vector< std::vector< SizeValueType > > vecCounts( GetNumberOfThreads(),
+                std::vector< SizeValueType >( this->m_vecLabels.size(), 0 ) );
+        IndexFunctor indexFunctor;
+        indexFunctor.pLabels = pLabels;
+        indexFunctor.pIndex = this->m_imageIndex->GetBufferPointer();
+        indexFunctor.vecLabels = &this->m_vecLabels;
+        indexFunctor.vecCounts = &vecCounts;
+        ParallelFor( 0, nVoxels, indexFunctor );
+
+        this->m_vecCounts.assign( this->m_vecLabels.size(), 0 );
+        for ( unsigned int n = 0; n < vecCounts.size(); n++ ) {
+            for ( unsigned int i = 0; i < this->m_vecLabels.size(); i++ ) {
+                this->m_vecCounts[i] += vecCounts[n][i];
+            }
+        }
+
+        this->Modified();
+    }
+
+    //Index of each voxel, from 0 to GetNumberOfLabels() - 1.
+    IndexImageType * GetIndexImage() const {
+        return this->m_imageIndex;
+    }
+
+    unsigned int GetNumberOfLabels() const {
+        return this->m_vecLabels.size();
+    }
+
+    //Label of each index, in ascending order.
+    const std::vector< LabelType > & GetLabels() const {
+        return this->m_vecLabels;
+    }
+
+    LabelType GetLabel( unsigned int n ) const {
+        return this->m_vecLabels[n];
+    }
+
+    SizeValueType GetNumberOfVoxels( unsigned int n ) const {
+        return this->m_vecCounts[n];
+    }
+
+    //Index of label, or -1 if it is not in the image.
+    int GetIndex( LabelType label ) const {
+        typename std::vector< LabelType >::const_iterator it =
+            std::lower_bound( this->m_vecLabels.begin(), this->m_vecLabels.end(), label );
+        if ( it == this->m_vecLabels.end() || *it != label ) {
+            return -1;
+        }
+        return it - this->m_vecLabels.begin();
+    }
+
+protected:
+    LabelCompaction() {}
+    ~LabelCompaction() {}
+
+private:
+    LabelCompaction(const Self &); //purposely not implemented
+    void operator=(const Self &);  //purposely not implemented
+
+    struct FindLabelsFunctor {
+        const LabelType * pLabels;
+        std::vector< std::set< LabelType > > * vecFound;
+
+        void operator()( SizeValueType nFirst, SizeValueType nLast, SizeValueType nUnit ) const {
+            std::set< LabelType > & found = ( *this->vecFound )[nUnit];
+
+            //Neighbouring voxels usually share a label.
+            LabelType last = this->pLabels[nFirst];
+            found.insert( last );
+            for ( SizeValueType i = nFirst + 1; i < nLast; i++ ) {
+                if ( this->pLabels[i] != last ) {
+                    last = this->pLabels[i];
+                    found.insert( last );
+                }
+            }
+        }
+    };
+
+    struct IndexFunctor {
+        const LabelType * pLabels;
+        IndexPixelType * pIndex;
+        const std::vector< LabelType > * vecLabels;
+        std::vector< std::vector< SizeValueType > > * vecCounts;
+
+        void operator()( SizeValueType nFirst, SizeValueType nLast, SizeValueType nUnit ) const {
+            std::vector< SizeValueType > & counts = ( *this->vecCounts )[nUnit];
+
+            LabelType last = this->pLabels[nFirst];
+            IndexPixelType nIndex = std::lower_bound( this->vecLabels->begin(), this->vecLabels->end(), last )
+                                    - this->vecLabels->begin();
+            for ( SizeValueType i = nFirst; i < nLast; i++ ) {
+                if ( this->pLabels[i] != last ) {
+                    last = this->pLabels[i];
+                    nIndex = std::lower_bound( this->vecLabels->begin(), this->vecLabels->end(), last )
+                             - this->vecLabels->begin();
+                }
+                this->pIndex[i] = nIndex;
+                counts[nIndex]++;
+            }
+        }
+    };
+
+    IndexImagePointer m_imageIndex;
+    std::vector< LabelType > m_vecLabels;
+    std::vector< SizeValueType > m_vecCounts;
+};
+
+//Sets each voxel of output to the value of its index in vecValues.
+template< class TPixel, class TValue >
+struct LookupFunctor {
+    const unsigned short * pIndex;
+    TPixel * pOutput;
+    const TValue * pValues;
+
+    void operator()( SizeValueType nFirst, SizeValueType nLast, SizeValueType ) const {
+        for ( SizeValueType i = nFirst; i < nLast; i++ ) {
+            this->pOutput[i] = static_cast< TPixel >( this->pValues[ this->pIndex[i] ] );
+        }
+    }
+};
+
+//Fills output with the value of each voxel's index, in one pass. vecValues
+//must have a value for every index.
+template< class TImage, class TIndexImage, class TValue >
+void LookupImage( TImage * output, const TIndexImage * indices, const std::vector< TValue > & vecValues )
+{
+    LookupFunctor< typename TImage::PixelType, TValue > functor;
+    functor.pIndex = indices->GetBufferPointer();
+    functor.pOutput = output->GetBufferPointer();
+    functor.pValues = vecValues.empty() ? NULL : &vecValues[0];
+    ParallelFor( 0, output->GetBufferedRegion().GetNumberOfPixels(), functor );
+    output->Modified();
+}
+
+} //namespace petpvc
+
+#endif // __PETPVCLABELCOMPACTION_H
@@ -33,7 +33,6 @@
 #include <itkAddImageFilter.h>
 #include <itkSubtractImageFilter.h>
 #include <itkDiscreteGaussianImageFilter.h>
-#include <itkStatisticsImageFilter.h>
 
 using namespace itk;
 
@@ -70,8 +69,6 @@ public:
     typedef typename TMaskImage::IndexType  MaskIndexType;
     typedef typename TMaskImage::PixelType  MaskPixelType;
 
-    //For calculating mean values from image
-    typedef itk::StatisticsImageFilter<TInputImage> StatisticsFilterType;
     //Extracts a 3D volume from 4D file.
     typedef itk::ExtractImageFilter<TMaskImage, TInputImage> ExtractFilterType;
     typedef itk::MultiplyImageFilter<TInputImage, TInputImage> MultiplyFilterType;
@@ -81,6 +78,7 @@ public:
     typedef itk::DiscreteGaussianImageFilter<TInputImage, TInputImage> BlurringFilterType;
 
     typedef GTMImageFilter<TMaskImage> GTMImageFilterType;
+    typedef typename GTMImageFilterType::MaskContextType MaskContextType;
     typedef itk::Vector<float, 3> ITKVectorType;
 
     /** Image related typedefs. */
@@ -125,6 +123,12 @@ public:
         this->m_bVerbose = bVerbose;
     }
 
+    //Shares the regions, and any blurred regions, with other filters.
+    void SetMaskContext( MaskContextType * context ) {
+        this->m_maskContext = context;
+        this->Modified();
+    }
+
     void ApplyYang();
 
 
@@ -139,6 +143,7 @@ protected:
     MatrixType m_matGTM;
     ITKVectorType m_vecVariance;
     bool m_bVerbose;
+    typename MaskContextType::Pointer m_maskContext;
 
 private:
     MTCPVCImageFilter(const Self &); //purposely not implemented
@@ -0,0 +1,475 @@
+/*
+   petpvcMappedImageReader.h
+
+   Author:      Benjamin A. Thomas
+
+   Copyright 2026 Institute of Nuclear Medicine, University College London.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+ */
+
+#ifndef __PETPVCMAPPEDIMAGEREADER_H
+#define __PETPVCMAPPEDIMAGEREADER_H
+
+#include <itkImage.h>
+#include <itkImageFileReader.h>
+#include <itkImportImageContainer.h>
+#include <itkNiftiImageIO.h>
+#include <itkMetaImageIO.h>
+#include <itkByteSwapper.h>
+#include <metaImage.h>
+
+#include "petpvcProfiler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace itk;
+
+namespace petpvc
+{
+
+/** \class MappedImageContainer
+ *
+ * \brief Pixel container backed by a memory-mapped file.
+ *
+ * The file is mapped copy-on-write, so the image may be modified without
+ * changing the file. The mapping is removed when the container is
+ * destroyed. Memory mapping is not used on Windows.
+ *
+ */
+template< class TElement >
+class MappedImageContainer : public ImportImageContainer< SizeValueType, TElement >
+{
+public:
+    typedef MappedImageContainer Self;
+    typedef ImportImageContainer< SizeValueType, TElement > Superclass;
+    typedef SmartPointer< Self > Pointer;
+
+    itkNewMacro( Self );
+
+    itkTypeMacro( MappedImageContainer, ImportImageContainer );
+
+    //Maps nElements starting at nOffset bytes into the file. Returns false
+    //if the file cannot be mapped.
+    bool MapFile( const std::string & sFileName, size_t nOffset, SizeValueType nElements ) {
+#ifdef _WIN32
+        return false;
+#else
+        const int fd = open( sFileName.c_str(), O_RDONLY );
+        if ( fd < 0 ) {
+            return false;
+        }
+
+        struct stat fileInfo;
+        if ( fstat( fd, &fileInfo ) != 0 ||
+                (size_t) fileInfo.st_size < nOffset + nElements * sizeof( TElement ) ) {
+            close( fd );
+            return false;
+        }
+
+        void * pData = mmap( NULL, fileInfo.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+        close( fd );
+
+        if ( pData == MAP_FAILED ) {
+            return false;
+        }
+
+        this->m_pMapped = pData;
+        this->m_nMappedBytes = fileInfo.st_size;
+
+        //Mapped pages count towards memory use once they are read.
+        AllocationTracker::GetInstance().Allocated( this->m_nMappedBytes );
+
+        this->SetImportPointer( reinterpret_cast< TElement * >( static_cast< char * >( pData ) + nOffset ),
+                                nElements, false );
+        return true;
+#endif
+    }
+
+protected:
+    MappedImageContainer() {
+        this->m_pMapped = NULL;
+        this->m_nMappedBytes = 0;
+    }
+
+    ~MappedImageContainer() {
+#ifndef _WIN32
+        if ( this->m_pMapped != NULL ) {
+            munmap( this->m_pMapped, this->m_nMappedBytes );
+            AllocationTracker::GetInstance().Freed( this->m_nMappedBytes );
+        }
+#endif
+    }
+
+private:
+    MappedImageContainer(const Self &); //purposely not implemented
+    void operator=(const Self &);  //purposely not implemented
+
+    void * m_pMapped;
+    size_t m_nMappedBytes;
+};
+
+//Finds where the voxel data of an uncompressed NIfTI-1 (.nii) or MetaImage
+//(.mhd + .raw) file starts. Returns false if the voxels cannot be used as
+//they are stored, e.g. compressed, byte-swapped or scaled data.
+inline bool GetRawDataLocation( const std::string & sFileName, ImageIOBase * io,
+                                size_t nDataBytes, std::string & sDataFileName, size_t & nOffset )
+{
+    const bool bBigEndian = ByteSwapper<int>::SystemIsBigEndian();
+
+    NiftiImageIO * niftiIO = dynamic_cast< NiftiImageIO * >( io );
+    if ( niftiIO != NULL ) {
+        if ( sFileName.size() < 4 || sFileName.substr( sFileName.size() - 4 ) != ".nii" ) {
+            return false;
+        }
+
+        //Fields of the NIfTI-1 header that ITK does not expose.
+        char header[348];
+        std::ifstream file( sFileName.c_str(), std::ios::binary );
+        if ( !file.read( header, sizeof( header ) ) ) {
+            return false;
+        }
+
+        int nHeaderSize;
+        float fVoxOffset, fSlope, fInter;
+        memcpy( &nHeaderSize, header, 4 );
+        memcpy( &fVoxOffset, header + 108, 4 );
+        memcpy( &fSlope, header + 112, 4 );
+        memcpy( &fInter, header + 116, 4 );
+
+        //Other byte order, or NIfTI-2.
+        if ( nHeaderSize != 348 ) {
+            return false;
+        }
+
+        //ITK rescales the voxels in this case.
+        if ( fSlope != 0.0f && ( fSlope != 1.0f || fInter != 0.0f ) ) {
+            return false;
+        }
+
+        sDataFileName = sFileName;
+        nOffset = (size_t) fVoxOffset;
+        return ( nOffset % sizeof( float ) ) == 0;
+    }
+
+    MetaImageIO * metaIO = dynamic_cast< MetaImageIO * >( io );
+    if ( metaIO != NULL ) {
+        MetaImage * metaImage = metaIO->GetMetaImagePointer();
+
+        if ( metaImage->CompressedData() || metaImage->BinaryDataByteOrderMSB() != bBigEndian ) {
+            return false;
+        }
+
+        const std::string sElementFile = metaImage->ElementDataFileName();
+        if ( sElementFile == "LOCAL" || sElementFile == "Local" || sElementFile == "local" ||
+                sElementFile.find( "LIST" ) == 0 || sElementFile.find( '%' ) != std::string::npos ) {
+            return false;
+        }
+
+        //Data file name is relative to the header.
+        const std::string::size_type nSlash = sFileName.find_last_of( "/\\" );
+        if ( nSlash != std::string::npos && sElementFile.find_first_of( "/\\" ) != 0 ) {
+            sDataFileName = sFileName.substr( 0, nSlash + 1 ) + sElementFile;
+        } else {
+            sDataFileName = sElementFile;
+        }
+
+        if ( metaImage->HeaderSize() >= 0 ) {
+            nOffset = metaImage->HeaderSize();
+        } else {
+            //Negative header size means the data is at the end of the file.
+            std::ifstream file( sDataFileName.c_str(), std::ios::binary | std::ios::ate );
+            const std::streamoff nFileSize = file.tellg();
+            if ( nFileSize < (std::streamoff) nDataBytes ) {
+                return false;
+            }
+            nOffset = nFileSize - nDataBytes;
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+//Reads the header of a file that can be memory-mapped as a TImage, and sets
+//the geometry of image from it. Returns false if the file cannot be mapped.
+template< class TImage >
+bool ReadMappableHeader( const std::string & sFileName, TImage * image,
+                         std::string & sDataFileName, size_t & nOffset )
+{
+    typedef typename TImage::PixelType PixelType;
+    const unsigned int nDims = TImage::ImageDimension;
+
+    ImageIOBase::Pointer io;
+
+    NiftiImageIO::Pointer niftiIO = NiftiImageIO::New();
+    MetaImageIO::Pointer metaIO = MetaImageIO::New();
+
+    if ( niftiIO->CanReadFile( sFileName.c_str() ) ) {
+        io = niftiIO.GetPointer();
+    } else if ( metaIO->CanReadFile( sFileName.c_str() ) ) {
+        io = metaIO.GetPointer();
+    } else {
+        return false;
+    }
+
+    try {
+        io->SetFileName( sFileName );
+        io->ReadImageInformation();
+    } catch ( ExceptionObject & ) {
+        return false;
+    }
+
+    //Voxels must be usable without any conversion.
+    if ( io->GetNumberOfDimensions() != nDims || io->GetNumberOfComponents() != 1 ||
+            io->GetComponentType() != ImageIOBase::MapPixelType< PixelType >::CType ) {
+        return false;
+    }
+
+    typename TImage::RegionType region;
+    typename TImage::SpacingType spacing;
+    typename TImage::PointType origin;
+    typename TImage::DirectionType direction;
+
+    SizeValueType nVoxels = 1;
+    for ( unsigned int i = 0; i < nDims; i++ ) {
+        region.SetIndex( i, 0 );
+        region.SetSize( i, io->GetDimensions( i ) );
+        spacing[i] = io->GetSpacing( i );
+        origin[i] = io->GetOrigin( i );
+
+        const std::vector<double> axis = io->GetDirection( i );
+        for ( unsigned int j = 0; j < nDims; j++ ) {
+            direction[j][i] = axis[j];
+        }
+
+        nVoxels *= io->GetDimensions( i );
+    }
+
+    if ( !GetRawDataLocation( sFileName, io, nVoxels * sizeof( PixelType ), sDataFileName, nOffset ) ) {
+        return false;
+    }
+
+    image->SetRegions( region );
+    image->SetSpacing( spacing );
+    image->SetOrigin( origin );
+    image->SetDirection( direction );
+    image->SetMetaDataDictionary( io->GetMetaDataDictionary() );
+
+    return true;
+}
+
+//Reads an image by memory-mapping the file. Returns a null pointer if the
+//file cannot be mapped, in which case ReadImage() should be used.
+template< class TImage >
+typename TImage::Pointer ReadMappedImage( const std::string & sFileName )
+{
+    typedef typename TImage::Pointer ImagePointer;
+    typedef typename TImage::PixelType PixelType;
+
+    typename TImage::Pointer image = TImage::New();
+
+    std::string sDataFileName;
+    size_t nOffset = 0;
+    if ( !ReadMappableHeader< TImage >( sFileName, image, sDataFileName, nOffset ) ) {
+        return ImagePointer();
+    }
+
+    typename MappedImageContainer< PixelType >::Pointer container = MappedImageContainer< PixelType >::New();
+    if ( !container->MapFile( sDataFileName, nOffset, image->GetLargestPossibleRegion().GetNumberOfPixels() ) ) {
+        return ImagePointer();
+    }
+
+    image->SetPixelContainer( container );
+
+    return image;
+}
+
+//Reads an image, memory-mapping it where possible and otherwise using
+//ImageFileReader. Throws itk::ExceptionObject if the file cannot be read.
+template< class TImage >
+typename TImage::Pointer ReadImage( const std::string & sFileName )
+{
+    ScopedStageTimer timer( NULL, "read" );
+
+    typename TImage::Pointer image = ReadMappedImage< TImage >( sFileName );
+
+    if ( image.IsNull() ) {
+        typedef ImageFileReader< TImage > ReaderType;
+        typename ReaderType::Pointer reader = ReaderType::New();
+        reader->SetFileName( sFileName );
+        reader->Update();
+
+        image = reader->GetOutput();
+        image->DisconnectPipeline();
+
+        //Without allocation tracking, mapped images are not counted.
+        timer.AddBytes( (double) image->GetBufferedRegion().GetNumberOfPixels()
+                        * sizeof( typename TImage::PixelType ) );
+    }
+
+    return image;
+}
+
+//Throws itk::ExceptionObject unless every volume in vecVolumes is one of
+//the nVolumes volumes of the file.
+inline void CheckVolumes( const std::string & sFileName, const std::vector< unsigned int > & vecVolumes,
+                          SizeValueType nVolumes )
+{
+    if ( vecVolumes.empty() ) {
+        itkGenericExceptionMacro( << "No volumes requested from " << sFileName );
+    }
+
+    for ( unsigned int i = 0; i < vecVolumes.size(); i++ ) {
+        if ( vecVolumes[i] >= nVolumes ) {
+            itkGenericExceptionMacro( << sFileName << " has " << nVolumes
+                                      << " volumes, so volume " << vecVolumes[i] << " cannot be read" );
+        }
+    }
+}
+
+//Reads only the volumes in vecVolumes, counting from zero, of a file with
+//one more dimension than a volume, e.g. two regions of a 4-D mask. Volume i
+//of the result is volume vecVolumes[i] of the file; the geometry of the
+//other dimensions is that of the file.
+//
+//Mappable files are mapped and only the pages of the requested volumes are
+//read. Consecutive volumes are used directly from the mapping, others are
+//copied from it. Any other file is read one volume at a time, which ITK
+//streams for NIfTI and MetaImage files. Throws itk::ExceptionObject if the
+//file or a volume cannot be read.
+template< class TImage >
+typename TImage::Pointer ReadVolumes( const std::string & sFileName, const std::vector< unsigned int > & vecVolumes )
+{
+    ScopedStageTimer timer( NULL, "read" );
+
+    typedef typename TImage::PixelType PixelType;
+    const unsigned int nVolumeDim = TImage::ImageDimension - 1;
+    const SizeValueType nVolumes = vecVolumes.size();
+
+    typename TImage::Pointer image = TImage::New();
+
+    std::string sDataFileName;
+    size_t nOffset = 0;
+    if ( ReadMappableHeader< TImage >( sFileName, image, sDataFileName, nOffset ) ) {
+        typename TImage::RegionType region = image->GetLargestPossibleRegion();
+        const SizeValueType nFileVolumes = region.GetSize()[nVolumeDim];
+        const SizeValueType nVolumeVoxels = region.GetNumberOfPixels() / std::max< SizeValueType >( nFileVolumes, 1 );
+        CheckVolumes( sFileName, vecVolumes, nFileVolumes );
+
+        bool bConsecutive = true;
+        for ( unsigned int i = 1; i < nVolumes; i++ ) {
+            bConsecutive = bConsecutive && ( vecVolumes[i] == vecVolumes[0] + i );
+        }
+
+        region.SetSize( nVolumeDim, nVolumes );
+
+        typename MappedImageContainer< PixelType >::Pointer container = MappedImageContainer< PixelType >::New();
+
+        if ( bConsecutive ) {
+            const size_t nFirstByte = nOffset + (size_t) vecVolumes[0] * nVolumeVoxels * sizeof( PixelType );
+            if ( container->MapFile( sDataFileName, nFirstByte, nVolumes * nVolumeVoxels ) ) {
+                image->SetRegions( region );
+                image->SetPixelContainer( container );
+                return image;
+            }
+        } else if ( container->MapFile( sDataFileName, nOffset, nFileVolumes * nVolumeVoxels ) ) {
+            image->SetRegions( region );
+            image->Allocate();
+
+            for ( unsigned int i = 0; i < nVolumes; i++ ) {
+                memcpy( image->GetBufferPointer() + i * nVolumeVoxels,
+                        container->GetBufferPointer() + vecVolumes[i] * nVolumeVoxels,
+                        nVolumeVoxels * sizeof( PixelType ) );
+            }
+
+            timer.AddBytes( (double) nVolumes * nVolumeVoxels * sizeof( PixelType ) );
+            return image;
+        }
+    }
+
+    typedef ImageFileReader< TImage > ReaderType;
+    typename ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName( sFileName );
+    reader->UpdateOutputInformation();
+
+    TImage * fileImage = reader->GetOutput();
+    const typename TImage::RegionType fileRegion = fileImage->GetLargestPossibleRegion();
+    const SizeValueType nFileVolumes = fileRegion.GetSize()[nVolumeDim];
+    const SizeValueType nVolumeVoxels = fileRegion.GetNumberOfPixels() / std::max< SizeValueType >( nFileVolumes, 1 );
+    CheckVolumes( sFileName, vecVolumes, nFileVolumes );
+
+    typename TImage::RegionType region = fileRegion;
+    region.SetIndex( nVolumeDim, 0 );
+    region.SetSize( nVolumeDim, nVolumes );
+
+    image = TImage::New();
+    image->CopyInformation( fileImage );
+    image->SetRegions( region );
+    image->Allocate();
+
+    for ( unsigned int i = 0; i < nVolumes; i++ ) {
+        typename TImage::RegionType volumeRegion = fileRegion;
+        volumeRegion.SetIndex( nVolumeDim, fileRegion.GetIndex()[nVolumeDim] + vecVolumes[i] );
+        volumeRegion.SetSize( nVolumeDim, 1 );
+
+        //Readers that cannot stream buffer the whole file the first time,
+        //and later volumes are then taken from that buffer.
+        fileImage->SetRequestedRegion( volumeRegion );
+        reader->Update();
+
+        memcpy( image->GetBufferPointer() + i * nVolumeVoxels,
+                fileImage->GetBufferPointer() + fileImage->ComputeOffset( volumeRegion.GetIndex() ),
+                nVolumeVoxels * sizeof( PixelType ) );
+    }
+
+    timer.AddBytes( (double) nVolumes * nVolumeVoxels * sizeof( PixelType ) );
+
+    return image;
+}
+
+//Reads the image size from the header only, without reading the voxels.
+//Returns false if the file cannot be read.
+template< class TImage >
+bool ReadImageSize( const std::string & sFileName, typename TImage::SizeType & imageSize )
+{
+    typedef ImageFileReader< TImage > ReaderType;
+    typename ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName( sFileName );
+
+    try {
+        reader->UpdateOutputInformation();
+    } catch ( ExceptionObject & ) {
+        return false;
+    }
+
+    imageSize = reader->GetOutput()->GetLargestPossibleRegion().GetSize();
+    return true;
+}
+
+} //namespace petpvc
+
+#endif // __PETPVCMAPPEDIMAGEREADER_H
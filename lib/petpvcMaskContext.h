@@ -0,0 +1,313 @@
+/*
+   petpvcMaskContext.h
+
+   Author:      Benjamin A. Thomas
+
+   Copyright 2026 Institute of Nuclear Medicine, University College London.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+ */
+
+#ifndef __PETPVCMASKCONTEXT_H
+#define __PETPVCMASKCONTEXT_H
+
+#include <itkObject.h>
+#include <itkObjectFactory.h>
+#include <itkImage.h>
+#include <itkDiscreteGaussianImageFilter.h>
+#include <vnl/vnl_matrix.h>
+#include <vnl/vnl_vector.h>
+
+#include "petpvcVolumeView.h"
+#include "petpvcProfiler.h"
+#include "petpvcRegionIndex.h"
+#include "petpvcChecksum.h"
+#include "petpvcImageExpression.h"
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace itk;
+
+namespace petpvc
+{
+
+/** \class MaskContext
+ *
+ * \brief The regions of a mask, and the regions blurred by the PSF, shared
+ * by the filters of a correction.
+ *
+ * Regions are views of the mask, so they cost no memory. A blurred region
+ * is computed the first time it is asked for. With caching on, it is then
+ * kept, so that other filters (e.g. the GTM and a following intra-regional
+ * deconvolution) and later iterations do not blur the same region again.
+ * Caching holds one PET-sized image per region.
+ *
+ * The context also keeps a RegionIndex of its regions, so that a region is
+ * only blurred within its bounding box, and filters can skip pairs of
+ * regions that are too far apart to interact. Matrices found from the
+ * regions (GTM, Labbe, fuzziness) are kept too, so the corrections of
+ * several images with the same mask and PSF find them only once.
+ *
+ */
+template< class TImage >
+class MaskContext : public Object
+{
+public:
+    typedef MaskContext Self;
+    typedef Object Superclass;
+    typedef SmartPointer< Self > Pointer;
+    typedef SmartPointer< const Self > ConstPointer;
+
+    itkNewMacro( Self );
+
+    itkTypeMacro( MaskContext, Object );
+
+    typedef TImage ImageType;
+    typedef typename TImage::Pointer ImagePointer;
+    typedef itk::Vector<float, 3> ITKVectorType;
+    typedef itk::DiscreteGaussianImageFilter<TImage, TImage> BlurringFilterType;
+    typedef RegionIndex< TImage > RegionIndexType;
+    typedef vnl_matrix<float> MatrixType;
+    typedef vnl_vector<float> VectorType;
+
+    //Uses every volume of a 4-D mask as a region. If reference is given,
+    //the regions take its direction.
+    template< class TMaskImage >
+    void SetMask( const TMaskImage * mask, const ImageBase<3> * reference = NULL ) {
+        this->Clear();
+
+        const unsigned int nRegions = mask->GetLargestPossibleRegion().GetSize()[3];
+        for ( unsigned int n = 0; n < nRegions; n++ ) {
+            ImagePointer region = GetVolumeView< TImage >( mask, n );
+            if ( reference != NULL ) {
+                region->SetDirection( reference->GetDirection() );
+            }
+            this->AddRegion( region );
+        }
+    }
+
+    //Adds a single region, e.g. a grey matter probability map.
+    void AddRegion( TImage * region ) {
+        this->m_vecRegions.push_back( region );
+        this->m_vecBlurred.push_back( ImagePointer() );
+        this->m_regionIndex = NULL;
+        this->m_mapMatrices.clear();
+        this->m_bMaskChecksum = false;
+        this->Modified();
+    }
+
+    void Clear() {
+        this->m_vecRegions.clear();
+        this->m_vecBlurred.clear();
+        this->m_regionIndex = NULL;
+        this->m_mapMatrices.clear();
+        this->m_bMaskChecksum = false;
+        this->Modified();
+    }
+
+    unsigned int GetNumberOfRegions() const {
+        return this->m_vecRegions.size();
+    }
+
+    //Region n, counting from zero.
+    TImage * GetRegion( unsigned int n ) const {
+        return this->m_vecRegions[n];
+    }
+
+    //Index of the regions, built the first time it is asked for.
+    RegionIndexType * GetRegionIndex() {
+        if ( this->m_regionIndex.IsNull() ) {
+            this->m_regionIndex = RegionIndexType::New();
+            this->m_regionIndex->SetRegions( this->m_vecRegions );
+            this->UpdateIndexPSF();
+        }
+        return this->m_regionIndex;
+    }
+
+    //Uses an index read from a file instead of building one. Returns false,
+    //and keeps the current index, if it was made from other regions.
+    bool SetRegionIndex( RegionIndexType * index ) {
+        if ( index == NULL || index->GetNumberOfRegions() != this->m_vecRegions.size() ) {
+            return false;
+        }
+        if ( !this->m_vecRegions.empty() &&
+             index->GetVolumeRegion() != this->m_vecRegions[0]->GetBufferedRegion() ) {
+            return false;
+        }
+        if ( index->GetMaskChecksum() != this->GetMaskChecksum() ) {
+            return false;
+        }
+
+        this->m_regionIndex = index;
+        this->UpdateIndexPSF();
+        return true;
+    }
+
+    //Checksum of the voxels of all the regions, in order, found the first
+    //time it is asked for.
+    itk::uint64_t GetMaskChecksum() {
+        if ( !this->m_bMaskChecksum ) {
+            this->m_nMaskChecksum = FNV_OFFSET_BASIS;
+            for ( unsigned int n = 0; n < this->m_vecRegions.size(); n++ ) {
+                this->m_nMaskChecksum = ChecksumImage( this->m_vecRegions[n].GetPointer(), this->m_nMaskChecksum );
+            }
+            this->m_bMaskChecksum = true;
+        }
+        return this->m_nMaskChecksum;
+    }
+
+    //Region n blurred by the PSF. Only the dilated bounding box of the
+    //region is blurred; the rest is zero.
+    ImagePointer GetBlurredRegion( unsigned int n ) {
+        if ( this->m_vecBlurred[n].IsNotNull() ) {
+            return this->m_vecBlurred[n];
+        }
+
+        const TImage * region = this->m_vecRegions[n];
+        const typename TImage::RegionType box = this->GetRegionIndex()->GetDilatedBoundingBox( n );
+
+        ImagePointer blurred;
+        if ( box == region->GetBufferedRegion() ) {
+            blurred = BlurInBox( region, box, this->m_vecVariance, this );
+        } else {
+            blurred = NewImageLike( region );
+            blurred->FillBuffer( 0 );
+            if ( box.GetNumberOfPixels() > 0 ) {
+                ImagePointer blurredBox = BlurInBox( region, box, this->m_vecVariance, this );
+                CopyBox( blurredBox.GetPointer(), blurred.GetPointer() );
+            }
+        }
+
+        if ( this->m_bCacheBlurred ) {
+            this->m_vecBlurred[n] = blurred;
+        }
+
+        return blurred;
+    }
+
+    //Changing the PSF drops any blurred regions.
+    void SetPSF( ITKVectorType vec ) {
+        if ( vec != this->m_vecVariance ) {
+            this->m_vecVariance = vec;
+            this->ReleaseBlurredRegions();
+            this->m_mapMatrices.clear();
+            this->UpdateIndexPSF();
+        }
+    }
+
+    ITKVectorType GetPSF() const {
+        return this->m_vecVariance;
+    }
+
+    void SetCacheBlurredRegions( bool bCache ) {
+        this->m_bCacheBlurred = bCache;
+        if ( !bCache ) {
+            this->ReleaseBlurredRegions();
+        }
+    }
+
+    bool GetCacheBlurredRegions() const {
+        return this->m_bCacheBlurred;
+    }
+
+    void ReleaseBlurredRegions() {
+        std::fill( this->m_vecBlurred.begin(), this->m_vecBlurred.end(), ImagePointer() );
+    }
+
+    //A context with the same regions, blurred regions, index and matrices,
+    //in which each image is a new object sharing the voxels. Threads must
+    //not share ITK data objects, so each thread correcting an image with a
+    //prepared context should use its own copy.
+    Pointer GraftCopy() const {
+        Pointer copy = Self::New();
+        for ( unsigned int n = 0; n < this->m_vecRegions.size(); n++ ) {
+            copy->m_vecRegions.push_back( GraftImage( this->m_vecRegions[n] ) );
+            copy->m_vecBlurred.push_back( GraftImage( this->m_vecBlurred[n] ) );
+        }
+        copy->m_vecVariance = this->m_vecVariance;
+        copy->m_bCacheBlurred = this->m_bCacheBlurred;
+        copy->m_regionIndex = this->m_regionIndex;
+        copy->m_mapMatrices = this->m_mapMatrices;
+        copy->m_nMaskChecksum = this->m_nMaskChecksum;
+        copy->m_bMaskChecksum = this->m_bMaskChecksum;
+        return copy;
+    }
+
+    //Keeps a matrix found from the regions and the PSF, and its region
+    //sums, under a name such as "GTM". Changing the regions or the PSF
+    //drops it.
+    void SetMatrix( const std::string & sName, const MatrixType & mat, const VectorType & vecSums ) {
+        this->m_mapMatrices[sName] = std::make_pair( mat, vecSums );
+    }
+
+    //Returns false if no matrix has been kept under sName.
+    bool GetMatrix( const std::string & sName, MatrixType & mat, VectorType & vecSums ) const {
+        typename MatrixMapType::const_iterator it = this->m_mapMatrices.find( sName );
+        if ( it == this->m_mapMatrices.end() ) {
+            return false;
+        }
+        mat = it->second.first;
+        vecSums = it->second.second;
+        return true;
+    }
+
+protected:
+    MaskContext() {
+        this->m_vecVariance.Fill( 0.0 );
+        this->m_bCacheBlurred = false;
+        this->m_nMaskChecksum = 0;
+        this->m_bMaskChecksum = false;
+    }
+    ~MaskContext() {}
+
+private:
+    MaskContext(const Self &); //purposely not implemented
+    void operator=(const Self &);  //purposely not implemented
+
+    static ImagePointer GraftImage( const TImage * image ) {
+        if ( image == NULL ) {
+            return ImagePointer();
+        }
+        ImagePointer copy = TImage::New();
+        copy->Graft( image );
+        return copy;
+    }
+
+    void UpdateIndexPSF() {
+        if ( this->m_regionIndex.IsNotNull() && !this->m_vecRegions.empty() ) {
+            typename BlurringFilterType::Pointer blurFilter = BlurringFilterType::New();
+            this->m_regionIndex->SetPSF( this->m_vecVariance, this->m_vecRegions[0]->GetSpacing(),
+                                         blurFilter->GetMaximumError()[0], blurFilter->GetMaximumKernelWidth() );
+        }
+    }
+
+    typedef std::map< std::string, std::pair< MatrixType, VectorType > > MatrixMapType;
+
+    std::vector< ImagePointer > m_vecRegions;
+    std::vector< ImagePointer > m_vecBlurred;
+    MatrixMapType m_mapMatrices;
+    ITKVectorType m_vecVariance;
+    bool m_bCacheBlurred;
+    typename RegionIndexType::Pointer m_regionIndex;
+    itk::uint64_t m_nMaskChecksum;
+    bool m_bMaskChecksum;
+};
+
+} //namespace petpvc
+
+#endif // __PETPVCMASKCONTEXT_H
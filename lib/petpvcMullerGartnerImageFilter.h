@@ -32,14 +32,6 @@
 #include "itkInPlaceImageFilter.h"
 #include "itkImageRegionConstIterator.h"
 #include "itkDiscreteGaussianImageFilter.h"
-#include "itkSubtractImageFilter.h"
-#include "itkMultiplyImageFilter.h"
-#include "itkDivideImageFilter.h"
-#include "itkImageDuplicator.h"
-#include "itkBinaryThresholdImageFilter.h"
-#include "itkThresholdImageFilter.h"
-#include "itkBinaryErodeImageFilter.h"
-#include "itkBinaryBallStructuringElement.h"
 
 using namespace itk;
 
@@ -166,9 +158,6 @@ protected:
     typedef Input1ImageType InternalImageType;
 
 
-    /*! Defines step for use with MultiplyByConstantImageFilter. */
-    typedef InternalPixelType StepType;
-
     /*! Defines image iterator. */
     typedef itk::ImageRegionConstIterator<InternalImageType> ItType;
 
@@ -176,44 +165,6 @@ protected:
      * Blurs an image with a Gaussian. The variance (sigma squared) specifies the width. */
     typedef itk::DiscreteGaussianImageFilter< InternalImageType, InternalImageType > GaussianFilterType;
 
-    /*! Defines subtract image filter type.
-     * Subtracts image 2 from image 1.
-     * */
-    typedef itk::SubtractImageFilter<InternalImageType, InternalImageType, InternalImageType> SubtractionImageFilterType;
-
-    /*! Defines multiply image filter type.
-     * Multiplies image 1 by image 2.
-     * */
-    typedef itk::MultiplyImageFilter<InternalImageType, InternalImageType, InternalImageType> MultiplyImageFilterType;
-
-    /*! Defines divide image filter type.
-     * Divides image 1 by image 2.
-     * */
-    typedef itk::DivideImageFilter<InternalImageType, InternalImageType, InternalImageType> DivideImageFilterType;
-
-    /*! Defines duplicate image filter type.
-     * Makes a complete copy of the input. Useful when images need to be stored at intermediate
-     * stages in the pipeline.
-     * */
-    typedef itk::ImageDuplicator<InternalImageType> ImageDuplicatorType;
-
-    /*! Defines threshold image filter type for binary images.
-     * Currently just assumes input will be binary (0 and 1) image. Could be used for fuzzy
-     * images instead.
-     * */
-    typedef itk::BinaryThresholdImageFilter< InternalImageType, InternalImageType >
-    BinaryThresholdFilterType;
-
-    /*! Defines threshold image filter type for  images.
-     * */
-
-    typedef itk::ThresholdImageFilter< InternalImageType > ThresholdFilterType;
-
-    /*! Defines ball structuring element for erosion.*/
-    typedef itk::BinaryBallStructuringElement< InternalPixelType, nDimension > StructuringElementType;
-    /*! Defines erosion filter, using ball structuring element */
-    typedef itk::BinaryErodeImageFilter< InternalImageType, InternalImageType, StructuringElementType > ErodeFilterType;
-
 
 private:
     MullerGartnerImageFilter(const Self&); //purposely not implemented
@@ -222,19 +173,6 @@ private:
     typename GaussianFilterType::Pointer m_filterGaussian;
     typename GaussianFilterType::Pointer m_filterGaussian2;
 
-    typename SubtractionImageFilterType::Pointer m_subFilter;
-
-    typename MultiplyImageFilterType::Pointer m_multiplyFilter;
-    typename DivideImageFilterType::Pointer m_divideFilter;
-
-    typename MultiplyImageFilterType::Pointer m_multFilter;
-    typename ImageDuplicatorType::Pointer m_duplicator;
-    typename BinaryThresholdFilterType::Pointer m_thresholdFilter;
-    typename ThresholdFilterType::Pointer m_thresholdFilter2;
-    typename ErodeFilterType::Pointer m_binaryErodeFilter;
-
-    typename InternalImageType::Pointer m_imgErodedWM;
-
     VectorType m_dVariance;
 
     bool m_bVerbose;
@@ -32,10 +32,56 @@
 #include "itkImageRegionIterator.h"
 #include "itkImageRegionConstIterator.h"
 #include "itkProgressReporter.h"
+#include "petpvcProfiler.h"
+#include "petpvcReduction.h"
+#include "petpvcDistanceTransform.h"
+#include "petpvcImageExpression.h"
+
+#include <vector>
 
 namespace petpvc
 {
 
+//Sum of the PET, and number of voxels, in the eroded WM: the voxels whose
+//squared distance to the nearest voxel outside the WM is above fThreshold.
+template< class TPixel >
+struct ErodedWMSumsFunctor {
+    const TPixel * pPET;
+    const float * pDistance;
+    double fThreshold;
+
+    void operator()( itk::SizeValueType nFirst, itk::SizeValueType nLast, double * pSums ) const {
+        for ( itk::SizeValueType i = nFirst; i < nLast; i++ ) {
+            if ( this->pDistance[i] > this->fThreshold ) {
+                pSums[0] += this->pPET[i];
+                pSums[1] += 1.0;
+            }
+        }
+    }
+};
+
+//The voxel-wise MG correction: the blurred WM is removed from the PET, the
+//result clipped to the GM and divided by the blurred GM. Values outside
+//[0, fUpper], including those from dividing by zero, are set to zero.
+template< class TPixel >
+struct MGCorrectionFunctor {
+    const TPixel * pPET;
+    const TPixel * pGM;
+    const TPixel * pBlurredWM;
+    const TPixel * pBlurredGM;
+    TPixel * pOutput;
+    double fWM;
+    double fUpper;
+
+    void operator()( itk::SizeValueType nFirst, itk::SizeValueType nLast, itk::SizeValueType ) const {
+        for ( itk::SizeValueType i = nFirst; i < nLast; i++ ) {
+            const double fValue = DivideOp::Apply( ( this->pPET[i] - this->fWM * this->pBlurredWM[i] ) * this->pGM[i],
+                                                   this->pBlurredGM[i] );
+            this->pOutput[i] = ( fValue >= 0.0 && fValue <= this->fUpper ) ? static_cast< TPixel >( fValue ) : 0;
+        }
+    }
+};
+
 /**
  * Constructor
  */
@@ -55,17 +101,8 @@ MullerGartnerImageFilter<TInputImage1, TInputImage2, TInputImage3, TOutputImage>
     m_filterGaussian = GaussianFilterType::New();
     m_filterGaussian2 = GaussianFilterType::New();
 
-    m_subFilter = SubtractionImageFilterType::New();
-
-    m_multiplyFilter = MultiplyImageFilterType::New();
-    m_divideFilter = DivideImageFilterType::New();
-    m_multFilter = MultiplyImageFilterType::New();
-    m_duplicator = ImageDuplicatorType::New();
-    m_thresholdFilter = BinaryThresholdFilterType::New();
-    m_binaryErodeFilter = ErodeFilterType::New();
-    m_thresholdFilter2 = ThresholdFilterType::New();
-
-    m_imgErodedWM = InternalImageType::New();
+    ProfileFilter( m_filterGaussian.GetPointer(), this, "blur" );
+    ProfileFilter( m_filterGaussian2.GetPointer(), this, "blur" );
 }
 
 template <class TInputImage1, class TInputImage2, class TInputImage3,
@@ -141,87 +178,60 @@ MullerGartnerImageFilter<TInputImage1, TInputImage2, TInputImage3, TOutputImage>
         std::cout << "Structuring element : " << elementRadius << std::endl;
     }
 
-    //Setup WM erosion filter
-    StructuringElementType structuringElement;
-    structuringElement.SetRadius( elementRadius );
-    structuringElement.CreateStructuringElement();
-    m_binaryErodeFilter->SetKernel(structuringElement);
-    m_binaryErodeFilter->SetInput(inputWM);
-    m_binaryErodeFilter->SetErodeValue(1);
-
-    //Threshold erosion filter to only include values = 1
-    m_thresholdFilter->SetInput(m_binaryErodeFilter->GetOutput());
-    m_thresholdFilter->SetLowerThreshold(1);
-    m_thresholdFilter->SetUpperThreshold(1);
-    m_thresholdFilter->SetOutsideValue(0);
-    m_thresholdFilter->SetInsideValue(1);
-    m_thresholdFilter->Update();
-
-    m_imgErodedWM = m_thresholdFilter->GetOutput();
-
-    //Multiply PET by eroded WM
-    m_multiplyFilter->SetInput1(inputPET);
-    m_multiplyFilter->SetInput2(m_imgErodedWM);
-    m_multiplyFilter->Update();
-
-    //Calculate sum of previous multiplication and sum of the eroded WM mask.
-    ItType iteratorVirtualWM(m_multiplyFilter->GetOutput(), m_multiplyFilter->GetOutput()->GetRequestedRegion());
-    ItType iteratorErodedWM(m_thresholdFilter->GetOutput(), m_thresholdFilter->GetOutput()->GetRequestedRegion());
-
-    double sumVWM = 0.0;
-    double sumErodedWM = 0.0;
-
-    while (!iteratorVirtualWM.IsAtEnd() ) {
-        sumVWM += iteratorVirtualWM.Value();
-        ++iteratorVirtualWM;
-    }
-
-    while (!iteratorErodedWM.IsAtEnd() ) {
-        sumErodedWM += iteratorErodedWM.Value();
-        ++iteratorErodedWM;
-    }
-
-    //Calculate mean value in WM.
-    double fWhiteMatterMeanValue = sumVWM / sumErodedWM;
-
-    if (this->m_fGivenWM != 0.0) {
-        fWhiteMatterMeanValue = this->m_fGivenWM;
+    //Calculate mean value in WM, unless it is given.
+    double fWhiteMatterMeanValue = this->m_fGivenWM;
+
+    if (this->m_fGivenWM == 0.0) {
+        //Erode the WM (voxels equal to 1) by a ball of elementRadius voxels,
+        //as BinaryErodeImageFilter with a BinaryBallStructuringElement,
+        //which covers the offsets d with |d|^2 <= r(r+1). A voxel survives
+        //if no voxel outside the WM is that close.
+        std::vector< float > vecDistance;
+        {
+            ScopedStageTimer erodeTimer( this, "WM erosion" );
+            SquaredDistanceToBackground( inputWM.GetPointer(), 1, vecDistance );
+        }
+
+        //Sum of the PET in the eroded WM, and its size, in one pass.
+        double sums[2];
+        {
+            ScopedStageTimer statsTimer( this, "regional statistics" );
+
+            ErodedWMSumsFunctor< InternalPixelType > sumsFunctor;
+            sumsFunctor.pPET = inputPET->GetBufferPointer();
+            sumsFunctor.pDistance = vecDistance.empty() ? NULL : &vecDistance[0];
+            sumsFunctor.fThreshold = elementRadius * ( elementRadius + 1.0 );
+            ParallelSums( 0, vecDistance.size(), 2, sumsFunctor, sums );
+        }
+
+        fWhiteMatterMeanValue = sums[0] / sums[1];
     }
 
     if (this->m_bVerbose) {
         std::cout << "White Matter mean value : " << fWhiteMatterMeanValue << std::endl;
     }
 
-    //Apply WM value to WM mask.
-    m_multFilter->SetConstant(fWhiteMatterMeanValue);
-    m_multFilter->SetInput(inputWM);
-
-    //Smooth output of previous step by resolution of PET.
-    m_filterGaussian->SetInput(m_multFilter->GetOutput());
-
-    //Remove Smooth WM estimate from PET
-    m_subFilter->SetInput1(inputPET);
-    m_subFilter->SetInput2(m_filterGaussian->GetOutput());
+    //Smooth the WM and GM masks by resolution of PET. The blur is linear,
+    //so the WM is scaled by its mean afterwards.
+    m_filterGaussian->SetInput(inputWM);
+    m_filterGaussian->Update();
 
-    //Clip to GM
-    m_multiplyFilter->SetInput1(m_subFilter->GetOutput());
-    m_multiplyFilter->SetInput2(inputGM);
-
-    //Smooth GM mask
     m_filterGaussian2->SetInput(inputGM);
-
-    //Divide vGM by smoothed GM mask (apply GM correction factors)
-    m_divideFilter->SetInput1(m_multiplyFilter->GetOutput());
-    m_divideFilter->SetInput2(m_filterGaussian2->GetOutput());
-    m_divideFilter->Update();
-
-    //Clean up areas where you get infs due to divide by zeros.
-    m_thresholdFilter2->SetInput(m_divideFilter->GetOutput());
-    m_thresholdFilter2->ThresholdOutside(0, fWhiteMatterMeanValue * 10.0);
-    m_thresholdFilter2->SetOutsideValue(0);
-    m_thresholdFilter2->Update();
-
-    this->GraftOutput(m_thresholdFilter2->GetOutput());
+    m_filterGaussian2->Update();
+
+    //Remove smooth WM estimate from PET, clip to GM, divide by smoothed GM
+    //(apply GM correction factors) and clean up in one pass.
+    this->AllocateOutputs();
+
+    MGCorrectionFunctor< InternalPixelType > correctionFunctor;
+    correctionFunctor.pPET = inputPET->GetBufferPointer();
+    correctionFunctor.pGM = inputGM->GetBufferPointer();
+    correctionFunctor.pBlurredWM = m_filterGaussian->GetOutput()->GetBufferPointer();
+    correctionFunctor.pBlurredGM = m_filterGaussian2->GetOutput()->GetBufferPointer();
+    correctionFunctor.pOutput = outputPtr->GetBufferPointer();
+    correctionFunctor.fWM = fWhiteMatterMeanValue;
+    correctionFunctor.fUpper = fWhiteMatterMeanValue * 10.0;
+    ParallelFor( 0, outputPtr->GetBufferedRegion().GetNumberOfPixels(), correctionFunctor );
 
 }
 
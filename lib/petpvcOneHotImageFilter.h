@@ -0,0 +1,104 @@
+/*
+   petpvcOneHotImageFilter.h
+
+   Author:      Benjamin A. Thomas
+
+   Copyright 2026 Institute of Nuclear Medicine, University College London.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+ */
+
+#ifndef __PETPVCONEHOTIMAGEFILTER_H
+#define __PETPVCONEHOTIMAGEFILTER_H
+
+#include "itkImage.h"
+#include "itkImageToImageFilter.h"
+
+using namespace itk;
+
+namespace petpvc
+{
+/** \class OneHotImageFilter
+ *
+ * \brief Turns a compact 3-D index image (see LabelCompaction) into a 4-D
+ * mask with one binary volume per index.
+ *
+ * Each requested volume is written in a single pass over the index image,
+ * straight into the output buffer. The filter supports streaming along the
+ * fourth dimension, so a writer with one stream division per volume only
+ * holds one volume at a time.
+ *
+ */
+template< class TIndexImage, class TOutputImage >
+class OneHotImageFilter:public ImageToImageFilter< TIndexImage, TOutputImage >
+{
+public:
+    /** Standard class typedefs. */
+    typedef OneHotImageFilter             Self;
+    typedef ImageToImageFilter< TIndexImage, TOutputImage > Superclass;
+    typedef SmartPointer< Self >        Pointer;
+
+    /** Method for creation through the object factory. */
+    itkNewMacro(Self);
+
+    /** Run-time type information (and related methods). */
+    itkTypeMacro(OneHotImageFilter, ImageToImageFilter);
+
+    /** Image related typedefs. */
+    typedef TIndexImage             IndexImageType;
+    typedef typename TIndexImage::PixelType  IndexPixelType;
+    typedef TOutputImage            OutputImageType;
+    typedef typename TOutputImage::RegionType OutputRegionType;
+    typedef typename TOutputImage::PixelType  OutputPixelType;
+
+    /** Number of volumes, one per index from 0. */
+    void SetNumberOfLabels( unsigned int nLabels ) {
+        this->m_nLabels = nLabels;
+        this->Modified();
+    }
+
+    unsigned int GetNumberOfLabels() const {
+        return this->m_nLabels;
+    }
+
+protected:
+    OneHotImageFilter();
+    ~OneHotImageFilter() {};
+
+    virtual void GenerateOutputInformation() ITK_OVERRIDE;
+
+    virtual void GenerateInputRequestedRegion() ITK_OVERRIDE;
+
+    /** Volumes are always produced whole. */
+    virtual void EnlargeOutputRequestedRegion( DataObject * output ) ITK_OVERRIDE;
+
+    /** Does the real work. */
+    virtual void GenerateData() ITK_OVERRIDE;
+
+    unsigned int m_nLabels;
+
+private:
+    OneHotImageFilter(const Self &); //purposely not implemented
+    void operator=(const Self &);  //purposely not implemented
+
+};
+} //namespace petpvc
+
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "petpvcOneHotImageFilter.txx"
+#endif
+
+
+#endif // __PETPVCONEHOTIMAGEFILTER_H
@@ -0,0 +1,162 @@
+/*
+   petpvcOneHotImageFilter.txx
+
+   Author:      Benjamin A. Thomas
+
+   Copyright 2026 Institute of Nuclear Medicine, University College London.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+ */
+
+#ifndef __PETPVCONEHOTIMAGEFILTER_TXX
+#define __PETPVCONEHOTIMAGEFILTER_TXX
+
+#include "petpvcOneHotImageFilter.h"
+#include "itkObjectFactory.h"
+#include "petpvcParallel.h"
+
+using namespace itk;
+
+namespace petpvc
+{
+
+//Sets the voxels of each index to 1 in its volume, for volumes nFirstVolume
+//to nFirstVolume + nVolumes - 1.
+template< class TIndex, class TPixel >
+struct OneHotFunctor {
+    const TIndex * pIndex;
+    TPixel * pOutput;
+    SizeValueType nVoxels;
+    SizeValueType nFirstVolume;
+    SizeValueType nVolumes;
+
+    void operator()( SizeValueType nFirst, SizeValueType nLast, SizeValueType ) const {
+        for ( SizeValueType i = nFirst; i < nLast; i++ ) {
+            const SizeValueType nVolume = this->pIndex[i];
+            if ( nVolume >= this->nFirstVolume && nVolume < this->nFirstVolume + this->nVolumes ) {
+                this->pOutput[ ( nVolume - this->nFirstVolume ) * this->nVoxels + i ] = 1;
+            }
+        }
+    }
+};
+
+template< class TIndexImage, class TOutputImage >
+OneHotImageFilter< TIndexImage, TOutputImage >
+::OneHotImageFilter()
+{
+    this->m_nLabels = 0;
+}
+
+template< class TIndexImage, class TOutputImage >
+void OneHotImageFilter< TIndexImage, TOutputImage >
+::GenerateOutputInformation()
+{
+    const TIndexImage * input = this->GetInput();
+    TOutputImage * output = this->GetOutput();
+
+    if ( input == NULL ) {
+        return;
+    }
+
+    //Copy the geometry of the input into the first three dimensions, as
+    //JoinSeriesImageFilter does.
+    const typename TIndexImage::RegionType inputRegion = input->GetLargestPossibleRegion();
+
+    OutputRegionType region;
+    typename TOutputImage::SpacingType spacing;
+    typename TOutputImage::PointType origin;
+    typename TOutputImage::DirectionType direction;
+    direction.SetIdentity();
+
+    for ( unsigned int d = 0; d < 3; d++ ) {
+        region.SetIndex( d, inputRegion.GetIndex()[d] );
+        region.SetSize( d, inputRegion.GetSize()[d] );
+        spacing[d] = input->GetSpacing()[d];
+        origin[d] = input->GetOrigin()[d];
+        for ( unsigned int e = 0; e < 3; e++ ) {
+            direction[d][e] = input->GetDirection()[d][e];
+        }
+    }
+
+    region.SetIndex( 3, 0 );
+    region.SetSize( 3, this->m_nLabels );
+    spacing[3] = 1.0;
+    origin[3] = 0.0;
+
+    output->SetLargestPossibleRegion( region );
+    output->SetSpacing( spacing );
+    output->SetOrigin( origin );
+    output->SetDirection( direction );
+    output->SetNumberOfComponentsPerPixel( 1 );
+}
+
+template< class TIndexImage, class TOutputImage >
+void OneHotImageFilter< TIndexImage, TOutputImage >
+::GenerateInputRequestedRegion()
+{
+    Superclass::GenerateInputRequestedRegion();
+
+    //Every volume needs the whole index image.
+    TIndexImage * input = const_cast< TIndexImage * >( this->GetInput() );
+    if ( input != NULL ) {
+        input->SetRequestedRegionToLargestPossibleRegion();
+    }
+}
+
+template< class TIndexImage, class TOutputImage >
+void OneHotImageFilter< TIndexImage, TOutputImage >
+::EnlargeOutputRequestedRegion( DataObject * data )
+{
+    TOutputImage * output = dynamic_cast< TOutputImage * >( data );
+    if ( output == NULL ) {
+        return;
+    }
+
+    OutputRegionType region = output->GetRequestedRegion();
+    const OutputRegionType largest = output->GetLargestPossibleRegion();
+
+    for ( unsigned int d = 0; d < 3; d++ ) {
+        region.SetIndex( d, largest.GetIndex()[d] );
+        region.SetSize( d, largest.GetSize()[d] );
+    }
+
+    output->SetRequestedRegion( region );
+}
+
+template< class TIndexImage, class TOutputImage >
+void OneHotImageFilter< TIndexImage, TOutputImage >
+::GenerateData()
+{
+    const TIndexImage * input = this->GetInput();
+    TOutputImage * output = this->GetOutput();
+
+    this->AllocateOutputs();
+    output->FillBuffer( 0 );
+
+    const OutputRegionType region = output->GetBufferedRegion();
+
+    OneHotFunctor< IndexPixelType, OutputPixelType > functor;
+    functor.pIndex = input->GetBufferPointer();
+    functor.pOutput = output->GetBufferPointer();
+    functor.nVoxels = input->GetBufferedRegion().GetNumberOfPixels();
+    functor.nFirstVolume = region.GetIndex()[3];
+    functor.nVolumes = region.GetSize()[3];
+
+    ParallelFor( 0, functor.nVoxels, functor );
+}
+
+}// end namespace
+
+
+#endif
@@ -0,0 +1,256 @@
+/*
+   petpvcParallel.h
+
+   Author:      Benjamin A. Thomas
+
+   Copyright 2026 Institute of Nuclear Medicine, University College London.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+ */
+
+/*
+   Thread control shared by the ITK filters and the hand-written voxel
+   loops. SetNumberOfThreads() sets the ITK global default and maximum, so
+   it must be called before any filters are created. ParallelFor() splits
+   a range of voxels (or regions) between that many threads using the ITK
+   multi-threader. Sums should use petpvcReduction.h, which does not
+   depend on the number of threads. ParallelTasks() runs a few coarse tasks,
+   such as the corrections of several images, that use threads themselves.
+   BackgroundTask runs one function, such as a file write, alongside the
+   caller.
+ */
+
+#ifndef __PETPVCPARALLEL_H
+#define __PETPVCPARALLEL_H
+
+#include <itkConfigure.h>
+#include <itkIntTypes.h>
+
+#if ITK_VERSION_MAJOR >= 5
+#include <itkMultiThreaderBase.h>
+#include <itkPlatformMultiThreader.h>
+#include <thread>
+#define PETPVC_THREAD_FUNCTION itk::ITK_THREAD_RETURN_TYPE ITK_THREAD_RETURN_FUNCTION_CALL_CONVENTION
+#define PETPVC_THREAD_RETURN itk::ITK_THREAD_RETURN_DEFAULT_VALUE
+#else
+#include <itkMultiThreader.h>
+#define PETPVC_THREAD_FUNCTION ITK_THREAD_RETURN_TYPE
+#define PETPVC_THREAD_RETURN ITK_THREAD_RETURN_VALUE
+#endif
+
+#include <algorithm>
+
+namespace petpvc
+{
+
+#if ITK_VERSION_MAJOR >= 5
+typedef itk::MultiThreaderBase ThreaderType;
+//Starts its own threads rather than using the pool.
+typedef itk::PlatformMultiThreader TaskThreaderType;
+#else
+typedef itk::MultiThreader ThreaderType;
+typedef itk::MultiThreader TaskThreaderType;
+#endif
+
+//Limits every stage to nThreads threads. Zero leaves the ITK default.
+inline void SetNumberOfThreads( unsigned int nThreads )
+{
+    if ( nThreads == 0 ) {
+        return;
+    }
+
+    ThreaderType::SetGlobalMaximumNumberOfThreads( nThreads );
+    ThreaderType::SetGlobalDefaultNumberOfThreads( nThreads );
+}
+
+inline unsigned int GetNumberOfThreads()
+{
+    return std::max( (unsigned int) ThreaderType::GetGlobalDefaultNumberOfThreads(), 1u );
+}
+
+template< class TFunctor >
+struct ParallelForData {
+    TFunctor * functor;
+    itk::SizeValueType nBegin;
+    itk::SizeValueType nEnd;
+};
+
+template< class TFunctor >
+PETPVC_THREAD_FUNCTION ParallelForCallback( void * arg )
+{
+#if ITK_VERSION_MAJOR >= 5
+    const ThreaderType::WorkUnitInfo * info = static_cast< ThreaderType::WorkUnitInfo * >( arg );
+    const itk::SizeValueType nUnit = info->WorkUnitID;
+    const itk::SizeValueType nUnits = info->NumberOfWorkUnits;
+#else
+    const ThreaderType::ThreadInfoStruct * info = static_cast< ThreaderType::ThreadInfoStruct * >( arg );
+    const itk::SizeValueType nUnit = info->ThreadID;
+    const itk::SizeValueType nUnits = info->NumberOfThreads;
+#endif
+    ParallelForData< TFunctor > * data = static_cast< ParallelForData< TFunctor > * >( info->UserData );
+
+    const itk::SizeValueType nLength = data->nEnd - data->nBegin;
+    const itk::SizeValueType nFirst = data->nBegin + ( nLength * nUnit ) / nUnits;
+    const itk::SizeValueType nLast = data->nBegin + ( nLength * ( nUnit + 1 ) ) / nUnits;
+
+    if ( nFirst < nLast ) {
+        ( *data->functor )( nFirst, nLast, nUnit );
+    }
+
+    return PETPVC_THREAD_RETURN;
+}
+
+//Calls functor( nFirst, nLast, nUnit ) on contiguous, non-overlapping parts
+//of [nBegin, nEnd), one per thread. nUnit numbers the parts from zero, so
+//each thread can write its own partial result.
+template< class TFunctor >
+void ParallelFor( itk::SizeValueType nBegin, itk::SizeValueType nEnd, TFunctor & functor )
+{
+    if ( nEnd <= nBegin ) {
+        return;
+    }
+
+    const itk::SizeValueType nUnits = std::min< itk::SizeValueType >( GetNumberOfThreads(), nEnd - nBegin );
+
+    if ( nUnits <= 1 ) {
+        functor( nBegin, nEnd, 0 );
+        return;
+    }
+
+    ParallelForData< TFunctor > data;
+    data.functor = &functor;
+    data.nBegin = nBegin;
+    data.nEnd = nEnd;
+
+    ThreaderType::Pointer threader = ThreaderType::New();
+#if ITK_VERSION_MAJOR >= 5
+    threader->SetNumberOfWorkUnits( nUnits );
+#else
+    threader->SetNumberOfThreads( nUnits );
+#endif
+    threader->SetSingleMethod( ParallelForCallback< TFunctor >, &data );
+    threader->SingleMethodExecute();
+}
+
+//Calls functor( nFirst, nLast, nUnit ) as ParallelFor() does, but each
+//part runs on a thread of its own rather than one from the ITK pool, so the
+//functor may run filters and ParallelFor() loops without waiting on the
+//pool that runs it.
+template< class TFunctor >
+void ParallelTasks( itk::SizeValueType nBegin, itk::SizeValueType nEnd, TFunctor & functor )
+{
+    if ( nEnd <= nBegin ) {
+        return;
+    }
+
+    const itk::SizeValueType nUnits = std::min< itk::SizeValueType >( GetNumberOfThreads(), nEnd - nBegin );
+
+    if ( nUnits <= 1 ) {
+        functor( nBegin, nEnd, 0 );
+        return;
+    }
+
+    ParallelForData< TFunctor > data;
+    data.functor = &functor;
+    data.nBegin = nBegin;
+    data.nEnd = nEnd;
+
+    TaskThreaderType::Pointer threader = TaskThreaderType::New();
+#if ITK_VERSION_MAJOR >= 5
+    threader->SetNumberOfWorkUnits( nUnits );
+#else
+    threader->SetNumberOfThreads( nUnits );
+#endif
+    threader->SetSingleMethod( ParallelForCallback< TFunctor >, &data );
+    threader->SingleMethodExecute();
+}
+
+/** \class BackgroundTask
+ *
+ * \brief Runs one function on a thread of its own while the caller carries
+ * on, e.g. to write a file without holding up the iterations.
+ *
+ * Start() first waits for the function before, and so does the destructor.
+ *
+ */
+class BackgroundTask
+{
+public:
+    typedef void ( *FunctionType )( void * );
+
+    BackgroundTask() {
+        this->m_function = NULL;
+        this->m_data = NULL;
+        this->m_bRunning = false;
+    }
+
+    ~BackgroundTask() {
+        this->Wait();
+    }
+
+    void Start( FunctionType function, void * data ) {
+        this->Wait();
+
+        this->m_function = function;
+        this->m_data = data;
+#if ITK_VERSION_MAJOR >= 5
+        //SpawnThread() is deprecated in ITK 5 in favour of std::thread.
+        this->m_thread = std::thread( function, data );
+#else
+        this->m_threader = TaskThreaderType::New();
+        this->m_nThreadID = this->m_threader->SpawnThread( Callback, this );
+#endif
+        this->m_bRunning = true;
+    }
+
+    //Returns once the function has finished.
+    void Wait() {
+        if ( !this->m_bRunning ) {
+            return;
+        }
+
+#if ITK_VERSION_MAJOR >= 5
+        this->m_thread.join();
+#else
+        this->m_threader->TerminateThread( this->m_nThreadID );
+#endif
+        this->m_bRunning = false;
+    }
+
+private:
+    BackgroundTask( const BackgroundTask & ); //purposely not implemented
+    void operator=( const BackgroundTask & ); //purposely not implemented
+
+#if ITK_VERSION_MAJOR >= 5
+    std::thread m_thread;
+#else
+    static PETPVC_THREAD_FUNCTION Callback( void * arg ) {
+        const ThreaderType::ThreadInfoStruct * info = static_cast< ThreaderType::ThreadInfoStruct * >( arg );
+        BackgroundTask * task = static_cast< BackgroundTask * >( info->UserData );
+        task->m_function( task->m_data );
+        return PETPVC_THREAD_RETURN;
+    }
+
+    TaskThreaderType::Pointer m_threader;
+    itk::ThreadIdType m_nThreadID;
+#endif
+
+    FunctionType m_function;
+    void * m_data;
+    bool m_bRunning;
+};
+
+} //namespace petpvc
+
+#endif // __PETPVCPARALLEL_H
@@ -0,0 +1,616 @@
+/*
+   petpvcPipeline.h
+
+   Author:      Benjamin A. Thomas
+
+   Copyright 2026 Institute of Nuclear Medicine, University College London.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+ */
+
+/*
+   Region-based corrections and their combinations, given as a chain of
+   keywords joined by '+', e.g. "RBV", "LABBE+MTC" or "IY+RL".
+
+   A chain has one region-based correction (RBV, MTC, IY or MG), which
+   RBV and MTC may combine with LABBE, and may end with an intra-regional
+   deconvolution (VC or RL). All stages share one MaskContext, so the
+   regions are extracted once and, where two stages blur the same
+   regions, each region is blurred only once.
+ */
+
+#ifndef __PETPVCPIPELINE_H
+#define __PETPVCPIPELINE_H
+
+#include <itkImage.h>
+#include <itkImageToImageFilter.h>
+
+#include "petpvcRBVPVCImageFilter.h"
+#include "petpvcLabbeRBVPVCImageFilter.h"
+#include "petpvcMTCPVCImageFilter.h"
+#include "petpvcLabbeMTCPVCImageFilter.h"
+#include "petpvcIterativeYangPVCImageFilter.h"
+#include "petpvcMullerGartnerImageFilter.h"
+#include "petpvcIntraRegVCImageFilter.h"
+#include "petpvcIntraRegRLImageFilter.h"
+#include "petpvcIterationSnapshotCommand.h"
+#include "petpvcCheckpoint.h"
+#include "petpvcGTMImageFilter.h"
+#include "petpvcLabbeImageFilter.h"
+#include "petpvcFuzzyCorrectionFilter.h"
+#include "petpvcMaskContext.h"
+#include "petpvcVolumeView.h"
+#include "petpvcParallel.h"
+#include "petpvcProfiler.h"
+#include "petpvcTimeBudget.h"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace petpvc
+{
+
+template< class TImage, class TMaskImage >
+class PVCPipeline
+{
+public:
+    typedef typename TImage::Pointer ImagePointer;
+    typedef MaskContext< TImage > MaskContextType;
+    typedef itk::Vector<float, 3> ITKVectorType;
+    typedef itk::ImageToImageFilter<TImage, TImage> FilterType;
+
+    enum Correction { ENoCorrection, ERBV, EMTC, EIterativeYang, EMullerGartner };
+    enum Deconvolution { ENoDeconvolution, EVanCittert, ERichardsonLucy };
+
+    struct Settings {
+        ITKVectorType vecVariance;
+        //Iterations of IY.
+        unsigned int nIterations;
+        //Iterations of the deconvolution.
+        unsigned int nDeconvIterations;
+        float fAlpha;
+        float fStop;
+        //IY stops once its means change by less than this fraction; 0 runs
+        //every iteration.
+        float fTolerance;
+        //Image IY starts from instead of the PET data, if set.
+        ImagePointer imageInitialEstimate;
+        //Iterations of IY already done, e.g. before a checkpoint.
+        unsigned int nStartIteration;
+        //Checkpoints of IY, when IY is the last stage.
+        CheckpointSettings checkpoint;
+        //Time from GetWallClockTime() by which the iterative stages must
+        //end; 0 sets no limit.
+        double fDeadline;
+        bool bDisableNonNeg;
+        bool bVerbose;
+        //Iterations of IY to save, when IY is the last stage.
+        std::vector<unsigned int> vecSaveIters;
+        std::string sOutputFileName;
+        std::string sMeansFileName;
+        //Region index to read, or to write if it cannot be read.
+        std::string sRegionIndexFileName;
+
+        Settings() {
+            vecVariance.Fill( 0.0 );
+            nIterations = 10;
+            nDeconvIterations = 10;
+            fAlpha = 1.5;
+            fStop = 0.01;
+            fTolerance = 0.0;
+            nStartIteration = 0;
+            fDeadline = 0.0;
+            bDisableNonNeg = false;
+            bVerbose = false;
+        }
+    };
+
+    PVCPipeline() {
+        this->m_correction = ENoCorrection;
+        this->m_deconvolution = ENoDeconvolution;
+        this->m_bLabbe = false;
+    }
+
+    //Reads a chain such as "LABBE+RBV+VC", in any case. Returns false if it
+    //is not a valid chain.
+    bool Parse( std::string sChain ) {
+        std::transform( sChain.begin(), sChain.end(), sChain.begin(), ::toupper );
+
+        this->m_correction = ENoCorrection;
+        this->m_deconvolution = ENoDeconvolution;
+        this->m_bLabbe = false;
+
+        std::stringstream ss( sChain );
+        std::string sToken;
+
+        while ( std::getline( ss, sToken, '+' ) ) {
+            //The deconvolution must be the last stage.
+            if ( this->m_deconvolution != ENoDeconvolution ) {
+                return false;
+            }
+
+            if ( sToken == "LABBE" && !this->m_bLabbe ) {
+                this->m_bLabbe = true;
+            } else if ( sToken == "VC" ) {
+                this->m_deconvolution = EVanCittert;
+            } else if ( sToken == "RL" ) {
+                this->m_deconvolution = ERichardsonLucy;
+            } else if ( this->m_correction == ENoCorrection ) {
+                if ( sToken == "RBV" ) {
+                    this->m_correction = ERBV;
+                } else if ( sToken == "MTC" ) {
+                    this->m_correction = EMTC;
+                } else if ( sToken == "IY" ) {
+                    this->m_correction = EIterativeYang;
+                } else if ( sToken == "MG" ) {
+                    this->m_correction = EMullerGartner;
+                } else {
+                    return false;
+                }
+            } else {
+                return false;
+            }
+        }
+
+        if ( this->m_correction == ENoCorrection ) {
+            return false;
+        }
+
+        //Labbe only changes the matrix of RBV and MTC.
+        if ( this->m_bLabbe && this->m_correction != ERBV && this->m_correction != EMTC ) {
+            return false;
+        }
+
+        return true;
+    }
+
+    Correction GetCorrection() const {
+        return this->m_correction;
+    }
+
+    Deconvolution GetDeconvolution() const {
+        return this->m_deconvolution;
+    }
+
+    bool GetUseLabbe() const {
+        return this->m_bLabbe;
+    }
+
+    //Whether blurred regions are kept between stages. They are when the
+    //Labbe matrix is used, which needs every pair of them, or when both the
+    //matrix and the deconvolution blur every region.
+    bool GetCacheBlurredRegions() const {
+        const bool bMatrix = ( this->m_correction == ERBV ) || ( this->m_correction == EMTC );
+        return this->m_bLabbe || ( bMatrix && this->m_deconvolution != ENoDeconvolution );
+    }
+
+    //Approximate number of PET-sized temporary images held at once, not
+    //counting any blurred regions that are kept.
+    unsigned int GetNumberOfTemporaries() const {
+        unsigned int nTemps = 6;
+        if ( this->m_correction == EIterativeYang || this->m_correction == EMullerGartner || this->m_bLabbe ) {
+            nTemps = 7;
+        }
+        //The deconvolution keeps the first result until it has finished.
+        if ( this->m_deconvolution != ENoDeconvolution ) {
+            nTemps++;
+        }
+        return nTemps;
+    }
+
+    //Sets up the context that the stages share. It may also be shared with
+    //the corrections of other images with the same mask and PSF.
+    typename MaskContextType::Pointer CreateContext( const TImage * pet, const TMaskImage * mask,
+                                                     const Settings & settings ) const {
+        typename MaskContextType::Pointer context = MaskContextType::New();
+        context->SetPSF( settings.vecVariance );
+        context->SetCacheBlurredRegions( this->GetCacheBlurredRegions() );
+
+        if ( this->m_correction == EMullerGartner ) {
+            //Only the GM, the first volume, is deconvolved.
+            ImagePointer imageGM = GetVolumeView< TImage >( mask, 0 );
+            imageGM->SetDirection( pet->GetDirection() );
+            context->AddRegion( imageGM );
+        } else {
+            this->SetUpContext( context.GetPointer(), pet, mask, settings );
+        }
+
+        return context;
+    }
+
+    //Does all of the work on the mask that the stages share: the region
+    //index, the blurred regions if they are kept, and the GTM, Labbe or
+    //fuzziness matrix. Afterwards, corrections only read the context, so
+    //several may use it at once.
+    void PrepareContext( MaskContextType * context, const TMaskImage * mask ) const {
+        if ( context->GetNumberOfRegions() == 0 ) {
+            return;
+        }
+
+        context->GetRegionIndex();
+
+        if ( context->GetCacheBlurredRegions() ) {
+            for ( unsigned int n = 0; n < context->GetNumberOfRegions(); n++ ) {
+                context->GetBlurredRegion( n );
+            }
+        }
+
+        if ( this->m_correction == EIterativeYang ) {
+            MatrixType matFuzzy;
+            VectorType vecSums;
+            this->GetFuzzyMatrix( context, mask, matFuzzy, vecSums );
+        } else if ( this->m_bLabbe ) {
+            typedef LabbeImageFilter< TMaskImage > LabbeFilterType;
+            typename LabbeFilterType::Pointer labbeFilter = LabbeFilterType::New();
+            labbeFilter->SetInput( mask );
+            labbeFilter->SetPSF( context->GetPSF() );
+            labbeFilter->SetMaskContext( context );
+            labbeFilter->Update();
+        } else if ( this->m_correction == ERBV || this->m_correction == EMTC ) {
+            typedef GTMImageFilter< TMaskImage > GTMFilterType;
+            typename GTMFilterType::Pointer gtmFilter = GTMFilterType::New();
+            gtmFilter->SetInput( mask );
+            gtmFilter->SetPSF( context->GetPSF() );
+            gtmFilter->SetMaskContext( context );
+            gtmFilter->Update();
+        }
+    }
+
+    //Runs every stage and returns the corrected image.
+    ImagePointer Run( const TImage * pet, const TMaskImage * mask, const Settings & settings ) const {
+        typename MaskContextType::Pointer context = this->CreateContext( pet, mask, settings );
+        return this->Run( pet, mask, settings, context );
+    }
+
+    //Runs every stage with a context from CreateContext(). After
+    //PrepareContext(), this may be called from several threads at once.
+    ImagePointer Run( const TImage * pet, const TMaskImage * mask, const Settings & settings,
+                      MaskContextType * context ) const {
+
+        typename FilterType::Pointer correctionFilter;
+
+        switch ( this->m_correction ) {
+            case ERBV:
+                if ( this->m_bLabbe ) {
+                    std::cout << "Performing Labbe-RBV..." << std::endl;
+                    typedef LabbeRBVPVCImageFilter< TImage, TMaskImage > LabbeRBVFilterType;
+                    typename LabbeRBVFilterType::Pointer lrbvFilter = LabbeRBVFilterType::New();
+                    this->SetUpRegional( lrbvFilter.GetPointer(), pet, mask, settings );
+                    lrbvFilter->SetMaskContext( context );
+                    correctionFilter = lrbvFilter.GetPointer();
+                } else {
+                    std::cout << "Performing RBV..." << std::endl;
+                    typedef RBVPVCImageFilter< TImage, TMaskImage > RBVFilterType;
+                    typename RBVFilterType::Pointer rbvFilter = RBVFilterType::New();
+                    this->SetUpRegional( rbvFilter.GetPointer(), pet, mask, settings );
+                    rbvFilter->SetMaskContext( context );
+                    correctionFilter = rbvFilter.GetPointer();
+                }
+                break;
+
+            case EMTC:
+                if ( this->m_bLabbe ) {
+                    std::cout << "Performing Labbe-MTC..." << std::endl;
+                    typedef LabbeMTCPVCImageFilter< TImage, TMaskImage > LabbeMTCFilterType;
+                    typename LabbeMTCFilterType::Pointer lmtcFilter = LabbeMTCFilterType::New();
+                    this->SetUpRegional( lmtcFilter.GetPointer(), pet, mask, settings );
+                    lmtcFilter->SetMaskContext( context );
+                    correctionFilter = lmtcFilter.GetPointer();
+                } else {
+                    std::cout << "Performing MTC..." << std::endl;
+                    typedef MTCPVCImageFilter< TImage, TMaskImage > MTCFilterType;
+                    typename MTCFilterType::Pointer mtcFilter = MTCFilterType::New();
+                    this->SetUpRegional( mtcFilter.GetPointer(), pet, mask, settings );
+                    mtcFilter->SetMaskContext( context );
+                    correctionFilter = mtcFilter.GetPointer();
+                }
+                break;
+
+            case EIterativeYang: {
+                std::cout << "Performing iterative Yang..." << std::endl;
+                typedef IterativeYangPVCImageFilter< TImage, TMaskImage > IYFilterType;
+                typename IYFilterType::Pointer iyFilter = IYFilterType::New();
+                this->SetUpRegional( iyFilter.GetPointer(), pet, mask, settings );
+                iyFilter->SetIterations( settings.nIterations );
+                iyFilter->SetStoppingCond( settings.fTolerance );
+                iyFilter->SetStartIteration( settings.nStartIteration );
+                iyFilter->SetDeadline( settings.fDeadline );
+                if ( settings.imageInitialEstimate.IsNotNull() ) {
+                    iyFilter->SetInitialEstimate( settings.imageInitialEstimate );
+                }
+                iyFilter->SetRegionIndex( context->GetRegionIndex() );
+
+                MatrixType matFuzzy;
+                VectorType vecSums;
+                this->GetFuzzyMatrix( context, mask, matFuzzy, vecSums );
+                iyFilter->SetFuzzyMatrix( matFuzzy, vecSums );
+
+                if ( this->m_deconvolution == ENoDeconvolution ) {
+                    AddIterationSnapshots( iyFilter.GetPointer(), settings.vecSaveIters, settings.sOutputFileName );
+                    AddIterationMeans( iyFilter.GetPointer(), settings.vecSaveIters, settings.sMeansFileName );
+                    AddCheckpoints( iyFilter.GetPointer(), "IY", settings.checkpoint );
+                }
+                correctionFilter = iyFilter.GetPointer();
+                break;
+            }
+
+            case EMullerGartner: {
+                std::cout << "Performing Muller-Gartner..." << std::endl;
+
+                //GM and WM masks are the first two volumes of the 4D file.
+                ImagePointer imageGM = GetVolumeView< TImage >( mask, 0 );
+                imageGM->SetDirection( pet->GetDirection() );
+
+                ImagePointer imageWM = GetVolumeView< TImage >( mask, 1 );
+                imageWM->SetDirection( pet->GetDirection() );
+
+                typedef MullerGartnerImageFilter< TImage, TImage, TImage, TImage > MGFilterType;
+                typename MGFilterType::Pointer mgFilter = MGFilterType::New();
+                mgFilter->SetInput1( pet );
+                mgFilter->SetInput2( imageGM );
+                mgFilter->SetInput3( imageWM );
+                mgFilter->SetWM( 0 );
+                mgFilter->SetPSF( settings.vecVariance );
+                mgFilter->SetVerbose( settings.bVerbose );
+                correctionFilter = mgFilter.GetPointer();
+                break;
+            }
+
+            default:
+                itkGenericExceptionMacro( << "No region-based correction in the chain" );
+        }
+
+        correctionFilter->Update();
+
+        //How the iterations of IY ended, if a deadline was set.
+        const bool bIYReport = ( this->m_correction == EIterativeYang && settings.fDeadline > 0.0 );
+        IterationReport iyReport;
+        if ( bIYReport ) {
+            iyReport = dynamic_cast< IterativeYangPVCImageFilter< TImage, TMaskImage > * >(
+                           correctionFilter.GetPointer() )->GetIterationReport();
+        }
+
+        if ( this->m_deconvolution == ENoDeconvolution ) {
+            ImagePointer imageOutput = correctionFilter->GetOutput();
+            if ( bIYReport ) {
+                RecordIterations( imageOutput, "IY", iyReport );
+            }
+            return imageOutput;
+        }
+
+        //Free the first result once the deconvolution has finished with it.
+        correctionFilter->ReleaseDataFlagOn();
+
+        typename FilterType::Pointer deconvFilter;
+
+        if ( this->m_deconvolution == EVanCittert ) {
+            std::cout << "Performing Intra-regional Van-Cittert..." << std::endl;
+
+            typedef IntraRegVCImageFilter< TImage, TMaskImage > IVCFilterType;
+            typename IVCFilterType::Pointer vcFilter = IVCFilterType::New();
+            vcFilter->SetInput( correctionFilter->GetOutput() );
+            vcFilter->SetMaskContext( context );
+            vcFilter->SetPSF( settings.vecVariance );
+            vcFilter->SetIterations( settings.nDeconvIterations );
+            vcFilter->SetAlpha( settings.fAlpha );
+            vcFilter->SetStoppingCond( settings.fStop );
+            vcFilter->SetDisableNonNegativity( settings.bDisableNonNeg );
+            vcFilter->SetVerbose( settings.bVerbose );
+            vcFilter->SetDeadline( settings.fDeadline );
+            deconvFilter = vcFilter.GetPointer();
+        } else {
+            std::cout << "Performing Intra-regional Richardson-Lucy..." << std::endl;
+
+            typedef IntraRegRLImageFilter< TImage, TMaskImage > IRLFilterType;
+            typename IRLFilterType::Pointer rlFilter = IRLFilterType::New();
+            rlFilter->SetInput( correctionFilter->GetOutput() );
+            rlFilter->SetMaskContext( context );
+            rlFilter->SetPSF( settings.vecVariance );
+            rlFilter->SetIterations( settings.nDeconvIterations );
+            rlFilter->SetVerbose( settings.bVerbose );
+            rlFilter->SetDeadline( settings.fDeadline );
+            deconvFilter = rlFilter.GetPointer();
+        }
+
+        deconvFilter->Update();
+
+        ImagePointer imageOutput = deconvFilter->GetOutput();
+        if ( settings.fDeadline > 0.0 ) {
+            if ( bIYReport ) {
+                RecordIterations( imageOutput, "IY", iyReport );
+            }
+
+            if ( this->m_deconvolution == EVanCittert ) {
+                RecordIterations( imageOutput, "VC", dynamic_cast< IntraRegVCImageFilter< TImage, TMaskImage > * >(
+                                      deconvFilter.GetPointer() )->GetIterationReport() );
+            } else {
+                RecordIterations( imageOutput, "RL", dynamic_cast< IntraRegRLImageFilter< TImage, TMaskImage > * >(
+                                      deconvFilter.GetPointer() )->GetIterationReport() );
+            }
+        }
+
+        return imageOutput;
+    }
+
+    //Corrects each image of vecPET with its own settings, all with the same
+    //mask and PSF, and returns the corrected images in the same order. The
+    //work on the mask is done once and shared, and the corrections run
+    //concurrently unless profiling is on, whose timers are not thread-safe.
+    //With bWarmStart, e.g. for the frames of a dynamic study, IY starts each
+    //image from the correction of the one before, so they run in order. It
+    //is refused for chains, whose outputs are deconvolved images and not IY
+    //results. Throws itk::ExceptionObject if any correction fails.
+    std::vector< ImagePointer > RunAll( const std::vector< ImagePointer > & vecPET, const TMaskImage * mask,
+                                        const std::vector< Settings > & vecSettings,
+                                        bool bWarmStart = false ) const {
+        std::vector< ImagePointer > vecOutput( vecPET.size() );
+        if ( vecPET.empty() ) {
+            return vecOutput;
+        }
+        if ( bWarmStart && this->m_deconvolution != ENoDeconvolution ) {
+            itkGenericExceptionMacro( << "Only IY without deconvolution can be warm-started" );
+        }
+
+        typename MaskContextType::Pointer context = this->CreateContext( vecPET[0], mask, vecSettings[0] );
+
+        //Every image blurs the same regions, so keep them.
+        if ( this->m_correction == ERBV || this->m_correction == EMTC ||
+             this->m_deconvolution != ENoDeconvolution ) {
+            context->SetCacheBlurredRegions( true );
+        }
+        this->PrepareContext( context, mask );
+
+        if ( bWarmStart ) {
+            for ( unsigned int i = 0; i < vecPET.size(); i++ ) {
+                Settings settings = vecSettings[i];
+                if ( i > 0 ) {
+                    settings.imageInitialEstimate = vecOutput[i - 1];
+                }
+
+                try {
+                    vecOutput[i] = this->Run( vecPET[i], mask, settings, context );
+                } catch ( itk::ExceptionObject & err ) {
+                    itkGenericExceptionMacro( << "image " << i + 1 << ": " << err.GetDescription() );
+                }
+            }
+            return vecOutput;
+        }
+
+        RunFunctor functor;
+        functor.pipeline = this;
+        functor.pVecPET = &vecPET;
+        functor.mask = mask;
+        functor.pVecSettings = &vecSettings;
+        functor.context = context;
+        functor.pVecOutput = &vecOutput;
+        functor.vecErrors.resize( vecPET.size() );
+
+        if ( Profiler::IsEnabled() ) {
+            functor( 0, vecPET.size(), 0 );
+        } else {
+            ParallelTasks( 0, vecPET.size(), functor );
+        }
+
+        for ( unsigned int i = 0; i < vecPET.size(); i++ ) {
+            if ( !functor.vecErrors[i].empty() ) {
+                itkGenericExceptionMacro( << "image " << i + 1 << ": " << functor.vecErrors[i] );
+            }
+        }
+
+        return vecOutput;
+    }
+
+private:
+    typedef vnl_matrix<float> MatrixType;
+    typedef vnl_vector<float> VectorType;
+
+    //Runs the pipeline on a range of the images of RunAll().
+    struct RunFunctor {
+        const PVCPipeline * pipeline;
+        const std::vector< ImagePointer > * pVecPET;
+        const TMaskImage * mask;
+        const std::vector< Settings > * pVecSettings;
+        const MaskContextType * context;
+        std::vector< ImagePointer > * pVecOutput;
+        std::vector< std::string > vecErrors;
+
+        void operator()( itk::SizeValueType nFirst, itk::SizeValueType nLast, itk::SizeValueType ) {
+            for ( itk::SizeValueType i = nFirst; i < nLast; i++ ) {
+                //Each correction has its own mask and context objects,
+                //sharing the voxels, as threads must not share ITK data
+                //objects.
+                typename TMaskImage::Pointer maskCopy = TMaskImage::New();
+                maskCopy->Graft( this->mask );
+                typename MaskContextType::Pointer contextCopy = this->context->GraftCopy();
+
+                try {
+                    ( *this->pVecOutput )[i] = this->pipeline->Run( ( *this->pVecPET )[i], maskCopy,
+                                                                    ( *this->pVecSettings )[i], contextCopy );
+                } catch ( itk::ExceptionObject & err ) {
+                    this->vecErrors[i] = err.GetDescription();
+                }
+            }
+        }
+    };
+
+    //Fuzziness matrix of the mask, found once and kept in the context.
+    void GetFuzzyMatrix( MaskContextType * context, const TMaskImage * mask,
+                         MatrixType & matFuzzy, VectorType & vecSums ) const {
+        if ( context->GetMatrix( "fuzzy", matFuzzy, vecSums ) ) {
+            return;
+        }
+
+        typedef FuzzyCorrectionFilter< TMaskImage > FuzzyFilterType;
+        typename FuzzyFilterType::Pointer fuzzyFilter = FuzzyFilterType::New();
+        fuzzyFilter->SetInput( mask );
+        fuzzyFilter->Update();
+
+        matFuzzy = fuzzyFilter->GetMatrix();
+        vecSums = fuzzyFilter->GetSumOfRegions();
+        context->SetMatrix( "fuzzy", matFuzzy, vecSums );
+    }
+
+    //Uses the volumes of the mask as regions. If a region index file is
+    //given, the index is read from it, or built and written to it.
+    void SetUpContext( MaskContextType * context, const TImage * pet, const TMaskImage * mask,
+                       const Settings & settings ) const {
+        context->SetMask( mask, pet );
+
+        if ( settings.sRegionIndexFileName.empty() ) {
+            return;
+        }
+
+        typedef typename MaskContextType::RegionIndexType RegionIndexType;
+        typename RegionIndexType::Pointer index = RegionIndexType::New();
+
+        if ( index->Read( settings.sRegionIndexFileName ) ) {
+            if ( context->SetRegionIndex( index ) ) {
+                if ( settings.bVerbose ) {
+                    std::cout << "Read region index from " << settings.sRegionIndexFileName << std::endl;
+                }
+                return;
+            }
+            std::cerr << "[Warning]\tThe region index in " << settings.sRegionIndexFileName
+                      << " is for another mask, so it is built again" << std::endl;
+        }
+
+        //The checksum is written with the index, so the file is only read
+        //back with this mask.
+        context->GetRegionIndex()->SetMaskChecksum( context->GetMaskChecksum() );
+        if ( !context->GetRegionIndex()->Write( settings.sRegionIndexFileName ) ) {
+            std::cerr << "[Warning]\tCould not write region index to "
+                      << settings.sRegionIndexFileName << std::endl;
+        }
+    }
+
+    //Settings shared by the region-based correction filters.
+    template< class TFilter >
+    void SetUpRegional( TFilter * filter, const TImage * pet, const TMaskImage * mask, const Settings & settings ) const {
+        filter->SetInput( pet );
+        filter->SetMaskInput( mask );
+        filter->SetPSF( settings.vecVariance );
+        filter->SetVerbose( settings.bVerbose );
+    }
+
+    Correction m_correction;
+    Deconvolution m_deconvolution;
+    bool m_bLabbe;
+};
+
+} //namespace petpvc
+
+#endif // __PETPVCPIPELINE_H
@@ -0,0 +1,392 @@
+/*
+   petpvcProfiler.h
+
+   Author:      Benjamin A. Thomas
+
+   Copyright 2026 Institute of Nuclear Medicine, University College London.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+ */
+
+#ifndef __PETPVCPROFILER_H
+#define __PETPVCPROFILER_H
+
+#include <itkCommand.h>
+#include <itkProcessObject.h>
+#include <itkRealTimeClock.h>
+
+#include "petpvcAllocationTracker.h"
+
+#include <algorithm>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace itk;
+
+namespace petpvc
+{
+
+/** \class Profiler
+ *
+ * \brief Collects wall time, CPU time, call counts and allocated bytes for
+ * named stages of a run.
+ *
+ * Profiling is off by default. While it is off, the timers below only test
+ * a flag. Stage times are inclusive, so a stage that runs inside another is
+ * counted in both. CPU time is process time as given by std::clock().
+ *
+ * When AllocationTracker is installed, allocated bytes and the peak bytes
+ * held during each stage come from it. Otherwise allocated bytes are
+ * estimated from the outputs of timed filters, and peaks are zero.
+ *
+ */
+class Profiler
+{
+public:
+    struct StageRecord {
+        double fWall;
+        double fCPU;
+        unsigned long nCalls;
+        double fBytes;
+        double fPeakBytes;
+    };
+
+    struct IterationRecord {
+        std::string sName;
+        unsigned int nIteration;
+        double fWall;
+        double fCPU;
+    };
+
+    static Profiler & GetInstance() {
+        static Profiler instance;
+        return instance;
+    }
+
+    static bool IsEnabled() {
+        return GetInstance().m_bEnabled;
+    }
+
+    static void SetEnabled( bool bEnabled ) {
+        Profiler & profiler = GetInstance();
+        if ( bEnabled && profiler.m_clock.IsNull() ) {
+            profiler.m_clock = RealTimeClock::New();
+        }
+        profiler.m_bEnabled = bEnabled;
+    }
+
+    double GetWallTime() const {
+        return this->m_clock->GetTimeInSeconds();
+    }
+
+    double GetCPUTime() const {
+        return (double) std::clock() / CLOCKS_PER_SEC;
+    }
+
+    void AddStage( const std::string & sName, double fWall, double fCPU, double fBytes,
+                   double fPeakBytes = 0.0 ) {
+        std::map< std::string, StageRecord >::iterator it = this->m_mapStages.find( sName );
+        if ( it == this->m_mapStages.end() ) {
+            StageRecord record = { 0.0, 0.0, 0, 0.0, 0.0 };
+            it = this->m_mapStages.insert( std::make_pair( sName, record ) ).first;
+            this->m_vecStageOrder.push_back( sName );
+        }
+
+        it->second.fWall += fWall;
+        it->second.fCPU += fCPU;
+        it->second.nCalls++;
+        it->second.fBytes += fBytes;
+        it->second.fPeakBytes = std::max( it->second.fPeakBytes, fPeakBytes );
+    }
+
+    void AddIteration( const std::string & sName, unsigned int nIteration, double fWall, double fCPU ) {
+        IterationRecord record;
+        record.sName = sName;
+        record.nIteration = nIteration;
+        record.fWall = fWall;
+        record.fCPU = fCPU;
+        this->m_vecIterations.push_back( record );
+    }
+
+    //Writes the report as JSON if the file name ends in .json, otherwise as
+    //CSV. Returns false if the file cannot be written.
+    bool WriteReport( const std::string & sFileName ) const {
+        std::ofstream file( sFileName.c_str() );
+        if ( !file.is_open() ) {
+            return false;
+        }
+
+        const bool bJSON = sFileName.size() >= 5 && sFileName.substr( sFileName.size() - 5 ) == ".json";
+        if ( bJSON ) {
+            this->WriteJSON( file );
+        } else {
+            this->WriteCSV( file );
+        }
+
+        return file.good();
+    }
+
+private:
+    Profiler() {
+        this->m_bEnabled = false;
+    }
+
+    void WriteJSON( std::ostream & os ) const {
+        os << "{" << std::endl << "  \"stages\": [";
+        for ( unsigned int n = 0; n < this->m_vecStageOrder.size(); n++ ) {
+            const StageRecord & record = this->m_mapStages.find( this->m_vecStageOrder[n] )->second;
+            os << ( n > 0 ? "," : "" ) << std::endl
+               << "    { \"name\": \"" << this->m_vecStageOrder[n] << "\", \"wall_s\": " << record.fWall
+               << ", \"cpu_s\": " << record.fCPU << ", \"calls\": " << record.nCalls
+               << ", \"bytes\": " << (unsigned long long) record.fBytes
+               << ", \"peak_bytes\": " << (unsigned long long) record.fPeakBytes << " }";
+        }
+        os << std::endl << "  ]," << std::endl << "  \"iterations\": [";
+        for ( unsigned int n = 0; n < this->m_vecIterations.size(); n++ ) {
+            const IterationRecord & record = this->m_vecIterations[n];
+            os << ( n > 0 ? "," : "" ) << std::endl
+               << "    { \"name\": \"" << record.sName << "\", \"iteration\": " << record.nIteration
+               << ", \"wall_s\": " << record.fWall << ", \"cpu_s\": " << record.fCPU << " }";
+        }
+        os << std::endl << "  ]" << std::endl << "}" << std::endl;
+    }
+
+    void WriteCSV( std::ostream & os ) const {
+        os << "type,name,iteration,wall_s,cpu_s,calls,bytes,peak_bytes" << std::endl;
+        for ( unsigned int n = 0; n < this->m_vecStageOrder.size(); n++ ) {
+            const StageRecord & record = this->m_mapStages.find( this->m_vecStageOrder[n] )->second;
+            os << "stage," << this->m_vecStageOrder[n] << ",," << record.fWall << "," << record.fCPU
+               << "," << record.nCalls << "," << (unsigned long long) record.fBytes
+               << "," << (unsigned long long) record.fPeakBytes << std::endl;
+        }
+        for ( unsigned int n = 0; n < this->m_vecIterations.size(); n++ ) {
+            const IterationRecord & record = this->m_vecIterations[n];
+            os << "iteration," << record.sName << "," << record.nIteration << "," << record.fWall
+               << "," << record.fCPU << ",1,," << std::endl;
+        }
+    }
+
+    Profiler(const Profiler &); //purposely not implemented
+    void operator=(const Profiler &);  //purposely not implemented
+
+    bool m_bEnabled;
+    RealTimeClock::Pointer m_clock;
+    std::vector< std::string > m_vecStageOrder;
+    std::map< std::string, StageRecord > m_mapStages;
+    std::vector< IterationRecord > m_vecIterations;
+};
+
+/** \class StageMemory
+ *
+ * \brief Measures the bytes allocated and the peak bytes held between
+ * Start() and Stop().
+ *
+ */
+class StageMemory
+{
+public:
+    StageMemory() {
+        this->m_nTotalStart = 0;
+        this->m_nSavedPeak = 0;
+    }
+
+    void Start() {
+        AllocationTracker & tracker = AllocationTracker::GetInstance();
+        this->m_nTotalStart = tracker.GetTotalBytes();
+        this->m_nSavedPeak = tracker.ResetPeak();
+    }
+
+    //Returns false if allocations are not tracked.
+    bool Stop( double & fBytes, double & fPeakBytes ) {
+        AllocationTracker & tracker = AllocationTracker::GetInstance();
+        fBytes = (double) ( tracker.GetTotalBytes() - this->m_nTotalStart );
+        fPeakBytes = (double) tracker.GetPeakBytes();
+        tracker.RestorePeak( this->m_nSavedPeak );
+        return AllocationTracker::IsInstalled();
+    }
+
+private:
+    size_t m_nTotalStart;
+    size_t m_nSavedPeak;
+};
+
+//Name of a stage, prefixed with the class that runs it.
+inline std::string GetStageName( const Object * owner, const char * sStage )
+{
+    if ( owner == NULL ) {
+        return sStage;
+    }
+    return std::string( owner->GetNameOfClass() ) + "/" + sStage;
+}
+
+/** \class ScopedStageTimer
+ *
+ * \brief Times the enclosing scope as one call of a stage.
+ *
+ * If an iteration number is given, the time is also recorded for that
+ * iteration.
+ *
+ */
+class ScopedStageTimer
+{
+public:
+    ScopedStageTimer( const Object * owner, const char * sStage, unsigned int nIteration = 0 ) {
+        this->m_bActive = Profiler::IsEnabled();
+        if ( this->m_bActive ) {
+            this->m_sName = GetStageName( owner, sStage );
+            this->m_nIteration = nIteration;
+            this->m_fBytes = 0.0;
+            this->m_memory.Start();
+            this->m_fWallStart = Profiler::GetInstance().GetWallTime();
+            this->m_fCPUStart = Profiler::GetInstance().GetCPUTime();
+        }
+    }
+
+    ~ScopedStageTimer() {
+        if ( this->m_bActive ) {
+            Profiler & profiler = Profiler::GetInstance();
+            const double fWall = profiler.GetWallTime() - this->m_fWallStart;
+            const double fCPU = profiler.GetCPUTime() - this->m_fCPUStart;
+
+            double fBytes, fPeakBytes;
+            if ( !this->m_memory.Stop( fBytes, fPeakBytes ) ) {
+                fBytes = this->m_fBytes;
+            }
+
+            profiler.AddStage( this->m_sName, fWall, fCPU, fBytes, fPeakBytes );
+            if ( this->m_nIteration > 0 ) {
+                profiler.AddIteration( this->m_sName, this->m_nIteration, fWall, fCPU );
+            }
+        }
+    }
+
+    //Adds to the bytes allocated by this call, if allocations are not
+    //tracked.
+    void AddBytes( double fBytes ) {
+        if ( this->m_bActive ) {
+            this->m_fBytes += fBytes;
+        }
+    }
+
+private:
+    ScopedStageTimer(const ScopedStageTimer &); //purposely not implemented
+    void operator=(const ScopedStageTimer &);  //purposely not implemented
+
+    bool m_bActive;
+    std::string m_sName;
+    unsigned int m_nIteration;
+    double m_fBytes;
+    double m_fWallStart;
+    double m_fCPUStart;
+    StageMemory m_memory;
+};
+
+/** \class FilterStageCommand
+ *
+ * \brief Observer that times each execution of an ITK filter as a stage.
+ *
+ * Filters in a pipeline run when a later filter is updated, so timing them
+ * from their own start and end events attributes the time correctly.
+ * Without allocation tracking, the size of the output buffer is counted as
+ * allocated bytes.
+ *
+ */
+template< class TFilter >
+class FilterStageCommand : public Command
+{
+public:
+    typedef FilterStageCommand Self;
+    typedef Command Superclass;
+    typedef SmartPointer< Self > Pointer;
+
+    itkNewMacro( Self );
+
+    itkTypeMacro( FilterStageCommand, Command );
+
+    void SetStageName( const std::string & sName ) {
+        this->m_sName = sName;
+    }
+
+    void SetCountBytes( bool bCountBytes ) {
+        this->m_bCountBytes = bCountBytes;
+    }
+
+    void Execute( Object * caller, const EventObject & event ) ITK_OVERRIDE {
+        this->Execute( (const Object *) caller, event );
+    }
+
+    void Execute( const Object * caller, const EventObject & event ) ITK_OVERRIDE {
+        Profiler & profiler = Profiler::GetInstance();
+
+        if ( StartEvent().CheckEvent( &event ) ) {
+            this->m_memory.Start();
+            this->m_fWallStart = profiler.GetWallTime();
+            this->m_fCPUStart = profiler.GetCPUTime();
+        } else if ( EndEvent().CheckEvent( &event ) ) {
+            const double fWall = profiler.GetWallTime() - this->m_fWallStart;
+            const double fCPU = profiler.GetCPUTime() - this->m_fCPUStart;
+
+            double fBytes, fPeakBytes;
+            if ( !this->m_memory.Stop( fBytes, fPeakBytes ) ) {
+                fBytes = 0.0;
+                const TFilter * filter = dynamic_cast< const TFilter * >( caller );
+                if ( this->m_bCountBytes && filter != NULL ) {
+                    fBytes = (double) filter->GetOutput()->GetBufferedRegion().GetNumberOfPixels()
+                             * sizeof( typename TFilter::OutputImagePixelType );
+                }
+            }
+
+            profiler.AddStage( this->m_sName, fWall, fCPU, fBytes, fPeakBytes );
+        }
+    }
+
+protected:
+    FilterStageCommand() {
+        this->m_bCountBytes = true;
+        this->m_fWallStart = 0.0;
+        this->m_fCPUStart = 0.0;
+    }
+
+private:
+    std::string m_sName;
+    bool m_bCountBytes;
+    double m_fWallStart;
+    double m_fCPUStart;
+    StageMemory m_memory;
+};
+
+//Records each execution of filter as a stage of owner. Does nothing if
+//profiling is off. Set bCountBytes to false for filters that pass their
+//input through, e.g. StatisticsImageFilter.
+template< class TFilter >
+void ProfileFilter( TFilter * filter, const Object * owner, const char * sStage, bool bCountBytes = true )
+{
+    if ( !Profiler::IsEnabled() ) {
+        return;
+    }
+
+    typename FilterStageCommand< TFilter >::Pointer command = FilterStageCommand< TFilter >::New();
+    command->SetStageName( GetStageName( owner, sStage ) );
+    command->SetCountBytes( bCountBytes );
+
+    filter->AddObserver( StartEvent(), command );
+    filter->AddObserver( EndEvent(), command );
+}
+
+} //namespace petpvc
+
+#endif // __PETPVCPROFILER_H
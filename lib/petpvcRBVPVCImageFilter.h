@@ -31,7 +31,6 @@
 #include <itkDivideImageFilter.h>
 #include <itkAddImageFilter.h>
 #include <itkDiscreteGaussianImageFilter.h>
-#include <itkStatisticsImageFilter.h>
 
 
 using namespace itk;
@@ -69,8 +68,6 @@ public:
     typedef typename TMaskImage::IndexType  MaskIndexType;
     typedef typename TMaskImage::PixelType  MaskPixelType;
 
-    //For calculating mean values from image
-    typedef itk::StatisticsImageFilter<TInputImage> StatisticsFilterType;
     //Extracts a 3D volume from 4D file.
     typedef itk::ExtractImageFilter<TMaskImage, TInputImage> ExtractFilterType;
     typedef itk::MultiplyImageFilter<TInputImage, TInputImage> MultiplyFilterType;
@@ -79,6 +76,7 @@ public:
     typedef itk::DiscreteGaussianImageFilter<TInputImage, TInputImage> BlurringFilterType;
 
     typedef GTMImageFilter<TMaskImage> GTMImageFilterType;
+    typedef typename GTMImageFilterType::MaskContextType MaskContextType;
     typedef itk::Vector<float, 3> ITKVectorType;
 
     /** Image related typedefs. */
@@ -123,6 +121,12 @@ public:
         this->m_bVerbose = bVerbose;
     }
 
+    //Shares the regions, and any blurred regions, with other filters.
+    void SetMaskContext( MaskContextType * context ) {
+        this->m_maskContext = context;
+        this->Modified();
+    }
+
     void SetUseLabbe() {
         this->m_bUseLabbe = true;
     }
@@ -142,6 +146,7 @@ protected:
     MatrixType m_matGTM;
     ITKVectorType m_vecVariance;
     bool m_bVerbose;
+    typename MaskContextType::Pointer m_maskContext;
 	
 
 private:
@@ -35,9 +35,10 @@
 #include <itkDiscreteGaussianImageFilter.h>
 #include <itkStatisticsImageFilter.h>
 #include <itkThresholdImageFilter.h>
-#include <itkImageDuplicator.h>
+#include "petpvcTimeBudget.h"
 
 #include <algorithm>
+#include <cmath>
 
 using namespace itk;
 
@@ -78,7 +79,6 @@ public:
 	typedef itk::SubtractImageFilter<TInputImage, TInputImage> SubFilterType;
     typedef itk::DiscreteGaussianImageFilter<TInputImage, TInputImage> BlurringFilterType;
 	typedef itk::ThresholdImageFilter<TInputImage> ThresholdFilterType;
-    typedef itk::ImageDuplicator<TInputImage> DuplicatorType;
 
     typedef itk::Vector<float, 3> ITKVectorType;
 
@@ -98,6 +98,15 @@ public:
         this->m_nIterations = nIters;
     }
 
+    //Number of iterations already done, e.g. by a run resumed from a
+    //checkpoint. Iterations are numbered on from it, up to the total set by
+    //SetIterations().
+    void SetStartIteration( unsigned int nIter ) {
+        this->m_nStartIteration = nIter;
+    }
+
+    //Stops early once the log-likelihood changes by less than this fraction
+    //between iterations. 0, the default, runs every iteration.
     void SetStoppingCond( float stop ) {
         this->m_fStopCriterion = stop;
     }
@@ -106,6 +115,47 @@ public:
         this->m_bVerbose = bVerbose;
     }
 
+    //Fixed threshold below which the blurred estimate gives a zero ratio,
+    //e.g. one computed over the whole image when the filter is run on
+    //slabs of it. Negative, the default, computes it at each iteration.
+    void SetZeroThreshold( float fThreshold ) {
+        this->m_fZeroThreshold = fThreshold;
+        this->Modified();
+    }
+
+    // Calculate threshold at which a value is zeroed
+    float GetZeroThreshold( typename TInputImage::ConstPointer img );
+
+    //Wall-clock time, from GetWallClockTime(), by which the iterations must
+    //end. 0, the default, sets no limit.
+    void SetDeadline( double fDeadline ) {
+        this->m_fDeadline = fDeadline;
+    }
+
+    /** How the iterations ended, after Update(). */
+    const IterationReport & GetIterationReport() const {
+        return this->m_report;
+    }
+
+    //Image to start from instead of the PET data, e.g. the correction of
+    //the previous frame. It must have the size of the PET image.
+    void SetInitialEstimate( const InputImageType * image ) {
+        this->m_imageInitialEstimate = image;
+        this->Modified();
+    }
+
+    /** Number of the iteration just completed. Valid while observers of
+     * itk::IterationEvent are executed. */
+    unsigned int GetCurrentIteration() const {
+        return this->m_nCurrentIteration;
+    }
+
+    /** Image estimate after the iteration just completed. Valid while
+     * observers of itk::IterationEvent are executed. */
+    const InputImageType * GetCurrentEstimate() const {
+        return this->m_imageCurrentEstimate;
+    }
+
 
 protected:
     RichardsonLucyPVCImageFilter();
@@ -114,13 +164,17 @@ protected:
     /** Does the real work. */
     virtual void GenerateData() ITK_OVERRIDE;
 
-    // Calculate threshold at which a value is zeroed
-    float GetZeroThreshold( typename TInputImage::ConstPointer img );
-
     ITKVectorType m_vecVariance;
     unsigned int m_nIterations;
+    unsigned int m_nStartIteration;
     float m_fStopCriterion;
+    float m_fZeroThreshold;
+    InputImagePointer m_imageInitialEstimate;
     bool m_bVerbose;
+    double m_fDeadline;
+    IterationReport m_report;
+    unsigned int m_nCurrentIteration;
+    const TInputImage * m_imageCurrentEstimate;
 
 private:
     RichardsonLucyPVCImageFilter(const Self &); //purposely not implemented
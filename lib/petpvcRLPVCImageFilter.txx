@@ -27,6 +27,9 @@
 #include "itkObjectFactory.h"
 #include "itkImageRegionIterator.h"
 #include "itkImageRegionConstIterator.h"
+#include "petpvcProfiler.h"
+#include "petpvcReduction.h"
+#include "petpvcImageExpression.h"
 
 using namespace itk;
 
@@ -38,8 +41,13 @@ RichardsonLucyPVCImageFilter< TInputImage >
 ::RichardsonLucyPVCImageFilter()
 {
     this->m_nIterations = 10;
+    this->m_nStartIteration = 0;
     this->m_bVerbose = false;
-    this->m_fStopCriterion = -3e+06;
+    this->m_fDeadline = 0.0;
+    this->m_fStopCriterion = 0.0;
+    this->m_fZeroThreshold = -1.0;
+    this->m_nCurrentIteration = 0;
+    this->m_imageCurrentEstimate = NULL;
 }
 
 template< class TInputImage >
@@ -51,6 +59,7 @@ float RichardsonLucyPVCImageFilter< TInputImage >
 
     // Calculate image statistics
     typename StatisticsFilterType::Pointer statsFilter = StatisticsFilterType::New();
+    ProfileFilter( statsFilter.GetPointer(), this, "image statistics", false );
     statsFilter->SetInput( img );
     statsFilter->Update();
     
@@ -75,128 +84,106 @@ void RichardsonLucyPVCImageFilter< TInputImage >
 
     //Gaussian smoothing
     typename BlurringFilterType::Pointer blurFilter = BlurringFilterType::New();
+    ProfileFilter( blurFilter.GetPointer(), this, "blur" );
 	typename BlurringFilterType::Pointer blurFilter2 = BlurringFilterType::New();
-
-    typename MultiplyFilterType::Pointer multiplyFilter = MultiplyFilterType::New();
-	typename DivideFilterType::Pointer divideFilter = DivideFilterType::New();
-
-    typename DuplicatorType::Pointer duplicator = DuplicatorType::New();
-    typename AddFilterType::Pointer addFilter = AddFilterType::New();
-    typename SubFilterType::Pointer subFilter = SubFilterType::New();
-    typename ThresholdFilterType::Pointer thresholdFilter = ThresholdFilterType::New();
+    ProfileFilter( blurFilter2.GetPointer(), this, "blur" );
 
     blurFilter->SetVariance( this->GetPSF() );
 	blurFilter2->SetVariance( this->GetPSF() );
 
-    thresholdFilter->ThresholdBelow( 0 );
-    thresholdFilter->SetOutsideValue( 0 );
-	thresholdFilter->SetInput( pPET );  
-	thresholdFilter->Update();
-	duplicator->SetInputImage( thresholdFilter->GetOutput() );
-    duplicator->Update();
+    //Non-negative PET data.
+    typename TInputImage::Pointer imagePET = EvaluateImage( pPET.GetPointer(), Max( Expr( pPET ), 0.0 ) );
 
+    //Set image estimate to the original non-negative PET data for the first
+    //iteration, or to the non-negative initial estimate if one was given.
     typename TInputImage::Pointer imageEstimate;
-    //Set image estimate to the original non-negative PET data for the first iteration.
-    imageEstimate = duplicator->GetOutput();
-    imageEstimate->DisconnectPipeline();
-
-    // Create a blank image with same dimensions as input to use for division
-    duplicator->SetInputImage(imageEstimate);
-    duplicator->Update();
-
-    typedef itk::CastImageFilter< TInputImage, TInputImage > CastImageFilterType;
-    typename CastImageFilterType::Pointer castFilter = CastImageFilterType::New();
-    castFilter->SetInput( duplicator->GetOutput() );
-    castFilter->Update();
-    typename TInputImage::Pointer blankImage = castFilter->GetOutput();
-
-    typedef typename TInputImage::PixelType PixelType;
-    blankImage->FillBuffer( itk::NumericTraits< PixelType >::Zero );
+    if ( this->m_imageInitialEstimate.IsNotNull() ) {
+        if ( this->m_imageInitialEstimate->GetLargestPossibleRegion().GetSize() !=
+             pPET->GetLargestPossibleRegion().GetSize() ) {
+            itkExceptionMacro( << "The initial estimate must have the size of the PET image" );
+        }
+        imageEstimate = EvaluateImage( pPET.GetPointer(), Max( Expr( this->m_imageInitialEstimate ), 0.0 ) );
+    } else {
+        imageEstimate = EvaluateImage( pPET.GetPointer(), Expr( imagePET ) );
+    }
 
     // Image to store result of division
-    typename TInputImage::Pointer dividedImage;
+    typename TInputImage::Pointer dividedImage = NewImageLike( pPET.GetPointer() );
 
     int nMaxNumOfIters =  this->m_nIterations;
-    int n=1;
+    const int nFirstIter = this->m_nStartIteration + 1;
+    int n = nFirstIter;
 
     bool bStopped = false;
+    double fPrevLog = 0.0;
+
+    this->m_report = IterationReport();
+    IterationBudget budget;
+    budget.Start( this->m_fDeadline );
 	
     while ( ( n <= nMaxNumOfIters ) && ( !bStopped ) ) {
-         float fLog = 0.0;  
+
+            ScopedStageTimer iterationTimer( this, "iteration", n );
+
+         double fLog = 0.0;  
             // f_k * h
             blurFilter->SetInput( imageEstimate );
             blurFilter->Update();
 
-            // Perform f(x) / [ f_k(x) * h ] voxel-by-voxel as itk::DivideFilterType sets image
-            // to max if denominator is 0.
-            ConstImageIterator numeratorIt( thresholdFilter->GetOutput(),  thresholdFilter->GetOutput()->GetLargestPossibleRegion() );
-            ConstImageIterator denomIt( blurFilter->GetOutput(),  blurFilter->GetOutput()->GetLargestPossibleRegion() );
-
-            duplicator->SetInputImage(blankImage);
-            duplicator->Update();
-            dividedImage = duplicator->GetOutput();
-            dividedImage->DisconnectPipeline();
-
-            ImageRegionIterator<TInputImage> divIt( dividedImage, dividedImage->GetLargestPossibleRegion() );
-
-            numeratorIt.GoToBegin();
-            denomIt.GoToBegin();
-            divIt.GoToBegin();
-
             // Get zero threshold
-            const float fSmallNum = this->GetZeroThreshold( blurFilter->GetOutput() );
-
-            while ( !divIt.IsAtEnd() )
-    	    {
-				if ( denomIt.Get() > fSmallNum )
-                    divIt.Set(numeratorIt.Get() / denomIt.Get());
-                else
-                    divIt.Set(itk::NumericTraits< PixelType >::Zero);
-			
-        		++numeratorIt;
-                ++denomIt;
-                ++divIt;
-        	}
+            const float fSmallNum = ( this->m_fZeroThreshold >= 0.0 ) ? this->m_fZeroThreshold
+                                    : this->GetZeroThreshold( blurFilter->GetOutput() );
+
+            // Perform f(x) / [ f_k(x) * h ] voxel-by-voxel, giving zero where the
+            // denominator is below the threshold rather than the maximum value
+            // that itk::DivideFilterType gives for a zero denominator.
+            Evaluate( dividedImage.GetPointer(),
+                      Where( Greater( Expr( blurFilter->GetOutput() ), fSmallNum ),
+                             Expr( imagePET ) / Expr( blurFilter->GetOutput() ), 0.0 ) );
 
             // Reblur correction factors            
             blurFilter2->SetInput( dividedImage );
             blurFilter2->Update();
 
-            // Multiply current image estimate by reblurred correction factors
-			multiplyFilter->SetInput1( imageEstimate );
-			multiplyFilter->SetInput2( blurFilter2->GetOutput() );
-            multiplyFilter->Update();
-            
-            // Update image estimate 
-            imageEstimate = multiplyFilter->GetOutput();
-            imageEstimate->DisconnectPipeline();
+            // Multiply current image estimate by reblurred correction factors,
+            // updating it in place.
+            Evaluate( imageEstimate.GetPointer(), Expr( imageEstimate ) * Expr( blurFilter2->GetOutput() ) );
+
+            PoissonLogLikelihoodFunctor< PixelType > logFunctor;
+            logFunctor.pMeasured = imagePET->GetBufferPointer();
+            logFunctor.pEstimate = imageEstimate->GetBufferPointer();
+            fLog = ParallelSum( 0, imageEstimate->GetLargestPossibleRegion().GetNumberOfPixels(), logFunctor );
 
-            ConstImageIterator origIt( thresholdFilter->GetOutput(),  thresholdFilter->GetOutput()->GetLargestPossibleRegion() );
-            ConstImageIterator currIt( imageEstimate, imageEstimate->GetLargestPossibleRegion() );
+            float fCurrentEval = fLog;
+            std::cout << n << "\t" << fCurrentEval << std::endl;         
 
-            origIt.GoToBegin();
-            currIt.GoToBegin();
+            //Let any observers see the estimate of this iteration.
+            this->m_nCurrentIteration = n;
+            this->m_imageCurrentEstimate = imageEstimate.GetPointer();
+            this->InvokeEvent( itk::IterationEvent() );
 
-            while ( !currIt.IsAtEnd() )
-    	    {
-				if (currIt.Get() > 0.0) {
-                    fLog += origIt.Get() * log(currIt.Get()) - currIt.Get();
-				}
+            //Relative change of the log-likelihood since the last iteration.
+            if ( n > nFirstIter && std::fabs( fLog - fPrevLog ) < this->m_fStopCriterion * std::fabs( fPrevLog ) ) {
+                bStopped = true;
+            }
+            fPrevLog = fLog;
 
-        		++currIt;
-                ++origIt;
-        	}
+            this->m_report.nIterations = n;
+            this->m_report.fConvergence = fLog;
+
+            if ( !bStopped && n < nMaxNumOfIters && !budget.AllowsNextIteration() ) {
+                this->m_report.bOutOfTime = true;
+                bStopped = true;
+            }
 
-            float fCurrentEval = fLog;
-            std::cout << n << "\t" << fCurrentEval << std::endl;         
 			n++;
     }
     std::cout << std::endl;
 
-    this->AllocateOutputs();
+    this->m_imageCurrentEstimate = NULL;
 
-    ImageAlgorithm::Copy( imageEstimate.GetPointer(), output.GetPointer(), output->GetRequestedRegion(),
-                          output->GetRequestedRegion() );
+    //The final estimate becomes the output, without copying it.
+    this->GraftOutput( imageEstimate.GetPointer() );
 
 }
 
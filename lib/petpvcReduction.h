@@ -0,0 +1,331 @@
+/*
+   petpvcReduction.h
+
+   Author:      Benjamin A. Thomas
+
+   Copyright 2026 Institute of Nuclear Medicine, University College London.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+ */
+
+/*
+   Parallel sums that give the same answer for any number of threads.
+
+   The range is cut into chunks of a fixed size, independent of the number
+   of threads. Each chunk is summed in double, in voxel order, and the
+   chunk sums are then added pairwise in a fixed tree. Threads only decide
+   who computes which chunk, so the result is bitwise identical for any
+   --threads setting, and the rounding error grows with the log of the
+   number of chunks rather than the number of voxels.
+ */
+
+#ifndef __PETPVCREDUCTION_H
+#define __PETPVCREDUCTION_H
+
+#include "petpvcParallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <vector>
+
+namespace petpvc
+{
+
+//Voxels per chunk. Changing this changes the rounding of every sum.
+const itk::SizeValueType REDUCTION_CHUNK_SIZE = 16384;
+
+//Adds up nValues values, nStride apart, as a balanced binary tree.
+inline double PairwiseSum( const double * pValues, itk::SizeValueType nValues, itk::SizeValueType nStride = 1 )
+{
+    if ( nValues == 0 ) {
+        return 0.0;
+    }
+
+    if ( nValues == 1 ) {
+        return pValues[0];
+    }
+
+    const itk::SizeValueType nHalf = nValues / 2;
+    return PairwiseSum( pValues, nHalf, nStride ) +
+           PairwiseSum( pValues + nHalf * nStride, nValues - nHalf, nStride );
+}
+
+template< class TFunctor >
+struct ChunkedSumAdaptor {
+    TFunctor * functor;
+    itk::SizeValueType nBegin;
+    itk::SizeValueType nEnd;
+    itk::SizeValueType nValues;
+    std::vector< double > vecPartial;
+
+    void operator()( itk::SizeValueType nFirstChunk, itk::SizeValueType nLastChunk, itk::SizeValueType ) {
+        for ( itk::SizeValueType c = nFirstChunk; c < nLastChunk; c++ ) {
+            const itk::SizeValueType nFirst = this->nBegin + c * REDUCTION_CHUNK_SIZE;
+            const itk::SizeValueType nLast = std::min( nFirst + REDUCTION_CHUNK_SIZE, this->nEnd );
+            ( *this->functor )( nFirst, nLast, &this->vecPartial[c * this->nValues] );
+        }
+    }
+};
+
+//Sums nValues quantities at once over [nBegin, nEnd). functor( nFirst,
+//nLast, pSums ) must add its part of each quantity to pSums[0..nValues),
+//which start at zero. Results are written to pResult.
+template< class TFunctor >
+void ParallelSums( itk::SizeValueType nBegin, itk::SizeValueType nEnd, itk::SizeValueType nValues,
+                   TFunctor & functor, double * pResult )
+{
+    std::fill( pResult, pResult + nValues, 0.0 );
+
+    if ( nEnd <= nBegin || nValues == 0 ) {
+        return;
+    }
+
+    const itk::SizeValueType nChunks = ( nEnd - nBegin + REDUCTION_CHUNK_SIZE - 1 ) / REDUCTION_CHUNK_SIZE;
+
+    ChunkedSumAdaptor< TFunctor > adaptor;
+    adaptor.functor = &functor;
+    adaptor.nBegin = nBegin;
+    adaptor.nEnd = nEnd;
+    adaptor.nValues = nValues;
+    adaptor.vecPartial.assign( nChunks * nValues, 0.0 );
+
+    ParallelFor( 0, nChunks, adaptor );
+
+    for ( itk::SizeValueType n = 0; n < nValues; n++ ) {
+        pResult[n] = PairwiseSum( &adaptor.vecPartial[n], nChunks, nValues );
+    }
+}
+
+//Single-value form of ParallelSums(), for functors that return the sum of
+//their part: double functor( nFirst, nLast ).
+template< class TFunctor >
+struct SingleSumAdaptor {
+    TFunctor * functor;
+
+    void operator()( itk::SizeValueType nFirst, itk::SizeValueType nLast, double * pSums ) {
+        pSums[0] += ( *this->functor )( nFirst, nLast );
+    }
+};
+
+template< class TFunctor >
+double ParallelSum( itk::SizeValueType nBegin, itk::SizeValueType nEnd, TFunctor & functor )
+{
+    SingleSumAdaptor< TFunctor > adaptor;
+    adaptor.functor = &functor;
+
+    double fSum = 0.0;
+    ParallelSums( nBegin, nEnd, 1, adaptor, &fSum );
+    return fSum;
+}
+
+//Sum of the voxels of a buffer, for ParallelSum().
+template< class TPixel >
+struct SumFunctor {
+    const TPixel * pData;
+
+    double operator()( itk::SizeValueType nFirst, itk::SizeValueType nLast ) const {
+        double fSum = 0.0;
+        for ( itk::SizeValueType i = nFirst; i < nLast; i++ ) {
+            fSum += this->pData[i];
+        }
+        return fSum;
+    }
+};
+
+//Sum of the voxel by voxel product of two buffers, e.g. an image and a
+//region mask.
+template< class TPixel1, class TPixel2 >
+struct ProductSumFunctor {
+    const TPixel1 * pData1;
+    const TPixel2 * pData2;
+
+    double operator()( itk::SizeValueType nFirst, itk::SizeValueType nLast ) const {
+        double fSum = 0.0;
+        for ( itk::SizeValueType i = nFirst; i < nLast; i++ ) {
+            fSum += (double) this->pData1[i] * this->pData2[i];
+        }
+        return fSum;
+    }
+};
+
+template< class TPixel >
+struct SumOfSquaresFunctor {
+    const TPixel * pData;
+
+    double operator()( itk::SizeValueType nFirst, itk::SizeValueType nLast ) const {
+        double fSum = 0.0;
+        for ( itk::SizeValueType i = nFirst; i < nLast; i++ ) {
+            fSum += (double) this->pData[i] * this->pData[i];
+        }
+        return fSum;
+    }
+};
+
+template< class TPixel >
+struct SumOfSquaredDifferencesFunctor {
+    const TPixel * pData1;
+    const TPixel * pData2;
+
+    double operator()( itk::SizeValueType nFirst, itk::SizeValueType nLast ) const {
+        double fSum = 0.0;
+        for ( itk::SizeValueType i = nFirst; i < nLast; i++ ) {
+            const double fDiff = (double) this->pData1[i] - this->pData2[i];
+            fSum += fDiff * fDiff;
+        }
+        return fSum;
+    }
+};
+
+//Poisson log-likelihood of an estimate, summed over voxels where the
+//estimate is positive.
+template< class TPixel >
+struct PoissonLogLikelihoodFunctor {
+    const TPixel * pMeasured;
+    const TPixel * pEstimate;
+
+    double operator()( itk::SizeValueType nFirst, itk::SizeValueType nLast ) const {
+        double fSum = 0.0;
+        for ( itk::SizeValueType i = nFirst; i < nLast; i++ ) {
+            if ( this->pEstimate[i] > 0.0 ) {
+                fSum += this->pMeasured[i] * std::log( (double) this->pEstimate[i] ) - this->pEstimate[i];
+            }
+        }
+        return fSum;
+    }
+};
+
+//Sum and voxel count of each label, for ParallelSums(). pSums holds the
+//sum of label n at 2n and its count at 2n+1. Labels not in mapIndex are
+//skipped.
+template< class TPixel, class TLabel >
+struct LabelSumFunctor {
+    const TPixel * pData;
+    const TLabel * pLabels;
+    const std::map< TLabel, itk::SizeValueType > * mapIndex;
+
+    void operator()( itk::SizeValueType nFirst, itk::SizeValueType nLast, double * pSums ) const {
+        typename std::map< TLabel, itk::SizeValueType >::const_iterator it = this->mapIndex->end();
+
+        for ( itk::SizeValueType i = nFirst; i < nLast; i++ ) {
+            //Neighbouring voxels usually share a label.
+            if ( it == this->mapIndex->end() || it->first != this->pLabels[i] ) {
+                it = this->mapIndex->find( this->pLabels[i] );
+                if ( it == this->mapIndex->end() ) {
+                    continue;
+                }
+            }
+
+            pSums[2 * it->second] += this->pData[i];
+            pSums[2 * it->second + 1] += 1.0;
+        }
+    }
+};
+
+//Sum and voxel count of each index of a compact label image, as for
+//LabelSumFunctor but without any lookup.
+template< class TPixel, class TIndex >
+struct IndexSumFunctor {
+    const TPixel * pData;
+    const TIndex * pIndex;
+
+    void operator()( itk::SizeValueType nFirst, itk::SizeValueType nLast, double * pSums ) const {
+        for ( itk::SizeValueType i = nFirst; i < nLast; i++ ) {
+            pSums[2 * this->pIndex[i]] += this->pData[i];
+            pSums[2 * this->pIndex[i] + 1] += 1.0;
+        }
+    }
+};
+
+//Sum of all voxels of an image.
+template< class TImage >
+double ImageSum( const TImage * image )
+{
+    SumFunctor< typename TImage::PixelType > functor;
+    functor.pData = image->GetBufferPointer();
+
+    return ParallelSum( 0, image->GetBufferedRegion().GetNumberOfPixels(), functor );
+}
+
+//Sum of the voxel by voxel product of two images of the same size.
+template< class TImage1, class TImage2 >
+double ImageProductSum( const TImage1 * image1, const TImage2 * image2 )
+{
+    ProductSumFunctor< typename TImage1::PixelType, typename TImage2::PixelType > functor;
+    functor.pData1 = image1->GetBufferPointer();
+    functor.pData2 = image2->GetBufferPointer();
+
+    return ParallelSum( 0, image1->GetBufferedRegion().GetNumberOfPixels(), functor );
+}
+
+//Mean of an image in each of the labels in vecLabels, in the same order.
+//Labels with no voxels have a mean of zero.
+template< class TImage, class TLabelImage >
+std::vector< double > LabelMeans( const TImage * image, const TLabelImage * labels,
+                                  const std::vector< typename TLabelImage::PixelType > & vecLabels )
+{
+    typedef typename TLabelImage::PixelType LabelType;
+
+    std::map< LabelType, itk::SizeValueType > mapIndex;
+    for ( itk::SizeValueType n = 0; n < vecLabels.size(); n++ ) {
+        mapIndex[ vecLabels[n] ] = n;
+    }
+
+    LabelSumFunctor< typename TImage::PixelType, LabelType > functor;
+    functor.pData = image->GetBufferPointer();
+    functor.pLabels = labels->GetBufferPointer();
+    functor.mapIndex = &mapIndex;
+
+    std::vector< double > vecSums( 2 * vecLabels.size(), 0.0 );
+    if ( !vecLabels.empty() ) {
+        ParallelSums( 0, image->GetBufferedRegion().GetNumberOfPixels(), vecSums.size(), functor, &vecSums[0] );
+    }
+
+    std::vector< double > vecMeans( vecLabels.size(), 0.0 );
+    for ( itk::SizeValueType n = 0; n < vecLabels.size(); n++ ) {
+        if ( vecSums[2 * n + 1] > 0.0 ) {
+            vecMeans[n] = vecSums[2 * n] / vecSums[2 * n + 1];
+        }
+    }
+
+    return vecMeans;
+}
+
+//Mean of an image for each index of a compact label image (see
+//LabelCompaction), from 0 to nLabels - 1.
+template< class TImage, class TIndexImage >
+std::vector< double > IndexMeans( const TImage * image, const TIndexImage * indices, unsigned int nLabels )
+{
+    IndexSumFunctor< typename TImage::PixelType, typename TIndexImage::PixelType > functor;
+    functor.pData = image->GetBufferPointer();
+    functor.pIndex = indices->GetBufferPointer();
+
+    std::vector< double > vecSums( 2 * nLabels, 0.0 );
+    if ( nLabels > 0 ) {
+        ParallelSums( 0, image->GetBufferedRegion().GetNumberOfPixels(), vecSums.size(), functor, &vecSums[0] );
+    }
+
+    std::vector< double > vecMeans( nLabels, 0.0 );
+    for ( unsigned int n = 0; n < nLabels; n++ ) {
+        if ( vecSums[2 * n + 1] > 0.0 ) {
+            vecMeans[n] = vecSums[2 * n] / vecSums[2 * n + 1];
+        }
+    }
+
+    return vecMeans;
+}
+
+} //namespace petpvc
+
+#endif // __PETPVCREDUCTION_H
@@ -31,6 +31,8 @@
 #include <itkDiscreteGaussianImageFilter.h>
 #include <itkImageDuplicator.h>
 
+#include "petpvcRegionIndex.h"
+
 #include <algorithm>
 
 using namespace itk;
@@ -108,6 +110,21 @@ public:
         this->m_bVerbose = bVerbose;
     }
 
+    //The mask already blurred by the PSF. If set, the mask is not blurred
+    //again on every update.
+    void SetBlurredMask( const TInputImage * blurred ) {
+        this->m_imageBlurredMask = blurred;
+        this->Modified();
+    }
+
+    //Only convolves within box, which must hold the mask's bounding box
+    //grown by the kernel radius. The output is zero outside it. An empty
+    //box means the whole image.
+    void SetRegionOfInterest( const RegionType & box ) {
+        this->m_regionOfInterest = box;
+        this->Modified();
+    }
+
 
 protected:
     RegionConvolutionPVCImageFilter();
@@ -118,6 +135,8 @@ protected:
 
     ITKVectorType m_vecVariance;
     bool m_bVerbose;
+    InputImagePointer m_imageBlurredMask;
+    RegionType m_regionOfInterest;
 
 private:
     RegionConvolutionPVCImageFilter(const Self &); //purposely not implemented
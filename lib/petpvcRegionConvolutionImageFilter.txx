@@ -27,6 +27,7 @@
 #include "itkObjectFactory.h"
 #include "itkImageRegionIterator.h"
 #include "itkImageRegionConstIterator.h"
+#include "petpvcProfiler.h"
 
 using namespace itk;
 
@@ -38,6 +39,7 @@ RegionConvolutionPVCImageFilter< TInputImage, TMaskImage>
 ::RegionConvolutionPVCImageFilter()
 {
     this->m_bVerbose = false;
+    this->m_regionOfInterest.GetModifiableSize().Fill( 0 );
 }
 
 template< class TInputImage, class TMaskImage >
@@ -58,20 +60,44 @@ void RegionConvolutionPVCImageFilter< TInputImage, TMaskImage>
 	typename MultiplyFilterType::Pointer multiplyFilter2 = MultiplyFilterType::New();
     typename DivideFilterType::Pointer divideFilter = DivideFilterType::New();
     typename BlurringFilterType::Pointer blurFilter = BlurringFilterType::New();
+    ProfileFilter( blurFilter.GetPointer(), this, "blur" );
 	typename BlurringFilterType::Pointer blurFilter2 = BlurringFilterType::New();
+    ProfileFilter( blurFilter2.GetPointer(), this, "blur" );
 
 	blurFilter->SetVariance( this->GetPSF() );
 	blurFilter2->SetVariance( this->GetPSF() );
 
+	//Work on copies of the region of interest, if there is one.
+	InputImagePointer pBlurredMask = this->m_imageBlurredMask;
+	const bool bCrop = ( this->m_regionOfInterest.GetNumberOfPixels() > 0 ) &&
+	                   ( this->m_regionOfInterest != pPET->GetBufferedRegion() );
+	if ( bCrop ) {
+		pPET = ExtractBox( pPET.GetPointer(), this->m_regionOfInterest );
+		pMask = ExtractBox( pMask.GetPointer(), this->m_regionOfInterest );
+		if ( pBlurredMask.IsNotNull() ) {
+			pBlurredMask = ExtractBox( pBlurredMask.GetPointer(), this->m_regionOfInterest );
+		}
+	}
+
 	//Perform regional convolution
 	multiplyFilter->SetInput1( pMask );
 	multiplyFilter->SetInput2( pPET );
 	blurFilter->SetInput( multiplyFilter->GetOutput() );
-	blurFilter2->SetInput( pMask );
 	divideFilter->SetInput1( blurFilter->GetOutput() );
-	divideFilter->SetInput2( blurFilter2->GetOutput() );
+	if ( pBlurredMask.IsNotNull() ) {
+		divideFilter->SetInput2( pBlurredMask );
+	} else {
+		blurFilter2->SetInput( pMask );
+		divideFilter->SetInput2( blurFilter2->GetOutput() );
+	}
 	multiplyFilter2->SetInput1( pMask );
 	multiplyFilter2->SetInput2( divideFilter->GetOutput() );
+
+	//Free each intermediate image as soon as the next step has used it.
+	multiplyFilter->ReleaseDataFlagOn();
+	blurFilter->ReleaseDataFlagOn();
+	blurFilter2->ReleaseDataFlagOn();
+	divideFilter->ReleaseDataFlagOn();
 	
 	try {
         multiplyFilter2->Update();
@@ -80,12 +106,15 @@ void RegionConvolutionPVCImageFilter< TInputImage, TMaskImage>
                   << std::endl;
     }
 
-	typename TInputImage::Pointer imageOut= multiplyFilter2->GetOutput();
-	
-    this->AllocateOutputs();
-
-    ImageAlgorithm::Copy( imageOut.GetPointer(), output.GetPointer(), output->GetRequestedRegion(),
-                          output->GetRequestedRegion() );
+    if ( bCrop ) {
+        //The result is zero outside the region of interest.
+        this->AllocateOutputs();
+        output->FillBuffer( 0 );
+        CopyBox( multiplyFilter2->GetOutput(), output.GetPointer() );
+    } else {
+        //Use the result as the output, without copying it.
+        this->GraftOutput( multiplyFilter2->GetOutput() );
+    }
 
 }
 
@@ -0,0 +1,787 @@
+/*
+   petpvcRegionIndex.h
+
+   Author:      Benjamin A. Thomas
+
+   Copyright 2026 Institute of Nuclear Medicine, University College London.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+ */
+
+/*
+   Where each region of a mask is, so that region-wise loops only visit the
+   voxels that matter.
+
+   For every region the index holds its bounding box, its number of
+   non-zero voxels and those voxels as runs along x. Given the PSF, it also
+   holds the radius of the blurring kernel, and which regions are close
+   enough to interact: a blurred region is exactly zero outside its
+   bounding box grown by the radius, so two regions whose grown boxes do
+   not overlap add nothing to each other's sums.
+
+   The index only depends on the mask, so it can be written to a file and
+   read back in a later run. A checksum of the mask is written with it, so
+   that the file is not used with another mask of the same size.
+ */
+
+#ifndef __PETPVCREGIONINDEX_H
+#define __PETPVCREGIONINDEX_H
+
+#include <itkObject.h>
+#include <itkObjectFactory.h>
+#include <itkImage.h>
+#include <itkImageRegionIterator.h>
+#include <itkImageRegionConstIterator.h>
+#include <itkExtractImageFilter.h>
+#include <itkDiscreteGaussianImageFilter.h>
+#include <itkGaussianOperator.h>
+
+#include "petpvcParallel.h"
+#include "petpvcReduction.h"
+#include "petpvcVolumeView.h"
+#include "petpvcProfiler.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace itk;
+
+namespace petpvc
+{
+
+//A run of voxels along x, as an offset into a volume buffer.
+struct VoxelRun {
+    SizeValueType nStart;
+    SizeValueType nLength;
+};
+
+typedef std::vector< VoxelRun > VoxelRunList;
+
+/** \class RegionIndex
+ *
+ * \brief Bounding boxes, voxel runs and neighbours of the regions of a mask.
+ *
+ * Regions are counted from zero, in the order of the volumes of a 4-D mask
+ * or of the labels given. A region with no voxels has an empty box and no
+ * neighbours.
+ *
+ */
+template< class TImage >
+class RegionIndex : public Object
+{
+public:
+    typedef RegionIndex Self;
+    typedef Object Superclass;
+    typedef SmartPointer< Self > Pointer;
+    typedef SmartPointer< const Self > ConstPointer;
+
+    itkNewMacro( Self );
+
+    itkTypeMacro( RegionIndex, Object );
+
+    typedef TImage ImageType;
+    typedef typename TImage::RegionType RegionType;
+    typedef typename TImage::IndexType IndexType;
+    typedef typename TImage::SizeType SizeType;
+    typedef typename TImage::SpacingType SpacingType;
+    typedef itk::Vector<float, 3> ITKVectorType;
+
+    //Indexes every volume of a 4-D mask, one region per volume.
+    template< class TMaskImage >
+    void SetMask( const TMaskImage * mask ) {
+        std::vector< typename TImage::Pointer > vecRegions;
+        const unsigned int nRegions = mask->GetLargestPossibleRegion().GetSize()[3];
+        for ( unsigned int n = 0; n < nRegions; n++ ) {
+            vecRegions.push_back( GetVolumeView< TImage >( mask, n ) );
+        }
+        this->SetRegions( vecRegions );
+    }
+
+    //Indexes the non-zero voxels of each image, one region per image.
+    void SetRegions( const std::vector< typename TImage::Pointer > & vecRegions ) {
+        ScopedStageTimer timer( this, "region index" );
+
+        this->Clear();
+        if ( vecRegions.empty() ) {
+            return;
+        }
+
+        this->m_volume = vecRegions[0]->GetBufferedRegion();
+        this->m_vecEntries.resize( vecRegions.size() );
+
+        //Each region is scanned by one thread, so the result does not depend
+        //on the number of threads.
+        IndexVolumesFunctor functor;
+        functor.regions = &vecRegions;
+        functor.entries = &this->m_vecEntries;
+        ParallelFor( 0, vecRegions.size(), functor );
+
+        this->UpdateNeighbours();
+        this->Modified();
+    }
+
+    //Adds one region, e.g. a grey matter probability map.
+    void AddRegion( const TImage * region ) {
+        if ( this->m_vecEntries.empty() ) {
+            this->m_volume = region->GetBufferedRegion();
+        }
+
+        RegionEntry entry;
+        IndexVolume( region->GetBufferPointer(), this->m_volume, entry );
+        this->m_vecEntries.push_back( entry );
+        this->UpdateNeighbours();
+        this->Modified();
+    }
+
+    //Indexes a label image, one region per value in vecLabels, in the same
+    //order, in a single pass.
+    template< class TLabelImage >
+    void SetLabels( const TLabelImage * labels, const std::vector< typename TLabelImage::PixelType > & vecLabels ) {
+        ScopedStageTimer timer( this, "region index" );
+
+        typedef typename TLabelImage::PixelType LabelType;
+
+        std::map< LabelType, unsigned int > mapIndex;
+        for ( unsigned int n = 0; n < vecLabels.size(); n++ ) {
+            mapIndex[ vecLabels[n] ] = n;
+        }
+
+        MapLookup< LabelType > lookup;
+        lookup.mapIndex = &mapIndex;
+        this->IndexLabels( labels, vecLabels.size(), lookup );
+    }
+
+    //Indexes a compact label image (see LabelCompaction), one region per
+    //index from 0 to nLabels - 1.
+    template< class TIndexImage >
+    void SetCompactLabels( const TIndexImage * indices, unsigned int nLabels ) {
+        ScopedStageTimer timer( this, "region index" );
+
+        DirectLookup lookup;
+        lookup.nLabels = nLabels;
+        this->IndexLabels( indices, nLabels, lookup );
+    }
+
+    void Clear() {
+        this->m_vecEntries.clear();
+        this->m_vecNeighbours.clear();
+        this->m_nMaskChecksum = 0;
+        this->Modified();
+    }
+
+    unsigned int GetNumberOfRegions() const {
+        return this->m_vecEntries.size();
+    }
+
+    //The region of the volume that was indexed.
+    const RegionType & GetVolumeRegion() const {
+        return this->m_volume;
+    }
+
+    const RegionType & GetBoundingBox( unsigned int n ) const {
+        return this->m_vecEntries[n].box;
+    }
+
+    SizeValueType GetNumberOfVoxels( unsigned int n ) const {
+        return this->m_vecEntries[n].nVoxels;
+    }
+
+    const VoxelRunList & GetRuns( unsigned int n ) const {
+        return this->m_vecEntries[n].runs;
+    }
+
+    //Checksum of the mask the index was made from, see ChecksumImage.
+    //Zero if it is not known.
+    itk::uint64_t GetMaskChecksum() const {
+        return this->m_nMaskChecksum;
+    }
+
+    void SetMaskChecksum( itk::uint64_t nChecksum ) {
+        this->m_nMaskChecksum = nChecksum;
+    }
+
+    //Works out the radius of the kernel that DiscreteGaussianImageFilter
+    //uses for this PSF, and which regions are within reach of each other.
+    //fMaximumError and nMaximumKernelWidth must match the blurring filter.
+    void SetPSF( const ITKVectorType & vecVariance, const SpacingType & spacing,
+                 double fMaximumError = 0.01, unsigned int nMaximumKernelWidth = 32 ) {
+        for ( unsigned int d = 0; d < 3; d++ ) {
+            GaussianOperator< double, 3 > oper;
+            oper.SetDirection( d );
+            oper.SetVariance( vecVariance[d] / ( spacing[d] * spacing[d] ) );
+            oper.SetMaximumError( fMaximumError );
+            oper.SetMaximumKernelWidth( nMaximumKernelWidth );
+            oper.CreateDirectional();
+            this->m_radius[d] = oper.GetRadius( d );
+        }
+
+        this->UpdateNeighbours();
+        this->Modified();
+    }
+
+    const SizeType & GetRadius() const {
+        return this->m_radius;
+    }
+
+    //The bounding box grown by the kernel radius and cropped to the volume.
+    //The region blurred by the PSF is zero outside it.
+    RegionType GetDilatedBoundingBox( unsigned int n ) const {
+        RegionType box = this->m_vecEntries[n].box;
+        if ( this->m_vecEntries[n].nVoxels > 0 ) {
+            box.PadByRadius( this->m_radius );
+            box.Crop( this->m_volume );
+        }
+        return box;
+    }
+
+    //Whether the blurred regions i and j overlap.
+    bool AreAdjacent( unsigned int i, unsigned int j ) const {
+        const std::vector< unsigned int > & vecNeighbours = this->m_vecNeighbours[i];
+        return std::binary_search( vecNeighbours.begin(), vecNeighbours.end(), j );
+    }
+
+    //Regions that are adjacent to region n, including n itself, in order.
+    const std::vector< unsigned int > & GetNeighbours( unsigned int n ) const {
+        return this->m_vecNeighbours[n];
+    }
+
+    //Writes the regions to a text file. The neighbours are not written, as
+    //they depend on the PSF.
+    bool Write( const std::string & sFileName ) const {
+        std::ofstream file( sFileName.c_str() );
+        if ( !file.is_open() ) {
+            return false;
+        }
+
+        file << "PETPVC_REGION_INDEX 2" << std::endl;
+        file << "mask " << this->m_nMaskChecksum << std::endl;
+        file << "volume";
+        for ( unsigned int d = 0; d < 3; d++ ) {
+            file << " " << this->m_volume.GetIndex()[d];
+        }
+        for ( unsigned int d = 0; d < 3; d++ ) {
+            file << " " << this->m_volume.GetSize()[d];
+        }
+        file << std::endl;
+        file << "regions " << this->m_vecEntries.size() << std::endl;
+
+        for ( unsigned int n = 0; n < this->m_vecEntries.size(); n++ ) {
+            const RegionEntry & entry = this->m_vecEntries[n];
+            file << "region " << n << " " << entry.nVoxels;
+            for ( unsigned int d = 0; d < 3; d++ ) {
+                file << " " << entry.box.GetIndex()[d];
+            }
+            for ( unsigned int d = 0; d < 3; d++ ) {
+                file << " " << entry.box.GetSize()[d];
+            }
+            file << " " << entry.runs.size() << std::endl;
+
+            for ( SizeValueType r = 0; r < entry.runs.size(); r++ ) {
+                file << entry.runs[r].nStart << " " << entry.runs[r].nLength << "\n";
+            }
+        }
+
+        return file.good();
+    }
+
+    //Reads a file written by Write(). Returns false, leaving the index
+    //empty, if the file cannot be read.
+    bool Read( const std::string & sFileName ) {
+        this->Clear();
+
+        std::ifstream file( sFileName.c_str() );
+        std::string sTag;
+        int nVersion = 0;
+
+        if ( !( file >> sTag >> nVersion ) || sTag != "PETPVC_REGION_INDEX" || nVersion != 2 ) {
+            return false;
+        }
+
+        itk::uint64_t nMaskChecksum = 0;
+        if ( !( file >> sTag >> nMaskChecksum ) || sTag != "mask" ) {
+            return false;
+        }
+
+        IndexType volumeIndex;
+        SizeType volumeSize;
+        file >> sTag;
+        for ( unsigned int d = 0; d < 3; d++ ) {
+            file >> volumeIndex[d];
+        }
+        for ( unsigned int d = 0; d < 3; d++ ) {
+            file >> volumeSize[d];
+        }
+        this->m_volume.SetIndex( volumeIndex );
+        this->m_volume.SetSize( volumeSize );
+
+        SizeValueType nRegions = 0;
+        file >> sTag >> nRegions;
+        if ( !file ) {
+            return false;
+        }
+
+        this->m_vecEntries.resize( nRegions );
+
+        for ( SizeValueType n = 0; n < nRegions; n++ ) {
+            RegionEntry & entry = this->m_vecEntries[n];
+            SizeValueType nRegion = 0;
+            SizeValueType nRuns = 0;
+            IndexType boxIndex;
+            SizeType boxSize;
+
+            file >> sTag >> nRegion >> entry.nVoxels;
+            for ( unsigned int d = 0; d < 3; d++ ) {
+                file >> boxIndex[d];
+            }
+            for ( unsigned int d = 0; d < 3; d++ ) {
+                file >> boxSize[d];
+            }
+            file >> nRuns;
+
+            if ( !file || sTag != "region" || nRegion != n ) {
+                this->Clear();
+                return false;
+            }
+
+            entry.box.SetIndex( boxIndex );
+            entry.box.SetSize( boxSize );
+            entry.runs.resize( nRuns );
+            for ( SizeValueType r = 0; r < nRuns; r++ ) {
+                file >> entry.runs[r].nStart >> entry.runs[r].nLength;
+            }
+        }
+
+        if ( !file ) {
+            this->Clear();
+            return false;
+        }
+
+        this->m_nMaskChecksum = nMaskChecksum;
+        this->UpdateNeighbours();
+        this->Modified();
+        return true;
+    }
+
+protected:
+    RegionIndex() {
+        this->m_radius.Fill( 0 );
+        this->m_volume.GetModifiableSize().Fill( 0 );
+        this->m_nMaskChecksum = 0;
+    }
+    ~RegionIndex() {}
+
+private:
+    RegionIndex(const Self &); //purposely not implemented
+    void operator=(const Self &);  //purposely not implemented
+
+    struct RegionEntry {
+        RegionType box;
+        SizeValueType nVoxels;
+        VoxelRunList runs;
+
+        RegionEntry() : nVoxels( 0 ) {
+            box.GetModifiableSize().Fill( 0 );
+        }
+    };
+
+    //Region of a label, or -1 if it is not indexed.
+    template< class TLabel >
+    struct MapLookup {
+        const std::map< TLabel, unsigned int > * mapIndex;
+
+        int operator()( TLabel label ) const {
+            typename std::map< TLabel, unsigned int >::const_iterator it = this->mapIndex->find( label );
+            return ( it != this->mapIndex->end() ) ? (int) it->second : -1;
+        }
+    };
+
+    struct DirectLookup {
+        unsigned int nLabels;
+
+        template< class TLabel >
+        int operator()( TLabel label ) const {
+            return ( label < this->nLabels ) ? (int) label : -1;
+        }
+    };
+
+    //Adds the runs of each label, looking its region up once per run.
+    template< class TLabelImage, class TLookup >
+    void IndexLabels( const TLabelImage * labels, unsigned int nRegions, const TLookup & lookup ) {
+        typedef typename TLabelImage::PixelType LabelType;
+
+        this->Clear();
+        this->m_volume = labels->GetBufferedRegion();
+        this->m_vecEntries.resize( nRegions );
+
+        const LabelType * pLabels = labels->GetBufferPointer();
+        const SizeType size = this->m_volume.GetSize();
+
+        SizeValueType nOffset = 0;
+        for ( SizeValueType z = 0; z < size[2]; z++ ) {
+            for ( SizeValueType y = 0; y < size[1]; y++ ) {
+                SizeValueType x = 0;
+                while ( x < size[0] ) {
+                    //Find the end of the run of this label.
+                    const LabelType label = pLabels[nOffset + x];
+                    SizeValueType xEnd = x + 1;
+                    while ( xEnd < size[0] && pLabels[nOffset + xEnd] == label ) {
+                        xEnd++;
+                    }
+
+                    const int nRegion = lookup( label );
+                    if ( nRegion >= 0 ) {
+                        AppendRun( this->m_vecEntries[nRegion], this->m_volume, nOffset + x, xEnd - x, x, y, z );
+                    }
+                    x = xEnd;
+                }
+                nOffset += size[0];
+            }
+        }
+
+        this->UpdateNeighbours();
+        this->Modified();
+    }
+
+    //Adds the run of nLength voxels starting at (x, y, z) of the volume,
+    //which is nStart voxels into its buffer, to a region.
+    static void AppendRun( RegionEntry & entry, const RegionType & volume, SizeValueType nStart,
+                           SizeValueType nLength, SizeValueType x, SizeValueType y, SizeValueType z ) {
+        IndexType first = volume.GetIndex();
+        first[0] += x;
+        first[1] += y;
+        first[2] += z;
+
+        if ( entry.nVoxels == 0 ) {
+            SizeType size;
+            size[0] = nLength;
+            size[1] = 1;
+            size[2] = 1;
+            entry.box.SetIndex( first );
+            entry.box.SetSize( size );
+        } else {
+            IndexType lower = entry.box.GetIndex();
+            IndexType upper = entry.box.GetUpperIndex();
+            IndexType last = first;
+            last[0] += nLength - 1;
+
+            for ( unsigned int d = 0; d < 3; d++ ) {
+                lower[d] = std::min( lower[d], first[d] );
+                upper[d] = std::max( upper[d], last[d] );
+            }
+            entry.box.SetIndex( lower );
+            entry.box.SetUpperIndex( upper );
+        }
+
+        VoxelRun run;
+        run.nStart = nStart;
+        run.nLength = nLength;
+        entry.runs.push_back( run );
+        entry.nVoxels += nLength;
+    }
+
+    //Finds the runs of non-zero voxels of one volume.
+    template< class TPixel >
+    static void IndexVolume( const TPixel * pData, const RegionType & volume, RegionEntry & entry ) {
+        const SizeType size = volume.GetSize();
+
+        SizeValueType nOffset = 0;
+        for ( SizeValueType z = 0; z < size[2]; z++ ) {
+            for ( SizeValueType y = 0; y < size[1]; y++ ) {
+                SizeValueType x = 0;
+                while ( x < size[0] ) {
+                    if ( pData[nOffset + x] == 0 ) {
+                        x++;
+                        continue;
+                    }
+
+                    SizeValueType xEnd = x + 1;
+                    while ( xEnd < size[0] && pData[nOffset + xEnd] != 0 ) {
+                        xEnd++;
+                    }
+
+                    AppendRun( entry, volume, nOffset + x, xEnd - x, x, y, z );
+                    x = xEnd;
+                }
+                nOffset += size[0];
+            }
+        }
+    }
+
+    struct IndexVolumesFunctor {
+        const std::vector< typename TImage::Pointer > * regions;
+        std::vector< RegionEntry > * entries;
+
+        void operator()( SizeValueType nFirst, SizeValueType nLast, SizeValueType ) const {
+            for ( SizeValueType n = nFirst; n < nLast; n++ ) {
+                const TImage * region = ( *this->regions )[n];
+                IndexVolume( region->GetBufferPointer(), region->GetBufferedRegion(), ( *this->entries )[n] );
+            }
+        }
+    };
+
+    void UpdateNeighbours() {
+        const unsigned int nRegions = this->m_vecEntries.size();
+        this->m_vecNeighbours.assign( nRegions, std::vector< unsigned int >() );
+
+        std::vector< RegionType > vecBoxes( nRegions );
+        for ( unsigned int n = 0; n < nRegions; n++ ) {
+            vecBoxes[n] = this->GetDilatedBoundingBox( n );
+        }
+
+        for ( unsigned int i = 0; i < nRegions; i++ ) {
+            if ( this->m_vecEntries[i].nVoxels == 0 ) {
+                continue;
+            }
+            for ( unsigned int j = 0; j < nRegions; j++ ) {
+                if ( this->m_vecEntries[j].nVoxels == 0 ) {
+                    continue;
+                }
+                //Crop() fails if the boxes do not overlap.
+                RegionType overlap = vecBoxes[i];
+                if ( overlap.Crop( vecBoxes[j] ) ) {
+                    this->m_vecNeighbours[i].push_back( j );
+                }
+            }
+        }
+    }
+
+    RegionType m_volume;
+    SizeType m_radius;
+    std::vector< RegionEntry > m_vecEntries;
+    std::vector< std::vector< unsigned int > > m_vecNeighbours;
+    itk::uint64_t m_nMaskChecksum;
+};
+
+//Sum of an image over a list of runs.
+template< class TPixel >
+struct RunSumFunctor {
+    const TPixel * pData;
+    const VoxelRun * pRuns;
+
+    double operator()( SizeValueType nFirst, SizeValueType nLast ) const {
+        double fSum = 0.0;
+        for ( SizeValueType r = nFirst; r < nLast; r++ ) {
+            const TPixel * pRun = this->pData + this->pRuns[r].nStart;
+            for ( SizeValueType i = 0; i < this->pRuns[r].nLength; i++ ) {
+                fSum += pRun[i];
+            }
+        }
+        return fSum;
+    }
+};
+
+template< class TPixel1, class TPixel2 >
+struct RunProductSumFunctor {
+    const TPixel1 * pData1;
+    const TPixel2 * pData2;
+    const VoxelRun * pRuns;
+
+    double operator()( SizeValueType nFirst, SizeValueType nLast ) const {
+        double fSum = 0.0;
+        for ( SizeValueType r = nFirst; r < nLast; r++ ) {
+            const SizeValueType nStart = this->pRuns[r].nStart;
+            for ( SizeValueType i = nStart; i < nStart + this->pRuns[r].nLength; i++ ) {
+                fSum += (double) this->pData1[i] * this->pData2[i];
+            }
+        }
+        return fSum;
+    }
+};
+
+//Sum of the voxels of an image that lie in the runs.
+template< class TImage >
+double RunSum( const TImage * image, const VoxelRunList & runs )
+{
+    if ( runs.empty() ) {
+        return 0.0;
+    }
+
+    RunSumFunctor< typename TImage::PixelType > functor;
+    functor.pData = image->GetBufferPointer();
+    functor.pRuns = &runs[0];
+
+    return ParallelSum( 0, runs.size(), functor );
+}
+
+//As ImageProductSum(), but only over the voxels in the runs, e.g. those of
+//the region that one of the images is zero outside.
+template< class TImage1, class TImage2 >
+double RunProductSum( const TImage1 * image1, const TImage2 * image2, const VoxelRunList & runs )
+{
+    if ( runs.empty() ) {
+        return 0.0;
+    }
+
+    RunProductSumFunctor< typename TImage1::PixelType, typename TImage2::PixelType > functor;
+    functor.pData1 = image1->GetBufferPointer();
+    functor.pData2 = image2->GetBufferPointer();
+    functor.pRuns = &runs[0];
+
+    return ParallelSum( 0, runs.size(), functor );
+}
+
+template< class TPixel, class TRegionPixel >
+struct ScaledRunsFunctor {
+    TPixel * pData;
+    const TRegionPixel * pRegion;
+    const VoxelRun * pRuns;
+    double fScale;
+    bool bAdd;
+
+    void operator()( SizeValueType nFirst, SizeValueType nLast, SizeValueType ) const {
+        for ( SizeValueType r = nFirst; r < nLast; r++ ) {
+            const SizeValueType nStart = this->pRuns[r].nStart;
+            for ( SizeValueType i = nStart; i < nStart + this->pRuns[r].nLength; i++ ) {
+                const double fBase = this->bAdd ? (double) this->pData[i] : 0.0;
+                this->pData[i] = static_cast< TPixel >( fBase + this->fScale * this->pRegion[i] );
+            }
+        }
+    }
+};
+
+template< class TImage, class TRegionImage >
+void ApplyScaledRuns( TImage * image, const TRegionImage * region, double fScale, const VoxelRunList & runs, bool bAdd )
+{
+    ScaledRunsFunctor< typename TImage::PixelType, typename TRegionImage::PixelType > functor;
+    functor.pData = image->GetBufferPointer();
+    functor.pRegion = region->GetBufferPointer();
+    functor.pRuns = runs.empty() ? NULL : &runs[0];
+    functor.fScale = fScale;
+    functor.bAdd = bAdd;
+
+    ParallelFor( 0, runs.size(), functor );
+
+    image->Modified();
+}
+
+//Adds fScale times region to image, over the voxels in the runs. Runs must
+//not overlap.
+template< class TImage, class TRegionImage >
+void AddScaledRuns( TImage * image, const TRegionImage * region, double fScale, const VoxelRunList & runs )
+{
+    ApplyScaledRuns( image, region, fScale, runs, true );
+}
+
+//Sets image to fScale times region, over the voxels in the runs.
+template< class TImage, class TRegionImage >
+void SetScaledRuns( TImage * image, const TRegionImage * region, double fScale, const VoxelRunList & runs )
+{
+    ApplyScaledRuns( image, region, fScale, runs, false );
+}
+
+//Runs covering a box of a volume, one per row.
+template< class TRegion >
+VoxelRunList BoxRuns( const TRegion & box, const TRegion & volume )
+{
+    VoxelRunList runs;
+    if ( box.GetNumberOfPixels() == 0 ) {
+        return runs;
+    }
+
+    const SizeValueType nX = volume.GetSize()[0];
+    const SizeValueType nY = volume.GetSize()[1];
+
+    for ( SizeValueType z = 0; z < box.GetSize()[2]; z++ ) {
+        for ( SizeValueType y = 0; y < box.GetSize()[1]; y++ ) {
+            const SizeValueType nZ = box.GetIndex()[2] - volume.GetIndex()[2] + z;
+            const SizeValueType nRow = box.GetIndex()[1] - volume.GetIndex()[1] + y;
+
+            VoxelRun run;
+            run.nStart = ( nZ * nY + nRow ) * nX + ( box.GetIndex()[0] - volume.GetIndex()[0] );
+            run.nLength = box.GetSize()[0];
+            runs.push_back( run );
+        }
+    }
+
+    return runs;
+}
+
+//Copies the part of image inside box. The copy keeps the index of the box.
+template< class TImage >
+typename TImage::Pointer ExtractBox( const TImage * image, const typename TImage::RegionType & box )
+{
+    typedef ExtractImageFilter< TImage, TImage > ExtractFilterType;
+
+    typename ExtractFilterType::Pointer extractFilter = ExtractFilterType::New();
+    extractFilter->SetInput( image );
+    extractFilter->SetExtractionRegion( box );
+    extractFilter->SetDirectionCollapseToSubmatrix();
+    extractFilter->Update();
+
+    typename TImage::Pointer extracted = extractFilter->GetOutput();
+    extracted->DisconnectPipeline();
+    return extracted;
+}
+
+//Blurs the part of image inside box. The result covers only the box. If
+//image is zero outside the box shrunk by the kernel radius, e.g. box is a
+//region's dilated bounding box, the result is the same as blurring the
+//whole image, which is zero outside the box.
+template< class TImage >
+typename TImage::Pointer BlurInBox( const TImage * image, const typename TImage::RegionType & box,
+                                    const itk::Vector<float, 3> & vecVariance, const Object * owner )
+{
+    typedef DiscreteGaussianImageFilter< TImage, TImage > BlurringFilterType;
+
+    typename BlurringFilterType::Pointer blurFilter = BlurringFilterType::New();
+    ProfileFilter( blurFilter.GetPointer(), owner, "blur" );
+    blurFilter->SetVariance( vecVariance );
+
+    if ( box == image->GetBufferedRegion() ) {
+        blurFilter->SetInput( image );
+    } else {
+        blurFilter->SetInput( ExtractBox( image, box ) );
+    }
+
+    blurFilter->Update();
+
+    typename TImage::Pointer blurred = blurFilter->GetOutput();
+    blurred->DisconnectPipeline();
+    return blurred;
+}
+
+//Copies the buffered region of source into the same region of target.
+template< class TImage >
+void CopyBox( const TImage * source, TImage * target )
+{
+    ImageRegionConstIterator< TImage > itSource( source, source->GetBufferedRegion() );
+    ImageRegionIterator< TImage > itTarget( target, source->GetBufferedRegion() );
+
+    for ( ; !itSource.IsAtEnd(); ++itSource, ++itTarget ) {
+        itTarget.Set( itSource.Get() );
+    }
+
+    target->Modified();
+}
+
+//Adds the buffered region of source to the same region of target.
+template< class TImage >
+void AddBox( const TImage * source, TImage * target )
+{
+    ImageRegionConstIterator< TImage > itSource( source, source->GetBufferedRegion() );
+    ImageRegionIterator< TImage > itTarget( target, source->GetBufferedRegion() );
+
+    for ( ; !itSource.IsAtEnd(); ++itSource, ++itTarget ) {
+        itTarget.Set( static_cast< typename TImage::PixelType >( (double) itTarget.Get() + itSource.Get() ) );
+    }
+
+    target->Modified();
+}
+
+} //namespace petpvc
+
+#endif // __PETPVCREGIONINDEX_H
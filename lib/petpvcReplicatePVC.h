@@ -0,0 +1,481 @@
+/*
+   petpvcReplicatePVC.h
+
+   Author:      Benjamin A. Thomas
+
+   Copyright 2026 Institute of Nuclear Medicine, University College London.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+ */
+
+/*
+   GTM, RBV and iterative Yang for a 4-D stack of replicates of one PET
+   image, e.g. the noisy realisations written by pvc_simulate.
+
+   Everything that only depends on the mask is done once: the regions and
+   their index, the blurred regions, and the inverse of the GTM (or, for
+   IY, the fuzziness) matrix. The regional sums of all replicates are then
+   found in one pass over each region, as a (regions x voxels) by
+   (voxels x replicates) product, and the corrected means of all replicates
+   are one matrix product. The blur is linear, so a blurred pseudo-image is
+   the sum of the blurred regions weighted by their means, and no replicate
+   needs a blur of its own.
+ */
+
+#ifndef __PETPVCREPLICATEPVC_H
+#define __PETPVCREPLICATEPVC_H
+
+#include <itkObject.h>
+#include <itkObjectFactory.h>
+#include <itkImage.h>
+#include <vnl/vnl_matrix.h>
+#include <vnl/algo/vnl_matrix_inverse.h>
+
+#include "petpvcGTMImageFilter.h"
+#include "petpvcFuzzyCorrectionFilter.h"
+#include "petpvcMaskContext.h"
+#include "petpvcRegionIndex.h"
+#include "petpvcImageExpression.h"
+#include "petpvcVolumeView.h"
+#include "petpvcParallel.h"
+#include "petpvcProfiler.h"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace itk;
+
+namespace petpvc
+{
+
+/** \class ReplicatePVC
+ *
+ * \brief Corrects every volume of a stack of replicates, sharing all of the
+ * work on the mask between them.
+ *
+ */
+template< class TImage, class TMaskImage >
+class ReplicatePVC : public Object
+{
+public:
+    typedef ReplicatePVC Self;
+    typedef Object Superclass;
+    typedef SmartPointer< Self > Pointer;
+    typedef SmartPointer< const Self > ConstPointer;
+
+    itkNewMacro( Self );
+
+    itkTypeMacro( ReplicatePVC, Object );
+
+    typedef typename TImage::Pointer ImagePointer;
+    typedef typename TImage::PixelType PixelType;
+    typedef Image< PixelType, 4 > StackImageType;
+    typedef typename StackImageType::Pointer StackImagePointer;
+    typedef MaskContext< TImage > MaskContextType;
+    typedef typename MaskContextType::RegionIndexType RegionIndexType;
+    typedef GTMImageFilter< TMaskImage > GTMImageFilterType;
+    typedef FuzzyCorrectionFilter< TMaskImage > FuzzyCorrFilterType;
+    typedef itk::Vector<float, 3> ITKVectorType;
+    typedef vnl_matrix<float> MatrixType;
+
+    enum Method { EGTM, ERBV, EIterativeYang };
+
+    void SetMethod( Method method ) {
+        this->m_method = method;
+    }
+
+    void SetPSF( ITKVectorType vec ) {
+        this->m_vecVariance = vec;
+    }
+
+    //Iterations of IY.
+    void SetIterations( unsigned int nIterations ) {
+        this->m_nIterations = nIterations;
+    }
+
+    //IY stops early once the corrected means change by less than this
+    //fraction between iterations. 0, the default, runs every iteration.
+    void SetStoppingCond( float stop ) {
+        this->m_fStopCriterion = stop;
+    }
+
+    //IY starts each replicate from the corrected means of the one before,
+    //instead of from its PET data.
+    void SetWarmStart( bool bWarmStart ) {
+        this->m_bWarmStart = bWarmStart;
+    }
+
+    void SetVerbose( bool bVerbose ) {
+        this->m_bVerbose = bVerbose;
+    }
+
+    //Corrects every volume of stack. RBV and IY return the corrected stack;
+    //GTM only finds the corrected means, and returns NULL.
+    StackImagePointer Correct( const StackImageType * stack, const TMaskImage * mask );
+
+    //Corrected mean of each region (rows) in each replicate (columns). For
+    //RBV and IY, these are the means of the corrected images over the
+    //regions.
+    const MatrixType & GetCorrectedMeans() const {
+        return this->m_matMeans;
+    }
+
+    //Writes the mean and variance over the replicates of the corrected mean
+    //of each region. Returns false if the file cannot be written.
+    bool WriteSummary( const std::string & sFileName ) const;
+
+    //Writes the corrected mean of each region in each replicate.
+    bool WriteMeans( const std::string & sFileName ) const;
+
+protected:
+    ReplicatePVC() {
+        this->m_method = ERBV;
+        this->m_vecVariance.Fill( 0.0 );
+        this->m_nIterations = 10;
+        this->m_fStopCriterion = 0.0;
+        this->m_bWarmStart = false;
+        this->m_bVerbose = false;
+    }
+    ~ReplicatePVC() {}
+
+private:
+    ReplicatePVC(const Self &); //purposely not implemented
+    void operator=(const Self &);  //purposely not implemented
+
+    //Sum of each region times each volume. Each region is summed by one
+    //thread, so the result does not depend on the number of threads.
+    struct RegionSumsFunctor {
+        const std::vector< ImagePointer > * regions;
+        const RegionIndexType * index;
+        //First voxel of each volume.
+        std::vector< const PixelType * > vecVolumes;
+        vnl_matrix< double > * sums;
+
+        void operator()( SizeValueType nFirst, SizeValueType nLast, SizeValueType ) const {
+            const unsigned int nVolumes = this->vecVolumes.size();
+            std::vector< double > vecSums( nVolumes );
+
+            for ( SizeValueType n = nFirst; n < nLast; n++ ) {
+                const PixelType * pRegion = ( *this->regions )[n]->GetBufferPointer();
+                const VoxelRunList & runs = this->index->GetRuns( n );
+                std::fill( vecSums.begin(), vecSums.end(), 0.0 );
+
+                //The region's run is reused for every volume while it is in
+                //cache.
+                for ( SizeValueType r = 0; r < runs.size(); r++ ) {
+                    const SizeValueType nStart = runs[r].nStart;
+                    const SizeValueType nEnd = nStart + runs[r].nLength;
+                    for ( unsigned int v = 0; v < nVolumes; v++ ) {
+                        const PixelType * pVolume = this->vecVolumes[v];
+                        double fSum = 0.0;
+                        for ( SizeValueType i = nStart; i < nEnd; i++ ) {
+                            fSum += (double) pRegion[i] * pVolume[i];
+                        }
+                        vecSums[v] += fSum;
+                    }
+                }
+
+                for ( unsigned int v = 0; v < nVolumes; v++ ) {
+                    ( *this->sums )( n, v ) = vecSums[v];
+                }
+            }
+        }
+    };
+
+    vnl_matrix< double > RegionSums( const std::vector< const PixelType * > & vecVolumes ) const {
+        vnl_matrix< double > sums( this->m_vecRegions.size(), vecVolumes.size(), 0.0 );
+
+        RegionSumsFunctor functor;
+        functor.regions = &this->m_vecRegions;
+        functor.index = this->m_index;
+        functor.vecVolumes = vecVolumes;
+        functor.sums = &sums;
+        ParallelFor( 0, this->m_vecRegions.size(), functor );
+
+        return sums;
+    }
+
+    //Fills pseudo with the regions, and blurred with the blurred regions,
+    //weighted by vecMeans.
+    void MakePseudoImages( const vnl_vector< float > & vecMeans, TImage * pseudo, TImage * blurred ) {
+        pseudo->FillBuffer( 0 );
+        blurred->FillBuffer( 0 );
+        for ( unsigned int n = 0; n < this->m_vecRegions.size(); n++ ) {
+            AddScaledRuns( pseudo, this->m_vecRegions[n].GetPointer(), vecMeans[n], this->m_index->GetRuns( n ) );
+            AddScaledRuns( blurred, this->m_context->GetBlurredRegion( n ).GetPointer(), vecMeans[n],
+                           this->m_vecDilatedRuns[n] );
+        }
+    }
+
+    Method m_method;
+    ITKVectorType m_vecVariance;
+    unsigned int m_nIterations;
+    float m_fStopCriterion;
+    bool m_bWarmStart;
+    bool m_bVerbose;
+
+    typename MaskContextType::Pointer m_context;
+    typename RegionIndexType::ConstPointer m_index;
+    std::vector< ImagePointer > m_vecRegions;
+    //Runs covering the dilated bounding box of each region.
+    std::vector< VoxelRunList > m_vecDilatedRuns;
+    MatrixType m_matMeans;
+};
+
+template< class TImage, class TMaskImage >
+typename ReplicatePVC< TImage, TMaskImage >::StackImagePointer
+ReplicatePVC< TImage, TMaskImage >
+::Correct( const StackImageType * stack, const TMaskImage * mask )
+{
+    const unsigned int nReplicates = stack->GetLargestPossibleRegion().GetSize()[3];
+
+    std::vector< ImagePointer > vecPET;
+    std::vector< const PixelType * > vecVolumes;
+    for ( unsigned int r = 0; r < nReplicates; r++ ) {
+        vecPET.push_back( GetVolumeView< TImage >( stack, r ) );
+        vecVolumes.push_back( vecPET[r]->GetBufferPointer() );
+    }
+
+    //The mask work, shared by all replicates.
+    this->m_context = MaskContextType::New();
+    this->m_context->SetPSF( this->m_vecVariance );
+    this->m_context->SetCacheBlurredRegions( this->m_method != EGTM );
+    this->m_context->SetMask( mask, vecPET[0].GetPointer() );
+
+    const unsigned int nRegions = this->m_context->GetNumberOfRegions();
+    this->m_index = this->m_context->GetRegionIndex();
+
+    this->m_vecRegions.clear();
+    this->m_vecDilatedRuns.clear();
+    for ( unsigned int n = 0; n < nRegions; n++ ) {
+        this->m_vecRegions.push_back( this->m_context->GetRegion( n ) );
+        this->m_vecDilatedRuns.push_back( BoxRuns( this->m_index->GetDilatedBoundingBox( n ),
+                                                   this->m_index->GetVolumeRegion() ) );
+    }
+
+    MatrixType matInverse;
+    vnl_vector< float > vecRegSize;
+
+    if ( this->m_method == EIterativeYang ) {
+        typename FuzzyCorrFilterType::Pointer pFuzzyCorrFilter = FuzzyCorrFilterType::New();
+        pFuzzyCorrFilter->SetInput( mask );
+        pFuzzyCorrFilter->Update();
+
+        ScopedStageTimer solverTimer( this, "solver" );
+        matInverse = vnl_matrix_inverse< float >( pFuzzyCorrFilter->GetMatrix() ).inverse();
+        vecRegSize = pFuzzyCorrFilter->GetSumOfRegions();
+    } else {
+        typename GTMImageFilterType::Pointer pGTM = GTMImageFilterType::New();
+        pGTM->SetInput( mask );
+        pGTM->SetPSF( this->m_vecVariance );
+        pGTM->SetMaskContext( this->m_context );
+        pGTM->Update();
+
+        if ( this->m_bVerbose ) {
+            std::cout << "GTM:" << std::endl;
+            pGTM->GetMatrix().print( std::cout );
+        }
+
+        ScopedStageTimer solverTimer( this, "solver" );
+        matInverse = vnl_matrix_inverse< float >( pGTM->GetMatrix() ).inverse();
+        vecRegSize = pGTM->GetSumOfRegions();
+    }
+
+    //Corrected means of every replicate, as for RBVPVCImageFilter.
+    MatrixType matCorrected;
+    if ( this->m_method != EIterativeYang ) {
+        vnl_matrix< double > sums;
+        {
+            ScopedStageTimer statsTimer( this, "regional statistics" );
+            sums = this->RegionSums( vecVolumes );
+        }
+
+        MatrixType matMeans( nRegions, nReplicates );
+        for ( unsigned int n = 0; n < nRegions; n++ ) {
+            for ( unsigned int r = 0; r < nReplicates; r++ ) {
+                matMeans( n, r ) = sums( n, r ) / vecRegSize[n];
+            }
+        }
+
+        ScopedStageTimer solverTimer( this, "solver" );
+        matCorrected = matInverse * matMeans;
+    }
+
+    if ( this->m_method == EGTM ) {
+        this->m_matMeans = matCorrected;
+        return NULL;
+    }
+
+    StackImagePointer output = StackImageType::New();
+    output->CopyInformation( stack );
+    output->SetRegions( stack->GetLargestPossibleRegion() );
+    output->Allocate();
+
+    //One pseudo-image and its blur, reused by every replicate.
+    ImagePointer imagePseudo = NewImageLike( vecPET[0].GetPointer() );
+    ImagePointer imageBlurred = NewImageLike( vecPET[0].GetPointer() );
+
+    std::vector< const PixelType * > vecOutputs;
+
+    //Corrected means of the last IY iteration.
+    vnl_vector< float > vecCorrected;
+
+    for ( unsigned int r = 0; r < nReplicates; r++ ) {
+        ScopedStageTimer replicateTimer( this, "replicate", r + 1 );
+
+        const TImage * pet = vecPET[r];
+        ImagePointer imageEstimate = GetVolumeView< TImage >( output.GetPointer(), r );
+        vecOutputs.push_back( imageEstimate->GetBufferPointer() );
+
+        if ( this->m_method == ERBV ) {
+            this->MakePseudoImages( matCorrected.get_column( r ), imagePseudo, imageBlurred );
+            Evaluate( imageEstimate.GetPointer(),
+                      Expr( pet ) * ( Expr( imagePseudo ) / Expr( imageBlurred ) ) );
+            continue;
+        }
+
+        //Iterative Yang, as IterativeYangPVCImageFilter. A warm start makes
+        //the first estimate from the means of the previous replicate.
+        const bool bWarm = this->m_bWarmStart && vecCorrected.size() == nRegions;
+        if ( bWarm ) {
+            this->MakePseudoImages( vecCorrected, imagePseudo, imageBlurred );
+            Evaluate( imageEstimate.GetPointer(),
+                      Expr( pet ) * ( Expr( imagePseudo ) / Expr( imageBlurred ) ) );
+        } else {
+            Evaluate( imageEstimate.GetPointer(), Expr( pet ) );
+        }
+
+        std::vector< const PixelType * > vecEstimate( 1, imageEstimate->GetBufferPointer() );
+        vnl_vector< float > vecRegMeans( nRegions );
+        unsigned int nIterations = 0;
+
+        for ( unsigned int k = 1; k <= this->m_nIterations; k++ ) {
+            vnl_matrix< double > sums;
+            {
+                ScopedStageTimer statsTimer( this, "regional statistics" );
+                sums = this->RegionSums( vecEstimate );
+            }
+
+            for ( unsigned int n = 0; n < nRegions; n++ ) {
+                vecRegMeans[n] = std::max( (float) ( sums( n, 0 ) / vecRegSize[n] ), (float) 0.0 );
+            }
+
+            const vnl_vector< float > vecUpdated = matInverse * vecRegMeans;
+
+            //Relative change of the corrected means since the last iteration.
+            const bool bStopped = ( k > 1 || bWarm ) && this->m_fStopCriterion > 0.0 &&
+                                  ( vecUpdated - vecCorrected ).two_norm() <
+                                  this->m_fStopCriterion * vecUpdated.two_norm();
+            vecCorrected = vecUpdated;
+            nIterations = k;
+
+            this->MakePseudoImages( vecCorrected, imagePseudo, imageBlurred );
+            Evaluate( imageEstimate.GetPointer(),
+                      Expr( pet ) * ( Expr( imagePseudo ) / Expr( imageBlurred ) ) );
+
+            if ( bStopped ) {
+                break;
+            }
+        }
+
+        if ( this->m_bVerbose ) {
+            std::cout << "Replicate " << r + 1 << ": " << nIterations << " iterations" << std::endl;
+        }
+    }
+
+    //Means of the corrected images over the regions.
+    vnl_matrix< double > sums;
+    {
+        ScopedStageTimer statsTimer( this, "regional statistics" );
+        sums = this->RegionSums( vecOutputs );
+    }
+
+    this->m_matMeans.set_size( nRegions, nReplicates );
+    for ( unsigned int n = 0; n < nRegions; n++ ) {
+        const double fRegionSum = RunSum( this->m_vecRegions[n].GetPointer(), this->m_index->GetRuns( n ) );
+        for ( unsigned int r = 0; r < nReplicates; r++ ) {
+            this->m_matMeans( n, r ) = fRegionSum > 0.0 ? sums( n, r ) / fRegionSum : 0.0;
+        }
+    }
+
+    //Drop the blurred regions, which take one image each.
+    this->m_context->ReleaseBlurredRegions();
+
+    return output;
+}
+
+template< class TImage, class TMaskImage >
+bool ReplicatePVC< TImage, TMaskImage >
+::WriteSummary( const std::string & sFileName ) const
+{
+    std::ofstream file( sFileName.c_str() );
+    if ( !file.is_open() ) {
+        return false;
+    }
+
+    const unsigned int nReplicates = this->m_matMeans.cols();
+
+    file << "REGION\tMEAN\tVARIANCE" << std::endl;
+    for ( unsigned int n = 0; n < this->m_matMeans.rows(); n++ ) {
+        double fMean = 0.0;
+        for ( unsigned int r = 0; r < nReplicates; r++ ) {
+            fMean += this->m_matMeans( n, r );
+        }
+        fMean /= std::max( nReplicates, 1u );
+
+        //Unbiased variance over the replicates.
+        double fVariance = 0.0;
+        for ( unsigned int r = 0; r < nReplicates; r++ ) {
+            const double fDiff = this->m_matMeans( n, r ) - fMean;
+            fVariance += fDiff * fDiff;
+        }
+        fVariance = nReplicates > 1 ? fVariance / ( nReplicates - 1 ) : 0.0;
+
+        file << n + 1 << "\t" << fMean << "\t" << fVariance << std::endl;
+    }
+
+    return file.good();
+}
+
+template< class TImage, class TMaskImage >
+bool ReplicatePVC< TImage, TMaskImage >
+::WriteMeans( const std::string & sFileName ) const
+{
+    std::ofstream file( sFileName.c_str() );
+    if ( !file.is_open() ) {
+        return false;
+    }
+
+    file << "REGION";
+    for ( unsigned int r = 0; r < this->m_matMeans.cols(); r++ ) {
+        file << "\tREPLICATE" << r + 1;
+    }
+    file << std::endl;
+
+    for ( unsigned int n = 0; n < this->m_matMeans.rows(); n++ ) {
+        file << n + 1;
+        for ( unsigned int r = 0; r < this->m_matMeans.cols(); r++ ) {
+            file << "\t" << this->m_matMeans( n, r );
+        }
+        file << std::endl;
+    }
+
+    return file.good();
+}
+
+} //namespace petpvc
+
+#endif // __PETPVCREPLICATEPVC_H
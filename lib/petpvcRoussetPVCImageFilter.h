@@ -28,7 +28,6 @@
 
 #include <itkExtractImageFilter.h>
 #include <itkMultiplyImageFilter.h>
-#include <itkStatisticsImageFilter.h>
 
 
 using namespace itk;
@@ -66,13 +65,12 @@ public:
     typedef typename TMaskImage::IndexType  MaskIndexType;
     typedef typename TMaskImage::PixelType  MaskPixelType;
 
-    //For calculating mean values from image
-    typedef itk::StatisticsImageFilter<TInputImage> StatisticsFilterType;
     //Extracts a 3D volume from 4D file.
     typedef itk::ExtractImageFilter<TMaskImage, TInputImage> ExtractFilterType;
     typedef itk::MultiplyImageFilter<InputImageType, TInputImage> MultiplyFilterType;
 
     typedef GTMImageFilter<TMaskImage> GTMImageFilterType;
+    typedef typename GTMImageFilterType::MaskContextType MaskContextType;
     typedef itk::Vector<float, 3> ITKVectorType;
 
     /** Image related typedefs. */
@@ -117,6 +115,12 @@ public:
         this->m_bVerbose = bVerbose;
     }
 
+    //Shares the regions, and any blurred regions, with other filters.
+    void SetMaskContext( MaskContextType * context ) {
+        this->m_maskContext = context;
+        this->Modified();
+    }
+
 protected:
     RoussetPVCImageFilter();
     ~RoussetPVCImageFilter() {}
@@ -128,6 +132,7 @@ protected:
     MatrixType m_matGTM;
     ITKVectorType m_vecVariance;
     bool m_bVerbose;
+    typename MaskContextType::Pointer m_maskContext;
 
 private:
     RoussetPVCImageFilter(const Self &); //purposely not implemented
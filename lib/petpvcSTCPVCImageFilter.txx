@@ -26,6 +26,12 @@
 #include "itkObjectFactory.h"
 #include "itkImageRegionIterator.h"
 #include "itkImageRegionConstIterator.h"
+#include "petpvcProfiler.h"
+#include "petpvcParallel.h"
+#include "petpvcReduction.h"
+#include "petpvcImageExpression.h"
+#include "petpvcRegionIndex.h"
+#include <vector>
 #include <stdexcept>
 
 using namespace itk;
@@ -39,6 +45,9 @@ STCPVCImageFilter< TInputImage, TMaskImage>
 {
     this->m_nIterations = 10;
     this->m_bVerbose = false;
+    this->m_fDeadline = 0.0;
+    this->m_nCurrentIteration = 0;
+    this->m_imageCurrentEstimate = NULL;
 }
 
 template< class TInputImage, class TMaskImage >
@@ -72,26 +81,16 @@ void STCPVCImageFilter< TInputImage, TMaskImage>
     desiredStart.Fill(0);
     MaskSizeType desiredSize = imageSize;
 
-    //Stats. filter used to calculate statistics for an image.
-    typename StatisticsFilterType::Pointer statsFilter = StatisticsFilterType::New();
-
-    //Multiplies two images together.
-    typename MultiplyFilterType::Pointer multiplyFilter = MultiplyFilterType::New();
-
     typename TInputImage::Pointer imageExtractedRegion;
 
-    typename LabelStatisticsFilterType::Pointer labelStatsFilter = LabelStatisticsFilterType::New();
-    typename BinaryThresholdImageFilterType::Pointer binThreshFilter = BinaryThresholdImageFilterType::New();
-
-    binThreshFilter->SetInput( pMask );
-    binThreshFilter->SetInsideValue(1);
-    binThreshFilter->SetOutsideValue(0);
+    //Replace the labels by dense indices, so that per-label loops use the
+    //index directly instead of a map lookup.
+    typedef typename LabelCompactionType::IndexImageType IndexImageType;
+    typename LabelCompactionType::Pointer labelCompaction = LabelCompactionType::New();
+    labelCompaction->Compact( pMask.GetPointer() );
+    IndexImageType * imageIndex = labelCompaction->GetIndexImage();
 
-    labelStatsFilter->SetLabelInput( pMask );
-    labelStatsFilter->SetInput( pPET );
-    labelStatsFilter->Update();
-
-    int numOfLabels = labelStatsFilter->GetNumberOfLabels();
+    int numOfLabels = labelCompaction->GetNumberOfLabels();
     nClasses = numOfLabels;
 
     if ( numOfLabels < 2 ) {
@@ -99,6 +98,9 @@ void STCPVCImageFilter< TInputImage, TMaskImage>
                 << std::endl;
         throw std::runtime_error("Mask file should contain at least 2 labels");
     }
+
+    //Labels present in the mask, in ascending order, as the means are stored.
+    const std::vector< LabelPixelType > & vecLabels = labelCompaction->GetLabels();
     if ( this->m_bVerbose )
         std::cout << "Number of labels: " << nClasses << std::endl;
 
@@ -123,80 +125,59 @@ void STCPVCImageFilter< TInputImage, TMaskImage>
     typename TInputImage::Pointer imageBackground;
 
     typename TInputImage::Pointer imageEstimate;
-    typename AddFilterType::Pointer addFilter = AddFilterType::New();
-    typename SubtractFilterType::Pointer subtractFilter = SubtractFilterType::New();
-    typename DuplicatorType::Pointer duplicator = DuplicatorType::New();
 
-    typename MultiplyFilterType::Pointer multiplyFilter2 = MultiplyFilterType::New();
-    typename DivideFilterType::Pointer divideFilter = DivideFilterType::New();
-    typename BlurringFilterType::Pointer pBlurFilter = BlurringFilterType::New();
+    //A blurred label is zero outside its bounding box grown by the kernel
+    //radius, so each label is only blurred and accumulated within that box.
+    typedef RegionIndex< TInputImage > RegionIndexType;
+    typename RegionIndexType::Pointer index = RegionIndexType::New();
+    index->SetCompactLabels( imageIndex, numOfLabels );
+    index->SetPSF( this->GetPSF(), pPET->GetSpacing() );
 
-    duplicator->SetInputImage( pPET );
-    duplicator->Update();
-
-    //Set image estimate to the original PET data for the first iteration.
-    imageEstimate = duplicator->GetOutput();
+    //The estimate is kept in the output buffer, so it does not have to be
+    //copied at the end. Start from the original PET data.
+    this->AllocateOutputs();
+    imageEstimate = output;
+    Evaluate( imageEstimate.GetPointer(), Expr( pPET ) );
 
-    pBlurFilter->SetVariance( this->GetPSF() );
+    //Crops of the index image to each label's box.
+    std::vector< typename IndexImageType::Pointer > vecIndexBoxes( numOfLabels );
 
     int i=0;
     //Calculate recovery factors
 
-    for( typename ValidLabelValuesType::const_iterator vIt=labelStatsFilter->GetValidLabelValues().begin();
-            vIt != labelStatsFilter->GetValidLabelValues().end(); ++vIt)
-    {
-        if ( labelStatsFilter->HasLabel(*vIt) )
-        {
-            LabelPixelType labelValue = *vIt;
-            binThreshFilter->SetLowerThreshold( labelValue );
-            binThreshFilter->SetUpperThreshold( labelValue );
-            binThreshFilter->Update();
-
-            imageExtractedRegion = binThreshFilter->GetOutput();
-            imageExtractedRegion->SetDirection( pPET->GetDirection() );
-            imageExtractedRegion->UpdateOutputData();
-
-            pBlurFilter->SetInput(imageExtractedRegion);
-            pBlurFilter->Update();
-
-            multiplyFilter->SetInput1( imageExtractedRegion );
-            multiplyFilter->SetInput2( pBlurFilter->GetOutput() );
-            multiplyFilter->Update();
-
-            //If this is the first region, create recovery factors image,
-            //else add the factors to the previous contents of imageRec.
-            if (i == 0) {
-                imageRec = multiplyFilter->GetOutput();
-            } else {
-                addFilter->SetInput1(imageRec);
-                addFilter->SetInput2(multiplyFilter->GetOutput());
-                addFilter->Update();
-
-                imageRec = addFilter->GetOutput();
-            }
-            imageRec->DisconnectPipeline();
+    imageRec = NewImageLike( pPET.GetPointer() );
+    imageRec->FillBuffer( 0 );
+    imageBackground = NewImageLike( pPET.GetPointer() );
 
-            i++;
-        }
+    for ( i = 0; i < numOfLabels; i++ ) {
+        const RegionType box = index->GetDilatedBoundingBox( i );
+        vecIndexBoxes[i] = ExtractBox( imageIndex, box );
+
+        //Binary mask of the label.
+        typename TInputImage::Pointer imageRecBox = ExtractBox( imageRec.GetPointer(), box );
+        imageExtractedRegion = EvaluateImage( imageRecBox.GetPointer(), Equal( Expr( vecIndexBoxes[i] ), i ) );
+        typename TInputImage::Pointer imageBlurred = BlurInBox( imageExtractedRegion.GetPointer(), box, this->GetPSF(), this );
+
+        //Add the recovery factors of this label to imageRec.
+        Evaluate( imageRecBox.GetPointer(),
+                  Expr( imageRecBox ) + Expr( imageExtractedRegion ) * Expr( imageBlurred ) );
+        CopyBox( imageRecBox.GetPointer(), imageRec.GetPointer() );
     }
 
     int nNumOfIters =  this->m_nIterations;
 
+    this->m_report = IterationReport();
+    IterationBudget budget;
+    budget.Start( this->m_fDeadline );
+
     //Correct for spill-out
 
     for (int k = 1; k <= nNumOfIters; k++) {
 
-        //Set up image iterator to operate directly on imageEstimate.
-        ImageIteratorType it( imageEstimate, imageEstimate->GetLargestPossibleRegion() );
-        PixelType voxelVal;
+        ScopedStageTimer iterationTimer( this, "iteration", k );
 
-        //Loop over all voxels and remove negative numbers.
-        while (! it.IsAtEnd() )
-        {
-            voxelVal = fmax(it.Get(), 0.0);
-            it.Set( voxelVal );
-            ++it;
-        }
+        //Remove negative numbers, working directly on imageEstimate.
+        Evaluate( imageEstimate.GetPointer(), Max( Expr( imageEstimate ), 0.0 ) );
 
         if ( this->m_bVerbose ) {
             if (k == 1) {
@@ -205,108 +186,94 @@ void STCPVCImageFilter< TInputImage, TMaskImage>
 
             std::cout << k << ":\t";
 
-            i = 0;
-            float fNewRegMean = 0;
-
-            labelStatsFilter->SetInput( imageEstimate );
-            labelStatsFilter->Update();
+            ScopedStageTimer statsTimer( this, "regional statistics" );
+            const std::vector< double > vecMeans = IndexMeans( imageEstimate.GetPointer(), imageIndex, numOfLabels );
 
-            for( typename ValidLabelValuesType::const_iterator vIt=labelStatsFilter->GetValidLabelValues().begin();
-                    vIt != labelStatsFilter->GetValidLabelValues().end(); ++vIt)
-            {
-                if ( labelStatsFilter->HasLabel(*vIt) )
-                {
-                    LabelPixelType labelValue = *vIt;
-                    //std::cout << "Label: " << labelValue << "\t";
-                    fNewRegMean = std::max( labelStatsFilter->GetMean( labelValue ), 0.0 );
-                    //std::cout << fNewRegMean << " ";
-                    vecRegMeansCurrent.put(i, fNewRegMean);
-                    i++;
-                }
+            for ( i = 0; i < numOfLabels; i++ ) {
+                vecRegMeansCurrent.put(i, std::max( vecMeans[i], 0.0 ) );
             }
 
             std::cout << vecRegMeansCurrent << std::endl;
         }
 
-        i=0;
+        imageBackground->FillBuffer( 0 );
 
-        for( typename ValidLabelValuesType::const_iterator vIt=labelStatsFilter->GetValidLabelValues().begin();
-                vIt != labelStatsFilter->GetValidLabelValues().end(); ++vIt)
-        {
-            if ( labelStatsFilter->HasLabel(*vIt) )
-            {
+        for ( i = 0; i < numOfLabels; i++ ) {
 
-                LabelPixelType labelValue = *vIt;
-
-                //checks on ROI size
-                if ( k == 1 ) {
-                    const typename LabelStatisticsFilterType::MapSizeType numOfVoxels = labelStatsFilter->GetCount( labelValue );
-                    if ( numOfVoxels == 0) {
-                        std::cerr << "[Error]\tMask file contains zero voxels in the ROI for label " << labelValue << "!"
-                                  << std::endl;
-                        throw std::runtime_error("Mask file contains zero voxels in the ROI");
-
-                    } else if ( numOfVoxels < 10 ) {
-                        std::cerr << "[Warning]\nMask file contains less than 10 voxels in the ROI. That is unlikely to work well.\n";
-                    }
-                    if ( this->m_bVerbose )
-                      std::cout << "Number of voxels in the ROI of label " << labelValue << ": " << numOfVoxels << std::endl;
-                }
+            LabelPixelType labelValue = vecLabels[i];
 
-                binThreshFilter->SetLowerThreshold( labelValue );
-                binThreshFilter->SetUpperThreshold( labelValue );
+            //checks on ROI size
+            if ( k == 1 ) {
+                const SizeValueType numOfVoxels = labelCompaction->GetNumberOfVoxels( i );
+                if ( numOfVoxels == 0) {
+                    std::cerr << "[Error]\tMask file contains zero voxels in the ROI for label " << labelValue << "!"
+                              << std::endl;
+                    throw std::runtime_error("Mask file contains zero voxels in the ROI");
 
-                multiplyFilter->SetInput1( imageEstimate );
-                multiplyFilter->SetInput2( binThreshFilter->GetOutput() );
+                } else if ( numOfVoxels < 10 ) {
+                    std::cerr << "[Warning]\nMask file contains less than 10 voxels in the ROI. That is unlikely to work well.\n";
+                }
+                if ( this->m_bVerbose )
+                  std::cout << "Number of voxels in the ROI of label " << labelValue << ": " << numOfVoxels << std::endl;
+            }
 
-                pBlurFilter->SetInput(multiplyFilter->GetOutput());
+            const RegionType box = index->GetDilatedBoundingBox( i );
+            const typename IndexImageType::Pointer indexBox = vecIndexBoxes[i];
 
-                //bkg = bkg + ( cc * (1-mask))
+            //Current estimate inside the label.
+            typename TInputImage::Pointer imageEstimateBox = ExtractBox( imageEstimate.GetPointer(), box );
+            Evaluate( imageEstimateBox.GetPointer(), Expr( imageEstimateBox ) * Equal( Expr( indexBox ), i ) );
+            typename TInputImage::Pointer imageBlurred = BlurInBox( imageEstimateBox.GetPointer(), box, this->GetPSF(), this );
 
-                subtractFilter->SetInput1( 1.0 );
-                subtractFilter->SetInput2( binThreshFilter->GetOutput() );
+            //bkg = bkg + ( cc * (1-mask))
+            typename TInputImage::Pointer imageBackgroundBox = ExtractBox( imageBackground.GetPointer(), box );
+            Evaluate( imageBackgroundBox.GetPointer(),
+                      Expr( imageBackgroundBox ) + Expr( imageBlurred ) * ( 1.0 - Equal( Expr( indexBox ), i ) ) );
+            CopyBox( imageBackgroundBox.GetPointer(), imageBackground.GetPointer() );
+        }
 
-                multiplyFilter2->SetInput1( pBlurFilter->GetOutput() );
-                multiplyFilter2->SetInput2( subtractFilter->GetOutput() );
-                multiplyFilter2->Update();
+        //- output = ( orig - bkg ) / rec
 
-                if (i==0){
-                    imageBackground = multiplyFilter2->GetOutput();
-                }
-                else {
-                    addFilter->SetInput1(imageBackground);
-                    addFilter->SetInput2(multiplyFilter2->GetOutput());
-                    addFilter->Update();
-                    imageBackground = addFilter->GetOutput();
-                }
-                imageBackground->DisconnectPipeline();
+        Evaluate( imageEstimate.GetPointer(), ( Expr( pPET ) - Expr( imageBackground ) ) / Expr( imageRec ) );
+
+        //Let any observers see the estimate and means of this iteration. With
+        //a deadline, the change of the means is also reported.
+        if ( this->HasObserver( itk::IterationEvent() ) || this->m_fDeadline > 0.0 ) {
+            std::vector< double > vecMeans;
+            {
+                ScopedStageTimer statsTimer( this, "regional statistics" );
+                vecMeans = IndexMeans( imageEstimate.GetPointer(), imageIndex, numOfLabels );
             }
-            i++;
-        }
 
-        //- output = ( orig - bkg ) / rec
+            for ( i = 0; i < numOfLabels; i++ ) {
+                vecRegMeansUpdated.put(i, std::max( vecMeans[i], 0.0 ) );
+            }
 
-        subtractFilter->SetInput1( pPET );
-        subtractFilter->SetInput2( imageBackground );
+            if ( k > 1 ) {
+                const float fNorm = vecRegMeansUpdated.two_norm();
+                const float fChange = ( vecRegMeansUpdated - this->m_vecRegMeansPVCorr ).two_norm();
+                this->m_report.fConvergence = ( fNorm > 0.0 ) ? fChange / fNorm : 0.0;
+            }
 
-        divideFilter->SetInput1( subtractFilter->GetOutput() );
-        divideFilter->SetInput2( imageRec );
-        divideFilter->Update();
+            this->m_vecRegMeansPVCorr = vecRegMeansUpdated;
+            this->m_nCurrentIteration = k;
+            this->m_imageCurrentEstimate = imageEstimate.GetPointer();
+            this->InvokeEvent( itk::IterationEvent() );
+        }
+        this->m_report.nIterations = k;
 
-        imageEstimate = divideFilter->GetOutput();
-        //imageEstimate->UpdateOutputData();
-        imageEstimate->DisconnectPipeline();
+        if ( k < nNumOfIters && !budget.AllowsNextIteration() ) {
+            this->m_report.bOutOfTime = true;
+            break;
+        }
     }
 
+    this->m_imageCurrentEstimate = NULL;
+
     if ( this->m_bVerbose ) {
         std::cout << std::endl;
     }
 
-    this->AllocateOutputs();
-
-    ImageAlgorithm::Copy( imageEstimate.GetPointer(), output.GetPointer(), output->GetRequestedRegion(),
-                          output->GetRequestedRegion() );
-
 }
 
 }// end namespace
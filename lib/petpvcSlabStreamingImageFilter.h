@@ -0,0 +1,153 @@
+/*
+   petpvcSlabStreamingImageFilter.h
+
+   Author:      Benjamin A. Thomas
+
+   Copyright 2026 Institute of Nuclear Medicine, University College London.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+ */
+
+#ifndef __PETPVCSLABSTREAMINGIMAGEFILTER_H
+#define __PETPVCSLABSTREAMINGIMAGEFILTER_H
+
+#include "itkImage.h"
+#include "itkImageToImageFilter.h"
+
+#include <itkRegionOfInterestImageFilter.h>
+#include <itkGaussianOperator.h>
+
+#include <algorithm>
+
+using namespace itk;
+
+namespace petpvc
+{
+/** \class SlabStreamingImageFilter
+ *
+ * \brief Runs a deconvolution filter over a volume in z-slabs.
+ *
+ * The wrapped filter (VanCittertPVCImageFilter or
+ * RichardsonLucyPVCImageFilter) only uses voxel-wise operations and
+ * Gaussian blurs. Each slab is padded with a halo of
+ * iterations x 2 x (kernel radius) slices, so the core of each slab is the
+ * same as when the whole volume is processed at once. The slab thickness is
+ * chosen so that the temporaries of the wrapped filter fit within the
+ * memory limit. The input and output are still full volumes.
+ *
+ * Stopping criteria computed over the whole image cannot be evaluated per
+ * slab, so the wrapped filter should run a fixed number of iterations.
+ * Thresholds taken from image statistics, such as the RL zero threshold,
+ * should likewise be computed over the whole image and fixed beforehand.
+ *
+ */
+template< class TInputImage, class TPVCFilter >
+class SlabStreamingImageFilter:public ImageToImageFilter< TInputImage, TInputImage >
+{
+public:
+    /** Standard class typedefs. */
+    typedef SlabStreamingImageFilter             Self;
+    typedef ImageToImageFilter< TInputImage, TInputImage > Superclass;
+    typedef SmartPointer< Self >        Pointer;
+
+    /** Method for creation through the object factory. */
+    itkNewMacro(Self);
+
+    /** Run-time type information (and related methods). */
+    itkTypeMacro(SlabStreamingImageFilter, ImageToImageFilter);
+
+    /** Image related typedefs. */
+    typedef TInputImage             InputImageType;
+    typedef typename TInputImage::ConstPointer    InputImagePointer;
+    typedef typename TInputImage::RegionType RegionType;
+    typedef typename TInputImage::SizeType   SizeType;
+    typedef typename TInputImage::IndexType  IndexType;
+    typedef typename TInputImage::PixelType  PixelType;
+
+    typedef TPVCFilter PVCFilterType;
+    typedef itk::RegionOfInterestImageFilter<TInputImage, TInputImage> ROIFilterType;
+    typedef itk::GaussianOperator<double, 3> GaussianOperatorType;
+
+    typedef itk::Vector<float, 3> ITKVectorType;
+
+    /** Image related typedefs. */
+    itkStaticConstMacro(InputImageDimension, unsigned int,
+                        3);
+
+    /** The configured filter to run on each slab. */
+    void SetPVCFilter( PVCFilterType * pvcFilter ) {
+        this->m_pvcFilter = pvcFilter;
+    }
+
+    void SetPSF(ITKVectorType vec) {
+        this->m_vecVariance = vec;
+    }
+
+    ITKVectorType GetPSF() {
+        return this->m_vecVariance;
+    }
+
+    void SetIterations( unsigned int nIters ) {
+        this->m_nIterations = nIters;
+    }
+
+    /** Approximate memory limit in MB. Zero processes the whole volume in
+     * one pass. */
+    void SetMemoryLimit( float fMegabytes ) {
+        this->m_fMemoryLimit = fMegabytes;
+    }
+
+    /** Number of slab-sized images the wrapped filter keeps at once. */
+    void SetNumberOfTemporaries( unsigned int nTemps ) {
+        this->m_nTemporaries = nTemps;
+    }
+
+    void SetVerbose( bool bVerbose ) {
+        this->m_bVerbose = bVerbose;
+    }
+
+    /** Number of slices added above and below each slab. */
+    unsigned int GetHaloSlices();
+
+protected:
+    SlabStreamingImageFilter();
+    ~SlabStreamingImageFilter() {};
+
+    /** Does the real work. */
+    virtual void GenerateData() ITK_OVERRIDE;
+
+    /** Number of core slices per slab that fit in the memory limit. */
+    unsigned int GetSlabSlices( unsigned int nHalo );
+
+    typename PVCFilterType::Pointer m_pvcFilter;
+    ITKVectorType m_vecVariance;
+    unsigned int m_nIterations;
+    float m_fMemoryLimit;
+    unsigned int m_nTemporaries;
+    bool m_bVerbose;
+
+private:
+    SlabStreamingImageFilter(const Self &); //purposely not implemented
+    void operator=(const Self &);  //purposely not implemented
+
+};
+} //namespace petpvc
+
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "petpvcSlabStreamingImageFilter.txx"
+#endif
+
+
+#endif // __PETPVCSLABSTREAMINGIMAGEFILTER_H
@@ -0,0 +1,174 @@
+/*
+   petpvcSlabStreamingImageFilter.txx
+
+   Author:      Benjamin A. Thomas
+
+   Copyright 2026 Institute of Nuclear Medicine, University College London.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+ */
+
+#ifndef __PETPVCSLABSTREAMINGIMAGEFILTER_TXX
+#define __PETPVCSLABSTREAMINGIMAGEFILTER_TXX
+
+#include "petpvcSlabStreamingImageFilter.h"
+#include "itkObjectFactory.h"
+#include "itkImageAlgorithm.h"
+#include "petpvcProfiler.h"
+
+using namespace itk;
+
+namespace petpvc
+{
+
+template< class TInputImage, class TPVCFilter >
+SlabStreamingImageFilter< TInputImage, TPVCFilter >
+::SlabStreamingImageFilter()
+{
+    this->m_nIterations = 10;
+    this->m_fMemoryLimit = 0.0;
+    //Estimate, previous estimate, two blurs and the voxel-wise results.
+    this->m_nTemporaries = 8;
+    this->m_bVerbose = false;
+}
+
+template< class TInputImage, class TPVCFilter >
+unsigned int SlabStreamingImageFilter< TInputImage, TPVCFilter >
+::GetHaloSlices()
+{
+    InputImagePointer pPET = this->GetInput();
+    const double fSpacingZ = pPET->GetSpacing()[2];
+
+    //Same kernel as DiscreteGaussianImageFilter with its default settings.
+    GaussianOperatorType oper;
+    oper.SetDirection( 2 );
+    oper.SetVariance( this->m_vecVariance[2] / ( fSpacingZ * fSpacingZ ) );
+    oper.SetMaximumError( 0.01 );
+    oper.SetMaximumKernelWidth( 32 );
+    oper.CreateDirectional();
+
+    //Each iteration blurs twice, so errors from the slab edge move inwards
+    //by two kernel radii per iteration.
+    return this->m_nIterations * 2 * oper.GetRadius( 2 );
+}
+
+template< class TInputImage, class TPVCFilter >
+unsigned int SlabStreamingImageFilter< TInputImage, TPVCFilter >
+::GetSlabSlices( unsigned int nHalo )
+{
+    InputImagePointer pPET = this->GetInput();
+    const SizeType imageSize = pPET->GetLargestPossibleRegion().GetSize();
+
+    if ( this->m_fMemoryLimit <= 0.0 ) {
+        return imageSize[2];
+    }
+
+    const double fSliceBytes = (double) imageSize[0] * imageSize[1] * sizeof( PixelType );
+    const double fVolumeBytes = fSliceBytes * imageSize[2];
+    const double fLimitBytes = this->m_fMemoryLimit * 1024.0 * 1024.0;
+
+    //Input and output are always held in full.
+    const double fSlabBytes = fLimitBytes - 2.0 * fVolumeBytes;
+    const double fMaxSlices = fSlabBytes / ( this->m_nTemporaries * fSliceBytes );
+
+    if ( fMaxSlices < 2.0 * nHalo + 1.0 ) {
+        const double fNeededMB = ( 2.0 * fVolumeBytes
+                                   + ( 2.0 * nHalo + 1.0 ) * this->m_nTemporaries * fSliceBytes ) / ( 1024.0 * 1024.0 );
+        itkExceptionMacro( << "Memory limit of " << this->m_fMemoryLimit << " MB is too small; slabs with a halo of "
+                           << nHalo << " slices need at least " << fNeededMB << " MB" );
+    }
+
+    return std::min( (unsigned int) ( fMaxSlices - 2.0 * nHalo ), (unsigned int) imageSize[2] );
+}
+
+template< class TInputImage, class TPVCFilter >
+void SlabStreamingImageFilter< TInputImage, TPVCFilter >
+::GenerateData()
+{
+    InputImagePointer pPET = this->GetInput();
+    typename TInputImage::Pointer output = this->GetOutput();
+
+    if ( this->m_pvcFilter.IsNull() ) {
+        itkExceptionMacro( << "No PVC filter set" );
+    }
+
+    const RegionType wholeRegion = pPET->GetLargestPossibleRegion();
+    const unsigned int nSlices = wholeRegion.GetSize()[2];
+    const unsigned int nHalo = this->GetHaloSlices();
+    const unsigned int nSlabSlices = this->GetSlabSlices( nHalo );
+
+    this->m_pvcFilter->SetPSF( this->m_vecVariance );
+    this->m_pvcFilter->SetIterations( this->m_nIterations );
+
+    //Whole volume fits, so no need to split it.
+    if ( nSlabSlices >= nSlices ) {
+        this->m_pvcFilter->SetInput( pPET );
+        this->m_pvcFilter->UpdateLargestPossibleRegion();
+        this->GraftOutput( this->m_pvcFilter->GetOutput() );
+        return;
+    }
+
+    if ( this->m_bVerbose ) {
+        std::cout << "Processing " << nSlices << " slices in slabs of " << nSlabSlices
+                  << " with a halo of " << nHalo << " slices" << std::endl;
+    }
+
+    this->AllocateOutputs();
+
+    typename ROIFilterType::Pointer roiFilter = ROIFilterType::New();
+    roiFilter->SetInput( pPET );
+    this->m_pvcFilter->SetInput( roiFilter->GetOutput() );
+
+    for ( unsigned int nStart = 0; nStart < nSlices; nStart += nSlabSlices ) {
+
+        ScopedStageTimer slabTimer( this, "slab" );
+
+        const unsigned int nEnd = std::min( nStart + nSlabSlices, nSlices );
+        const unsigned int nPadStart = ( nStart > nHalo ) ? nStart - nHalo : 0;
+        const unsigned int nPadEnd = std::min( nEnd + nHalo, nSlices );
+
+        if ( this->m_bVerbose ) {
+            std::cout << "Slab: slices " << nStart << " to " << nEnd - 1 << std::endl;
+        }
+
+        //Padded slab, read from the input.
+        RegionType padReg = wholeRegion;
+        padReg.SetIndex( 2, wholeRegion.GetIndex()[2] + nPadStart );
+        padReg.SetSize( 2, nPadEnd - nPadStart );
+
+        roiFilter->SetRegionOfInterest( padReg );
+        this->m_pvcFilter->UpdateLargestPossibleRegion();
+
+        typename TInputImage::Pointer imageSlab = this->m_pvcFilter->GetOutput();
+
+        //Core of the slab, without the halo.
+        RegionType srcReg = imageSlab->GetLargestPossibleRegion();
+        srcReg.SetIndex( 2, srcReg.GetIndex()[2] + ( nStart - nPadStart ) );
+        srcReg.SetSize( 2, nEnd - nStart );
+
+        RegionType dstReg = wholeRegion;
+        dstReg.SetIndex( 2, wholeRegion.GetIndex()[2] + nStart );
+        dstReg.SetSize( 2, nEnd - nStart );
+
+        ImageAlgorithm::Copy( imageSlab.GetPointer(), output.GetPointer(), srcReg, dstReg );
+    }
+
+    //Drop the last slab.
+    this->m_pvcFilter->GetOutput()->ReleaseData();
+}
+
+}// end namespace
+
+
+#endif
@@ -0,0 +1,166 @@
+/*
+   petpvcTimeBudget.h
+
+   Author:      Benjamin A. Thomas
+
+   Copyright 2026 Institute of Nuclear Medicine, University College London.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+ */
+
+/*
+   Wall-clock budgets for the iterative filters. A budget is given to the
+   filters as a deadline, so that the stages of a chain share it. Each
+   filter times its iterations and, after each one, stops if another as
+   long as the longest so far would end after the deadline. The first
+   iteration always runs.
+ */
+
+#ifndef __PETPVCTIMEBUDGET_H
+#define __PETPVCTIMEBUDGET_H
+
+#include <itkObject.h>
+#include <itkMetaDataObject.h>
+#include <itkRealTimeClock.h>
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace petpvc
+{
+
+//Seconds on the clock that deadlines are given in.
+inline double GetWallClockTime()
+{
+    itk::RealTimeClock::Pointer clock = itk::RealTimeClock::New();
+    return clock->GetTimeInSeconds();
+}
+
+//How the iterations of a filter ended.
+struct IterationReport {
+    unsigned int nIterations;
+    //Convergence measure of the last iteration, as the filter prints it.
+    double fConvergence;
+    //Whether the iterations stopped at the deadline.
+    bool bOutOfTime;
+
+    IterationReport() {
+        nIterations = 0;
+        fConvergence = 0.0;
+        bOutOfTime = false;
+    }
+};
+
+/** \class IterationBudget
+ *
+ * \brief Decides whether another iteration fits before a deadline.
+ *
+ */
+class IterationBudget
+{
+public:
+    IterationBudget() {
+        this->m_fDeadline = 0.0;
+        this->m_fLast = 0.0;
+        this->m_fLongest = 0.0;
+    }
+
+    //Starts timing iterations that must end by fDeadline, a time from
+    //GetWallClockTime(); 0 sets no limit. With nShares, the iterations get
+    //an even share of the time left, e.g. the first of nShares regions that
+    //are corrected in turn.
+    void Start( double fDeadline, unsigned int nShares = 1 ) {
+        this->m_fDeadline = fDeadline;
+        this->m_fLongest = 0.0;
+
+        if ( fDeadline <= 0.0 ) {
+            return;
+        }
+
+        this->m_fLast = GetWallClockTime();
+        if ( nShares > 1 ) {
+            this->m_fDeadline = this->m_fLast + ( fDeadline - this->m_fLast ) / nShares;
+        }
+    }
+
+    //Call after each iteration. Returns false if one more would end after
+    //the deadline.
+    bool AllowsNextIteration() {
+        if ( this->m_fDeadline <= 0.0 ) {
+            return true;
+        }
+
+        const double fNow = GetWallClockTime();
+        this->m_fLongest = std::max( this->m_fLongest, fNow - this->m_fLast );
+        this->m_fLast = fNow;
+
+        return fNow + this->m_fLongest <= this->m_fDeadline;
+    }
+
+private:
+    double m_fDeadline;
+    double m_fLast;
+    double m_fLongest;
+};
+
+//Length of the NIfTI description field, less its terminating null.
+const std::string::size_type NOTES_LENGTH = 79;
+
+//Marker of the notes of an image whose iterations stopped at the deadline.
+const std::string TIME_BUDGET_NOTE = " (time budget)";
+
+//Logs how the iterations of a stage ended, and adds a short token such as
+//"RL 3" for it to the notes of image, which the NIfTI writer puts in the
+//80-character description field. The notes end in " (time budget)" if any
+//stage stopped at the deadline, and the first tokens are dropped rather
+//than that marker if the field is full.
+inline void RecordIterations( itk::Object * image, const std::string & sStage, const IterationReport & report )
+{
+    std::cout << sStage << ": " << report.nIterations << " iterations, convergence " << report.fConvergence;
+    if ( report.bOutOfTime ) {
+        std::cout << TIME_BUDGET_NOTE;
+    }
+    std::cout << std::endl;
+
+    itk::MetaDataDictionary & dict = image->GetMetaDataDictionary();
+    std::string sNotes;
+    itk::ExposeMetaData< std::string >( dict, "ITK_FileNotes", sNotes );
+
+    bool bOutOfTime = report.bOutOfTime;
+    if ( sNotes.size() >= TIME_BUDGET_NOTE.size()
+         && sNotes.compare( sNotes.size() - TIME_BUDGET_NOTE.size(), TIME_BUDGET_NOTE.size(), TIME_BUDGET_NOTE ) == 0 ) {
+        sNotes.erase( sNotes.size() - TIME_BUDGET_NOTE.size() );
+        bOutOfTime = true;
+    }
+
+    std::stringstream ss;
+    ss << sStage << " " << report.nIterations;
+    if ( !sNotes.empty() ) {
+        sNotes += ", ";
+    }
+    sNotes += ss.str();
+
+    const std::string sMarker = bOutOfTime ? TIME_BUDGET_NOTE : std::string();
+    if ( sNotes.size() + sMarker.size() > NOTES_LENGTH ) {
+        sNotes.erase( 0, sNotes.size() + sMarker.size() - NOTES_LENGTH );
+    }
+    sNotes += sMarker;
+    itk::EncapsulateMetaData< std::string >( dict, "ITK_FileNotes", sNotes );
+}
+
+} //namespace petpvc
+
+#endif // __PETPVCTIMEBUDGET_H
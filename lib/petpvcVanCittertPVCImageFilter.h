@@ -34,7 +34,7 @@
 #include <itkDiscreteGaussianImageFilter.h>
 #include <itkStatisticsImageFilter.h>
 #include <itkThresholdImageFilter.h>
-#include <itkImageDuplicator.h>
+#include "petpvcTimeBudget.h"
 
 #include <algorithm>
 
@@ -76,7 +76,6 @@ public:
 	typedef itk::SubtractImageFilter<TInputImage, TInputImage> SubFilterType;
     typedef itk::DiscreteGaussianImageFilter<TInputImage, TInputImage> BlurringFilterType;
 	typedef itk::ThresholdImageFilter<TInputImage> ThresholdFilterType;
-    typedef itk::ImageDuplicator<TInputImage> DuplicatorType;
 
     typedef itk::Vector<float, 3> ITKVectorType;
 
@@ -97,6 +96,13 @@ public:
         this->m_nIterations = nIters;
     }
 
+    //Number of iterations already done, e.g. by a run resumed from a
+    //checkpoint. Iterations are numbered on from it, up to the total set by
+    //SetIterations().
+    void SetStartIteration( unsigned int nIter ) {
+        this->m_nStartIteration = nIter;
+    }
+
     void SetAlpha( float alpha ) {
         this->m_fAlpha = alpha;
     }
@@ -109,6 +115,36 @@ public:
         this->m_bVerbose = bVerbose;
     }
 
+    //Wall-clock time, from GetWallClockTime(), by which the iterations must
+    //end. 0, the default, sets no limit.
+    void SetDeadline( double fDeadline ) {
+        this->m_fDeadline = fDeadline;
+    }
+
+    /** How the iterations ended, after Update(). */
+    const IterationReport & GetIterationReport() const {
+        return this->m_report;
+    }
+
+    //Image to start from instead of the PET data, e.g. the correction of
+    //the previous frame. It must have the size of the PET image.
+    void SetInitialEstimate( const InputImageType * image ) {
+        this->m_imageInitialEstimate = image;
+        this->Modified();
+    }
+
+    /** Number of the iteration just completed. Valid while observers of
+     * itk::IterationEvent are executed. */
+    unsigned int GetCurrentIteration() const {
+        return this->m_nCurrentIteration;
+    }
+
+    /** Image estimate after the iteration just completed. Valid while
+     * observers of itk::IterationEvent are executed. */
+    const InputImageType * GetCurrentEstimate() const {
+        return this->m_imageCurrentEstimate;
+    }
+
     void SetDisableNonNegativity( bool bDisableNonNeg ) {
         this->m_bDisableNonNeg = bDisableNonNeg;
     }
@@ -123,9 +159,15 @@ protected:
 
     ITKVectorType m_vecVariance;
     unsigned int m_nIterations;
+    unsigned int m_nStartIteration;
     float m_fAlpha;
     float m_fStopCriterion;
+    InputImagePointer m_imageInitialEstimate;
     bool m_bVerbose;
+    double m_fDeadline;
+    IterationReport m_report;
+    unsigned int m_nCurrentIteration;
+    const TInputImage * m_imageCurrentEstimate;
     bool m_bDisableNonNeg;
 
 private:
@@ -27,6 +27,9 @@
 #include "itkObjectFactory.h"
 #include "itkImageRegionIterator.h"
 #include "itkImageRegionConstIterator.h"
+#include "petpvcProfiler.h"
+#include "petpvcReduction.h"
+#include "petpvcImageExpression.h"
 
 using namespace itk;
 
@@ -38,10 +41,14 @@ VanCittertPVCImageFilter< TInputImage >
 ::VanCittertPVCImageFilter()
 {
     this->m_nIterations = 30;
+    this->m_nStartIteration = 0;
     this->m_bVerbose = false;
+    this->m_fDeadline = 0.0;
     this->m_fAlpha = 1.5;
     this->m_fStopCriterion = 0.01;
     this->m_bDisableNonNeg = false;
+    this->m_nCurrentIteration = 0;
+    this->m_imageCurrentEstimate = NULL;
 }
 
 template< class TInputImage >
@@ -59,106 +66,110 @@ void VanCittertPVCImageFilter< TInputImage >
 
     //Gaussian smoothing
     typename BlurringFilterType::Pointer blurFilter = BlurringFilterType::New();
+    ProfileFilter( blurFilter.GetPointer(), this, "blur" );
     typename BlurringFilterType::Pointer blurFilter2 = BlurringFilterType::New();
-    //Multiplies two images together.
-    typename MultiplyFilterType::Pointer multiplyFilter = MultiplyFilterType::New();
-    typename DuplicatorType::Pointer duplicator = DuplicatorType::New();
-    typename AddFilterType::Pointer addFilter = AddFilterType::New();
-    typename SubFilterType::Pointer subFilter = SubFilterType::New();
-    typename ThresholdFilterType::Pointer thresholdFilter = ThresholdFilterType::New();
-
-    duplicator->SetInputImage( pPET );
-    duplicator->Update();
+    ProfileFilter( blurFilter2.GetPointer(), this, "blur" );
 
     typename TInputImage::Pointer imageEstimate;
-    //Set image estimate to the original PET data for the first iteration.
-    imageEstimate = duplicator->GetOutput();
+    //Set image estimate to the original PET data for the first iteration, or
+    //to the initial estimate if one was given.
+    if ( this->m_imageInitialEstimate.IsNotNull() ) {
+        if ( this->m_imageInitialEstimate->GetLargestPossibleRegion().GetSize() !=
+             pPET->GetLargestPossibleRegion().GetSize() ) {
+            itkExceptionMacro( << "The initial estimate must have the size of the PET image" );
+        }
+        imageEstimate = EvaluateImage( pPET.GetPointer(), Expr( this->m_imageInitialEstimate ) );
+    } else {
+        imageEstimate = EvaluateImage( pPET.GetPointer(), Expr( pPET ) );
+    }
+
+    //The previous estimate, whose buffer the next estimate is written to, so
+    //that no image is allocated in the iterations.
+    typename TInputImage::Pointer imagePrev = NewImageLike( pPET.GetPointer() );
 
-    typename TInputImage::Pointer imagePrev;
-    //Set imagePrev to the original PET data for the first iteration.
-    imagePrev = duplicator->GetOutput();
+    //Difference between the PET data and the blurred estimate.
+    typename TInputImage::Pointer imageResidual = NewImageLike( pPET.GetPointer() );
 
     blurFilter->SetVariance( this->GetPSF() );
     blurFilter2->SetVariance( this->GetPSF() );
 
-    thresholdFilter->ThresholdBelow( 0 );
-    thresholdFilter->SetOutsideValue( 0 );
 
+    const SizeValueType nVoxels = pPET->GetLargestPossibleRegion().GetNumberOfPixels();
 
-    float fSumOfPETsq = 0.0;
-
-	ConstImageIterator inputIt( pPET, pPET->GetLargestPossibleRegion() );
-    inputIt.GoToBegin();
-
-	while ( !inputIt.IsAtEnd() )
-	{
-        fSumOfPETsq += inputIt.Get()*inputIt.Get();
-		++inputIt;
-	}
+    SumOfSquaresFunctor< typename TInputImage::PixelType > sumOfPETsqFunctor;
+    sumOfPETsqFunctor.pData = pPET->GetBufferPointer();
+    double fSumOfPETsq = ParallelSum( 0, nVoxels, sumOfPETsqFunctor );
 
     int nMaxNumOfIters =  this->m_nIterations;
-    int n=1;
+    int n = this->m_nStartIteration + 1;
 
     bool bStopped = false;
 
+    this->m_report = IterationReport();
+    IterationBudget budget;
+    budget.Start( this->m_fDeadline );
+
     while ( ( n <= nMaxNumOfIters ) && ( !bStopped ) ) {
+
+            ScopedStageTimer iterationTimer( this, "iteration", n );
             
-            float fSumOfDiffsq = 0.0;
-
-            duplicator->SetInputImage( imageEstimate );
-            duplicator->Update();
-            imagePrev = duplicator->GetOutput();
-
-            blurFilter->SetInput( imageEstimate );
-            subFilter->SetInput1( pPET );
-            subFilter->SetInput2( blurFilter->GetOutput() );
-            blurFilter2->SetInput( subFilter->GetOutput() ); 
-            multiplyFilter->SetConstant( this->m_fAlpha );
-            multiplyFilter->SetInput( blurFilter2->GetOutput() );
-            addFilter->SetInput1( imageEstimate );
-            addFilter->SetInput2( multiplyFilter->GetOutput() );
+            double fSumOfDiffsq = 0.0;
+
+            //The new estimate is written to the spare buffer, so the previous
+            //one can be kept without copying it.
+            std::swap( imagePrev, imageEstimate );
+
+            blurFilter->SetInput( imagePrev );
+            blurFilter->Update();
+
+            Evaluate( imageResidual.GetPointer(), Expr( pPET ) - Expr( blurFilter->GetOutput() ) );
+
+            blurFilter2->SetInput( imageResidual ); 
+            blurFilter2->Update();
             
             if (!m_bDisableNonNeg) {
-                thresholdFilter->SetInput( addFilter->GetOutput() );  
-                thresholdFilter->Update();
-                imageEstimate = thresholdFilter->GetOutput();
+                Evaluate( imageEstimate.GetPointer(),
+                          Max( Expr( imagePrev ) + this->m_fAlpha * Expr( blurFilter2->GetOutput() ), 0.0 ) );
             }
             else {
-                addFilter->Update();
-                imageEstimate = addFilter->GetOutput();
+                Evaluate( imageEstimate.GetPointer(),
+                          Expr( imagePrev ) + this->m_fAlpha * Expr( blurFilter2->GetOutput() ) );
             }
-
-            imageEstimate->DisconnectPipeline();
             
-            ConstImageIterator currIt( imageEstimate, imageEstimate->GetLargestPossibleRegion() );
-            ConstImageIterator prevIt( imagePrev, imagePrev->GetLargestPossibleRegion() );
-
-            currIt.GoToBegin();
-            prevIt.GoToBegin();
-
-            while ( !currIt.IsAtEnd() )
-    	    {
-                float diff = currIt.Get() - prevIt.Get();
-                fSumOfDiffsq += diff*diff;
-        		++currIt;
-                ++prevIt;
-        	}
+            SumOfSquaredDifferencesFunctor< typename TInputImage::PixelType > sumOfDiffsqFunctor;
+            sumOfDiffsqFunctor.pData1 = imageEstimate->GetBufferPointer();
+            sumOfDiffsqFunctor.pData2 = imagePrev->GetBufferPointer();
+            fSumOfDiffsq = ParallelSum( 0, nVoxels, sumOfDiffsqFunctor );
 
             float fCurrentEval = sqrt( fSumOfDiffsq ) / sqrt( fSumOfPETsq );
             std::cout << n << "\t" << fCurrentEval << std::endl;
+
+            //Let any observers see the estimate of this iteration.
+            this->m_nCurrentIteration = n;
+            this->m_imageCurrentEstimate = imageEstimate.GetPointer();
+            this->InvokeEvent( itk::IterationEvent() );
+
+            this->m_report.nIterations = n;
+            this->m_report.fConvergence = fCurrentEval;
+
             n++;
 
             if ( fCurrentEval < this->m_fStopCriterion )
                 bStopped = true;
+
+            if ( !bStopped && n <= nMaxNumOfIters && !budget.AllowsNextIteration() ) {
+                this->m_report.bOutOfTime = true;
+                bStopped = true;
+            }
     }
     std::cout << std::endl;
 
+    this->m_imageCurrentEstimate = NULL;
 
-  
-    this->AllocateOutputs();
 
-    ImageAlgorithm::Copy( imageEstimate.GetPointer(), output.GetPointer(), output->GetRequestedRegion(),
-                          output->GetRequestedRegion() );
+  
+    //The final estimate becomes the output, without copying it.
+    this->GraftOutput( imageEstimate.GetPointer() );
 
 }
 
@@ -0,0 +1,180 @@
+/*
+   petpvcVolumeView.h
+
+   Author:      Benjamin A. Thomas
+
+   Copyright 2026 Institute of Nuclear Medicine, University College London.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+ */
+
+#ifndef __PETPVCVOLUMEVIEW_H
+#define __PETPVCVOLUMEVIEW_H
+
+#include <itkImage.h>
+#include <itkImportImageContainer.h>
+#include <itkExtractImageFilter.h>
+
+#include "petpvcProfiler.h"
+
+using namespace itk;
+
+namespace petpvc
+{
+
+//Compile-time check for identical pixel types.
+template< class T1, class T2 >
+struct IsSamePixelType {
+    enum { Value = false };
+};
+
+template< class T >
+struct IsSamePixelType< T, T > {
+    enum { Value = true };
+};
+
+/** \class VolumeViewContainer
+ *
+ * \brief Pixel container that points into the buffer of another image.
+ *
+ * Holds a reference to the parent's pixel container, so the memory stays
+ * valid for as long as the view exists. The view does not own or free the
+ * memory.
+ *
+ */
+template< class TElement >
+class VolumeViewContainer : public ImportImageContainer< SizeValueType, TElement >
+{
+public:
+    typedef VolumeViewContainer Self;
+    typedef ImportImageContainer< SizeValueType, TElement > Superclass;
+    typedef SmartPointer< Self > Pointer;
+
+    itkNewMacro( Self );
+
+    itkTypeMacro( VolumeViewContainer, ImportImageContainer );
+
+    void SetParent( const Object * parent ) {
+        this->m_parent = parent;
+    }
+
+protected:
+    VolumeViewContainer() {}
+    ~VolumeViewContainer() {}
+
+private:
+    VolumeViewContainer(const Self &); //purposely not implemented
+    void operator=(const Self &);  //purposely not implemented
+
+    Object::ConstPointer m_parent;
+};
+
+//Copies volume nVolume of a 4-D image using ExtractImageFilter. Used when
+//a zero-copy view is not possible.
+template< class TVolume, class TImage >
+typename TVolume::Pointer ExtractVolumeCopy( const TImage * image, unsigned int nVolume )
+{
+    ScopedStageTimer timer( NULL, "mask extraction copy" );
+
+    typedef ExtractImageFilter< TImage, TVolume > ExtractFilterType;
+
+    typename TImage::RegionType extractReg = image->GetLargestPossibleRegion();
+    extractReg.SetIndex( TImage::ImageDimension - 1, nVolume );
+    extractReg.SetSize( TImage::ImageDimension - 1, 0 );
+
+    typename ExtractFilterType::Pointer extractFilter = ExtractFilterType::New();
+    extractFilter->SetInput( image );
+    extractFilter->SetExtractionRegion( extractReg );
+    extractFilter->SetDirectionCollapseToIdentity(); // This is required.
+    extractFilter->Update();
+
+    typename TVolume::Pointer volume = extractFilter->GetOutput();
+    volume->DisconnectPipeline();
+
+    timer.AddBytes( (double) volume->GetBufferedRegion().GetNumberOfPixels() * sizeof( typename TVolume::PixelType ) );
+
+    return volume;
+}
+
+template< class TVolume, class TImage, bool bSamePixelType >
+struct VolumeViewHelper {
+    static typename TVolume::Pointer Get( const TImage * image, unsigned int nVolume ) {
+        return ExtractVolumeCopy< TVolume >( image, nVolume );
+    }
+};
+
+template< class TVolume, class TImage >
+struct VolumeViewHelper< TVolume, TImage, true > {
+    static typename TVolume::Pointer Get( const TImage * image, unsigned int nVolume ) {
+
+        const typename TImage::RegionType imageReg = image->GetLargestPossibleRegion();
+
+        //The whole image must be in memory to point into it.
+        if ( image->GetBufferedRegion() != imageReg ) {
+            return ExtractVolumeCopy< TVolume >( image, nVolume );
+        }
+
+        const unsigned int nDims = TVolume::ImageDimension;
+
+        typename TVolume::RegionType volumeReg;
+        typename TVolume::SpacingType spacing;
+        typename TVolume::PointType origin;
+        typename TVolume::DirectionType direction;
+
+        SizeValueType nVoxels = 1;
+        for ( unsigned int i = 0; i < nDims; i++ ) {
+            volumeReg.SetIndex( i, imageReg.GetIndex()[i] );
+            volumeReg.SetSize( i, imageReg.GetSize()[i] );
+            spacing[i] = image->GetSpacing()[i];
+            origin[i] = image->GetOrigin()[i];
+            nVoxels *= imageReg.GetSize()[i];
+        }
+
+        //Same as ExtractImageFilter with SetDirectionCollapseToIdentity().
+        direction.SetIdentity();
+
+        const SizeValueType nOffset = nVoxels * ( nVolume - imageReg.GetIndex()[nDims] );
+
+        typename VolumeViewContainer< typename TVolume::PixelType >::Pointer container =
+            VolumeViewContainer< typename TVolume::PixelType >::New();
+        container->SetParent( image->GetPixelContainer() );
+        container->SetImportPointer( const_cast< typename TVolume::PixelType * >( image->GetBufferPointer() ) + nOffset,
+                                     nVoxels, false );
+
+        typename TVolume::Pointer volume = TVolume::New();
+        volume->SetRegions( volumeReg );
+        volume->SetSpacing( spacing );
+        volume->SetOrigin( origin );
+        volume->SetDirection( direction );
+        volume->SetPixelContainer( container );
+
+        return volume;
+    }
+};
+
+//Returns volume nVolume of a 4-D image as a 3-D image. When the pixel types
+//match, the result points directly into the 4-D buffer, so no voxels are
+//copied; it must then be treated as read-only.
+template< class TVolume, class TImage >
+typename TVolume::Pointer GetVolumeView( const TImage * image, unsigned int nVolume )
+{
+    ScopedStageTimer timer( NULL, "mask extraction" );
+
+    return VolumeViewHelper< TVolume, TImage,
+           IsSamePixelType< typename TVolume::PixelType, typename TImage::PixelType >::Value >::Get( image, nVolume );
+}
+
+} //namespace petpvc
+
+#endif // __PETPVCVOLUMEVIEW_H
@@ -37,6 +37,9 @@
 #include <itkTimeProbe.h>
 
 #include "petpvcDiscreteIYPVCImageFilter.h"
+#include "petpvcIterationSnapshotCommand.h"
+#include "petpvcParallel.h"
+#include "petpvcTimeBudget.h"
 
 typedef itk::Vector<float, 3> VectorType;
 typedef itk::Image<short, 3> MaskImageType;
@@ -101,11 +104,41 @@ int main(int argc, char *argv[])
     command.SetOption("debug", "d", false,"Prints debug information");
     command.SetOptionLongTag("debug", "debug");
 
+    command.SetOption("Threads", "j", false, "Maximum number of threads to use (0 for the default)");
+    command.SetOptionLongTag("Threads", "threads");
+    command.AddOptionField("Threads", "N", MetaCommand::INT, true, "0");
+
+    command.SetOption("SaveIterations", "S", false,
+                      "Comma-separated list of iterations at which to save the current estimate, e.g. 2,5,10");
+    command.SetOptionLongTag("SaveIterations", "save-iterations");
+    command.AddOptionField("SaveIterations", "list", MetaCommand::STRING, true, "");
+
+    command.SetOption("SaveMeans", "M", false,
+                      "Text file to which the regional means are appended at each saved iteration (or every iteration)");
+    command.SetOptionLongTag("SaveMeans", "save-means");
+    command.AddOptionField("SaveMeans", "filename", MetaCommand::STRING, true, "");
+
+    command.SetOption("TimeBudget", "b", false,
+                      "Stop iterating before this many seconds have passed since the start of the run");
+    command.SetOptionLongTag("TimeBudget", "time-budget");
+    command.AddOptionField("TimeBudget", "sec", MetaCommand::FLOAT, true);
+
     //Parse command line.
     if (!command.Parse(argc, argv)) {
         return EXIT_FAILURE;
     }
 
+    //The time budget counts from here, so reading the images is part of it.
+    double fDeadline = 0.0;
+    if ( command.GetOptionWasSet("TimeBudget") ) {
+        const float fBudget = command.GetValueAsFloat("TimeBudget", "sec");
+        if ( fBudget <= 0.0 ) {
+            std::cerr << "[Error]\tThe time budget must be positive" << std::endl;
+            return EXIT_FAILURE;
+        }
+        fDeadline = petpvc::GetWallClockTime() + fBudget;
+    }
+
     itk::TimeProbe timer;
 
     timer.Start();
@@ -132,6 +165,20 @@ int main(int argc, char *argv[])
     //Toggle debug mode
     bool bDebug = command.GetValueAsBool("debug");
 
+    //Limit the number of threads before any filters are created.
+    petpvc::SetNumberOfThreads( command.GetValueAsInt("Threads", "N") );
+
+    //Get iterations at which to save intermediate results.
+    std::vector<unsigned int> vecSaveIters;
+    if ( command.GetOptionWasSet("SaveIterations") ) {
+        vecSaveIters = petpvc::ParseIterationList( command.GetValueAsString("SaveIterations", "list") );
+    }
+
+    std::string sMeansFileName;
+    if ( command.GetOptionWasSet("SaveMeans") ) {
+        sMeansFileName = command.GetValueAsString("SaveMeans", "filename");
+    }
+
     //Create reader for mask image.
     MaskReaderType::Pointer maskReader = MaskReaderType::New();
     maskReader->SetFileName(sMaskFileName);
@@ -176,6 +223,11 @@ int main(int argc, char *argv[])
     iyFilter->SetPSF(vVariance);
     iyFilter->SetIterations( nNumOfIters );
     iyFilter->SetVerbose ( bDebug );
+    iyFilter->SetDeadline( fDeadline );
+
+    //Save intermediate results, if requested.
+    petpvc::AddIterationSnapshots( iyFilter.GetPointer(), vecSaveIters, sOutputFileName );
+    petpvc::AddIterationMeans( iyFilter.GetPointer(), vecSaveIters, sMeansFileName );
 
     //Perform IY.
     try {
@@ -187,6 +239,10 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    if ( fDeadline > 0.0 ) {
+        petpvc::RecordIterations( iyFilter->GetOutput(), "DIY", iyFilter->GetIterationReport() );
+    }
+
     PETWriterType::Pointer petWriter = PETWriterType::New();
     petWriter->SetFileName(sOutputFileName);
     petWriter->SetInput( iyFilter->GetOutput() );
@@ -34,6 +34,7 @@
 #include <metaCommand.h>
 
 #include "petpvcMTCPVCImageFilter.h"
+#include "petpvcParallel.h"
 
 typedef itk::Vector<float, 3> VectorType;
 typedef itk::Image<float, 4> MaskImageType;
@@ -94,6 +95,10 @@ int main(int argc, char *argv[])
     command.SetOption("debug", "d", false,"Prints debug information");
     command.SetOptionLongTag("debug", "debug");
 
+    command.SetOption("Threads", "j", false, "Maximum number of threads to use (0 for the default)");
+    command.SetOptionLongTag("Threads", "threads");
+    command.AddOptionField("Threads", "N", MetaCommand::INT, true, "0");
+
     //Parse command line.
     if (!command.Parse(argc, argv)) {
         return EXIT_FAILURE;
@@ -118,6 +123,9 @@ int main(int argc, char *argv[])
     //Toggle debug mode
     bool bDebug = command.GetValueAsBool("debug");
 
+    //Limit the number of threads before any filters are created.
+    petpvc::SetNumberOfThreads( command.GetValueAsInt("Threads", "N") );
+
     //Create reader for mask image.
     MaskReaderType::Pointer maskReader = MaskReaderType::New();
     maskReader->SetFileName(sMaskFileName);
@@ -24,33 +24,28 @@
 
 #include <iostream>
 #include <fstream>
-#include <map>
 
 #include <itkImage.h>
 #include <itkImageFileReader.h>
 #include <itkImageFileWriter.h>
-#include <itkImageDuplicator.h>
-#include <itkLabelGeometryImageFilter.h>
-#include <itkBinaryThresholdImageFilter.h>
-#include <itkJoinSeriesImageFilter.h>
 #include <metaCommand.h>
 
 #include "EnvironmentInfo.h"
+#include "petpvcLabelCompaction.h"
+#include "petpvcOneHotImageFilter.h"
+#include "petpvcImageExpression.h"
 
 typedef itk::Image<short, 3> ImageType;
-typedef itk::Image<short, 3> MaskImageType;
 typedef itk::Image<short, 4> ImageType4D;
 
 typedef itk::ImageFileReader<ImageType> ReaderType;
 typedef itk::ImageFileWriter<ImageType4D> WriterType;
 
-typedef itk::ImageRegionIterator<ImageType> ImageIterator;
-typedef itk::ImageRegionConstIterator<ImageType> ConstImageIterator;
+typedef petpvc::LabelCompaction<ImageType> LabelCompactionType;
+typedef LabelCompactionType::IndexImageType IndexImageType;
+typedef itk::ImageFileWriter<IndexImageType> IndexWriterType;
 
-typedef itk::LabelGeometryImageFilter<ImageType> LabelGeometryImageFilterType;
-typedef itk::BinaryThresholdImageFilter<ImageType, ImageType> BinaryThresholdImageFilterType;
-
-typedef itk::JoinSeriesImageFilter<ImageType, ImageType4D> JoinSeriesImageFilterType;
+typedef petpvc::OneHotImageFilter<IndexImageType, ImageType4D> OneHotFilterType;
 
 int main(int argc, char *argv[])
 {
@@ -79,6 +74,18 @@ int main(int argc, char *argv[])
 	command.SetOption("Output", "o", true, "Output file");
 	command.AddOptionField("Output", "outfilename", MetaCommand::FILE, true, "", "", MetaCommand::DATA_OUT);
 
+	command.SetOption("Format", "f", false,
+	                  "Output format: 'dense' for a 4-D mask (default) or 'labelmap' for a 3-D image of volume numbers");
+	command.SetOptionLongTag("Format", "format");
+	command.AddOptionField("Format", "name", MetaCommand::STRING, true, "dense");
+
+	command.SetOption("Stream", "s", false, "Write the 4-D mask one volume at a time, if the file format allows it");
+	command.SetOptionLongTag("Stream", "stream");
+
+	command.SetOption("Table", "t", false, "CSV file to which the label of each volume is written");
+	command.SetOptionLongTag("Table", "table");
+	command.AddOptionField("Table", "filename", MetaCommand::STRING, true, "");
+
 	if (!command.Parse(argc, argv))
 	{
 		return EXIT_FAILURE;
@@ -86,6 +93,12 @@ int main(int argc, char *argv[])
 
 	std::string inFileName = command.GetValueAsString("Input", "infilename");
 	std::string outputFileName = command.GetValueAsString("Output", "outfilename");
+	std::string formatName = command.GetValueAsString("Format", "name");
+
+	if ( formatName != "dense" && formatName != "labelmap" ) {
+		std::cerr << "[Error]\tUnknown output format: " << formatName << "!" << std::endl;
+		return EXIT_FAILURE;
+	}
 
 	std::cout << "Input file: " << inFileName << std::endl;
 	std::cout << "Output file: " << outputFileName << std::endl;
@@ -103,46 +116,73 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
-	ImageType::Pointer inputImage = reader->GetOutput();
-
-	LabelGeometryImageFilterType::Pointer labelGeometryFilter = LabelGeometryImageFilterType::New();
-	LabelGeometryImageFilterType::Pointer labelGeometryImageFilter = LabelGeometryImageFilterType::New();
-	labelGeometryImageFilter->SetInput(inputImage);
-	labelGeometryImageFilter->SetIntensityInput(inputImage);
-
-	labelGeometryImageFilter->Update();
-	LabelGeometryImageFilterType::LabelsType allLabels =
-	labelGeometryImageFilter->GetLabels();
+	//Find the labels, in ascending order, and the volume of every voxel.
+	LabelCompactionType::Pointer labelCompaction = LabelCompactionType::New();
+	labelCompaction->Compact( reader->GetOutput() );
 
-	std::cout << "No. of labels found:\t" << allLabels.size() << std::endl;
+	IndexImageType::Pointer indexImage = labelCompaction->GetIndexImage();
+	const unsigned int nLabels = labelCompaction->GetNumberOfLabels();
 
-	BinaryThresholdImageFilterType::Pointer binThreshFilter = BinaryThresholdImageFilterType::New();
-	binThreshFilter->SetInput(inputImage);
-	binThreshFilter->SetInsideValue(1);
-	binThreshFilter->SetOutsideValue(0);
-
-	JoinSeriesImageFilterType::Pointer joinFilter = JoinSeriesImageFilterType::New();
-	ImageType::Pointer maskImage = ImageType::New();
+	//The index image holds everything needed from here on.
+	reader = NULL;
 
+	std::cout << "No. of labels found:\t" << nLabels << std::endl;
 	std::cout << "Mapping:" << std::endl;
 
-	for (int i = 0; i < allLabels.size(); i++)
+	for (unsigned int i = 0; i < nLabels; i++)
 	{
-		std::cout << "\tID: " << allLabels[i] << " -> volume " << i+1 << std::endl;
-		int labelValue = allLabels[i];
-		binThreshFilter->SetLowerThreshold(labelValue);
-		binThreshFilter->SetUpperThreshold(labelValue);
-		binThreshFilter->Update();
+		std::cout << "\tID: " << labelCompaction->GetLabel(i) << " -> volume " << i+1 << std::endl;
+	}
+
+	if ( command.GetOptionWasSet("Table") ) {
+		std::string tableFileName = command.GetValueAsString("Table", "filename");
+		std::ofstream tableFile( tableFileName.c_str() );
+
+		if ( !tableFile.is_open() ) {
+			std::cerr << "[Error]\tCannot write label table: " << tableFileName << "!" << std::endl;
+			return EXIT_FAILURE;
+		}
 
-		maskImage = binThreshFilter->GetOutput();
+		tableFile << "VOLUME,LABEL" << std::endl;
+		for (unsigned int i = 0; i < nLabels; i++)
+		{
+			tableFile << i+1 << "," << labelCompaction->GetLabel(i) << std::endl;
+		}
+	}
 
-		joinFilter->SetInput(i, maskImage);
-		maskImage->DisconnectPipeline();
+	if ( formatName == "labelmap" ) {
+		//Number the volumes from 1, as in the 4-D mask.
+		petpvc::Evaluate( indexImage.GetPointer(), petpvc::Expr( indexImage ) + 1.0 );
+
+		IndexWriterType::Pointer indexWriter = IndexWriterType::New();
+		indexWriter->SetFileName(outputFileName);
+		indexWriter->SetInput(indexImage);
+
+		try
+		{
+			indexWriter->Update();
+		}
+		catch (itk::ExceptionObject &ex)
+		{
+			std::cerr << "[Error]\tCannot write output image: " << outputFileName << "!" << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		return EXIT_SUCCESS;
 	}
 
+	//Write one binary volume per label, straight from the index image.
+	OneHotFilterType::Pointer oneHotFilter = OneHotFilterType::New();
+	oneHotFilter->SetInput(indexImage);
+	oneHotFilter->SetNumberOfLabels(nLabels);
+
 	WriterType::Pointer writer = WriterType::New();
 	writer->SetFileName(outputFileName);
-	writer->SetInput(joinFilter->GetOutput());
+	writer->SetInput(oneHotFilter->GetOutput());
+
+	if ( command.GetOptionWasSet("Stream") ) {
+		writer->SetNumberOfStreamDivisions( nLabels );
+	}
 
 	try
 	{
@@ -29,11 +29,15 @@
 
 #include "EnvironmentInfo.h"
 #include <string>
+#include <vector>
 #include <itkImage.h>
 #include <itkImageFileReader.h>
 #include <itkImageFileWriter.h>
-#include <itkExtractImageFilter.h>
+#include <itkImageDuplicator.h>
 #include "petpvcMullerGartnerImageFilter.h"
+#include "petpvcParallel.h"
+#include "petpvcMappedImageReader.h"
+#include "petpvcVolumeView.h"
 
 #include <metaCommand.h>
 
@@ -41,14 +45,9 @@ typedef itk::Vector<float, 3> VectorType;
 typedef itk::Image<float, 4> MaskImageType;
 typedef itk::Image<float, 3> PETImageType;
 
-typedef itk::ImageFileReader<MaskImageType> MaskReaderType;
-
 typedef itk::ImageFileReader<PETImageType> PETReaderType;
 typedef itk::ImageFileWriter<PETImageType> PETWriterType;
 
-//Extracts a 3D volume from 4D file.
-typedef itk::ExtractImageFilter<MaskImageType, PETImageType> ExtractFilterType;
-
 typedef itk::ImageDuplicator<PETImageType> DuplicatorType;
 
 typedef petpvc::MullerGartnerImageFilter< PETImageType, PETImageType, PETImageType, PETImageType > MGFilterType;
@@ -102,6 +101,10 @@ int main(int argc, char *argv[])
     command.SetOption("debug", "d", false,"Prints debug information");
     command.SetOptionLongTag("debug", "debug");
 
+    command.SetOption("Threads", "j", false, "Maximum number of threads to use (0 for the default)");
+    command.SetOptionLongTag("Threads", "threads");
+    command.AddOptionField("Threads", "N", MetaCommand::INT, true, "0");
+
     //Parse command line.
     if (!command.Parse(argc, argv)) {
         return EXIT_FAILURE;
@@ -126,16 +129,22 @@ int main(int argc, char *argv[])
     //Toggle debug mode
     bool bDebug = command.GetValueAsBool("debug");
 
-    //Create reader for mask image.
-    MaskReaderType::Pointer maskReader = MaskReaderType::New();
-    maskReader->SetFileName(sMaskFileName);
+    //Limit the number of threads before any filters are created.
+    petpvc::SetNumberOfThreads( command.GetValueAsInt("Threads", "N") );
+
+    //Read only the GM and WM masks, the first two volumes of the 4D file.
+    std::vector< unsigned int > vecVolumes;
+    vecVolumes.push_back( 0 );
+    vecVolumes.push_back( 1 );
+
+    MaskImageType::Pointer maskImage;
 
     //Try to read mask.
     try {
-        maskReader->Update();
+        maskImage = petpvc::ReadVolumes< MaskImageType >( sMaskFileName, vecVolumes );
     } catch (itk::ExceptionObject & err) {
         std::cerr << "[Error]\tCannot read mask input file: " << sMaskFileName
-                  << std::endl;
+                  << std::endl << err << std::endl;
         return EXIT_FAILURE;
     }
 
@@ -164,69 +173,12 @@ int main(int argc, char *argv[])
     vVariance[1] = pow(vVariance[1], 2);
     vVariance[2] = pow(vVariance[2], 2);
 
-    //Get mask image size.
-    MaskImageType::SizeType imageSize =
-        maskReader->GetOutput()->GetLargestPossibleRegion().GetSize();
-
-    //If mask is not 4D, then quit.
-    if (imageSize.Dimension != 4) {
-        std::cerr << "[Error]\tMask file: " << sMaskFileName << " must be 4-D!"
-                  << std::endl;
-        return EXIT_FAILURE;
-    }
-
-    MaskImageType::IndexType desiredStart;
-    desiredStart.Fill(0);
-    MaskImageType::SizeType desiredSize = imageSize;
-
-    //Extract filter used to extract 3D volume from 4D file.
-    ExtractFilterType::Pointer extractFilter = ExtractFilterType::New();
-    extractFilter->SetInput(maskReader->GetOutput());
-    extractFilter->SetDirectionCollapseToIdentity(); // This is required.
-
-    PETImageType::Pointer imageGM = PETImageType::New();
-    PETImageType::Pointer imageWM = PETImageType::New();
-    //PETImageType::Pointer imageCSF = PETImageType::New();
-
-    //Starts reading from 4D volume at index (0,0,0,i) through to
-    //(maxX, maxY, maxZ,0), i.e. one 3D brain mask.
-    desiredStart[3] = 0;
-    desiredSize[3] = 0;
-
-    //Get GM mask.
-    extractFilter->SetExtractionRegion(
-        MaskImageType::RegionType(desiredStart, desiredSize));
-    extractFilter->Update();
-
-    imageGM = extractFilter->GetOutput();
+    //Views of the two volumes, without copying them.
+    PETImageType::Pointer imageGM = petpvc::GetVolumeView< PETImageType >( maskImage.GetPointer(), 0 );
     imageGM->SetDirection(petReader->GetOutput()->GetDirection());
-    imageGM->UpdateOutputData();
-    imageGM->DisconnectPipeline();
 
-    desiredStart[3] = 1;
-
-    //Get WM mask.
-    extractFilter->SetExtractionRegion(
-        MaskImageType::RegionType(desiredStart, desiredSize));
-    extractFilter->Update();
-
-    imageWM = extractFilter->GetOutput();
+    PETImageType::Pointer imageWM = petpvc::GetVolumeView< PETImageType >( maskImage.GetPointer(), 1 );
     imageWM->SetDirection(petReader->GetOutput()->GetDirection());
-    imageWM->UpdateOutputData();
-    imageWM->DisconnectPipeline();
-
-    desiredStart[3] = 2;
-
-    //Get CSF mask.
-    /*
-    extractFilter->SetExtractionRegion(
-        MaskImageType::RegionType(desiredStart, desiredSize));
-    extractFilter->Update();
-
-    imageCSF = extractFilter->GetOutput();
-    imageCSF->SetDirection(petReader->GetOutput()->GetDirection());
-    imageCSF->UpdateOutputData();
-    imageCSF->DisconnectPipeline();*/
 
     //Set-up Muller-Gartner filter
     MGFilterType::Pointer MGFilter = MGFilterType::New();
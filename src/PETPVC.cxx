@@ -25,59 +25,97 @@
 #include <itkImage.h>
 #include <itkImageFileReader.h>
 #include <itkImageFileWriter.h>
-#include <itkExtractImageFilter.h>
 #include <itkCastImageFilter.h>
 #include <metaCommand.h>
 #include <vnl/vnl_matrix.h>
 
 #include "petpvcRoussetPVCImageFilter.h"
 #include "petpvcLabbePVCImageFilter.h"
-#include "petpvcRBVPVCImageFilter.h"
-#include "petpvcIterativeYangPVCImageFilter.h"
-#include "petpvcMTCPVCImageFilter.h"
-#include "petpvcMullerGartnerImageFilter.h"
 #include "petpvcVanCittertPVCImageFilter.h"
 #include "petpvcRLPVCImageFilter.h"
 #include "petpvcSTCPVCImageFilter.h"
 
-#include "petpvcLabbeRBVPVCImageFilter.h"
-#include "petpvcLabbeMTCPVCImageFilter.h"
-
-#include "petpvcIntraRegVCImageFilter.h"
-#include "petpvcIntraRegRLImageFilter.h"
+#include "petpvcPipeline.h"
+#include "petpvcReplicatePVC.h"
+#include "petpvcIterationSnapshotCommand.h"
+#include "petpvcCheckpoint.h"
+#include "petpvcTimeBudget.h"
+#include "petpvcSlabStreamingImageFilter.h"
+#include "petpvcMappedImageReader.h"
+#include "petpvcVolumeView.h"
+#include "petpvcProfiler.h"
+#include "petpvcAllocationHooks.h"
+#include "petpvcParallel.h"
 
 #include <algorithm>
+#include <cstdio>
 #include <string>
 #include <iostream>
 #include <fstream>
 
-enum PVCMethod { EGTM, ELabbe, EMullerGartner, EMTC,
-				ERBV, EIterativeYang, ERichardsonLucy, EVanCittert,
-				ELabbeRBV, ELabbeMTC, ERBVVanCittert, ERBVRichardsonLucy,
-				EMTCVanCittert, EMTCRichardsonLucy, EIYVanCittert, EIYRichardsonLucy,
-				ELabbeRBVVanCittert, ELabbeRBVRichardsonLucy, ELabbeMTCVanCittert, ELabbeMTCRichardsonLucy,
-				EMGVanCittert, EMGRichardsonLucy, ESTC, EUnknown };
+//ERegional covers RBV, MTC, IY and MG, alone or chained with LABBE, VC
+//and RL. The chain itself is held by a PVCPipeline.
+enum PVCMethod { EGTM, ELabbe, ERichardsonLucy, EVanCittert, ESTC, ERegional, EUnknown };
 
 typedef itk::Vector<float, 3> VectorType;
 typedef itk::Image<float, 4> MaskImageType;
 typedef itk::Image<short, 3> Mask3DImageType;
 typedef itk::Image<float, 3> PETImageType;
 
-typedef itk::ImageFileReader<MaskImageType> MaskReaderType;
 typedef itk::ImageFileReader<Mask3DImageType> Mask3DReaderType;
 
-typedef itk::ImageFileReader<PETImageType> PETReaderType;
 typedef itk::ImageFileWriter<PETImageType> PETWriterType;
 
+typedef itk::ImageToImageFilter<PETImageType, PETImageType> PETFilterType;
+
+typedef petpvc::PVCPipeline<PETImageType, MaskImageType> PipelineType;
+
+typedef petpvc::ReplicatePVC<PETImageType, MaskImageType> ReplicatePVCType;
+typedef itk::ImageFileWriter<ReplicatePVCType::StackImageType> StackWriterType;
+
 //Produces the text for the acknowledgment dialog in Slicer.
 std::string getAcknowledgments(void);
 
-//Takes input and checks for valid PVC method request.
-PVCMethod getPVCMethod( std::string );
+//Takes input and checks for valid PVC method request. Region-based chains
+//are parsed into pipeline.
+PVCMethod getPVCMethod( std::string, PipelineType & pipeline );
 
 //Prints list of available methods.
 void printPVCMethodList(void);
 
+//Approximate number of PET-sized temporary images a method holds at once.
+unsigned int getNumberOfTemporaries( PVCMethod method, const PipelineType & pipeline );
+
+//Estimated peak memory in bytes, from the size of the PET and mask images,
+//when nImages images are corrected at once.
+double estimatePeakMemory( PVCMethod method, const PipelineType & pipeline, double fPETBytes, double fMaskBytes,
+                           unsigned int nImages );
+
+//Values of every occurrence of an option with one field, in order.
+std::vector< std::string > getOptionValues( MetaCommand & command, const std::string & sOption );
+
+//Reads the volumes of the mask that the method uses. Throws
+//itk::ExceptionObject if the mask cannot be read.
+MaskImageType::Pointer readMask( PVCMethod method, const PipelineType & pipeline, const std::string & sMaskFileName );
+
+//Corrects several PET images with the same mask and PSF, sharing the work on
+//the mask between them, and writes each to its own output. With bWarmStart,
+//they are corrected in order, IY starting each from the one before.
+int correctImages( const PipelineType & pipeline, const std::vector< std::string > & vecPETFileNames,
+                   const std::string & sMaskFileName, const std::vector< std::string > & vecOutputFileNames,
+                   const PipelineType::Settings & settings, bool bWarmStart );
+
+//Reports the peak memory and writes the stage profile, if one was asked for.
+int finishRun( const std::string & sProfileFileName, const std::string & sMethod,
+               double fWallStart, double fCPUStart, float fMemoryLimit, bool bDebug );
+
+//Corrects a 4-D stack of replicates with GTM, RBV or IY, and writes the
+//mean and variance of each region over the replicates to sSummaryFileName.
+int correctReplicates( PVCMethod method, const PipelineType & pipeline, const std::string & sPETFileName,
+                       const std::string & sMaskFileName, const std::string & sOutputFileName,
+                       const std::string & sSummaryFileName, VectorType vVariance,
+                       unsigned int nIterations, float fTolerance, bool bWarmStart, bool bDebug );
+
 int main(int argc, char *argv[])
 {
 
@@ -102,7 +140,7 @@ int main(int argc, char *argv[])
 
     command.SetCategory("PETPVC");
 
-    command.SetOption("Input", "i", true,"PET image file");
+    command.SetOption("Input", "i", true,"PET image file. Give -i and -o once per image to correct several images with the same mask (RBV, MTC, IY, MG and their chains)");
     command.SetOptionLongTag("Input", "input");
 	command.AddOptionField("Input", "filename", MetaCommand::IMAGE, true, "");
 
@@ -133,6 +171,10 @@ int main(int argc, char *argv[])
     command.SetOption("debug", "d", false,"Prints debug information");
     command.SetOptionLongTag("debug", "debug");
 
+    command.SetOption("Threads", "j", false, "Maximum number of threads to use (0 for the default)");
+    command.SetOptionLongTag("Threads", "threads");
+    command.AddOptionField("Threads", "N", MetaCommand::INT, true, "0");
+
     command.SetOption("Iterations", "n", false, "Number of iterations (used for iterative Yang)");
     command.SetOptionLongTag("Iterations", "iter");
     command.AddOptionField("Iterations", "Val", MetaCommand::INT, false, "10");
@@ -144,19 +186,101 @@ int main(int argc, char *argv[])
     command.SetOptionLongTag("Alpha", "alpha");
     command.AddOptionField("Alpha", "aval", MetaCommand::FLOAT, false, "1.5");
 
-    command.SetOption("Stop", "s", false, "Stopping criterion");
+    command.SetOption("Stop", "s", false, "Stopping criterion (VC)");
     command.SetOptionLongTag("Stop", "stop");
     command.AddOptionField("Stop", "stopval", MetaCommand::FLOAT, false, "0.01");
 
+    command.SetOption("Tolerance", "t", false,
+                      "Convergence tolerance of IY (change in the means) and RL (change in the log-likelihood)");
+    command.SetOptionLongTag("Tolerance", "tolerance");
+    command.AddOptionField("Tolerance", "tolval", MetaCommand::FLOAT, true, "0");
+
 	command.SetOption("NonNeg", "0", false,"Turns off non-negativity constraint");
     command.SetOptionLongTag("NonNeg", "disable-non-neg");
 
+    command.SetOption("SaveIterations", "S", false,
+                      "Comma-separated list of iterations at which to save the current estimate (IY, STC, RL and VC)");
+    command.SetOptionLongTag("SaveIterations", "save-iterations");
+    command.AddOptionField("SaveIterations", "list", MetaCommand::STRING, true, "");
+
+    command.SetOption("SaveMeans", "M", false,
+                      "Text file to which the regional means are appended at each saved iteration (IY and STC)");
+    command.SetOptionLongTag("SaveMeans", "save-means");
+    command.AddOptionField("SaveMeans", "filename", MetaCommand::STRING, true, "");
+
+    command.SetOption("MemoryLimit", "L", false,
+                      "Approximate memory limit in MB. RL and VC then process the volume in z-slabs; other methods stop if their estimated peak memory is higher. "
+                      "The input and output images are still held in full, so slabs only reduce the temporaries");
+    command.SetOptionLongTag("MemoryLimit", "memory-limit");
+    command.AddOptionField("MemoryLimit", "MB", MetaCommand::FLOAT, true, "0");
+
+    command.SetOption("Profile", "P", false,
+                      "Write the time spent in each stage to a report (.json for JSON, otherwise CSV)");
+    command.SetOptionLongTag("Profile", "profile");
+    command.AddOptionField("Profile", "filename", MetaCommand::STRING, true, "");
+
+    command.SetOption("RegionIndex", "R", false,
+                      "Region index file for the mask regions. It is read if it matches the mask, otherwise built and written (RBV, MTC, IY and their chains)");
+    command.SetOptionLongTag("RegionIndex", "region-index");
+    command.AddOptionField("RegionIndex", "filename", MetaCommand::STRING, true, "");
+
+    command.SetOption("Replicates", "N", false,
+                      "The PET image is a 4-D stack of replicates, corrected together (GTM, RBV and IY). The mean and variance of each region over the replicates are written to this file");
+    command.SetOptionLongTag("Replicates", "replicates");
+    command.AddOptionField("Replicates", "filename", MetaCommand::STRING, true, "");
+
+    command.SetOption("Init", "I", false,
+                      "Initial estimate to start from instead of the PET data, e.g. the correction of the previous frame (IY and its chains, RL and VC)");
+    command.SetOptionLongTag("Init", "init");
+    command.AddOptionField("Init", "filename", MetaCommand::STRING, true, "");
+
+    command.SetOption("WarmStart", "W", false,
+                      "With several inputs or replicates, IY starts each one from the correction of the one before (not with VC or RL after it)");
+    command.SetOptionLongTag("WarmStart", "warm-start");
+
+    command.SetOption("Checkpoint", "c", false,
+                      "File in which to keep the state of IY, RL or VC while they run, so that --resume can continue from it");
+    command.SetOptionLongTag("Checkpoint", "checkpoint");
+    command.AddOptionField("Checkpoint", "filename", MetaCommand::STRING, true, "");
+
+    command.SetOption("CheckpointEvery", "e", false,
+                      "How often to write the checkpoint: a number of iterations, or of seconds followed by s (default 300s)");
+    command.SetOptionLongTag("CheckpointEvery", "checkpoint-every");
+    command.AddOptionField("CheckpointEvery", "interval", MetaCommand::STRING, true, "300s");
+
+    command.SetOption("Resume", "r", false, "Continue from the checkpoint, if there is one");
+    command.SetOptionLongTag("Resume", "resume");
+
+    command.SetOption("KeepCheckpoint", "K", false,
+                      "Keep the checkpoint once the output is written, e.g. to continue for more iterations later");
+    command.SetOptionLongTag("KeepCheckpoint", "keep-checkpoint");
+
+    command.SetOption("TimeBudget", "b", false,
+                      "Stop the iterative methods before this many seconds have passed since the start of the run");
+    command.SetOptionLongTag("TimeBudget", "time-budget");
+    command.AddOptionField("TimeBudget", "sec", MetaCommand::FLOAT, true);
+
+    command.SetOption("DryRun", "D", false,
+                      "Print the estimated peak memory, using only the image headers, and exit");
+    command.SetOptionLongTag("DryRun", "dry-run");
+
     //Parse command line.
     if (!command.Parse(argc, argv)) {
 		printPVCMethodList();
 		return EXIT_SUCCESS;
     }
 
+    //The time budget counts from here, so reading the images is part of it.
+    double fDeadline = 0.0;
+    if ( command.GetOptionWasSet("TimeBudget") ) {
+        const float fBudget = command.GetValueAsFloat("TimeBudget", "sec");
+        if ( fBudget <= 0.0 ) {
+            std::cerr << "[Error]\tThe time budget must be positive" << std::endl;
+            return EXIT_FAILURE;
+        }
+        fDeadline = petpvc::GetWallClockTime() + fBudget;
+    }
+
     //Get image filenames
     std::string sPETFileName = command.GetValueAsString("Input", "filename");
     std::string sMaskFileName = command.GetValueAsString("Mask", "filename");
@@ -182,7 +306,44 @@ int main(int argc, char *argv[])
     //Toggle debug mode
     bool bDebug = command.GetValueAsBool("debug");
 
-	PVCMethod approach = getPVCMethod( desiredMethod );
+    //Limit the number of threads before any filters are created.
+    petpvc::SetNumberOfThreads( command.GetValueAsInt("Threads", "N") );
+
+    //Get iterations at which to save intermediate results.
+    std::vector<unsigned int> vecSaveIters;
+    if ( command.GetOptionWasSet("SaveIterations") ) {
+        vecSaveIters = petpvc::ParseIterationList( command.GetValueAsString("SaveIterations", "list") );
+    }
+
+    std::string sMeansFileName;
+    if ( command.GetOptionWasSet("SaveMeans") ) {
+        sMeansFileName = command.GetValueAsString("SaveMeans", "filename");
+    }
+
+    std::string sRegionIndexFileName;
+    if ( command.GetOptionWasSet("RegionIndex") ) {
+        sRegionIndexFileName = command.GetValueAsString("RegionIndex", "filename");
+    }
+
+    //Get memory limit for slab processing.
+    float fMemoryLimit = 0.0;
+    if ( command.GetOptionWasSet("MemoryLimit") ) {
+        fMemoryLimit = command.GetValueAsFloat("MemoryLimit", "MB");
+    }
+
+    //Turn on stage profiling.
+    std::string sProfileFileName;
+    if ( command.GetOptionWasSet("Profile") ) {
+        sProfileFileName = command.GetValueAsString("Profile", "filename");
+        petpvc::Profiler::SetEnabled( true );
+    }
+
+    petpvc::Profiler & profiler = petpvc::Profiler::GetInstance();
+    const double fWallStart = sProfileFileName.empty() ? 0.0 : profiler.GetWallTime();
+    const double fCPUStart = sProfileFileName.empty() ? 0.0 : profiler.GetCPUTime();
+
+	PipelineType pipeline;
+	PVCMethod approach = getPVCMethod( desiredMethod, pipeline );
 
 	if (approach == EUnknown) {
 		std::cerr << "[Error]\tUnknown method '" << desiredMethod << "' requested" << std::endl << std::endl;
@@ -190,64 +351,338 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
-    //Create reader for PET image.
-    PETReaderType::Pointer petReader = PETReaderType::New();
-    petReader->SetFileName(sPETFileName);
+	//Several images with the same mask and PSF, e.g. one per tracer.
+	const std::vector< std::string > vecPETFileNames = getOptionValues( command, "Input" );
+	const std::vector< std::string > vecOutputFileNames = getOptionValues( command, "Output" );
+
+	if ( vecPETFileNames.size() > 1 ) {
+		if ( vecOutputFileNames.size() != vecPETFileNames.size() ) {
+			std::cerr << "[Error]\tEach input needs its own output, but " << vecPETFileNames.size()
+			          << " inputs and " << vecOutputFileNames.size() << " outputs were given" << std::endl;
+			return EXIT_FAILURE;
+		}
+		if ( approach != ERegional || command.GetOptionWasSet("Replicates") ) {
+			std::cerr << "[Error]\tSeveral inputs can only be corrected with RBV, MTC, IY, MG and their chains"
+			          << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	//Estimate peak memory from the image headers.
+	if ( command.GetOptionWasSet("DryRun") || fMemoryLimit > 0.0 ) {
+		MaskImageType::SizeType petSize, maskSize;
+		maskSize.Fill( 0 );
+
+		if ( !petpvc::ReadImageSize< MaskImageType >( sPETFileName, petSize ) ) {
+			std::cerr << "[Error]\tCannot read PET input file: " << sPETFileName << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		const bool bNeedsMask = ( approach != ERichardsonLucy ) && ( approach != EVanCittert );
+		if ( bNeedsMask && !petpvc::ReadImageSize< MaskImageType >( sMaskFileName, maskSize ) ) {
+			std::cerr << "[Error]\tCannot read mask input file: " << sMaskFileName << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		const double fPETBytes = (double) petSize[0] * petSize[1] * petSize[2] * sizeof( PETImageType::PixelType );
+		//MG reads only the first two volumes of the mask.
+		itk::SizeValueType nMaskVolumes = maskSize[3];
+		if ( approach == ERegional && pipeline.GetCorrection() == PipelineType::EMullerGartner ) {
+			nMaskVolumes = std::min< itk::SizeValueType >( nMaskVolumes, 2 );
+		}
+
+		const double fMaskBytes = (double) maskSize[0] * maskSize[1] * maskSize[2] * nMaskVolumes
+		                          * sizeof( MaskImageType::PixelType );
+		//An initial estimate is one more image.
+		const double fInitBytes = command.GetOptionWasSet("Init") ? fPETBytes : 0.0;
+		const double fEstimateMB = ( estimatePeakMemory( approach, pipeline, fPETBytes, fMaskBytes,
+		                                                 std::max< unsigned int >( vecPETFileNames.size(), 1 ) )
+		                             + fInitBytes ) / ( 1024.0 * 1024.0 );
+		const bool bSlabs = ( approach == ERichardsonLucy ) || ( approach == EVanCittert );
+
+		if ( command.GetOptionWasSet("DryRun") ) {
+			std::cout << "PET image:\t" << petSize[0] << " x " << petSize[1] << " x " << petSize[2]
+			          << " (" << fPETBytes / ( 1024.0 * 1024.0 ) << " MB)" << std::endl;
+			if ( bNeedsMask ) {
+				std::cout << "Mask image:\t" << maskSize[0] << " x " << maskSize[1] << " x " << maskSize[2]
+				          << " x " << maskSize[3] << " (" << fMaskBytes / ( 1024.0 * 1024.0 ) << " MB)" << std::endl;
+			}
+			std::cout << "Estimated peak memory for " << desiredMethod << ":\t" << fEstimateMB << " MB" << std::endl;
+			if ( bSlabs && fMemoryLimit > 0.0 && fEstimateMB > fMemoryLimit ) {
+				std::cout << "The volume will be processed in z-slabs to fit within " << fMemoryLimit << " MB" << std::endl;
+			}
+			return EXIT_SUCCESS;
+		}
+
+		//RL and VC fit themselves to the limit.
+		if ( !bSlabs && fEstimateMB > fMemoryLimit ) {
+			std::cerr << "[Error]\tEstimated peak memory of " << fEstimateMB << " MB for " << desiredMethod
+			          << " exceeds the memory limit of " << fMemoryLimit << " MB" << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+    //Calculate the variance for a given FWHM.
+    VectorType vVariance;
+    vVariance = vFWHM / (2.0 * sqrt(2.0 * log(2.0)));
+    //std::cout << vVariance << std::endl;
+
+    vVariance[0] = pow(vVariance[0], 2);
+    vVariance[1] = pow(vVariance[1], 2);
+    vVariance[2] = pow(vVariance[2], 2);
+
+    //Settings of the region-based chains.
+    PipelineType::Settings settings;
+    settings.vecVariance = vVariance;
+    settings.nIterations = command.GetValueAsInt("Iterations", "Val");
+    settings.nDeconvIterations = command.GetValueAsInt("Deconvolution", "Val");
+    settings.fAlpha = command.GetValueAsFloat("Alpha", "aval");
+    settings.fStop = command.GetValueAsFloat("Stop", "stopval");
+    //IY and RL run every iteration unless a tolerance is given.
+    const float fTolerance = command.GetOptionWasSet("Tolerance") ? command.GetValueAsFloat("Tolerance", "tolval") : 0.0;
+    settings.fTolerance = fTolerance;
+    settings.bDisableNonNeg = command.GetValueAsBool("NonNeg");
+    settings.bVerbose = bDebug;
+    settings.vecSaveIters = vecSaveIters;
+    settings.sOutputFileName = sOutputFileName;
+    settings.sMeansFileName = sMeansFileName;
+    settings.sRegionIndexFileName = sRegionIndexFileName;
+
+    bool bWarmStart = command.GetValueAsBool("WarmStart");
+
+    //Checkpoints of the iterative methods, for resuming a stopped run.
+    petpvc::CheckpointSettings checkpoint;
+    if ( command.GetOptionWasSet("Checkpoint") ) {
+        checkpoint.sFileName = command.GetValueAsString("Checkpoint", "filename");
+        const std::string sInterval = command.GetOptionWasSet("CheckpointEvery") ?
+                                      command.GetValueAsString("CheckpointEvery", "interval") : "300s";
+        if ( !petpvc::ParseCheckpointInterval( sInterval, checkpoint ) ) {
+            std::cerr << "[Error]\tInvalid checkpoint interval: " << sInterval << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    const bool bResume = command.GetValueAsBool("Resume");
+    if ( bResume && checkpoint.sFileName.empty() ) {
+        std::cerr << "[Error]\t--resume needs the --checkpoint file to resume from" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    //Name the checkpoint is kept under, or empty for methods without one.
+    std::string sCheckpointMethod;
+    if ( approach == ERichardsonLucy ) {
+        sCheckpointMethod = "RL";
+    } else if ( approach == EVanCittert ) {
+        sCheckpointMethod = "VC";
+    } else if ( approach == ERegional && pipeline.GetCorrection() == PipelineType::EIterativeYang &&
+                pipeline.GetDeconvolution() == PipelineType::ENoDeconvolution ) {
+        sCheckpointMethod = "IY";
+    }
+
+    if ( !checkpoint.sFileName.empty() && ( sCheckpointMethod.empty() || vecPETFileNames.size() > 1 ||
+                                            command.GetOptionWasSet("Replicates") ) ) {
+        std::cerr << "[Warning]\tCheckpoints are only kept for IY, RL and VC on one image" << std::endl;
+        checkpoint = petpvc::CheckpointSettings();
+        sCheckpointMethod.clear();
+    }
+    settings.checkpoint = checkpoint;
+
+    //Only the iterative methods can stop early.
+    const bool bIterative = ( approach == ERichardsonLucy ) || ( approach == EVanCittert ) || ( approach == ESTC ) ||
+                            ( approach == ERegional && ( pipeline.GetCorrection() == PipelineType::EIterativeYang ||
+                                                         pipeline.GetDeconvolution() != PipelineType::ENoDeconvolution ) );
+    if ( fDeadline > 0.0 && ( !bIterative || command.GetOptionWasSet("Replicates") ) ) {
+        std::cerr << "[Warning]\tThe time budget is only used by the iterative methods on single images" << std::endl;
+        fDeadline = 0.0;
+    }
+    settings.fDeadline = fDeadline;
+
+    //Correct a stack of replicates, doing the mask work once for all of them.
+    if ( command.GetOptionWasSet("Replicates") ) {
+        if ( command.GetOptionWasSet("Init") ) {
+            std::cerr << "[Warning]\tThe initial estimate is not used for replicates" << std::endl;
+        }
+        return correctReplicates( approach, pipeline, sPETFileName, sMaskFileName, sOutputFileName,
+                                  command.GetValueAsString("Replicates", "filename"), vVariance,
+                                  command.GetValueAsInt("Iterations", "Val"), fTolerance, bWarmStart, bDebug );
+    }
+
+    //Initial estimate, e.g. the correction of the previous frame.
+    PETImageType::Pointer initialImage;
+    if ( command.GetOptionWasSet("Init") ) {
+        const std::string sInitFileName = command.GetValueAsString("Init", "filename");
+        try {
+            initialImage = petpvc::ReadImage< PETImageType >( sInitFileName );
+        } catch (itk::ExceptionObject & err) {
+            std::cerr << "[Error]\tCannot read initial estimate: " << sInitFileName
+                      << std::endl << err << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        const bool bUsesInitialEstimate = approach == ERichardsonLucy || approach == EVanCittert ||
+                                          ( approach == ERegional && pipeline.GetCorrection() == PipelineType::EIterativeYang );
+        if ( !bUsesInitialEstimate ) {
+            std::cerr << "[Warning]\tThe initial estimate is only used by IY, RL and VC" << std::endl;
+        }
+        settings.imageInitialEstimate = initialImage;
+    }
+
+    //In a chain the output is the deconvolved image, which is not a start
+    //for the IY of the next image.
+    if ( bWarmStart && !( approach == ERegional && pipeline.GetCorrection() == PipelineType::EIterativeYang &&
+                          pipeline.GetDeconvolution() == PipelineType::ENoDeconvolution ) ) {
+        std::cerr << "[Warning]\tOnly IY on its own is warm-started" << std::endl;
+        bWarmStart = false;
+    }
+
+    //Correct several images, doing the mask work once for all of them.
+    if ( vecPETFileNames.size() > 1 ) {
+        const int nResult = correctImages( pipeline, vecPETFileNames, sMaskFileName, vecOutputFileNames, settings,
+                                           bWarmStart );
+        if ( nResult != EXIT_SUCCESS ) {
+            return nResult;
+        }
+        return finishRun( sProfileFileName, desiredMethod, fWallStart, fCPUStart, fMemoryLimit, bDebug );
+    }
+
+    //Read PET, memory-mapped if the file is uncompressed.
+    PETImageType::Pointer petImage;
 
     //Try to read PET.
     try {
-        petReader->Update();
+        petImage = petpvc::ReadImage< PETImageType >( sPETFileName );
     } catch (itk::ExceptionObject & err) {
         std::cerr << "[Error]\tCannot read PET input file: " << sPETFileName
                   << std::endl << err << std::endl;
         return EXIT_FAILURE;
     }
 
-    //Calculate the variance for a given FWHM.
-    VectorType vVariance;
-    vVariance = vFWHM / (2.0 * sqrt(2.0 * log(2.0)));
-    //std::cout << vVariance << std::endl;
+    //Mask image, memory-mapped if the file is uncompressed.
+    MaskImageType::Pointer maskImage;
+
+    //Checkpoints record the input, mask, PSF and VC settings they were made
+    //from. IY reads its mask now, to check it before resuming.
+    if ( !sCheckpointMethod.empty() ) {
+        checkpoint.source = petpvc::CheckpointSource( petImage.GetPointer(), vVariance );
+        if ( sCheckpointMethod == "IY" ) {
+            try {
+                maskImage = readMask( approach, pipeline, sMaskFileName );
+            } catch (itk::ExceptionObject & err) {
+                std::cerr << "[Error]\tCannot read mask input file: " << sMaskFileName
+                          << std::endl << err << std::endl;
+                return EXIT_FAILURE;
+            }
+            checkpoint.source.nMaskChecksum = petpvc::ChecksumImage( maskImage.GetPointer() );
+        } else if ( sCheckpointMethod == "VC" ) {
+            checkpoint.source.fAlpha = settings.fAlpha;
+            checkpoint.source.bDisableNonNeg = settings.bDisableNonNeg;
+        }
+        settings.checkpoint.source = checkpoint.source;
+    }
 
-    VectorType vVoxelSize = petReader->GetOutput()->GetSpacing();
-    //std::cout << vVoxelSize << std::endl;
+    //Continue from the checkpoint of an earlier run, if there is one.
+    unsigned int nStartIteration = 0;
+    if ( bResume && !sCheckpointMethod.empty() ) {
+        petpvc::Checkpoint< PETImageType > state;
+        if ( !state.Read( checkpoint.sFileName ) ) {
+            std::cout << "No checkpoint to resume from in " << checkpoint.sFileName
+                      << ", starting from the beginning" << std::endl;
+        } else if ( state.sMethod != sCheckpointMethod ||
+                    state.size != petImage->GetLargestPossibleRegion().GetSize() ||
+                    !state.source.Matches( checkpoint.source ) ) {
+            std::cerr << "[Error]\tThe checkpoint in " << checkpoint.sFileName
+                      << " is not for " << sCheckpointMethod << " with this image, mask, PSF and settings" << std::endl;
+            return EXIT_FAILURE;
+        } else {
+            std::cout << "Resuming " << sCheckpointMethod << " after iteration " << state.nIteration << std::endl;
+            initialImage = state.GetEstimate( petImage );
+            nStartIteration = state.nIteration;
+            settings.imageInitialEstimate = initialImage;
+            settings.nStartIteration = nStartIteration;
+        }
+    }
 
-    vVariance[0] = pow(vVariance[0], 2);
-    vVariance[1] = pow(vVariance[1], 2);
-    vVariance[2] = pow(vVariance[2], 2);
+    VectorType vVoxelSize = petImage->GetSpacing();
+    //std::cout << vVoxelSize << std::endl;
 
 	//Create output image
 	PETImageType::Pointer outputImage;
 	bool isOutputImageReady = false;
 
-	//Create reader for mask image.
-    MaskReaderType::Pointer maskReader = MaskReaderType::New();
-
 	switch (approach) {
 		case ERichardsonLucy: {
 				std::cout << "Performing Richardson-Lucy..." << std::endl;
 
 				typedef petpvc::RichardsonLucyPVCImageFilter< PETImageType >  RLFilterType;
 				RLFilterType::Pointer rlFilter = RLFilterType::New();
-    			rlFilter->SetInput( petReader->GetOutput() );
+    			rlFilter->SetInput( petImage );
 		    	rlFilter->SetPSF(vVariance);
 
 				//Get number of iterations
 				int nNumOfIters = command.GetValueAsInt("Deconvolution", "Val");
 		    	rlFilter->SetIterations( nNumOfIters );
 
-		    	//rlFilter->SetStoppingCond( fStop );
+		    	rlFilter->SetStoppingCond( fTolerance );
 		    	rlFilter->SetVerbose ( bDebug );
+				rlFilter->SetInitialEstimate( initialImage );
+				rlFilter->SetStartIteration( nStartIteration );
+				rlFilter->SetDeadline( fDeadline );
+
+				PETFilterType::Pointer pvcFilter = rlFilter.GetPointer();
+
+				if ( fMemoryLimit > 0.0 ) {
+					//Process the volume in z-slabs. The stopping criterion and
+					//the initial estimate need the whole image, so run all
+					//iterations from the PET data instead.
+					rlFilter->SetStoppingCond( 0.0 );
+					rlFilter->SetInitialEstimate( NULL );
+					rlFilter->SetStartIteration( 0 );
+					rlFilter->SetDeadline( 0.0 );
+					//The zero threshold is taken once from the whole image, so
+					//that every slab uses the same one.
+					rlFilter->SetZeroThreshold( rlFilter->GetZeroThreshold( petImage.GetPointer() ) );
+					if ( fDeadline > 0.0 ) {
+						std::cerr << "[Warning]\tThe time budget is not used when processing in slabs" << std::endl;
+						fDeadline = 0.0;
+					}
+					if ( initialImage.IsNotNull() ) {
+						std::cerr << "[Warning]\tThe initial estimate is not used when processing in slabs" << std::endl;
+					}
+					if ( !checkpoint.sFileName.empty() ) {
+						std::cerr << "[Warning]\tCheckpoints are not kept when processing in slabs" << std::endl;
+					}
+
+					typedef petpvc::SlabStreamingImageFilter< PETImageType, RLFilterType > SlabFilterType;
+					SlabFilterType::Pointer slabFilter = SlabFilterType::New();
+					slabFilter->SetInput( petImage );
+					slabFilter->SetPVCFilter( rlFilter );
+					slabFilter->SetPSF( vVariance );
+					slabFilter->SetIterations( nNumOfIters );
+					slabFilter->SetMemoryLimit( fMemoryLimit );
+					slabFilter->SetVerbose( bDebug );
+					pvcFilter = slabFilter.GetPointer();
+
+					if ( !vecSaveIters.empty() ) {
+						std::cerr << "[Warning]\tIntermediate iterations are not saved when processing in slabs" << std::endl;
+					}
+				} else {
+					petpvc::AddIterationSnapshots( rlFilter.GetPointer(), vecSaveIters, sOutputFileName );
+					petpvc::AddCheckpoints( rlFilter.GetPointer(), sCheckpointMethod, checkpoint );
+				}
 
     			//Perform RL.
     			try {
-		    	    rlFilter->Update();
+		    	    pvcFilter->Update();
 		    	} catch (itk::ExceptionObject & err) {
         			std::cerr << "[Error]\tfailure applying Richardson-Lucy on: " << sPETFileName
             	      << "\n" << err << std::endl;
         			return EXIT_FAILURE;
 				}
 
-				outputImage = rlFilter->GetOutput();
+				outputImage = pvcFilter->GetOutput();
+				if ( fDeadline > 0.0 ) {
+					petpvc::RecordIterations( outputImage, "RL", rlFilter->GetIterationReport() );
+				}
 				isOutputImageReady = true;
 
 				break;
@@ -257,7 +692,7 @@ int main(int argc, char *argv[])
 
 				typedef petpvc::VanCittertPVCImageFilter< PETImageType >  VCFilterType;
 				VCFilterType::Pointer vcFilter = VCFilterType::New();
-    			vcFilter->SetInput( petReader->GetOutput() );
+    			vcFilter->SetInput( petImage );
 		    	vcFilter->SetPSF(vVariance);
 
 				//Get number of iterations
@@ -277,26 +712,72 @@ int main(int argc, char *argv[])
 				vcFilter->SetDisableNonNegativity( bDisableNonNeg );
 
 		    	vcFilter->SetVerbose ( bDebug );
+				vcFilter->SetInitialEstimate( initialImage );
+				vcFilter->SetStartIteration( nStartIteration );
+				vcFilter->SetDeadline( fDeadline );
+
+				PETFilterType::Pointer pvcFilter = vcFilter.GetPointer();
+
+				if ( fMemoryLimit > 0.0 ) {
+					//Process the volume in z-slabs. The stopping criterion and
+					//the initial estimate need the whole image, so run all
+					//iterations from the PET data instead.
+					vcFilter->SetStoppingCond( 0.0 );
+					vcFilter->SetInitialEstimate( NULL );
+					vcFilter->SetStartIteration( 0 );
+					vcFilter->SetDeadline( 0.0 );
+					if ( fDeadline > 0.0 ) {
+						std::cerr << "[Warning]\tThe time budget is not used when processing in slabs" << std::endl;
+						fDeadline = 0.0;
+					}
+					if ( initialImage.IsNotNull() ) {
+						std::cerr << "[Warning]\tThe initial estimate is not used when processing in slabs" << std::endl;
+					}
+					if ( !checkpoint.sFileName.empty() ) {
+						std::cerr << "[Warning]\tCheckpoints are not kept when processing in slabs" << std::endl;
+					}
+
+					typedef petpvc::SlabStreamingImageFilter< PETImageType, VCFilterType > SlabFilterType;
+					SlabFilterType::Pointer slabFilter = SlabFilterType::New();
+					slabFilter->SetInput( petImage );
+					slabFilter->SetPVCFilter( vcFilter );
+					slabFilter->SetPSF( vVariance );
+					slabFilter->SetIterations( nNumOfIters );
+					slabFilter->SetMemoryLimit( fMemoryLimit );
+					slabFilter->SetVerbose( bDebug );
+					pvcFilter = slabFilter.GetPointer();
+
+					if ( !vecSaveIters.empty() ) {
+						std::cerr << "[Warning]\tIntermediate iterations are not saved when processing in slabs" << std::endl;
+					}
+				} else {
+					petpvc::AddIterationSnapshots( vcFilter.GetPointer(), vecSaveIters, sOutputFileName );
+					petpvc::AddCheckpoints( vcFilter.GetPointer(), sCheckpointMethod, checkpoint );
+				}
 
     			//Perform VC.
     			try {
-		    	    vcFilter->Update();
+		    	    pvcFilter->Update();
 		    	} catch (itk::ExceptionObject & err) {
         			std::cerr << "[Error]\tfailure applying Van-Cittert on: " << sPETFileName
             	      << "\n" << err << std::endl;
         			return EXIT_FAILURE;
 				}
 
-				outputImage = vcFilter->GetOutput();
+				outputImage = pvcFilter->GetOutput();
+				if ( fDeadline > 0.0 ) {
+					petpvc::RecordIterations( outputImage, "VC", vcFilter->GetIterationReport() );
+				}
 				isOutputImageReady = true;
 
 				break;
 			}
 		default:
-			maskReader->SetFileName(sMaskFileName);
-			//Try to read mask.
+			//Try to read mask, unless it was read for the checkpoint.
     		try {
-		        maskReader->Update();
+		        if ( maskImage.IsNull() ) {
+		            maskImage = readMask( approach, pipeline, sMaskFileName );
+		        }
 		    } catch (itk::ExceptionObject & err) {
         		std::cerr << "[Error]\tCannot read mask input file: " << sMaskFileName
                   << std::endl << err << std::endl;
@@ -304,87 +785,22 @@ int main(int argc, char *argv[])
     		}
 	}
 
-    	switch (approach) {
-		case ERBV: {
-				std::cout << "Performing RBV..." << std::endl;
-			    typedef petpvc::RBVPVCImageFilter<PETImageType, MaskImageType>  RBVFilterType;
-
-				RBVFilterType::Pointer rbvFilter = RBVFilterType::New();
-			    rbvFilter->SetInput( petReader->GetOutput() );
-			    rbvFilter->SetMaskInput( maskReader->GetOutput() );
-			    rbvFilter->SetPSF(vVariance);
-			    rbvFilter->SetVerbose( bDebug );
-
-			    //Perform RBV.
-			    try {
-			        rbvFilter->Update();
-			    } catch (itk::ExceptionObject & err) {
-			        std::cerr << "\n[Error]\tfailure applying RBV on: " << sPETFileName
-			                  << "\n" << err
-			                  << std::endl;
-			        return EXIT_FAILURE;
-			    }
-
-				outputImage = rbvFilter->GetOutput();
-				isOutputImageReady = true;
-
-				break;
-			}
-		case EIterativeYang: {
-				std::cout << "Performing iterative Yang..." << std::endl;
-			    typedef petpvc::IterativeYangPVCImageFilter<PETImageType, MaskImageType>  IYFilterType;
-
-				IYFilterType::Pointer iyFilter = IYFilterType::New();
-			    iyFilter->SetInput( petReader->GetOutput() );
-			    iyFilter->SetMaskInput( maskReader->GetOutput() );
-
-				//Get number of iterations
-				int nNumOfIters = command.GetValueAsInt("Iterations", "Val");
-		    	iyFilter->SetIterations( nNumOfIters );
-
-			    iyFilter->SetPSF(vVariance);
-			    iyFilter->SetVerbose( bDebug );
-
-			    //Perform iY.
-			    try {
-			        iyFilter->Update();
-			    } catch (itk::ExceptionObject & err) {
-			        std::cerr << "\n[Error]\tfailure applying iY on: " << sPETFileName
-			                  << "\n" << err
-			                  << std::endl;
-			        return EXIT_FAILURE;
-			    }
+	switch (approach) {
+		case ERegional: {
+				try {
+					outputImage = pipeline.Run( petImage, maskImage, settings );
+				} catch (itk::ExceptionObject & err) {
+					std::cerr << "\n[Error]\tfailure applying " << desiredMethod << " on: " << sPETFileName
+					          << "\n" << err
+					          << std::endl;
+					return EXIT_FAILURE;
+				}
 
-				outputImage = iyFilter->GetOutput();
 				isOutputImageReady = true;
 
 				break;
 			}
-		case EMTC: {
-				std::cout << "Performing MTC..." << std::endl;
-			    typedef petpvc::MTCPVCImageFilter<PETImageType, MaskImageType>  MTCFilterType;
-
-				MTCFilterType::Pointer mtcFilter = MTCFilterType::New();
-			    mtcFilter->SetInput( petReader->GetOutput() );
-			    mtcFilter->SetMaskInput( maskReader->GetOutput() );
-			    mtcFilter->SetPSF(vVariance);
-			    mtcFilter->SetVerbose( bDebug );
 
-			    //Perform MTC.
-			    try {
-			        mtcFilter->Update();
-			    } catch (itk::ExceptionObject & err) {
-			        std::cerr << "\n[Error]\tfailure applying MTC on: " << sPETFileName
-			                  << "\n" << err
-			                  << std::endl;
-			        return EXIT_FAILURE;
-			    }
-
-				outputImage = mtcFilter->GetOutput();
-				isOutputImageReady = true;
-
-				break;
-			}
 			case ESTC: {
 
 					Mask3DReaderType::Pointer mask3Dreader = Mask3DReaderType::New();
@@ -394,10 +810,14 @@ int main(int argc, char *argv[])
 					typedef petpvc::STCPVCImageFilter<PETImageType, Mask3DImageType>  STCFilterType;
 
 					STCFilterType::Pointer stcFilter = STCFilterType::New();
-					stcFilter->SetInput( petReader->GetOutput() );
+					stcFilter->SetInput( petImage );
 					stcFilter->SetMaskInput( mask3Dreader->GetOutput() );
 					stcFilter->SetPSF(vVariance);
 					stcFilter->SetVerbose( bDebug );
+					stcFilter->SetDeadline( fDeadline );
+
+					petpvc::AddIterationSnapshots( stcFilter.GetPointer(), vecSaveIters, sOutputFileName );
+					petpvc::AddIterationMeans( stcFilter.GetPointer(), vecSaveIters, sMeansFileName );
 
 					//Perform STC.
 					try {
@@ -410,1005 +830,149 @@ int main(int argc, char *argv[])
 					}
 
 					outputImage = stcFilter->GetOutput();
+					if ( fDeadline > 0.0 ) {
+						petpvc::RecordIterations( outputImage, "STC", stcFilter->GetIterationReport() );
+					}
 					isOutputImageReady = true;
 
 					break;
 		}
-		case EMullerGartner: {
-				std::cout << "Performing Muller-Gartner..." << std::endl;
-
-				//Extracts a 3D volume from 4D file.
-				typedef itk::ExtractImageFilter<MaskImageType, PETImageType> ExtractFilterType;
-
-				MaskImageType::IndexType desiredStart;
-    			desiredStart.Fill(0);
-			    MaskImageType::SizeType desiredSize =
-					maskReader->GetOutput()->GetLargestPossibleRegion().GetSize();
-
-			    //Extract filter used to extract 3D volume from 4D file.
-			    ExtractFilterType::Pointer extractFilter = ExtractFilterType::New();
-			    extractFilter->SetInput(maskReader->GetOutput());
-			    extractFilter->SetDirectionCollapseToIdentity(); // This is required.
-
-			    //Extract filter used to extract 3D volume from 4D file.
-			    ExtractFilterType::Pointer extractFilter2 = ExtractFilterType::New();
-			    extractFilter2->SetInput(maskReader->GetOutput());
-			    extractFilter2->SetDirectionCollapseToIdentity(); // This is required.
-
-			    PETImageType::Pointer imageGM = PETImageType::New();
-			    PETImageType::Pointer imageWM = PETImageType::New();
-			    //PETImageType::Pointer imageCSF = PETImageType::New();
-
-			    //Starts reading from 4D volume at index (0,0,0,i) through to
-			    //(maxX, maxY, maxZ,0), i.e. one 3D brain mask.
-			    desiredStart[3] = 0;
-			    desiredSize[3] = 0;
-
-			    //Get GM mask.
-			    extractFilter->SetExtractionRegion(
-			        MaskImageType::RegionType(desiredStart, desiredSize));
-			    extractFilter->Update();
-
-			    imageGM = extractFilter->GetOutput();
-			    imageGM->SetDirection(petReader->GetOutput()->GetDirection());
-			    imageGM->UpdateOutputData();
-
-			    //Get WM mask.
-				desiredStart[3] = 1;
-			    extractFilter2->SetExtractionRegion(
-			        MaskImageType::RegionType(desiredStart, desiredSize));
-			    extractFilter2->Update();
-
-			    imageWM = extractFilter2->GetOutput();
-			    imageWM->SetDirection(petReader->GetOutput()->GetDirection());
-			    imageWM->UpdateOutputData();
-
-			    typedef petpvc::MullerGartnerImageFilter<PETImageType, PETImageType, PETImageType, PETImageType>  MGFilterType;
-
-				MGFilterType::Pointer mgFilter = MGFilterType::New();
-			    mgFilter->SetInput1(petReader->GetOutput());
-    			mgFilter->SetInput2(imageGM);
-    			mgFilter->SetInput3(imageWM);
-				mgFilter->SetWM( 0 );
-			    mgFilter->SetPSF(vVariance);
-			    mgFilter->SetVerbose( bDebug );
-
-			    //Perform MG.
-			    try {
-			        mgFilter->Update();
-			    } catch (itk::ExceptionObject & err) {
-			        std::cerr << "\n[Error]\tfailure applying MG on: " << sPETFileName
-			                  << "\n" << err
-			                  << std::endl;
-			        return EXIT_FAILURE;
-			    }
-
-				outputImage = mgFilter->GetOutput();
-				isOutputImageReady = true;
-
+			default:
 				break;
-			}
-
-		case EMGVanCittert: {
-				std::cout << "Performing Muller-Gartner..." << std::endl;
-
-				//Extracts a 3D volume from 4D file.
-				typedef itk::ExtractImageFilter<MaskImageType, PETImageType> ExtractFilterType;
-
-				//Puts 3D into 4D.
-				typedef itk::CastImageFilter<PETImageType, MaskImageType> CastFilterType;
-
-				MaskImageType::IndexType desiredStart;
-    			desiredStart.Fill(0);
-			    MaskImageType::SizeType desiredSize =
-					maskReader->GetOutput()->GetLargestPossibleRegion().GetSize();
-
-			    //Extract filter used to extract 3D volume from 4D file.
-			    ExtractFilterType::Pointer extractFilter = ExtractFilterType::New();
-			    extractFilter->SetInput(maskReader->GetOutput());
-			    extractFilter->SetDirectionCollapseToIdentity(); // This is required.
-
-			    //Extract filter used to extract 3D volume from 4D file.
-			    ExtractFilterType::Pointer extractFilter2 = ExtractFilterType::New();
-			    extractFilter2->SetInput(maskReader->GetOutput());
-			    extractFilter2->SetDirectionCollapseToIdentity(); // This is required.
-
-			    PETImageType::Pointer imageGM = PETImageType::New();
-			    PETImageType::Pointer imageWM = PETImageType::New();
-			    //PETImageType::Pointer imageCSF = PETImageType::New();
-
-			    //Starts reading from 4D volume at index (0,0,0,i) through to
-			    //(maxX, maxY, maxZ,0), i.e. one 3D brain mask.
-			    desiredStart[3] = 0;
-			    desiredSize[3] = 0;
-
-			    //Get GM mask.
-			    extractFilter->SetExtractionRegion(
-			        MaskImageType::RegionType(desiredStart, desiredSize));
-			    extractFilter->Update();
-
-			    imageGM = extractFilter->GetOutput();
-			    imageGM->SetDirection(petReader->GetOutput()->GetDirection());
-			    imageGM->UpdateOutputData();
-
-			    //Get WM mask.
-				desiredStart[3] = 1;
-			    extractFilter2->SetExtractionRegion(
-			        MaskImageType::RegionType(desiredStart, desiredSize));
-			    extractFilter2->Update();
-
-			    imageWM = extractFilter2->GetOutput();
-			    imageWM->SetDirection(petReader->GetOutput()->GetDirection());
-			    imageWM->UpdateOutputData();
-
-			    typedef petpvc::MullerGartnerImageFilter<PETImageType, PETImageType, PETImageType, PETImageType>  MGFilterType;
-
-				MGFilterType::Pointer mgFilter = MGFilterType::New();
-			    mgFilter->SetInput1(petReader->GetOutput());
-    			mgFilter->SetInput2(imageGM);
-    			mgFilter->SetInput3(imageWM);
-				mgFilter->SetWM( 0 );
-			    mgFilter->SetPSF(vVariance);
-			    mgFilter->SetVerbose( bDebug );
-
-			    //Perform MG.
-			    try {
-			        mgFilter->Update();
-			    } catch (itk::ExceptionObject & err) {
-			        std::cerr << "\n[Error]\tfailure applying MG on: " << sPETFileName
-			                  << "\n" << err
-			                  << std::endl;
-			        return EXIT_FAILURE;
-			    }
-
-				std::cout << "Performing Intra-regional Van-Cittert..." << std::endl;
 
-				CastFilterType::Pointer castFilter = CastFilterType::New();
-				castFilter->SetInput( imageGM );
-
-				typedef petpvc::IntraRegVCImageFilter< PETImageType, MaskImageType >  IVCFilterType;
-				IVCFilterType::Pointer vcFilter = IVCFilterType::New();
-    			vcFilter->SetInput( mgFilter->GetOutput() );
-				vcFilter->SetMaskInput( castFilter->GetOutput() );
-		    	vcFilter->SetPSF(vVariance);
-
-				//Get number of iterations
-				int nNumOfDeconvIters = command.GetValueAsInt("Deconvolution", "Val");
-		    	vcFilter->SetIterations( nNumOfDeconvIters );
+		}
 
-				//Get value for alpha.
-    			float fAlpha = command.GetValueAsFloat("Alpha", "aval");
-				vcFilter->SetAlpha( fAlpha );
+	if ( isOutputImageReady == true ) {
+    	PETWriterType::Pointer petWriter = PETWriterType::New();
+    	petWriter->SetFileName(sOutputFileName);
+    	petWriter->SetInput( outputImage );
 
-    			//Get value for stopping criterion.
-			    float fStop = command.GetValueAsFloat("Stop", "stopval");
-		    	vcFilter->SetStoppingCond( fStop );
+    	try {
+    	    petpvc::ScopedStageTimer writeTimer( NULL, "write" );
+    	    petWriter->Update();
+    	} catch (itk::ExceptionObject & err) {
+    	    std::cerr << "[Error]\tCannot write output file: " << sOutputFileName
+                  << std::endl;
 
-				//Toggle non-negativity constraint for VC
-    			const bool bDisableNonNeg = command.GetValueAsBool("NonNeg");
-				vcFilter->SetDisableNonNegativity( bDisableNonNeg );
+    	    return EXIT_FAILURE;
+    	}
 
-		    	vcFilter->SetVerbose ( bDebug );
+    	//The run has finished, so its checkpoint is no longer needed.
+    	if ( !sCheckpointMethod.empty() && !checkpoint.sFileName.empty() &&
+    	     !command.GetValueAsBool("KeepCheckpoint") ) {
+    	    std::remove( checkpoint.sFileName.c_str() );
+    	}
+	}
 
-    			//Perform VC.
-    			try {
-		    	    vcFilter->Update();
-		    	} catch (itk::ExceptionObject & err) {
-        			std::cerr << "[Error]\tfailure applying Van-Cittert on: " << sPETFileName
-            	      << "\n" << err << std::endl;
-        			return EXIT_FAILURE;
-				}
+	switch (approach) {
+		case EGTM: {
+				std::cout << "Performing Geometric matrix method..." << std::endl;
+			    typedef petpvc::RoussetPVCImageFilter<PETImageType, MaskImageType>  GTMFilterType;
 
-				outputImage = vcFilter->GetOutput();
-				isOutputImageReady = true;
+				GTMFilterType::Pointer gtmFilter = GTMFilterType::New();
+			    gtmFilter->SetInput( petImage );
+			    gtmFilter->SetMaskInput( maskImage );
+			    gtmFilter->SetPSF(vVariance);
+			    gtmFilter->SetVerbose( bDebug );
 
-				break;
-			}
-		case EMGRichardsonLucy: {
-				std::cout << "Performing Muller-Gartner..." << std::endl;
-
-				//Extracts a 3D volume from 4D file.
-				typedef itk::ExtractImageFilter<MaskImageType, PETImageType> ExtractFilterType;
-
-				//Puts 3D into 4D.
-				typedef itk::CastImageFilter<PETImageType, MaskImageType> CastFilterType;
-
-				MaskImageType::IndexType desiredStart;
-    			desiredStart.Fill(0);
-			    MaskImageType::SizeType desiredSize =
-					maskReader->GetOutput()->GetLargestPossibleRegion().GetSize();
-
-			    //Extract filter used to extract 3D volume from 4D file.
-			    ExtractFilterType::Pointer extractFilter = ExtractFilterType::New();
-			    extractFilter->SetInput(maskReader->GetOutput());
-			    extractFilter->SetDirectionCollapseToIdentity(); // This is required.
-
-			    //Extract filter used to extract 3D volume from 4D file.
-			    ExtractFilterType::Pointer extractFilter2 = ExtractFilterType::New();
-			    extractFilter2->SetInput(maskReader->GetOutput());
-			    extractFilter2->SetDirectionCollapseToIdentity(); // This is required.
-
-			    PETImageType::Pointer imageGM = PETImageType::New();
-			    PETImageType::Pointer imageWM = PETImageType::New();
-			    //PETImageType::Pointer imageCSF = PETImageType::New();
-
-			    //Starts reading from 4D volume at index (0,0,0,i) through to
-			    //(maxX, maxY, maxZ,0), i.e. one 3D brain mask.
-			    desiredStart[3] = 0;
-			    desiredSize[3] = 0;
-
-			    //Get GM mask.
-			    extractFilter->SetExtractionRegion(
-			        MaskImageType::RegionType(desiredStart, desiredSize));
-			    extractFilter->Update();
-
-			    imageGM = extractFilter->GetOutput();
-			    imageGM->SetDirection(petReader->GetOutput()->GetDirection());
-			    imageGM->UpdateOutputData();
-
-			    //Get WM mask.
-				desiredStart[3] = 1;
-			    extractFilter2->SetExtractionRegion(
-			        MaskImageType::RegionType(desiredStart, desiredSize));
-			    extractFilter2->Update();
-
-			    imageWM = extractFilter2->GetOutput();
-			    imageWM->SetDirection(petReader->GetOutput()->GetDirection());
-			    imageWM->UpdateOutputData();
-
-			    typedef petpvc::MullerGartnerImageFilter<PETImageType, PETImageType, PETImageType, PETImageType>  MGFilterType;
-
-				MGFilterType::Pointer mgFilter = MGFilterType::New();
-			    mgFilter->SetInput1(petReader->GetOutput());
-    			mgFilter->SetInput2(imageGM);
-    			mgFilter->SetInput3(imageWM);
-				mgFilter->SetWM( 0 );
-			    mgFilter->SetPSF(vVariance);
-			    mgFilter->SetVerbose( bDebug );
-
-			    //Perform MG.
+			    //Perform GTM.
 			    try {
-			        mgFilter->Update();
+			        gtmFilter->Update();
 			    } catch (itk::ExceptionObject & err) {
-			        std::cerr << "\n[Error]\tfailure applying MG on: " << sPETFileName
+			        std::cerr << "\n[Error]\tfailure applying GTM on: " << sPETFileName
 			                  << "\n" << err
 			                  << std::endl;
 			        return EXIT_FAILURE;
 			    }
 
-				std::cout << "Performing Intra-regional Richardson-Lucy..." << std::endl;
-
-				CastFilterType::Pointer castFilter = CastFilterType::New();
-				castFilter->SetInput( imageGM );
-
-				typedef petpvc::IntraRegRLImageFilter< PETImageType, MaskImageType >  IRLFilterType;
-				IRLFilterType::Pointer rlFilter = IRLFilterType::New();
-    			rlFilter->SetInput( mgFilter->GetOutput() );
-				rlFilter->SetMaskInput( castFilter->GetOutput() );
-		    	rlFilter->SetPSF(vVariance);
-
-				//Get number of iterations
-				int nNumOfDeconvIters = command.GetValueAsInt("Deconvolution", "Val");
-		    	rlFilter->SetIterations( nNumOfDeconvIters );
-		    	rlFilter->SetVerbose ( bDebug );
+				std::ofstream outputTextFile;
+				outputTextFile.open( sOutputFileName.c_str() );
+				if ( outputTextFile.is_open() ) {
+					outputTextFile << "REGION\tMEAN" << std::endl;
+					vnl_vector<float> results = gtmFilter->GetCorrectedMeans();
+					for (int n=0; n < results.size(); n++)
+						outputTextFile << n+1 << "\t" << results[n] << std::endl;
+					outputTextFile.close();
+				} else {
+					 std::cerr << "[Error]\tCannot write output file: " << sOutputFileName
+                  		<< std::endl;
 
-    			//Perform RL.
-    			try {
-		    	    rlFilter->Update();
-		    	} catch (itk::ExceptionObject & err) {
-        			std::cerr << "[Error]\tfailure applying Richardson-Lucy on: " << sPETFileName
-            	      << "\n" << err << std::endl;
-        			return EXIT_FAILURE;
+    	    		return EXIT_FAILURE;
 				}
 
-				outputImage = rlFilter->GetOutput();
-				isOutputImageReady = true;
-
 				break;
 			}
-		case ELabbeRBV: {
-				std::cout << "Performing Labbe-RBV..." << std::endl;
-			    typedef petpvc::LabbeRBVPVCImageFilter<PETImageType, MaskImageType>  LabbeRBVFilterType;
+		case ELabbe: {
+				std::cout << "Performing the Labbe method..." << std::endl;
+			    typedef petpvc::LabbePVCImageFilter<PETImageType, MaskImageType>  LabbeFilterType;
 
-				LabbeRBVFilterType::Pointer lrbvFilter = LabbeRBVFilterType::New();
-			    lrbvFilter->SetInput( petReader->GetOutput() );
-			    lrbvFilter->SetMaskInput( maskReader->GetOutput() );
-			    lrbvFilter->SetPSF(vVariance);
-			    lrbvFilter->SetVerbose( bDebug );
+				LabbeFilterType::Pointer labbeFilter = LabbeFilterType::New();
+			    labbeFilter->SetInput( petImage );
+			    labbeFilter->SetMaskInput( maskImage );
+			    labbeFilter->SetPSF(vVariance);
+			    labbeFilter->SetVerbose( bDebug );
 
-			    //Perform Labbe-RBV.
+			    //Perform L-PVC.
 			    try {
-			        lrbvFilter->Update();
+			        labbeFilter->Update();
 			    } catch (itk::ExceptionObject & err) {
-			        std::cerr << "\n[Error]\tfailure applying L-RBV on: " << sPETFileName
+			        std::cerr << "\n[Error]\tfailure applying Labbe on: " << sPETFileName
 			                  << "\n" << err
 			                  << std::endl;
 			        return EXIT_FAILURE;
 			    }
 
-				outputImage = lrbvFilter->GetOutput();
-				isOutputImageReady = true;
+				std::ofstream outputTextFile;
+				outputTextFile.open( sOutputFileName.c_str() );
+				if ( outputTextFile.is_open() ) {
+					outputTextFile << "REGION\tMEAN" << std::endl;
+					vnl_vector<float> results = labbeFilter->GetCorrectedMeans();
+					for (int n=0; n < results.size(); n++)
+						outputTextFile << n+1 << "\t" << results[n] << std::endl;
+					outputTextFile.close();
+				} else {
+					 std::cerr << "[Error]\tCannot write output file: " << sOutputFileName
+                  		<< std::endl;
 
-				break;
-			}
-		case ELabbeMTC: {
-				std::cout << "Performing Labbe-MTC..." << std::endl;
-			    typedef petpvc::LabbeMTCPVCImageFilter<PETImageType, MaskImageType>  LabbeMTCFilterType;
-
-				LabbeMTCFilterType::Pointer lmtcFilter = LabbeMTCFilterType::New();
-			    lmtcFilter->SetInput( petReader->GetOutput() );
-			    lmtcFilter->SetMaskInput( maskReader->GetOutput() );
-			    lmtcFilter->SetPSF(vVariance);
-			    lmtcFilter->SetVerbose( bDebug );
-
-			    //Perform Labbe-MTC.
-			    try {
-			        lmtcFilter->Update();
-			    } catch (itk::ExceptionObject & err) {
-			        std::cerr << "\n[Error]\tfailure applying L-RBV on: " << sPETFileName
-			                  << "\n" << err
-			                  << std::endl;
-			        return EXIT_FAILURE;
-			    }
-
-				outputImage = lmtcFilter->GetOutput();
-				isOutputImageReady = true;
-
-				break;
-			}
-
-		case ERBVVanCittert: {
-				std::cout << "Performing RBV..." << std::endl;
-			    typedef petpvc::RBVPVCImageFilter<PETImageType, MaskImageType>  RBVFilterType;
-
-				RBVFilterType::Pointer rbvFilter = RBVFilterType::New();
-			    rbvFilter->SetInput( petReader->GetOutput() );
-			    rbvFilter->SetMaskInput( maskReader->GetOutput() );
-			    rbvFilter->SetPSF(vVariance);
-			    rbvFilter->SetVerbose( bDebug );
-
-			    //Perform RBV.
-			    try {
-			        rbvFilter->Update();
-			    } catch (itk::ExceptionObject & err) {
-			        std::cerr << "\n[Error]\tfailure applying RBV on: " << sPETFileName
-			                  << "\n" << err
-			                  << std::endl;
-			        return EXIT_FAILURE;
-			    }
-
-				std::cout << "Performing Intra-regional Van-Cittert..." << std::endl;
-
-				typedef petpvc::IntraRegVCImageFilter< PETImageType, MaskImageType >  IVCFilterType;
-				IVCFilterType::Pointer vcFilter = IVCFilterType::New();
-    			vcFilter->SetInput( rbvFilter->GetOutput() );
-				vcFilter->SetMaskInput( maskReader->GetOutput() );
-		    	vcFilter->SetPSF(vVariance);
-
-				//Get number of iterations
-				int nNumOfDeconvIters = command.GetValueAsInt("Deconvolution", "Val");
-		    	vcFilter->SetIterations( nNumOfDeconvIters );
-
-				//Get value for alpha.
-    			float fAlpha = command.GetValueAsFloat("Alpha", "aval");
-				vcFilter->SetAlpha( fAlpha );
-
-    			//Get value for stopping criterion.
-			    float fStop = command.GetValueAsFloat("Stop", "stopval");
-		    	vcFilter->SetStoppingCond( fStop );
-
-				//Toggle non-negativity constraint for VC
-    			const bool bDisableNonNeg = command.GetValueAsBool("NonNeg");
-				vcFilter->SetDisableNonNegativity( bDisableNonNeg );
-
-		    	vcFilter->SetVerbose ( bDebug );
-
-    			//Perform VC.
-    			try {
-		    	    vcFilter->Update();
-		    	} catch (itk::ExceptionObject & err) {
-        			std::cerr << "[Error]\tfailure applying Van-Cittert on: " << sPETFileName
-            	      << "\n" << err << std::endl;
-        			return EXIT_FAILURE;
-				}
-
-				outputImage = vcFilter->GetOutput();
-				isOutputImageReady = true;
-
-				break;
-			}
-		case ERBVRichardsonLucy: {
-				std::cout << "Performing RBV..." << std::endl;
-			    typedef petpvc::RBVPVCImageFilter<PETImageType, MaskImageType>  RBVFilterType;
-
-				RBVFilterType::Pointer rbvFilter = RBVFilterType::New();
-			    rbvFilter->SetInput( petReader->GetOutput() );
-			    rbvFilter->SetMaskInput( maskReader->GetOutput() );
-			    rbvFilter->SetPSF(vVariance);
-			    rbvFilter->SetVerbose( bDebug );
-
-			    //Perform RBV.
-			    try {
-			        rbvFilter->Update();
-			    } catch (itk::ExceptionObject & err) {
-			        std::cerr << "\n[Error]\tfailure applying RBV on: " << sPETFileName
-			                  << "\n" << err
-			                  << std::endl;
-			        return EXIT_FAILURE;
-			    }
-
-				std::cout << "Performing Intra-regional Richardson-Lucy..." << std::endl;
-
-				typedef petpvc::IntraRegRLImageFilter< PETImageType, MaskImageType >  IRLFilterType;
-				IRLFilterType::Pointer rlFilter = IRLFilterType::New();
-    			rlFilter->SetInput( rbvFilter->GetOutput() );
-				rlFilter->SetMaskInput( maskReader->GetOutput() );
-		    	rlFilter->SetPSF(vVariance);
-
-				//Get number of iterations
-				int nNumOfDeconvIters = command.GetValueAsInt("Deconvolution", "Val");
-		    	rlFilter->SetIterations( nNumOfDeconvIters );
-		    	rlFilter->SetVerbose ( bDebug );
-
-    			//Perform RL.
-    			try {
-		    	    rlFilter->Update();
-		    	} catch (itk::ExceptionObject & err) {
-        			std::cerr << "[Error]\tfailure applying Richardson-Lucy on: " << sPETFileName
-            	      << "\n" << err << std::endl;
-        			return EXIT_FAILURE;
-				}
-
-				outputImage = rlFilter->GetOutput();
-				isOutputImageReady = true;
-
-				break;
-			}
-
-		case ELabbeRBVVanCittert: {
-				std::cout << "Performing Labbe-RBV..." << std::endl;
-			    typedef petpvc::LabbeRBVPVCImageFilter<PETImageType, MaskImageType>  LabbeRBVFilterType;
-
-				LabbeRBVFilterType::Pointer lrbvFilter = LabbeRBVFilterType::New();
-			    lrbvFilter->SetInput( petReader->GetOutput() );
-			    lrbvFilter->SetMaskInput( maskReader->GetOutput() );
-			    lrbvFilter->SetPSF(vVariance);
-			    lrbvFilter->SetVerbose( bDebug );
-
-			    //Perform RBV.
-			    try {
-			        lrbvFilter->Update();
-			    } catch (itk::ExceptionObject & err) {
-			        std::cerr << "\n[Error]\tfailure applying RBV on: " << sPETFileName
-			                  << "\n" << err
-			                  << std::endl;
-			        return EXIT_FAILURE;
-			    }
-
-				std::cout << "Performing Intra-regional Van-Cittert..." << std::endl;
-
-				typedef petpvc::IntraRegVCImageFilter< PETImageType, MaskImageType >  IVCFilterType;
-				IVCFilterType::Pointer vcFilter = IVCFilterType::New();
-    			vcFilter->SetInput( lrbvFilter->GetOutput() );
-				vcFilter->SetMaskInput( maskReader->GetOutput() );
-		    	vcFilter->SetPSF(vVariance);
-
-				//Get number of iterations
-				int nNumOfDeconvIters = command.GetValueAsInt("Deconvolution", "Val");
-		    	vcFilter->SetIterations( nNumOfDeconvIters );
-
-				//Get value for alpha.
-    			float fAlpha = command.GetValueAsFloat("Alpha", "aval");
-				vcFilter->SetAlpha( fAlpha );
-
-    			//Get value for stopping criterion.
-			    float fStop = command.GetValueAsFloat("Stop", "stopval");
-		    	vcFilter->SetStoppingCond( fStop );
-
-				//Toggle non-negativity constraint for VC
-    			const bool bDisableNonNeg = command.GetValueAsBool("NonNeg");
-				vcFilter->SetDisableNonNegativity( bDisableNonNeg );
-
-		    	vcFilter->SetVerbose ( bDebug );
-
-    			//Perform VC.
-    			try {
-		    	    vcFilter->Update();
-		    	} catch (itk::ExceptionObject & err) {
-        			std::cerr << "[Error]\tfailure applying Van-Cittert on: " << sPETFileName
-            	      << "\n" << err << std::endl;
-        			return EXIT_FAILURE;
-				}
-
-				outputImage = vcFilter->GetOutput();
-				isOutputImageReady = true;
-
-				break;
-			}
-		case ELabbeRBVRichardsonLucy: {
-				std::cout << "Performing Labbe-RBV..." << std::endl;
-			    typedef petpvc::LabbeRBVPVCImageFilter<PETImageType, MaskImageType>  LabbeRBVFilterType;
-
-				LabbeRBVFilterType::Pointer lrbvFilter = LabbeRBVFilterType::New();
-			    lrbvFilter->SetInput( petReader->GetOutput() );
-			    lrbvFilter->SetMaskInput( maskReader->GetOutput() );
-			    lrbvFilter->SetPSF(vVariance);
-			    lrbvFilter->SetVerbose( bDebug );
-
-			    //Perform RBV.
-			    try {
-			        lrbvFilter->Update();
-			    } catch (itk::ExceptionObject & err) {
-			        std::cerr << "\n[Error]\tfailure applying RBV on: " << sPETFileName
-			                  << "\n" << err
-			                  << std::endl;
-			        return EXIT_FAILURE;
-			    }
-
-
-				std::cout << "Performing Intra-regional Richardson-Lucy..." << std::endl;
-
-				typedef petpvc::IntraRegRLImageFilter< PETImageType, MaskImageType >  IRLFilterType;
-				IRLFilterType::Pointer rlFilter = IRLFilterType::New();
-    			rlFilter->SetInput( lrbvFilter->GetOutput() );
-				rlFilter->SetMaskInput( maskReader->GetOutput() );
-		    	rlFilter->SetPSF(vVariance);
-
-				//Get number of iterations
-				int nNumOfDeconvIters = command.GetValueAsInt("Deconvolution", "Val");
-		    	rlFilter->SetIterations( nNumOfDeconvIters );
-		    	rlFilter->SetVerbose ( bDebug );
-
-    			//Perform RL.
-    			try {
-		    	    rlFilter->Update();
-		    	} catch (itk::ExceptionObject & err) {
-        			std::cerr << "[Error]\tfailure applying Richardson-Lucy on: " << sPETFileName
-            	      << "\n" << err << std::endl;
-        			return EXIT_FAILURE;
-				}
-
-				outputImage = rlFilter->GetOutput();
-				isOutputImageReady = true;
-
-				break;
-			}
-
-//MTC
-		case EMTCVanCittert: {
-				std::cout << "Performing MTC..." << std::endl;
-			    typedef petpvc::MTCPVCImageFilter<PETImageType, MaskImageType>  MTCFilterType;
-
-				MTCFilterType::Pointer mtcFilter = MTCFilterType::New();
-			    mtcFilter->SetInput( petReader->GetOutput() );
-			    mtcFilter->SetMaskInput( maskReader->GetOutput() );
-			    mtcFilter->SetPSF(vVariance);
-			    mtcFilter->SetVerbose( bDebug );
-
-			    //Perform RBV.
-			    try {
-			        mtcFilter->Update();
-			    } catch (itk::ExceptionObject & err) {
-			        std::cerr << "\n[Error]\tfailure applying MTC on: " << sPETFileName
-			                  << "\n" << err
-			                  << std::endl;
-			        return EXIT_FAILURE;
-			    }
-
-				std::cout << "Performing Intra-regional Van-Cittert..." << std::endl;
-
-				typedef petpvc::IntraRegVCImageFilter< PETImageType, MaskImageType >  IVCFilterType;
-				IVCFilterType::Pointer vcFilter = IVCFilterType::New();
-    			vcFilter->SetInput( mtcFilter->GetOutput() );
-				vcFilter->SetMaskInput( maskReader->GetOutput() );
-		    	vcFilter->SetPSF(vVariance);
-
-				//Get number of iterations
-				int nNumOfDeconvIters = command.GetValueAsInt("Deconvolution", "Val");
-		    	vcFilter->SetIterations( nNumOfDeconvIters );
-
-				//Get value for alpha.
-    			float fAlpha = command.GetValueAsFloat("Alpha", "aval");
-				vcFilter->SetAlpha( fAlpha );
-
-    			//Get value for stopping criterion.
-			    float fStop = command.GetValueAsFloat("Stop", "stopval");
-		    	vcFilter->SetStoppingCond( fStop );
-
-				//Toggle non-negativity constraint for VC
-    			const bool bDisableNonNeg = command.GetValueAsBool("NonNeg");
-				vcFilter->SetDisableNonNegativity( bDisableNonNeg );
-
-		    	vcFilter->SetVerbose ( bDebug );
-
-    			//Perform VC.
-    			try {
-		    	    vcFilter->Update();
-		    	} catch (itk::ExceptionObject & err) {
-        			std::cerr << "[Error]\tfailure applying Van-Cittert on: " << sPETFileName
-            	      << "\n" << err << std::endl;
-        			return EXIT_FAILURE;
-				}
-
-				outputImage = vcFilter->GetOutput();
-				isOutputImageReady = true;
-
-				break;
-			}
-		case EMTCRichardsonLucy: {
-				std::cout << "Performing MTC..." << std::endl;
-			    typedef petpvc::MTCPVCImageFilter<PETImageType, MaskImageType>  MTCFilterType;
-
-				MTCFilterType::Pointer mtcFilter = MTCFilterType::New();
-			    mtcFilter->SetInput( petReader->GetOutput() );
-			    mtcFilter->SetMaskInput( maskReader->GetOutput() );
-			    mtcFilter->SetPSF(vVariance);
-			    mtcFilter->SetVerbose( bDebug );
-
-			    //Perform RBV.
-			    try {
-			        mtcFilter->Update();
-			    } catch (itk::ExceptionObject & err) {
-			        std::cerr << "\n[Error]\tfailure applying MTC on: " << sPETFileName
-			                  << "\n" << err
-			                  << std::endl;
-			        return EXIT_FAILURE;
-			    }
-
-
-				std::cout << "Performing Intra-regional Richardson-Lucy..." << std::endl;
-
-				typedef petpvc::IntraRegRLImageFilter< PETImageType, MaskImageType >  IRLFilterType;
-				IRLFilterType::Pointer rlFilter = IRLFilterType::New();
-    			rlFilter->SetInput( mtcFilter->GetOutput() );
-				rlFilter->SetMaskInput( maskReader->GetOutput() );
-		    	rlFilter->SetPSF(vVariance);
-
-				//Get number of iterations
-				int nNumOfDeconvIters = command.GetValueAsInt("Deconvolution", "Val");
-		    	rlFilter->SetIterations( nNumOfDeconvIters );
-		    	rlFilter->SetVerbose ( bDebug );
-
-    			//Perform RL.
-    			try {
-		    	    rlFilter->Update();
-		    	} catch (itk::ExceptionObject & err) {
-        			std::cerr << "[Error]\tfailure applying Richardson-Lucy on: " << sPETFileName
-            	      << "\n" << err << std::endl;
-        			return EXIT_FAILURE;
-				}
-
-				outputImage = rlFilter->GetOutput();
-				isOutputImageReady = true;
-
-				break;
-			}
-		case ELabbeMTCVanCittert: {
-				std::cout << "Performing Labbe-MTC..." << std::endl;
-			    typedef petpvc::LabbeMTCPVCImageFilter<PETImageType, MaskImageType>  LabbeMTCFilterType;
-
-				LabbeMTCFilterType::Pointer lmtcFilter = LabbeMTCFilterType::New();
-			    lmtcFilter->SetInput( petReader->GetOutput() );
-			    lmtcFilter->SetMaskInput( maskReader->GetOutput() );
-			    lmtcFilter->SetPSF(vVariance);
-			    lmtcFilter->SetVerbose( bDebug );
-
-			    //Perform RBV.
-			    try {
-			        lmtcFilter->Update();
-			    } catch (itk::ExceptionObject & err) {
-			        std::cerr << "\n[Error]\tfailure applying MTC on: " << sPETFileName
-			                  << "\n" << err
-			                  << std::endl;
-			        return EXIT_FAILURE;
-			    }
-
-				std::cout << "Performing Intra-regional Van-Cittert..." << std::endl;
-
-				typedef petpvc::IntraRegVCImageFilter< PETImageType, MaskImageType >  IVCFilterType;
-				IVCFilterType::Pointer vcFilter = IVCFilterType::New();
-    			vcFilter->SetInput( lmtcFilter->GetOutput() );
-				vcFilter->SetMaskInput( maskReader->GetOutput() );
-		    	vcFilter->SetPSF(vVariance);
-
-				//Get number of iterations
-				int nNumOfDeconvIters = command.GetValueAsInt("Deconvolution", "Val");
-		    	vcFilter->SetIterations( nNumOfDeconvIters );
-
-				//Get value for alpha.
-    			float fAlpha = command.GetValueAsFloat("Alpha", "aval");
-				vcFilter->SetAlpha( fAlpha );
-
-    			//Get value for stopping criterion.
-			    float fStop = command.GetValueAsFloat("Stop", "stopval");
-		    	vcFilter->SetStoppingCond( fStop );
-
-				//Toggle non-negativity constraint for VC
-    			const bool bDisableNonNeg = command.GetValueAsBool("NonNeg");
-				vcFilter->SetDisableNonNegativity( bDisableNonNeg );
-
-		    	vcFilter->SetVerbose ( bDebug );
-
-    			//Perform VC.
-    			try {
-		    	    vcFilter->Update();
-		    	} catch (itk::ExceptionObject & err) {
-        			std::cerr << "[Error]\tfailure applying Van-Cittert on: " << sPETFileName
-            	      << "\n" << err << std::endl;
-        			return EXIT_FAILURE;
-				}
-
-				outputImage = vcFilter->GetOutput();
-				isOutputImageReady = true;
-
-				break;
-			}
-		case ELabbeMTCRichardsonLucy: {
-				std::cout << "Performing Labbe-MTC..." << std::endl;
-			    typedef petpvc::LabbeMTCPVCImageFilter<PETImageType, MaskImageType>  LabbeMTCFilterType;
-
-				LabbeMTCFilterType::Pointer lmtcFilter = LabbeMTCFilterType::New();
-			    lmtcFilter->SetInput( petReader->GetOutput() );
-			    lmtcFilter->SetMaskInput( maskReader->GetOutput() );
-			    lmtcFilter->SetPSF(vVariance);
-			    lmtcFilter->SetVerbose( bDebug );
-
-			    //Perform RBV.
-			    try {
-			        lmtcFilter->Update();
-			    } catch (itk::ExceptionObject & err) {
-			        std::cerr << "\n[Error]\tfailure applying MTC on: " << sPETFileName
-			                  << "\n" << err
-			                  << std::endl;
-			        return EXIT_FAILURE;
-			    }
-
-				std::cout << "Performing Intra-regional Richardson-Lucy..." << std::endl;
-
-				typedef petpvc::IntraRegRLImageFilter< PETImageType, MaskImageType >  IRLFilterType;
-				IRLFilterType::Pointer rlFilter = IRLFilterType::New();
-    			rlFilter->SetInput( lmtcFilter->GetOutput() );
-				rlFilter->SetMaskInput( maskReader->GetOutput() );
-		    	rlFilter->SetPSF(vVariance);
-
-				//Get number of iterations
-				int nNumOfDeconvIters = command.GetValueAsInt("Deconvolution", "Val");
-		    	rlFilter->SetIterations( nNumOfDeconvIters );
-		    	rlFilter->SetVerbose ( bDebug );
-
-    			//Perform RL.
-    			try {
-		    	    rlFilter->Update();
-		    	} catch (itk::ExceptionObject & err) {
-        			std::cerr << "[Error]\tfailure applying Richardson-Lucy on: " << sPETFileName
-            	      << "\n" << err << std::endl;
-        			return EXIT_FAILURE;
-				}
-
-				outputImage = rlFilter->GetOutput();
-				isOutputImageReady = true;
-
-				break;
-			}
-//IY
-		case EIYVanCittert: {
-				std::cout << "Performing iterative Yang..." << std::endl;
-			    typedef petpvc::IterativeYangPVCImageFilter<PETImageType, MaskImageType>  IYFilterType;
-
-				IYFilterType::Pointer iyFilter = IYFilterType::New();
-			    iyFilter->SetInput( petReader->GetOutput() );
-			    iyFilter->SetMaskInput( maskReader->GetOutput() );
-
-				//Get number of iterations
-				int nNumOfIters = command.GetValueAsInt("Iterations", "Val");
-		    	iyFilter->SetIterations( nNumOfIters );
-
-			    iyFilter->SetPSF(vVariance);
-			    iyFilter->SetVerbose( bDebug );
-
-			    //Perform iY.
-			    try {
-			        iyFilter->Update();
-			    } catch (itk::ExceptionObject & err) {
-			        std::cerr << "\n[Error]\tfailure applying iY on: " << sPETFileName
-			                  << "\n" << err
-			                  << std::endl;
-			        return EXIT_FAILURE;
-			    }
-
-				std::cout << "Performing Intra-regional Van-Cittert..." << std::endl;
-
-				typedef petpvc::IntraRegVCImageFilter< PETImageType, MaskImageType >  IVCFilterType;
-				IVCFilterType::Pointer vcFilter = IVCFilterType::New();
-    			vcFilter->SetInput( iyFilter->GetOutput() );
-				vcFilter->SetMaskInput( maskReader->GetOutput() );
-		    	vcFilter->SetPSF(vVariance);
-
-				//Get number of iterations
-				int nNumOfDeconvIters = command.GetValueAsInt("Deconvolution", "Val");
-		    	vcFilter->SetIterations( nNumOfDeconvIters );
-
-				//Get value for alpha.
-    			float fAlpha = command.GetValueAsFloat("Alpha", "aval");
-				vcFilter->SetAlpha( fAlpha );
-
-    			//Get value for stopping criterion.
-			    float fStop = command.GetValueAsFloat("Stop", "stopval");
-		    	vcFilter->SetStoppingCond( fStop );
-
-				//Toggle non-negativity constraint for VC
-    			const bool bDisableNonNeg = command.GetValueAsBool("NonNeg");
-				vcFilter->SetDisableNonNegativity( bDisableNonNeg );
-
-		    	vcFilter->SetVerbose ( bDebug );
-
-    			//Perform VC.
-    			try {
-		    	    vcFilter->Update();
-		    	} catch (itk::ExceptionObject & err) {
-        			std::cerr << "[Error]\tfailure applying Van-Cittert on: " << sPETFileName
-            	      << "\n" << err << std::endl;
-        			return EXIT_FAILURE;
-				}
-
-				outputImage = vcFilter->GetOutput();
-				isOutputImageReady = true;
-
-				break;
-			}
-		case EIYRichardsonLucy: {
-				std::cout << "Performing iterative Yang..." << std::endl;
-			    typedef petpvc::IterativeYangPVCImageFilter<PETImageType, MaskImageType>  IYFilterType;
-
-				IYFilterType::Pointer iyFilter = IYFilterType::New();
-			    iyFilter->SetInput( petReader->GetOutput() );
-			    iyFilter->SetMaskInput( maskReader->GetOutput() );
-
-				//Get number of iterations
-				int nNumOfIters = command.GetValueAsInt("Iterations", "Val");
-		    	iyFilter->SetIterations( nNumOfIters );
-
-			    iyFilter->SetPSF(vVariance);
-			    iyFilter->SetVerbose( bDebug );
-
-			    //Perform iY.
-			    try {
-			        iyFilter->Update();
-			    } catch (itk::ExceptionObject & err) {
-			        std::cerr << "\n[Error]\tfailure applying iY on: " << sPETFileName
-			                  << "\n" << err
-			                  << std::endl;
-			        return EXIT_FAILURE;
-			    }
-
-				std::cout << "Performing Intra-regional Richardson-Lucy..." << std::endl;
-
-				typedef petpvc::IntraRegRLImageFilter< PETImageType, MaskImageType >  IRLFilterType;
-				IRLFilterType::Pointer rlFilter = IRLFilterType::New();
-    			rlFilter->SetInput( iyFilter->GetOutput() );
-				rlFilter->SetMaskInput( maskReader->GetOutput() );
-		    	rlFilter->SetPSF(vVariance);
-
-				//Get number of iterations
-				int nNumOfDeconvIters = command.GetValueAsInt("Deconvolution", "Val");
-		    	rlFilter->SetIterations( nNumOfDeconvIters );
-		    	rlFilter->SetVerbose ( bDebug );
-
-    			//Perform RL.
-    			try {
-		    	    rlFilter->Update();
-		    	} catch (itk::ExceptionObject & err) {
-        			std::cerr << "[Error]\tfailure applying Richardson-Lucy on: " << sPETFileName
-            	      << "\n" << err << std::endl;
-        			return EXIT_FAILURE;
+    	    		return EXIT_FAILURE;
 				}
 
-				outputImage = rlFilter->GetOutput();
-				isOutputImageReady = true;
-
 				break;
 			}
-
-
-			default:
-				break;
-
-		}
-
-	if ( isOutputImageReady == true ) {
-    	PETWriterType::Pointer petWriter = PETWriterType::New();
-    	petWriter->SetFileName(sOutputFileName);
-    	petWriter->SetInput( outputImage );
-
-    	try {
-    	    petWriter->Update();
-    	} catch (itk::ExceptionObject & err) {
-    	    std::cerr << "[Error]\tCannot write output file: " << sOutputFileName
-                  << std::endl;
-
-    	    return EXIT_FAILURE;
-    	}
+		default: break;
 	}
 
-	switch (approach) {
-		case EGTM: {
-				std::cout << "Performing Geometric matrix method..." << std::endl;
-			    typedef petpvc::RoussetPVCImageFilter<PETImageType, MaskImageType>  GTMFilterType;
-
-				GTMFilterType::Pointer gtmFilter = GTMFilterType::New();
-			    gtmFilter->SetInput( petReader->GetOutput() );
-			    gtmFilter->SetMaskInput( maskReader->GetOutput() );
-			    gtmFilter->SetPSF(vVariance);
-			    gtmFilter->SetVerbose( bDebug );
-
-			    //Perform GTM.
-			    try {
-			        gtmFilter->Update();
-			    } catch (itk::ExceptionObject & err) {
-			        std::cerr << "\n[Error]\tfailure applying GTM on: " << sPETFileName
-			                  << "\n" << err
-			                  << std::endl;
-			        return EXIT_FAILURE;
-			    }
-
-				std::ofstream outputTextFile;
-				outputTextFile.open( sOutputFileName.c_str() );
-				if ( outputTextFile.is_open() ) {
-					outputTextFile << "REGION\tMEAN" << std::endl;
-					vnl_vector<float> results = gtmFilter->GetCorrectedMeans();
-					for (int n=0; n < results.size(); n++)
-						outputTextFile << n+1 << "\t" << results[n] << std::endl;
-					outputTextFile.close();
-				} else {
-					 std::cerr << "[Error]\tCannot write output file: " << sOutputFileName
-                  		<< std::endl;
-
-    	    		return EXIT_FAILURE;
-				}
+	return finishRun( sProfileFileName, desiredMethod, fWallStart, fCPUStart, fMemoryLimit, bDebug );
+}
 
-				break;
-			}
-		case ELabbe: {
-				std::cout << "Performing the Labbe method..." << std::endl;
-			    typedef petpvc::LabbePVCImageFilter<PETImageType, MaskImageType>  LabbeFilterType;
+int finishRun( const std::string & sProfileFileName, const std::string & sMethod,
+               double fWallStart, double fCPUStart, float fMemoryLimit, bool bDebug ) {
 
-				LabbeFilterType::Pointer labbeFilter = LabbeFilterType::New();
-			    labbeFilter->SetInput( petReader->GetOutput() );
-			    labbeFilter->SetMaskInput( maskReader->GetOutput() );
-			    labbeFilter->SetPSF(vVariance);
-			    labbeFilter->SetVerbose( bDebug );
+	//High-water mark of the whole run.
+	petpvc::AllocationTracker & tracker = petpvc::AllocationTracker::GetInstance();
+	const double fPeakMB = tracker.GetPeakBytes() / ( 1024.0 * 1024.0 );
 
-			    //Perform L-PVC.
-			    try {
-			        labbeFilter->Update();
-			    } catch (itk::ExceptionObject & err) {
-			        std::cerr << "\n[Error]\tfailure applying Labbe on: " << sPETFileName
-			                  << "\n" << err
-			                  << std::endl;
-			        return EXIT_FAILURE;
-			    }
+	if ( bDebug && petpvc::AllocationTracker::IsInstalled() ) {
+		std::cout << "Peak memory in images: " << fPeakMB << " MB" << std::endl;
+	}
 
-				std::ofstream outputTextFile;
-				outputTextFile.open( sOutputFileName.c_str() );
-				if ( outputTextFile.is_open() ) {
-					outputTextFile << "REGION\tMEAN" << std::endl;
-					vnl_vector<float> results = labbeFilter->GetCorrectedMeans();
-					for (int n=0; n < results.size(); n++)
-						outputTextFile << n+1 << "\t" << results[n] << std::endl;
-					outputTextFile.close();
-				} else {
-					 std::cerr << "[Error]\tCannot write output file: " << sOutputFileName
-                  		<< std::endl;
+	if ( fMemoryLimit > 0.0 && fPeakMB > fMemoryLimit ) {
+		std::cerr << "[Warning]\tPeak memory of " << fPeakMB << " MB exceeded the memory limit of "
+		          << fMemoryLimit << " MB" << std::endl;
+	}
 
-    	    		return EXIT_FAILURE;
-				}
+	if ( !sProfileFileName.empty() ) {
+		petpvc::Profiler & profiler = petpvc::Profiler::GetInstance();
+		profiler.AddStage( "total:" + sMethod, profiler.GetWallTime() - fWallStart,
+		                   profiler.GetCPUTime() - fCPUStart,
+		                   (double) tracker.GetTotalBytes(), (double) tracker.GetPeakBytes() );
 
-				break;
-			}
-		default: break;
+		if ( !profiler.WriteReport( sProfileFileName ) ) {
+			std::cerr << "[Error]\tCannot write profile report: " << sProfileFileName << std::endl;
+			return EXIT_FAILURE;
+		}
 	}
 
-
     return EXIT_SUCCESS;
 }
 
@@ -1420,7 +984,7 @@ std::string getAcknowledgments(void)
 }
 
 
-PVCMethod getPVCMethod( std::string method ) {
+PVCMethod getPVCMethod( std::string method, PipelineType & pipeline ) {
 
 	std::transform(method.begin(), method.end(),method.begin(), ::toupper);
 
@@ -1430,18 +994,6 @@ PVCMethod getPVCMethod( std::string method ) {
 	if ( method == "LABBE" )
 		return ELabbe;
 
-	if ( method == "MG" )
-		return EMullerGartner;
-
-	if ( method == "MTC" )
-		return EMTC;
-
-	if ( method == "RBV" )
-		return ERBV;
-
-	if ( method == "IY" )
-		return EIterativeYang;
-
 	if ( method == "RL" )
 		return ERichardsonLucy;
 
@@ -1451,47 +1003,8 @@ PVCMethod getPVCMethod( std::string method ) {
 	if ( method == "VC" )
 		return EVanCittert;
 
-	if ( ( method == "LABBE+RBV" ) || ( method == "RBV+LABBE" ) )
-		return ELabbeRBV;
-
-	if ( ( method == "LABBE+MTC" ) || ( method == "MTC+LABBE" ) )
-		return ELabbeMTC;
-
-	if ( method == "RBV+VC" )
-		return ERBVVanCittert;
-
-	if ( method == "RBV+RL" )
-		return ERBVRichardsonLucy;
-
-	if ( method == "LABBE+RBV+VC" )
-		return ELabbeRBVVanCittert;
-
-	if ( method == "LABBE+RBV+RL" )
-		return ELabbeRBVRichardsonLucy;
-
-	if ( method == "MTC+VC" )
-		return EMTCVanCittert;
-
-	if ( method == "MTC+RL" )
-		return EMTCRichardsonLucy;
-
-	if ( method == "LABBE+MTC+VC" )
-		return ELabbeMTCVanCittert;
-
-	if ( method == "LABBE+MTC+RL" )
-		return ELabbeMTCRichardsonLucy;
-
-	if ( method == "IY+VC" )
-		return EIYVanCittert;
-
-	if ( method == "IY+RL" )
-		return EIYRichardsonLucy;
-
-	if ( method == "MG+VC" )
-		return EMGVanCittert;
-
-	if ( method == "MG+RL" )
-		return EMGRichardsonLucy;
+	if ( pipeline.Parse( method ) )
+		return ERegional;
 
 	return EUnknown;
 }
@@ -1508,28 +1021,231 @@ void printPVCMethodList(void) {
 
 	std::cout << "Region-based voxel-wise correction - \"RBV\"" << std::endl;
 	std::cout << "RBV with Labbe - \"LABBE+RBV\"" << std::endl;
-	std::cout << "RBV with Van-Cittert - \"RBV+VC\"" << std::endl;
-	std::cout << "RBV with Richardson-Lucy - \"RBV+RL\"" << std::endl;
-	std::cout << "RBV with Labbe and Van-Cittert - \"LABBE+RBV+VC\"" << std::endl;
-	std::cout << "RBV with Labbe and Richardson-Lucy- \"LABBE+RBV+RL\"" << std::endl;
 
 	std::cout << "Single-target correction - \"STC\"" << std::endl;
 
 	std::cout << "Multi-target correction - \"MTC\"" << std::endl;
 	std::cout << "MTC with Labbe - \"LABBE+MTC\"" << std::endl;
-	std::cout << "MTC with Van-Cittert - \"MTC+VC\"" << std::endl;
-	std::cout << "MTC with Richardson-Lucy - \"MTC+RL\"" << std::endl;
-	std::cout << "MTC with Labbe and Van-Cittert - \"LABBE+MTC+VC\"" << std::endl;
-	std::cout << "MTC with Labbe and Richardson-Lucy- \"LABBE+MTC+RL\"" << std::endl;
 
 	std::cout << "Iterative Yang - \"IY\"" << std::endl;
-	std::cout << "Iterative Yang with Van-Cittert - \"IY+VC\"" << std::endl;
-	std::cout << "Iterative Yang with Richardson-Lucy - \"IY+RL\"" << std::endl;
 
 	std::cout << "Muller Gartner - \"MG\"" << std::endl;
-	std::cout << "Muller Gartner with Van-Cittert - \"MG+VC\"" << std::endl;
-	std::cout << "Muller Gartner with Richardson-Lucy - \"MG+RL\"" << std::endl;
 
+	std::cout << std::endl;
+	std::cout << "RBV, MTC, IY and MG, with or without Labbe, can be followed by" << std::endl;
+	std::cout << "Van-Cittert or Richardson-Lucy, e.g. \"LABBE+RBV+VC\" or \"MG+RL\"" << std::endl;
 
 	std::cout << std::endl;
 }
+
+unsigned int getNumberOfTemporaries( PVCMethod method, const PipelineType & pipeline ) {
+
+	switch ( method ) {
+		case EGTM:
+			return 3;
+		case ELabbe:
+			return 4;
+		case ERichardsonLucy:
+		case EVanCittert:
+		case ESTC:
+			return 7;
+		default:
+			return pipeline.GetNumberOfTemporaries();
+	}
+}
+
+double estimatePeakMemory( PVCMethod method, const PipelineType & pipeline, double fPETBytes, double fMaskBytes,
+                           unsigned int nImages ) {
+
+	//Input, output and temporaries of each image, plus the whole mask.
+	double fBytes = nImages * ( 2 + getNumberOfTemporaries( method, pipeline ) ) * fPETBytes + fMaskBytes;
+
+	//Blurred regions that are kept take as much again as the mask. Several
+	//images keep them whenever the chain blurs the regions.
+	const bool bSharedBlur = ( nImages > 1 ) && ( pipeline.GetCorrection() == PipelineType::ERBV ||
+	                                              pipeline.GetCorrection() == PipelineType::EMTC ||
+	                                              pipeline.GetDeconvolution() != PipelineType::ENoDeconvolution );
+	if ( method == ELabbe || ( method == ERegional && ( pipeline.GetCacheBlurredRegions() || bSharedBlur ) ) ) {
+		fBytes += fMaskBytes;
+	}
+
+	return fBytes;
+}
+
+std::vector< std::string > getOptionValues( MetaCommand & command, const std::string & sOption ) {
+
+	std::vector< std::string > vecValues;
+	const MetaCommand::OptionVector & options = command.GetParsedOptions();
+
+	for ( unsigned int i = 0; i < options.size(); i++ ) {
+		if ( options[i].name == sOption && !options[i].fields.empty() ) {
+			vecValues.push_back( options[i].fields[0].value );
+		}
+	}
+
+	return vecValues;
+}
+
+MaskImageType::Pointer readMask( PVCMethod method, const PipelineType & pipeline, const std::string & sMaskFileName ) {
+
+	//MG uses only the GM and WM, the first two volumes, so the other
+	//regions are not read.
+	if ( method == ERegional && pipeline.GetCorrection() == PipelineType::EMullerGartner ) {
+		std::vector< unsigned int > vecVolumes;
+		vecVolumes.push_back( 0 );
+		vecVolumes.push_back( 1 );
+		return petpvc::ReadVolumes< MaskImageType >( sMaskFileName, vecVolumes );
+	}
+
+	return petpvc::ReadImage< MaskImageType >( sMaskFileName );
+}
+
+int correctImages( const PipelineType & pipeline, const std::vector< std::string > & vecPETFileNames,
+                   const std::string & sMaskFileName, const std::vector< std::string > & vecOutputFileNames,
+                   const PipelineType::Settings & settings, bool bWarmStart ) {
+
+	std::vector< PETImageType::Pointer > vecPET;
+	for ( unsigned int i = 0; i < vecPETFileNames.size(); i++ ) {
+		try {
+			vecPET.push_back( petpvc::ReadImage< PETImageType >( vecPETFileNames[i] ) );
+		} catch (itk::ExceptionObject & err) {
+			std::cerr << "[Error]\tCannot read PET input file: " << vecPETFileNames[i]
+			          << std::endl << err << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	MaskImageType::Pointer maskImage;
+	try {
+		maskImage = readMask( ERegional, pipeline, sMaskFileName );
+	} catch (itk::ExceptionObject & err) {
+		std::cerr << "[Error]\tCannot read mask input file: " << sMaskFileName
+		          << std::endl << err << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	//Each image saves its iterations next to its own output, and its means
+	//to a file numbered by its position on the command line.
+	std::vector< PipelineType::Settings > vecSettings( vecPET.size(), settings );
+	for ( unsigned int i = 0; i < vecPET.size(); i++ ) {
+		vecSettings[i].sOutputFileName = vecOutputFileNames[i];
+		if ( !settings.sMeansFileName.empty() ) {
+			std::stringstream suffix;
+			suffix << "_" << i + 1;
+			vecSettings[i].sMeansFileName = petpvc::AddFileNameSuffix( settings.sMeansFileName, suffix.str() );
+		}
+	}
+
+	std::cout << "Correcting " << vecPET.size() << " images with one mask..." << std::endl;
+
+	std::vector< PETImageType::Pointer > vecOutput;
+	try {
+		vecOutput = pipeline.RunAll( vecPET, maskImage, vecSettings, bWarmStart );
+	} catch (itk::ExceptionObject & err) {
+		std::cerr << "\n[Error]\tfailure applying the correction\n" << err << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	for ( unsigned int i = 0; i < vecOutput.size(); i++ ) {
+		PETWriterType::Pointer petWriter = PETWriterType::New();
+		petWriter->SetFileName( vecOutputFileNames[i] );
+		petWriter->SetInput( vecOutput[i] );
+
+		try {
+			petpvc::ScopedStageTimer writeTimer( NULL, "write" );
+			petWriter->Update();
+		} catch (itk::ExceptionObject & err) {
+			std::cerr << "[Error]\tCannot write output file: " << vecOutputFileNames[i] << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int correctReplicates( PVCMethod method, const PipelineType & pipeline, const std::string & sPETFileName,
+                       const std::string & sMaskFileName, const std::string & sOutputFileName,
+                       const std::string & sSummaryFileName, VectorType vVariance,
+                       unsigned int nIterations, float fTolerance, bool bWarmStart, bool bDebug ) {
+
+	ReplicatePVCType::Pointer replicatePVC = ReplicatePVCType::New();
+
+	const bool bSingleStage = ( method == ERegional ) && !pipeline.GetUseLabbe()
+	                          && pipeline.GetDeconvolution() == PipelineType::ENoDeconvolution;
+
+	if ( method == EGTM ) {
+		replicatePVC->SetMethod( ReplicatePVCType::EGTM );
+	} else if ( bSingleStage && pipeline.GetCorrection() == PipelineType::ERBV ) {
+		replicatePVC->SetMethod( ReplicatePVCType::ERBV );
+	} else if ( bSingleStage && pipeline.GetCorrection() == PipelineType::EIterativeYang ) {
+		replicatePVC->SetMethod( ReplicatePVCType::EIterativeYang );
+	} else {
+		std::cerr << "[Error]\tReplicates can only be corrected with GTM, RBV or IY" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	ReplicatePVCType::StackImageType::Pointer stackImage;
+	MaskImageType::Pointer maskImage;
+
+	try {
+		stackImage = petpvc::ReadImage< ReplicatePVCType::StackImageType >( sPETFileName );
+	} catch (itk::ExceptionObject & err) {
+		std::cerr << "[Error]\tCannot read PET input file: " << sPETFileName
+		          << std::endl << err << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	try {
+		maskImage = petpvc::ReadImage< MaskImageType >( sMaskFileName );
+	} catch (itk::ExceptionObject & err) {
+		std::cerr << "[Error]\tCannot read mask input file: " << sMaskFileName
+		          << std::endl << err << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::cout << "Correcting " << stackImage->GetLargestPossibleRegion().GetSize()[3]
+	          << " replicates..." << std::endl;
+
+	replicatePVC->SetPSF( vVariance );
+	replicatePVC->SetIterations( nIterations );
+	replicatePVC->SetStoppingCond( fTolerance );
+	replicatePVC->SetWarmStart( bWarmStart );
+	replicatePVC->SetVerbose( bDebug );
+
+	ReplicatePVCType::StackImageType::Pointer outputImage;
+
+	try {
+		outputImage = replicatePVC->Correct( stackImage, maskImage );
+	} catch (itk::ExceptionObject & err) {
+		std::cerr << "\n[Error]\tfailure correcting replicates in: " << sPETFileName
+		          << "\n" << err << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	//GTM gives the corrected means of each replicate, the others images.
+	if ( method == EGTM ) {
+		if ( !replicatePVC->WriteMeans( sOutputFileName ) ) {
+			std::cerr << "[Error]\tCannot write output file: " << sOutputFileName << std::endl;
+			return EXIT_FAILURE;
+		}
+	} else {
+		StackWriterType::Pointer stackWriter = StackWriterType::New();
+		stackWriter->SetFileName( sOutputFileName );
+		stackWriter->SetInput( outputImage );
+
+		try {
+			petpvc::ScopedStageTimer writeTimer( NULL, "write" );
+			stackWriter->Update();
+		} catch (itk::ExceptionObject & err) {
+			std::cerr << "[Error]\tCannot write output file: " << sOutputFileName << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	if ( !replicatePVC->WriteSummary( sSummaryFileName ) ) {
+		std::cerr << "[Error]\tCannot write replicate summary: " << sSummaryFileName << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -26,160 +26,248 @@
 #include <itkImageFileReader.h>
 #include <itkImageFileWriter.h>
 
-#include <itkImageDuplicator.h>
-#include <itkOneWayEquivalencyTable.h>
 #include <metaCommand.h>
 
 #include "EnvironmentInfo.h"
+#include "petpvcParallel.h"
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
-#include <map> 
+#include <sstream>
+#include <string>
+#include <vector>
 
 typedef itk::Image<short, 3>   ImageType;
+typedef ImageType::PixelType   LabelType;
 
 typedef itk::ImageFileReader<ImageType> ReaderType;
 typedef itk::ImageFileWriter<ImageType> WriterType;
 
-typedef itk::ImageRegionIterator<ImageType> ImageIterator;
-typedef itk::ImageRegionConstIterator<ImageType> ConstImageIterator;
+//New label of every possible input label, indexed by the label's bit
+//pattern as an unsigned short. Labels that are not mapped become 0.
+typedef std::vector<LabelType> LabelTableType;
+const unsigned int LABEL_TABLE_SIZE = 65536;
 
-int main(int argc, char *argv[])
-{
+//Voxels relabelled for one output before moving to the next, so that the
+//input stays in cache while it is read once per output.
+const itk::SizeValueType RELABEL_BLOCK_SIZE = 4096;
 
-	const char * const AUTHOR = "Benjamin A. Thomas";
-  const char * const APP_TITLE = "Relabel an image";
+//Applies every table to part of the image.
+struct RelabelFunctor {
+	const LabelType * pInput;
+	std::vector<LabelType *> vecOutputs;
+	std::vector<const LabelType *> vecTables;
 
-  std::stringstream version_number;
-  version_number << VERSION_MAJOR << "." << VERSION_MINOR << "." << VERSION_PATCH;
-  const std::string VERSION_NO = version_number.str();
-	MetaCommand command;
+	void operator()( itk::SizeValueType nFirst, itk::SizeValueType nLast, itk::SizeValueType ) const {
+		for ( itk::SizeValueType nBlock = nFirst; nBlock < nLast; nBlock += RELABEL_BLOCK_SIZE ) {
+			const itk::SizeValueType nEnd = std::min( nBlock + RELABEL_BLOCK_SIZE, nLast );
 
-	command.SetVersion( VERSION_NO.c_str() );
-	command.SetAuthor( AUTHOR );
-	command.SetName( APP_TITLE );
-	command.SetDescription("Relabels a parcellation image");
-	command.SetAcknowledgments( " " );
-	command.SetCategory("PETPVC");
-
-	command.SetOption("Input", "i", true, "Input file");
-  command.AddOptionField("Input", "infilename", MetaCommand::FILE, true, "", "", MetaCommand::DATA_IN);
+			for ( unsigned int t = 0; t < vecTables.size(); t++ ) {
+				const LabelType * pTable = vecTables[t];
+				LabelType * pOutput = vecOutputs[t];
 
-  command.SetOption("Output", "o", true, "Output file");
-  command.AddOptionField("Output", "outfilename", MetaCommand::FILE, true, "", "", MetaCommand::DATA_OUT);
-
-  command.SetOption("Parcellation", "p", true, "Description file");
-	command.SetOptionLongTag("Parcellation", "parc");
-	command.AddOptionField("Parcellation", "parcfile", MetaCommand::FILE, true, "", "", MetaCommand::DATA_IN);
-
-  command.SetOption("Type", "t", true, "Parcellation type");
-	command.SetOptionLongTag("Type", "type");
-  command.AddOptionField("Type", "parctype", MetaCommand::STRING, true, "", "");
+				for ( itk::SizeValueType i = nBlock; i < nEnd; i++ ) {
+					pOutput[i] = pTable[ (unsigned short) pInput[i] ];
+				}
+			}
+		}
+	}
+};
 
-	if( !command.Parse(argc,argv) )
-	{
-		return EXIT_FAILURE;
-	}	
+//Splits a comma-separated list.
+std::vector<std::string> splitList( const std::string & sList )
+{
+	std::vector<std::string> vecItems;
+	std::istringstream ss( sList );
+	std::string sItem;
 
-	std::string inFileName = command.GetValueAsString("Input", "infilename");
-	std::string maskDescriptionFileName = command.GetValueAsString("Parcellation", "parcfile");
-	std::string outputFileName = command.GetValueAsString("Output", "outfilename");
-	std::string targetColumnName = command.GetValueAsString("Type", "parctype");
+	while ( getline( ss, sItem, ',' ) ) {
+		if ( !sItem.empty() ) {
+			vecItems.push_back( sItem );
+		}
+	}
 
-	std::cout << "Input file: " << inFileName << std::endl;
-	std::cout << "Output file: " << outputFileName << std::endl;
-	std::cout << "Description file: " << maskDescriptionFileName << std::endl;
-	std::cout << "Parcellation type: " << targetColumnName << std::endl;
+	return vecItems;
+}
 
-	ReaderType::Pointer reader = ReaderType::New();
-	reader->SetFileName( inFileName );
+//Removes a trailing \r.
+void stripCR( std::string & line )
+{
+	if ( line.size() && line[line.size()-1] == '\r' ){
+		line = line.substr( 0, line.size() - 1 );
+	}
+}
 
+//Reads the columns named in vecTypes from a description file, one table per
+//type.
+bool readDescription( const std::string & maskDescriptionFileName, const std::vector<std::string> & vecTypes,
+                      std::vector<LabelTableType> & vecTables )
+{
 	std::ifstream maskDesriptionFile;
 	maskDesriptionFile.open( maskDescriptionFileName.c_str() , std::ios::in );
 
-	std::vector<std::string> columnHeaders;
-	std::string line;
-
-	std::map<float, float> eqTable;
-
-	if ( maskDesriptionFile.is_open() ){
-
-		int targetColumnIndex =0;
-
-		//Get header of CSV
-		getline( maskDesriptionFile, line );
+	if ( !maskDesriptionFile.is_open() ) {
+		std::cerr << "[Error]\tCannot open mask description file: " << maskDescriptionFileName << "!" << std::endl;
+		return false;
+	}
 
-		//Remove \r
-		if ( line.size() && line[line.size()-1] == '\r' ){
-           line = line.substr( 0, line.size() - 1 );
-		}
+	std::string line;
+	std::string field;
 
-		std::istringstream s(line);
-		std::string field;
+	//Get header of CSV
+	getline( maskDesriptionFile, line );
+	stripCR( line );
 
-		//Find requested parcellation type.
-		int count = 0;
-		while (getline(s, field,',')) {
-			//std::cout << count << " : " << field << std::endl;
-			columnHeaders.push_back(field);
+	std::vector<std::string> columnHeaders;
+	std::istringstream s(line);
+	while (getline(s, field,',')) {
+		columnHeaders.push_back(field);
+	}
 
-			if (field == targetColumnName){
-				targetColumnIndex = count;
+	//Find requested parcellation types.
+	std::vector<unsigned int> vecColumns;
+	for ( unsigned int t = 0; t < vecTypes.size(); t++ ) {
+		unsigned int targetColumnIndex = 0;
+		for ( unsigned int c = 1; c < columnHeaders.size(); c++ ) {
+			if ( columnHeaders[c] == vecTypes[t] ) {
+				targetColumnIndex = c;
 			}
-
-			count++;
 		}
 
 		if ( targetColumnIndex != 0) {
-			std::cout << "Found desired parcellation index in column : " << targetColumnIndex << std::endl << std::endl;
+			std::cout << "Found parcellation " << vecTypes[t] << " in column : " << targetColumnIndex << std::endl;
 		}
 		else {
-			std::cerr << "[Error]\tCannot find desired parcellation " << targetColumnName << 
+			std::cerr << "[Error]\tCannot find desired parcellation " << vecTypes[t] <<
 				" in " << maskDescriptionFileName << "!" << std::endl;
+			return false;
+		}
 
-			return EXIT_FAILURE;
+		vecColumns.push_back( targetColumnIndex );
+	}
 
-		}
+	vecTables.assign( vecTypes.size(), LabelTableType( LABEL_TABLE_SIZE, 0 ) );
+
+	std::vector<std::string> vecMappings( vecTypes.size() );
+
+	//Build equivalency tables.
+	while ( getline( maskDesriptionFile, line ) ) {
+		stripCR( line );
 
-		std::string currentRegion;
-		float sourceVal;
-		float destVal;
+		std::istringstream ss(line);
+		std::vector<std::string> rowValues;
 
-		std::cout << "Mapping:" << std::endl;
+		while (getline(ss, field,',')) {
+			rowValues.push_back(field);
+		}
 
-		//Build equivalency table mapping.
-		while ( getline( maskDesriptionFile, line ) ) {
+		if ( rowValues.size() < 2 ) {
+			continue;
+		}
 
-			std::istringstream ss(line);
-			std::vector<std::string> rowValues;
-			
-			while (getline(ss, field,',')) {
-				rowValues.push_back(field);
-			}	
+		const std::string currentRegion = rowValues[0];
 
-			currentRegion = rowValues[0];
+		float sourceVal = 0;
+		std::stringstream inval;
+		inval << rowValues[1];
+		inval >> sourceVal;
 
-			std::stringstream inval;
-			inval << rowValues[1];
-			inval >> sourceVal;
+		for ( unsigned int t = 0; t < vecTypes.size(); t++ ) {
+			if ( vecColumns[t] >= rowValues.size() ) {
+				continue;
+			}
 
+			float destVal = 0;
 			inval.clear();
 			inval.str("");
-			inval << rowValues[targetColumnIndex];
+			inval << rowValues[ vecColumns[t] ];
 			inval >> destVal;
 
 			if ( destVal != 0) {
-				eqTable[sourceVal]=destVal;
-				std::cout << "\tID: "	<< sourceVal << " -> " << eqTable[sourceVal] 
-					<<  "\t\t(" << currentRegion << ")" << std::endl;
+				const LabelType nSource = static_cast<LabelType>( sourceVal );
+				vecTables[t][ (unsigned short) nSource ] = static_cast<LabelType>( destVal );
+
+				std::ostringstream mapping;
+				mapping << "\tID: " << nSource << " -> " << vecTables[t][ (unsigned short) nSource ]
+					<< "\t\t(" << currentRegion << ")" << std::endl;
+				vecMappings[t] += mapping.str();
 			}
 		}
 	}
-	else {
-		std::cerr << "[Error]\tCannot open mask description file: " << maskDescriptionFileName << "!" << std::endl;
-		return EXIT_FAILURE;
+
+	for ( unsigned int t = 0; t < vecTypes.size(); t++ ) {
+		std::cout << std::endl << "Mapping (" << vecTypes[t] << "):" << std::endl << vecMappings[t];
+	}
+	std::cout << std::endl;
+
+	return true;
+}
+
+//Relabels image with each type in one pass and writes one file per type.
+bool relabelImage( const ImageType * image, const std::string & maskDescriptionFileName,
+                   const std::vector<std::string> & vecTypes, const std::vector<std::string> & vecOutputs )
+{
+	if ( vecTypes.empty() || vecTypes.size() != vecOutputs.size() ) {
+		std::cerr << "[Error]\tThere must be one output file for each parcellation type!" << std::endl;
+		return false;
+	}
+
+	std::vector<LabelTableType> vecTables;
+	if ( !readDescription( maskDescriptionFileName, vecTypes, vecTables ) ) {
+		return false;
+	}
+
+	std::vector<ImageType::Pointer> vecImages;
+	RelabelFunctor relabelFunctor;
+	relabelFunctor.pInput = image->GetBufferPointer();
+
+	for ( unsigned int t = 0; t < vecTypes.size(); t++ ) {
+		ImageType::Pointer outputImage = ImageType::New();
+		outputImage->CopyInformation( image );
+		outputImage->SetRegions( image->GetBufferedRegion() );
+		outputImage->Allocate();
+
+		vecImages.push_back( outputImage );
+		relabelFunctor.vecOutputs.push_back( outputImage->GetBufferPointer() );
+		relabelFunctor.vecTables.push_back( &vecTables[t][0] );
 	}
 
+	//Apply eqivalency tables
+	petpvc::ParallelFor( 0, image->GetBufferedRegion().GetNumberOfPixels(), relabelFunctor );
+
+	//Write to disk.
+	for ( unsigned int t = 0; t < vecTypes.size(); t++ ) {
+		WriterType::Pointer writer = WriterType::New();
+		writer->SetFileName( vecOutputs[t] );
+		writer->SetInput( vecImages[t] );
+
+		try
+		{
+			writer->Update();
+		}
+		catch (itk::ExceptionObject &ex)
+		{
+			std::cerr << "[Error]\tCannot write output image: " << vecOutputs[t] << "!" << std::endl;
+			return false;
+		}
+
+		std::cout << "Written " << vecTypes[t] << " to " << vecOutputs[t] << std::endl;
+	}
+
+	return true;
+}
+
+//Reads an image, or keeps the last one if it is the same file.
+ImageType::Pointer readImage( const std::string & inFileName, std::string & lastFileName, ImageType::Pointer & lastImage )
+{
+	if ( lastImage.IsNotNull() && inFileName == lastFileName ) {
+		return lastImage;
+	}
+
+	ReaderType::Pointer reader = ReaderType::New();
+	reader->SetFileName( inFileName );
+
 	try
 	{
 		reader->Update();
@@ -187,52 +275,130 @@ int main(int argc, char *argv[])
 	catch (itk::ExceptionObject &ex)
 	{
 		std::cerr << "[Error]\tImage file: " << inFileName << " cannot be loaded!" << std::endl;
-		return EXIT_FAILURE;
+		return NULL;
 	}
 
-	typedef itk::ImageDuplicator< ImageType > DuplicatorType;
-  	DuplicatorType::Pointer duplicator = DuplicatorType::New();
-  	duplicator->SetInputImage( reader->GetOutput() );
-  	duplicator->Update();
+	lastFileName = inFileName;
+	lastImage = reader->GetOutput();
+	return lastImage;
+}
+
+int main(int argc, char *argv[])
+{
+
+	const char * const AUTHOR = "Benjamin A. Thomas";
+  const char * const APP_TITLE = "Relabel an image";
+
+  std::stringstream version_number;
+  version_number << VERSION_MAJOR << "." << VERSION_MINOR << "." << VERSION_PATCH;
+  const std::string VERSION_NO = version_number.str();
+	MetaCommand command;
+
+	command.SetVersion( VERSION_NO.c_str() );
+	command.SetAuthor( AUTHOR );
+	command.SetName( APP_TITLE );
+	command.SetDescription("Relabels a parcellation image");
+	command.SetAcknowledgments( " " );
+	command.SetCategory("PETPVC");
+
+	command.SetOption("Input", "i", false, "Input file");
+  command.AddOptionField("Input", "infilename", MetaCommand::FILE, true, "", "", MetaCommand::DATA_IN);
+
+  command.SetOption("Output", "o", false, "Output file, or comma-separated list with one file per type");
+  command.AddOptionField("Output", "outfilename", MetaCommand::STRING, true, "");
+
+  command.SetOption("Parcellation", "p", false, "Description file");
+	command.SetOptionLongTag("Parcellation", "parc");
+	command.AddOptionField("Parcellation", "parcfile", MetaCommand::FILE, true, "", "", MetaCommand::DATA_IN);
+
+  command.SetOption("Type", "t", false, "Parcellation type, or comma-separated list of types");
+	command.SetOptionLongTag("Type", "type");
+  command.AddOptionField("Type", "parctype", MetaCommand::STRING, true, "", "");
+
+  command.SetOption("Batch", "b", false,
+                    "Text file with one relabelling per line: <INPUT> <CSVFILE> <TYPES> <OUTPUTS>");
+	command.SetOptionLongTag("Batch", "batch");
+  command.AddOptionField("Batch", "batchfile", MetaCommand::FILE, true, "", "", MetaCommand::DATA_IN);
 
-  	ImageType::Pointer outputImage = duplicator->GetOutput();
+  command.SetOption("Threads", "j", false, "Maximum number of threads to use (0 for the default)");
+	command.SetOptionLongTag("Threads", "threads");
+  command.AddOptionField("Threads", "N", MetaCommand::INT, true, "0");
 
-	ImageIterator outputIt( outputImage, outputImage->GetRequestedRegion() );
-	
-	while (! outputIt.IsAtEnd() )
+	if( !command.Parse(argc,argv) )
 	{
-		outputIt.Set( 0 );
-		++outputIt;
+		return EXIT_FAILURE;
 	}	
 
-	outputIt.GoToBegin();
+	petpvc::SetNumberOfThreads( command.GetValueAsInt("Threads", "N") );
 
-	ConstImageIterator inputIt( reader->GetOutput(), reader->GetOutput()->GetRequestedRegion() );
+	std::string lastFileName;
+	ImageType::Pointer lastImage;
 
-	//Apply eqivalency table 
-	while ( !inputIt.IsAtEnd() )
-	{
-		if ( eqTable.find( inputIt.Get() ) != eqTable.end() ) {
-			outputIt.Set( eqTable[inputIt.Get()] );
+	if ( command.GetOptionWasSet("Batch") ) {
+		std::string batchFileName = command.GetValueAsString("Batch", "batchfile");
+
+		std::ifstream batchFile( batchFileName.c_str() );
+		if ( !batchFile.is_open() ) {
+			std::cerr << "[Error]\tCannot open batch file: " << batchFileName << "!" << std::endl;
+			return EXIT_FAILURE;
 		}
-		++inputIt;
-		++outputIt;
-	}	
 
-	//Write to disk.
-	WriterType::Pointer writer = WriterType::New();
-	writer->SetFileName( outputFileName );
-	writer->SetInput( outputImage );
-	
-	try
-	{
-		writer->Update();	
+		int nFailed = 0;
+		std::string line;
+
+		while ( getline( batchFile, line ) ) {
+			stripCR( line );
+
+			std::istringstream ss( line );
+			std::string inFileName, maskDescriptionFileName, types, outputs;
+			if ( !( ss >> inFileName ) || inFileName[0] == '#' ) {
+				continue;
+			}
+
+			if ( !( ss >> maskDescriptionFileName >> types >> outputs ) ) {
+				std::cerr << "[Error]\tCannot read batch line: " << line << std::endl;
+				nFailed++;
+				continue;
+			}
+
+			std::cout << "Input file: " << inFileName << std::endl;
+			std::cout << "Description file: " << maskDescriptionFileName << std::endl;
+
+			//Consecutive lines with the same input only read it once.
+			ImageType::Pointer image = readImage( inFileName, lastFileName, lastImage );
+			if ( image.IsNull() ||
+			     !relabelImage( image, maskDescriptionFileName, splitList( types ), splitList( outputs ) ) ) {
+				nFailed++;
+			}
+		}
+
+		return ( nFailed == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
 	}
-	catch (itk::ExceptionObject &ex)
-	{
-		std::cerr << "[Error]\tCannot write output image: " << outputFileName << "!" << std::endl;
+
+	if ( !command.GetOptionWasSet("Input") || !command.GetOptionWasSet("Output") ||
+	     !command.GetOptionWasSet("Parcellation") || !command.GetOptionWasSet("Type") ) {
+		std::cerr << "[Error]\t-i, -o, --parc and --type are required unless --batch is given!" << std::endl;
 		return EXIT_FAILURE;
 	}
-	
+
+	std::string inFileName = command.GetValueAsString("Input", "infilename");
+	std::string maskDescriptionFileName = command.GetValueAsString("Parcellation", "parcfile");
+	std::string outputFileName = command.GetValueAsString("Output", "outfilename");
+	std::string targetColumnName = command.GetValueAsString("Type", "parctype");
+
+	std::cout << "Input file: " << inFileName << std::endl;
+	std::cout << "Output file: " << outputFileName << std::endl;
+	std::cout << "Description file: " << maskDescriptionFileName << std::endl;
+	std::cout << "Parcellation type: " << targetColumnName << std::endl;
+
+	ImageType::Pointer image = readImage( inFileName, lastFileName, lastImage );
+	if ( image.IsNull() ) {
+		return EXIT_FAILURE;
+	}
+
+	if ( !relabelImage( image, maskDescriptionFileName, splitList( targetColumnName ), splitList( outputFileName ) ) ) {
+		return EXIT_FAILURE;
+	}
+
 	return EXIT_SUCCESS;
 }
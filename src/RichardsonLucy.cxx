@@ -34,6 +34,8 @@
 #include <metaCommand.h>
 
 #include "petpvcRLPVCImageFilter.h"
+#include "petpvcIterationSnapshotCommand.h"
+#include "petpvcParallel.h"
 
 typedef itk::Vector<float, 3> VectorType;
 typedef itk::Image<float, 3> PETImageType;
@@ -99,6 +101,15 @@ int main(int argc, char *argv[])
     command.SetOption("debug", "d", false,"Prints debug information");
     command.SetOptionLongTag("debug", "debug");
 
+    command.SetOption("Threads", "j", false, "Maximum number of threads to use (0 for the default)");
+    command.SetOptionLongTag("Threads", "threads");
+    command.AddOptionField("Threads", "N", MetaCommand::INT, true, "0");
+
+    command.SetOption("SaveIterations", "S", false,
+                      "Comma-separated list of iterations at which to save the current estimate, e.g. 2,5,10");
+    command.SetOptionLongTag("SaveIterations", "save-iterations");
+    command.AddOptionField("SaveIterations", "list", MetaCommand::STRING, true, "");
+
     //Parse command line.
     if (!command.Parse(argc, argv)) {
         return EXIT_FAILURE;
@@ -128,6 +139,15 @@ int main(int argc, char *argv[])
     //Toggle debug mode
     bool bDebug = command.GetValueAsBool("debug");
 
+    //Limit the number of threads before any filters are created.
+    petpvc::SetNumberOfThreads( command.GetValueAsInt("Threads", "N") );
+
+    //Get iterations at which to save intermediate results.
+    std::vector<unsigned int> vecSaveIters;
+    if ( command.GetOptionWasSet("SaveIterations") ) {
+        vecSaveIters = petpvc::ParseIterationList( command.GetValueAsString("SaveIterations", "list") );
+    }
+
     //Create reader for PET image.
     PETReaderType::Pointer petReader = PETReaderType::New();
     petReader->SetFileName(sPETFileName);
@@ -160,6 +180,9 @@ int main(int argc, char *argv[])
     //rlFilter->SetStoppingCond( fStop );
     rlFilter->SetVerbose ( bDebug );
 
+    //Save intermediate results, if requested.
+    petpvc::AddIterationSnapshots( rlFilter.GetPointer(), vecSaveIters, sOutputFileName );
+
     //Perform RL.
     try {
         rlFilter->Update();
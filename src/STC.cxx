@@ -38,6 +38,8 @@
 #include <metaCommand.h>
 
 #include "petpvcSTCPVCImageFilter.h"
+#include "petpvcIterationSnapshotCommand.h"
+#include "petpvcParallel.h"
 
 typedef itk::Vector<float, 3> VectorType;
 typedef itk::Image<short, 3> MaskImageType;
@@ -101,6 +103,20 @@ int main(int argc, char *argv[])
     command.SetOption("debug", "d", false,"Prints debug information");
     command.SetOptionLongTag("debug", "debug");
 
+    command.SetOption("Threads", "j", false, "Maximum number of threads to use (0 for the default)");
+    command.SetOptionLongTag("Threads", "threads");
+    command.AddOptionField("Threads", "N", MetaCommand::INT, true, "0");
+
+    command.SetOption("SaveIterations", "S", false,
+                      "Comma-separated list of iterations at which to save the current estimate, e.g. 2,5,10");
+    command.SetOptionLongTag("SaveIterations", "save-iterations");
+    command.AddOptionField("SaveIterations", "list", MetaCommand::STRING, true, "");
+
+    command.SetOption("SaveMeans", "M", false,
+                      "Text file to which the regional means are appended at each saved iteration (or every iteration)");
+    command.SetOptionLongTag("SaveMeans", "save-means");
+    command.AddOptionField("SaveMeans", "filename", MetaCommand::STRING, true, "");
+
     //Parse command line.
     if (!command.Parse(argc, argv)) {
         return EXIT_FAILURE;
@@ -128,6 +144,20 @@ int main(int argc, char *argv[])
     //Toggle debug mode
     bool bDebug = command.GetValueAsBool("debug");
 
+    //Limit the number of threads before any filters are created.
+    petpvc::SetNumberOfThreads( command.GetValueAsInt("Threads", "N") );
+
+    //Get iterations at which to save intermediate results.
+    std::vector<unsigned int> vecSaveIters;
+    if ( command.GetOptionWasSet("SaveIterations") ) {
+        vecSaveIters = petpvc::ParseIterationList( command.GetValueAsString("SaveIterations", "list") );
+    }
+
+    std::string sMeansFileName;
+    if ( command.GetOptionWasSet("SaveMeans") ) {
+        sMeansFileName = command.GetValueAsString("SaveMeans", "filename");
+    }
+
     //Create reader for mask image.
     MaskReaderType::Pointer maskReader = MaskReaderType::New();
     maskReader->SetFileName(sMaskFileName);
@@ -177,6 +207,10 @@ int main(int argc, char *argv[])
     stcFilter->SetIterations( nNumOfIters );
     stcFilter->SetVerbose ( bDebug );
 
+    //Save intermediate results, if requested.
+    petpvc::AddIterationSnapshots( stcFilter.GetPointer(), vecSaveIters, sOutputFileName );
+    petpvc::AddIterationMeans( stcFilter.GetPointer(), vecSaveIters, sMeansFileName );
+
     //Perform STC.
     try {
         stcFilter->Update();
@@ -19,6 +19,10 @@
 
    This program implements blurring if an image with a kernel to simulate
    the partial volume effect. It is useful for testing the PVC methods.
+
+   With --replicates, Poisson or Gaussian noise is added to the blurred
+   image to give that many independent noisy realisations. The blur is only
+   computed once. With --noise none the replicates are the blurred image.
  */
 
 
@@ -33,16 +37,66 @@
 #include <metaCommand.h>
 #include <vnl/vnl_vector.h>
 
+#include "petpvcCounterRandom.h"
+#include "petpvcIterationSnapshotCommand.h"
+#include "petpvcParallel.h"
+
+#include <algorithm>
+#include <iomanip>
+
 typedef itk::Vector<float, 3> VectorType;
 typedef itk::Image<float, 3> PETImageType;
+typedef itk::Image<float, 4> ReplicateImageType;
 
 typedef itk::ImageFileReader<PETImageType> PETReaderType;
 typedef itk::ImageFileWriter<PETImageType> PETWriterType;
+typedef itk::ImageFileWriter<ReplicateImageType> ReplicateWriterType;
 typedef itk::DiscreteGaussianImageFilter<PETImageType, PETImageType> BlurringFilterType;
 
+enum NoiseModel { ENoiseNone, ENoisePoisson, ENoiseGaussian };
+
+//Adds noise to the blurred image, for replicates nFirstReplicate onwards.
+//Element j of the range is voxel j % nVoxels of replicate j / nVoxels, and
+//has its own random stream, so the noise does not depend on the threads.
+struct NoiseFunctor {
+    const float * pBlurred;
+    float * pOutput;
+    itk::SizeValueType nVoxels;
+    itk::SizeValueType nFirstReplicate;
+    itk::uint64_t nSeed;
+    NoiseModel model;
+    //Counts per unit of activity, for Poisson noise.
+    double fScale;
+    //Standard deviation of Gaussian noise. Zero matches the Poisson variance.
+    double fSD;
+
+    void operator()( itk::SizeValueType nFirst, itk::SizeValueType nLast, itk::SizeValueType ) const {
+        for ( itk::SizeValueType j = nFirst; j < nLast; j++ ) {
+            const itk::SizeValueType i = j % this->nVoxels;
+            const itk::uint64_t nStream = ( this->nFirstReplicate + j / this->nVoxels ) * this->nVoxels + i;
+            petpvc::CounterRandom rng( this->nSeed, nStream );
+
+            const double fMean = this->pBlurred[i];
+            if ( this->model == ENoiseNone ) {
+                this->pOutput[j] = this->pBlurred[i];
+            } else if ( this->model == ENoisePoisson ) {
+                this->pOutput[j] = rng.NextPoisson( fMean * this->fScale ) / this->fScale;
+            } else {
+                const double fSD = this->fSD > 0.0 ? this->fSD :
+                                   std::sqrt( std::max( fMean, 0.0 ) / this->fScale );
+                this->pOutput[j] = fMean + fSD * rng.NextGaussian();
+            }
+        }
+    }
+};
+
 //Produces the text for the acknowledgments dialog in Slicer.
 std::string getAcknowledgments(void);
 
+//Blurs once, then writes nReplicates noisy copies of the blurred image.
+int writeReplicates(MetaCommand & command, PETImageType * blurred, int nReplicates,
+                    const std::string & sOutputFileName);
+
 int main(int argc, char *argv[])
 {
     const char * const AUTHOR = "Kris Thielemans";
@@ -81,11 +135,44 @@ int main(int argc, char *argv[])
                       "The full-width at half maximum in mm along z-axis");
     command.AddOptionField("FWHMz", "Z", MetaCommand::FLOAT, true, "");
 
+    command.SetOption("Replicates", "n", false,
+                      "Number of noisy replicates of the blurred image, written as one 4-D image");
+    command.SetOptionLongTag("Replicates", "replicates");
+    command.AddOptionField("Replicates", "N", MetaCommand::INT, true, "0");
+
+    command.SetOption("Noise", "m", false, "Noise model: poisson (default), gaussian or none");
+    command.SetOptionLongTag("Noise", "noise");
+    command.AddOptionField("Noise", "model", MetaCommand::STRING, true, "poisson");
+
+    command.SetOption("Scale", "s", false,
+                      "Counts per unit of activity. Higher values give less noise");
+    command.SetOptionLongTag("Scale", "scale");
+    command.AddOptionField("Scale", "counts", MetaCommand::FLOAT, true, "1");
+
+    command.SetOption("SD", "d", false,
+                      "Standard deviation of Gaussian noise (default matches the Poisson variance)");
+    command.SetOptionLongTag("SD", "sd");
+    command.AddOptionField("SD", "value", MetaCommand::FLOAT, true, "0");
+
+    command.SetOption("Seed", "e", false, "Seed of the random streams");
+    command.SetOptionLongTag("Seed", "seed");
+    command.AddOptionField("Seed", "N", MetaCommand::INT, true, "1");
+
+    command.SetOption("Series", "r", false,
+                      "Write each replicate to its own 3-D image, e.g. noisy_0001.nii");
+    command.SetOptionLongTag("Series", "series");
+
+    command.SetOption("Threads", "j", false, "Maximum number of threads to use (0 for the default)");
+    command.SetOptionLongTag("Threads", "threads");
+    command.AddOptionField("Threads", "N", MetaCommand::INT, true, "0");
+
     //Parse command line.
     if (!command.Parse(argc, argv)) {
         return EXIT_FAILURE;
     }
 
+    petpvc::SetNumberOfThreads( command.GetValueAsInt("Threads", "N") );
+
     //Get image filenames
     std::string sPETFileName = command.GetValueAsString("petfile");
     std::string sOutputFileName = command.GetValueAsString("outputfile");
@@ -133,6 +220,11 @@ int main(int argc, char *argv[])
     // apply blur to input image
     blurFilter->SetInput(petReader->GetOutput());
 
+    const int nReplicates = command.GetValueAsInt("Replicates", "N");
+    if (nReplicates > 0) {
+        return writeReplicates(command, blurFilter->GetOutput(), nReplicates, sOutputFileName);
+    }
+
     //Write out result of final iteration.
     PETWriterType::Pointer petWriter = PETWriterType::New();
     petWriter->SetFileName(sOutputFileName);
@@ -162,3 +254,116 @@ std::string getAcknowledgments(void)
     return sAck;
 }
 
+
+int writeReplicates(MetaCommand & command, PETImageType * blurred, int nReplicates,
+                    const std::string & sOutputFileName)
+{
+    const std::string sNoise = command.GetValueAsString("Noise", "model");
+    NoiseFunctor functor;
+    if (sNoise == "poisson") {
+        functor.model = ENoisePoisson;
+    } else if (sNoise == "gaussian") {
+        functor.model = ENoiseGaussian;
+    } else if (sNoise == "none") {
+        functor.model = ENoiseNone;
+    } else {
+        std::cerr << "[Error]\tUnknown noise model: " << sNoise << std::endl;
+        return EXIT_FAILURE;
+    }
+    functor.fScale = command.GetValueAsFloat("Scale", "counts");
+    functor.fSD = command.GetValueAsFloat("SD", "value");
+    functor.nSeed = command.GetValueAsInt("Seed", "N");
+
+    if (functor.fScale <= 0.0) {
+        std::cerr << "[Error]\tThe scale must be positive." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    try {
+        blurred->Update();
+    } catch (itk::ExceptionObject & err) {
+        std::cerr << "[Error]\tCannot blur PET image: " << err << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    functor.pBlurred = blurred->GetBufferPointer();
+    functor.nVoxels = blurred->GetBufferedRegion().GetNumberOfPixels();
+
+    if (command.GetOptionWasSet("Series")) {
+        //One replicate at a time, so only one is held in memory.
+        PETImageType::Pointer noisy = PETImageType::New();
+        noisy->CopyInformation(blurred);
+        noisy->SetRegions(blurred->GetBufferedRegion());
+        noisy->Allocate();
+        functor.pOutput = noisy->GetBufferPointer();
+
+        for (int n = 0; n < nReplicates; n++) {
+            functor.nFirstReplicate = n;
+            petpvc::ParallelFor(0, functor.nVoxels, functor);
+            noisy->Modified();
+
+            std::stringstream suffix;
+            suffix << "_" << std::setw(4) << std::setfill('0') << ( n + 1 );
+            const std::string sFileName = petpvc::AddFileNameSuffix(sOutputFileName, suffix.str());
+
+            PETWriterType::Pointer petWriter = PETWriterType::New();
+            petWriter->SetFileName(sFileName);
+            petWriter->SetInput(noisy);
+
+            try {
+                petWriter->Update();
+            } catch (itk::ExceptionObject & err) {
+                std::cerr << "[Error]\tCannot write output file: " << sFileName << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+
+        return EXIT_SUCCESS;
+    }
+
+    //All replicates as the volumes of one 4-D image, with the geometry of
+    //the PET image in the first three dimensions.
+    ReplicateImageType::RegionType region;
+    ReplicateImageType::SpacingType spacing;
+    ReplicateImageType::PointType origin;
+    ReplicateImageType::DirectionType direction;
+    direction.SetIdentity();
+
+    for (unsigned int d = 0; d < 3; d++) {
+        region.SetIndex(d, blurred->GetBufferedRegion().GetIndex()[d]);
+        region.SetSize(d, blurred->GetBufferedRegion().GetSize()[d]);
+        spacing[d] = blurred->GetSpacing()[d];
+        origin[d] = blurred->GetOrigin()[d];
+        for (unsigned int e = 0; e < 3; e++) {
+            direction[d][e] = blurred->GetDirection()[d][e];
+        }
+    }
+    region.SetIndex(3, 0);
+    region.SetSize(3, nReplicates);
+    spacing[3] = 1.0;
+    origin[3] = 0.0;
+
+    ReplicateImageType::Pointer replicates = ReplicateImageType::New();
+    replicates->SetRegions(region);
+    replicates->SetSpacing(spacing);
+    replicates->SetOrigin(origin);
+    replicates->SetDirection(direction);
+    replicates->Allocate();
+
+    functor.pOutput = replicates->GetBufferPointer();
+    functor.nFirstReplicate = 0;
+    petpvc::ParallelFor(0, functor.nVoxels * nReplicates, functor);
+
+    ReplicateWriterType::Pointer replicateWriter = ReplicateWriterType::New();
+    replicateWriter->SetFileName(sOutputFileName);
+    replicateWriter->SetInput(replicates);
+
+    try {
+        replicateWriter->Update();
+    } catch (itk::ExceptionObject & err) {
+        std::cerr << "[Error]\tCannot write output file: " << sOutputFileName << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
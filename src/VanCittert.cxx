@@ -35,6 +35,8 @@
 #include <metaCommand.h>
 
 #include "petpvcVanCittertPVCImageFilter.h"
+#include "petpvcIterationSnapshotCommand.h"
+#include "petpvcParallel.h"
 
 typedef itk::Vector<float, 3> VectorType;
 typedef itk::Image<float, 3> PETImageType;
@@ -106,6 +108,15 @@ int main(int argc, char *argv[])
     command.SetOption("debug", "d", false,"Prints debug information");
     command.SetOptionLongTag("debug", "debug");
 
+    command.SetOption("Threads", "j", false, "Maximum number of threads to use (0 for the default)");
+    command.SetOptionLongTag("Threads", "threads");
+    command.AddOptionField("Threads", "N", MetaCommand::INT, true, "0");
+
+    command.SetOption("SaveIterations", "S", false,
+                      "Comma-separated list of iterations at which to save the current estimate, e.g. 2,5,10");
+    command.SetOptionLongTag("SaveIterations", "save-iterations");
+    command.AddOptionField("SaveIterations", "list", MetaCommand::STRING, true, "");
+
     //Parse command line.
     if (!command.Parse(argc, argv)) {
         return EXIT_FAILURE;
@@ -138,6 +149,15 @@ int main(int argc, char *argv[])
     //Toggle debug mode
     bool bDebug = command.GetValueAsBool("debug");
 
+    //Limit the number of threads before any filters are created.
+    petpvc::SetNumberOfThreads( command.GetValueAsInt("Threads", "N") );
+
+    //Get iterations at which to save intermediate results.
+    std::vector<unsigned int> vecSaveIters;
+    if ( command.GetOptionWasSet("SaveIterations") ) {
+        vecSaveIters = petpvc::ParseIterationList( command.GetValueAsString("SaveIterations", "list") );
+    }
+
     //Toggle non-negativity constraint
     const bool bDisableNonNeg = command.GetValueAsBool("NonNeg");
 
@@ -175,6 +195,9 @@ int main(int argc, char *argv[])
     vcFilter->SetVerbose ( bDebug );
     vcFilter->SetDisableNonNegativity( bDisableNonNeg );
 
+    //Save intermediate results, if requested.
+    petpvc::AddIterationSnapshots( vcFilter.GetPointer(), vecSaveIters, sOutputFileName );
+
     //Perform VC.
     try {
         vcFilter->Update();
@@ -0,0 +1,742 @@
+/*
+   Bench.cxx
+
+   Author:      Benjamin A. Thomas
+
+   Copyright 2026 Institute of Nuclear Medicine, University College London.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+   This program times the PVC methods on a synthetic phantom of a given
+   size and reports their throughput.
+
+ */
+
+#include <itkImage.h>
+#include <itkCastImageFilter.h>
+#include <itkDiscreteGaussianImageFilter.h>
+#include <itkRealTimeClock.h>
+#include <metaCommand.h>
+
+#include "petpvcRoussetPVCImageFilter.h"
+#include "petpvcLabbePVCImageFilter.h"
+#include "petpvcRBVPVCImageFilter.h"
+#include "petpvcIterativeYangPVCImageFilter.h"
+#include "petpvcDiscreteIYPVCImageFilter.h"
+#include "petpvcMTCPVCImageFilter.h"
+#include "petpvcMullerGartnerImageFilter.h"
+#include "petpvcVanCittertPVCImageFilter.h"
+#include "petpvcRLPVCImageFilter.h"
+#include "petpvcSTCPVCImageFilter.h"
+#include "petpvcLabbeRBVPVCImageFilter.h"
+#include "petpvcLabbeMTCPVCImageFilter.h"
+#include "petpvcIntraRegVCImageFilter.h"
+#include "petpvcIntraRegRLImageFilter.h"
+#include "petpvcVolumeView.h"
+#include "petpvcAllocationHooks.h"
+#include "petpvcParallel.h"
+#include "petpvcPhantom.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+typedef petpvc::Phantom::ImageType PETImageType;
+typedef petpvc::Phantom::MaskImageType MaskImageType;
+typedef petpvc::Phantom::LabelImageType LabelImageType;
+typedef itk::Vector<float, 3> VectorType;
+
+struct BenchSettings {
+    VectorType vVariance;
+    unsigned int nIterations;
+    unsigned int nDeconvIterations;
+};
+
+typedef PETImageType::Pointer (*StageFunction)( const petpvc::Phantom &, const BenchSettings & );
+typedef PETImageType::Pointer (*PostStageFunction)( const PETImageType *, const MaskImageType *, const BenchSettings & );
+
+struct BenchMethod {
+    std::string sName;
+    StageFunction stage;
+    //Optional intra-regional deconvolution of the stage output.
+    PostStageFunction postStage;
+    //Use the GM volume, rather than the whole mask, for the second stage.
+    bool bGMOnly;
+};
+
+struct BenchResult {
+    std::string sName;
+    std::vector<double> vecTimes;
+    size_t nPeakBytes;
+};
+
+//Exit code of a comparison with no baseline for some method, which ctest
+//reports as skipped (SKIP_RETURN_CODE).
+const int BENCH_SKIPPED = 77;
+
+//Reference kernel that the methods are timed against: a Gaussian blur of the
+//truth with ITK, which runs on the same machine and threads as the methods.
+void RunReference( const petpvc::Phantom & phantom, const BenchSettings & settings )
+{
+    typedef itk::DiscreteGaussianImageFilter< PETImageType, PETImageType > BlurType;
+
+    BlurType::ArrayType variance;
+    for ( unsigned int d = 0; d < 3; d++ ) {
+        variance[d] = settings.vVariance[d];
+    }
+
+    BlurType::Pointer blurFilter = BlurType::New();
+    blurFilter->SetInput( phantom.truth );
+    blurFilter->SetVariance( variance );
+    blurFilter->SetUseImageSpacingOn();
+    blurFilter->Update();
+}
+
+//Methods that take the 4-D mask and have no extra parameters.
+template< class TFilter >
+PETImageType::Pointer RunMaskFilter( const petpvc::Phantom & phantom, const BenchSettings & settings )
+{
+    typename TFilter::Pointer filter = TFilter::New();
+    filter->SetInput( phantom.image );
+    filter->SetMaskInput( phantom.mask );
+    filter->SetPSF( settings.vVariance );
+    filter->Update();
+
+    return filter->GetOutput();
+}
+
+//Methods that take the 3-D label image and iterate.
+template< class TFilter >
+PETImageType::Pointer RunLabelFilter( const petpvc::Phantom & phantom, const BenchSettings & settings )
+{
+    typename TFilter::Pointer filter = TFilter::New();
+    filter->SetInput( phantom.image );
+    filter->SetMaskInput( phantom.labels );
+    filter->SetPSF( settings.vVariance );
+    filter->SetIterations( settings.nIterations );
+    filter->Update();
+
+    return filter->GetOutput();
+}
+
+PETImageType::Pointer RunIY( const petpvc::Phantom & phantom, const BenchSettings & settings )
+{
+    typedef petpvc::IterativeYangPVCImageFilter<PETImageType, MaskImageType> FilterType;
+
+    FilterType::Pointer filter = FilterType::New();
+    filter->SetInput( phantom.image );
+    filter->SetMaskInput( phantom.mask );
+    filter->SetPSF( settings.vVariance );
+    filter->SetIterations( settings.nIterations );
+    filter->Update();
+
+    return filter->GetOutput();
+}
+
+PETImageType::Pointer RunMG( const petpvc::Phantom & phantom, const BenchSettings & settings )
+{
+    typedef petpvc::MullerGartnerImageFilter<PETImageType, PETImageType, PETImageType, PETImageType> FilterType;
+
+    //The first two regions act as GM and WM.
+    FilterType::Pointer filter = FilterType::New();
+    filter->SetInput1( phantom.image );
+    filter->SetInput2( petpvc::GetVolumeView< PETImageType >( phantom.mask.GetPointer(), 0 ) );
+    filter->SetInput3( petpvc::GetVolumeView< PETImageType >( phantom.mask.GetPointer(), 1 ) );
+    filter->SetWM( 0 );
+    filter->SetPSF( settings.vVariance );
+    filter->Update();
+
+    return filter->GetOutput();
+}
+
+PETImageType::Pointer RunVC( const petpvc::Phantom & phantom, const BenchSettings & settings )
+{
+    typedef petpvc::VanCittertPVCImageFilter< PETImageType > FilterType;
+
+    FilterType::Pointer filter = FilterType::New();
+    filter->SetInput( phantom.image );
+    filter->SetPSF( settings.vVariance );
+    filter->SetIterations( settings.nDeconvIterations );
+    filter->SetAlpha( 1.5 );
+    //Run every iteration, so the times are comparable.
+    filter->SetStoppingCond( 0.0 );
+    filter->Update();
+
+    return filter->GetOutput();
+}
+
+PETImageType::Pointer RunRL( const petpvc::Phantom & phantom, const BenchSettings & settings )
+{
+    typedef petpvc::RichardsonLucyPVCImageFilter< PETImageType > FilterType;
+
+    FilterType::Pointer filter = FilterType::New();
+    filter->SetInput( phantom.image );
+    filter->SetPSF( settings.vVariance );
+    filter->SetIterations( settings.nDeconvIterations );
+    filter->Update();
+
+    return filter->GetOutput();
+}
+
+PETImageType::Pointer RunIntraRegVC( const PETImageType * image, const MaskImageType * mask, const BenchSettings & settings )
+{
+    typedef petpvc::IntraRegVCImageFilter< PETImageType, MaskImageType > FilterType;
+
+    FilterType::Pointer filter = FilterType::New();
+    filter->SetInput( image );
+    filter->SetMaskInput( mask );
+    filter->SetPSF( settings.vVariance );
+    filter->SetIterations( settings.nDeconvIterations );
+    filter->SetAlpha( 1.5 );
+    filter->SetStoppingCond( 0.0 );
+    filter->Update();
+
+    return filter->GetOutput();
+}
+
+PETImageType::Pointer RunIntraRegRL( const PETImageType * image, const MaskImageType * mask, const BenchSettings & settings )
+{
+    typedef petpvc::IntraRegRLImageFilter< PETImageType, MaskImageType > FilterType;
+
+    FilterType::Pointer filter = FilterType::New();
+    filter->SetInput( image );
+    filter->SetMaskInput( mask );
+    filter->SetPSF( settings.vVariance );
+    filter->SetIterations( settings.nDeconvIterations );
+    filter->Update();
+
+    return filter->GetOutput();
+}
+
+void RunMethod( const BenchMethod & method, const petpvc::Phantom & phantom, const BenchSettings & settings )
+{
+    PETImageType::Pointer output = method.stage( phantom, settings );
+
+    if ( method.postStage == NULL ) {
+        return;
+    }
+
+    if ( method.bGMOnly ) {
+        //Puts 3D into 4D, as PETPVC does for MG.
+        typedef itk::CastImageFilter<PETImageType, MaskImageType> CastFilterType;
+        CastFilterType::Pointer castFilter = CastFilterType::New();
+        castFilter->SetInput( petpvc::GetVolumeView< PETImageType >( phantom.mask.GetPointer(), 0 ) );
+        castFilter->Update();
+
+        method.postStage( output, castFilter->GetOutput(), settings );
+    } else {
+        method.postStage( output, phantom.mask, settings );
+    }
+}
+
+std::vector<BenchMethod> GetBenchMethods()
+{
+    typedef petpvc::RoussetPVCImageFilter<PETImageType, MaskImageType> GTMFilterType;
+    typedef petpvc::LabbePVCImageFilter<PETImageType, MaskImageType> LabbeFilterType;
+    typedef petpvc::RBVPVCImageFilter<PETImageType, MaskImageType> RBVFilterType;
+    typedef petpvc::MTCPVCImageFilter<PETImageType, MaskImageType> MTCFilterType;
+    typedef petpvc::LabbeRBVPVCImageFilter<PETImageType, MaskImageType> LabbeRBVFilterType;
+    typedef petpvc::LabbeMTCPVCImageFilter<PETImageType, MaskImageType> LabbeMTCFilterType;
+    typedef petpvc::DiscreteIYPVCImageFilter<PETImageType, LabelImageType> DIYFilterType;
+    typedef petpvc::STCPVCImageFilter<PETImageType, LabelImageType> STCFilterType;
+
+    const BenchMethod methods[] = {
+        { "GTM", RunMaskFilter< GTMFilterType >, NULL, false },
+        { "LABBE", RunMaskFilter< LabbeFilterType >, NULL, false },
+        { "RBV", RunMaskFilter< RBVFilterType >, NULL, false },
+        { "IY", RunIY, NULL, false },
+        { "DIY", RunLabelFilter< DIYFilterType >, NULL, false },
+        { "MTC", RunMaskFilter< MTCFilterType >, NULL, false },
+        { "STC", RunLabelFilter< STCFilterType >, NULL, false },
+        { "MG", RunMG, NULL, false },
+        { "VC", RunVC, NULL, false },
+        { "RL", RunRL, NULL, false },
+        { "LABBE+RBV", RunMaskFilter< LabbeRBVFilterType >, NULL, false },
+        { "LABBE+MTC", RunMaskFilter< LabbeMTCFilterType >, NULL, false },
+        { "RBV+VC", RunMaskFilter< RBVFilterType >, RunIntraRegVC, false },
+        { "RBV+RL", RunMaskFilter< RBVFilterType >, RunIntraRegRL, false },
+        { "LABBE+RBV+VC", RunMaskFilter< LabbeRBVFilterType >, RunIntraRegVC, false },
+        { "LABBE+RBV+RL", RunMaskFilter< LabbeRBVFilterType >, RunIntraRegRL, false },
+        { "MTC+VC", RunMaskFilter< MTCFilterType >, RunIntraRegVC, false },
+        { "MTC+RL", RunMaskFilter< MTCFilterType >, RunIntraRegRL, false },
+        { "LABBE+MTC+VC", RunMaskFilter< LabbeMTCFilterType >, RunIntraRegVC, false },
+        { "LABBE+MTC+RL", RunMaskFilter< LabbeMTCFilterType >, RunIntraRegRL, false },
+        { "IY+VC", RunIY, RunIntraRegVC, false },
+        { "IY+RL", RunIY, RunIntraRegRL, false },
+        { "MG+VC", RunMG, RunIntraRegVC, true },
+        { "MG+RL", RunMG, RunIntraRegRL, true }
+    };
+
+    return std::vector<BenchMethod>( methods, methods + sizeof( methods ) / sizeof( methods[0] ) );
+}
+
+//Selects methods from a comma-separated list, or all of them.
+bool SelectBenchMethods( const std::string & sList, std::vector<BenchMethod> & vecSelected )
+{
+    const std::vector<BenchMethod> vecMethods = GetBenchMethods();
+
+    if ( sList.empty() || sList == "all" ) {
+        vecSelected = vecMethods;
+        return true;
+    }
+
+    std::stringstream ss( sList );
+    std::string sName;
+    while ( std::getline( ss, sName, ',' ) ) {
+        std::transform( sName.begin(), sName.end(), sName.begin(), ::toupper );
+
+        bool bFound = false;
+        for ( unsigned int n = 0; n < vecMethods.size(); n++ ) {
+            if ( vecMethods[n].sName == sName ) {
+                vecSelected.push_back( vecMethods[n] );
+                bFound = true;
+            }
+        }
+
+        if ( !bFound ) {
+            std::cerr << "[Error]\tUnknown method '" << sName << "' requested" << std::endl;
+            return false;
+        }
+    }
+
+    return !vecSelected.empty();
+}
+
+double GetMedian( std::vector<double> vecValues )
+{
+    std::sort( vecValues.begin(), vecValues.end() );
+    const size_t n = vecValues.size();
+    return ( n % 2 == 1 ) ? vecValues[n / 2] : 0.5 * ( vecValues[n / 2 - 1] + vecValues[n / 2] );
+}
+
+double GetMean( const std::vector<double> & vecValues )
+{
+    double fSum = 0.0;
+    for ( unsigned int n = 0; n < vecValues.size(); n++ ) {
+        fSum += vecValues[n];
+    }
+    return fSum / vecValues.size();
+}
+
+//Writes the results. The reference ratio is each median over the median of
+//the reference kernel.
+bool WriteBenchResults( const std::string & sFileName, const petpvc::PhantomSettings & phantomSettings,
+                        const BenchSettings & settings, const std::vector<BenchResult> & vecResults,
+                        double fReference )
+{
+    std::ofstream file( sFileName.c_str() );
+    if ( !file.is_open() ) {
+        return false;
+    }
+
+    const double fVoxels = (double) phantomSettings.size[0] * phantomSettings.size[1] * phantomSettings.size[2];
+    const bool bJSON = sFileName.size() >= 5 && sFileName.substr( sFileName.size() - 5 ) == ".json";
+
+    if ( bJSON ) {
+        file << "{" << std::endl
+             << "  \"phantom\": { \"size\": [" << phantomSettings.size[0] << ", " << phantomSettings.size[1]
+             << ", " << phantomSettings.size[2] << "], \"spacing\": [" << phantomSettings.spacing[0] << ", "
+             << phantomSettings.spacing[1] << ", " << phantomSettings.spacing[2] << "], \"regions\": "
+             << phantomSettings.nRegions << ", \"edge_mm\": " << phantomSettings.fEdgeWidth
+             << ", \"fwhm_mm\": " << phantomSettings.fFWHM << " }," << std::endl
+             << "  \"threads\": " << petpvc::GetNumberOfThreads() << "," << std::endl
+             << "  \"iterations\": " << settings.nIterations << "," << std::endl
+             << "  \"deconvolution_iterations\": " << settings.nDeconvIterations << "," << std::endl
+             << "  \"reference_s\": " << fReference << "," << std::endl
+             << "  \"results\": [";
+    } else {
+        file << "method,size_x,size_y,size_z,regions,edge_mm,threads,repeats,min_s,median_s,mean_s,"
+             << "voxels_per_s,regions_per_s,peak_bytes,reference_ratio" << std::endl;
+    }
+
+    for ( unsigned int n = 0; n < vecResults.size(); n++ ) {
+        const BenchResult & result = vecResults[n];
+        const double fMin = *std::min_element( result.vecTimes.begin(), result.vecTimes.end() );
+        const double fMedian = GetMedian( result.vecTimes );
+        const double fMean = GetMean( result.vecTimes );
+
+        if ( bJSON ) {
+            file << ( n > 0 ? "," : "" ) << std::endl
+                 << "    { \"method\": \"" << result.sName << "\", \"repeats\": " << result.vecTimes.size()
+                 << ", \"min_s\": " << fMin << ", \"median_s\": " << fMedian << ", \"mean_s\": " << fMean
+                 << ", \"voxels_per_s\": " << fVoxels / fMedian
+                 << ", \"regions_per_s\": " << phantomSettings.nRegions / fMedian
+                 << ", \"peak_bytes\": " << (unsigned long long) result.nPeakBytes
+                 << ", \"reference_ratio\": " << fMedian / fReference << " }";
+        } else {
+            file << result.sName << "," << phantomSettings.size[0] << "," << phantomSettings.size[1] << ","
+                 << phantomSettings.size[2] << "," << phantomSettings.nRegions << ","
+                 << phantomSettings.fEdgeWidth << "," << petpvc::GetNumberOfThreads() << ","
+                 << result.vecTimes.size() << "," << fMin << ","
+                 << fMedian << "," << fMean << "," << fVoxels / fMedian << ","
+                 << phantomSettings.nRegions / fMedian << "," << (unsigned long long) result.nPeakBytes << ","
+                 << fMedian / fReference << std::endl;
+        }
+    }
+
+    if ( bJSON ) {
+        file << std::endl << "  ]" << std::endl << "}" << std::endl;
+    }
+
+    return file.good();
+}
+
+struct BaselineEntry {
+    double fRatio;
+    double fPeakBytes;
+};
+
+typedef std::map<std::string, BaselineEntry> BaselineMap;
+
+std::vector<std::string> SplitCSVLine( const std::string & sLine )
+{
+    std::vector<std::string> vecFields;
+    std::stringstream ss( sLine );
+    std::string sField;
+    while ( std::getline( ss, sField, ',' ) ) {
+        vecFields.push_back( sField );
+    }
+    return vecFields;
+}
+
+//Reads the rows of a CSV results file that were made with the same phantom.
+//Lines starting with '#' are comments. Returns false if the file cannot be read.
+bool ReadBenchBaseline( const std::string & sFileName, const petpvc::PhantomSettings & phantomSettings,
+                        BaselineMap & mapBaseline )
+{
+    std::ifstream file( sFileName.c_str() );
+    if ( !file.is_open() ) {
+        return false;
+    }
+
+    std::map<std::string, unsigned int> mapColumns;
+    std::string sLine;
+
+    while ( std::getline( file, sLine ) ) {
+        if ( sLine.empty() || sLine[0] == '#' ) {
+            continue;
+        }
+
+        const std::vector<std::string> vecFields = SplitCSVLine( sLine );
+
+        if ( mapColumns.empty() ) {
+            for ( unsigned int n = 0; n < vecFields.size(); n++ ) {
+                mapColumns[ vecFields[n] ] = n;
+            }
+
+            const char * const requiredColumns[] = { "method", "size_x", "size_y", "size_z", "regions",
+                                                     "edge_mm", "peak_bytes", "reference_ratio" };
+            for ( unsigned int n = 0; n < sizeof( requiredColumns ) / sizeof( requiredColumns[0] ); n++ ) {
+                if ( mapColumns.find( requiredColumns[n] ) == mapColumns.end() ) {
+                    return false;
+                }
+            }
+            continue;
+        }
+
+        if ( vecFields.size() != mapColumns.size() ) {
+            continue;
+        }
+
+        //Only compare like with like.
+        if ( atoi( vecFields[ mapColumns["size_x"] ].c_str() ) != (int) phantomSettings.size[0] ||
+                atoi( vecFields[ mapColumns["size_y"] ].c_str() ) != (int) phantomSettings.size[1] ||
+                atoi( vecFields[ mapColumns["size_z"] ].c_str() ) != (int) phantomSettings.size[2] ||
+                atoi( vecFields[ mapColumns["regions"] ].c_str() ) != (int) phantomSettings.nRegions ||
+                fabs( atof( vecFields[ mapColumns["edge_mm"] ].c_str() ) - phantomSettings.fEdgeWidth ) > 1e-3 ) {
+            continue;
+        }
+
+        //Older results do not record the number of threads.
+        if ( mapColumns.find( "threads" ) != mapColumns.end() &&
+                atoi( vecFields[ mapColumns["threads"] ].c_str() ) != (int) petpvc::GetNumberOfThreads() ) {
+            continue;
+        }
+
+        BaselineEntry entry;
+        entry.fRatio = atof( vecFields[ mapColumns["reference_ratio"] ].c_str() );
+        entry.fPeakBytes = atof( vecFields[ mapColumns["peak_bytes"] ].c_str() );
+        mapBaseline[ vecFields[ mapColumns["method"] ] ] = entry;
+    }
+
+    return !mapColumns.empty();
+}
+
+enum BaselineComparison { EBaselinePassed, EBaselineMissing, EBaselineRegressed };
+
+//Prints each method against its baseline. Times are compared as ratios to the
+//reference kernel, so a baseline holds on machines of different speed.
+//Returns EBaselineRegressed if any method is slower, or uses more memory,
+//than the baseline allows, and otherwise EBaselineMissing if any method has
+//no baseline.
+BaselineComparison CompareWithBaseline( const std::vector<BenchResult> & vecResults, const BaselineMap & mapBaseline,
+                                        double fReference, float fTimeTolerance, float fMemoryTolerance )
+{
+    bool bPassed = true;
+    bool bMissing = false;
+
+    std::cout << std::endl << "Comparison with baseline (time tolerance " << 100.0 * fTimeTolerance
+              << "%, memory tolerance " << 100.0 * fMemoryTolerance << "%, reference " << fReference
+              << " s):" << std::endl;
+
+    for ( unsigned int n = 0; n < vecResults.size(); n++ ) {
+        const BenchResult & result = vecResults[n];
+        const double fRatio = GetMedian( result.vecTimes ) / fReference;
+
+        BaselineMap::const_iterator it = mapBaseline.find( result.sName );
+        if ( it == mapBaseline.end() ) {
+            std::cout << result.sName << "\tno baseline (" << fRatio << " x reference)" << std::endl;
+            bMissing = true;
+            continue;
+        }
+
+        const BaselineEntry & entry = it->second;
+
+        const bool bSlower = fRatio > entry.fRatio * ( 1.0 + fTimeTolerance );
+        std::cout << result.sName << "\ttime " << fRatio << " x reference, baseline " << entry.fRatio << " x ("
+                  << std::showpos << 100.0 * ( fRatio / entry.fRatio - 1.0 ) << std::noshowpos << "%)"
+                  << ( bSlower ? "\t[REGRESSION]" : "" ) << std::endl;
+
+        //Memory is only known when allocations are tracked.
+        if ( result.nPeakBytes > 0 && entry.fPeakBytes > 0.0 ) {
+            const bool bLarger = result.nPeakBytes > entry.fPeakBytes * ( 1.0 + fMemoryTolerance );
+            std::cout << result.sName << "\tpeak memory " << result.nPeakBytes / ( 1024.0 * 1024.0 )
+                      << " MB, baseline " << entry.fPeakBytes / ( 1024.0 * 1024.0 ) << " MB ("
+                      << std::showpos << 100.0 * ( result.nPeakBytes / entry.fPeakBytes - 1.0 )
+                      << std::noshowpos << "%)" << ( bLarger ? "\t[REGRESSION]" : "" ) << std::endl;
+            bPassed = bPassed && !bLarger;
+        }
+
+        bPassed = bPassed && !bSlower;
+    }
+
+    if ( !bPassed ) {
+        return EBaselineRegressed;
+    }
+    return bMissing ? EBaselineMissing : EBaselinePassed;
+}
+
+int main( int argc, char *argv[] )
+{
+    MetaCommand command;
+
+    command.SetName( "pvc_bench" );
+    command.SetDescription( "Times the PVC methods on a synthetic phantom" );
+    command.SetCategory( "PETPVC" );
+
+    command.SetOption( "Size", "s", false, "Matrix size of the phantom" );
+    command.SetOptionLongTag( "Size", "size" );
+    command.AddOptionField( "Size", "X", MetaCommand::INT, true, "128" );
+    command.AddOptionField( "Size", "Y", MetaCommand::INT, true, "128" );
+    command.AddOptionField( "Size", "Z", MetaCommand::INT, true, "64" );
+
+    command.SetOption( "Spacing", "v", false, "Voxel size in mm" );
+    command.SetOptionLongTag( "Spacing", "spacing" );
+    command.AddOptionField( "Spacing", "X", MetaCommand::FLOAT, true, "2" );
+    command.AddOptionField( "Spacing", "Y", MetaCommand::FLOAT, true, "2" );
+    command.AddOptionField( "Spacing", "Z", MetaCommand::FLOAT, true, "2" );
+
+    command.SetOption( "Regions", "r", false, "Number of regions" );
+    command.SetOptionLongTag( "Regions", "regions" );
+    command.AddOptionField( "Regions", "N", MetaCommand::INT, true, "16" );
+
+    command.SetOption( "Edge", "e", false, "Width in mm of the probabilistic region edges (0 for binary regions)" );
+    command.SetOptionLongTag( "Edge", "edge" );
+    command.AddOptionField( "Edge", "mm", MetaCommand::FLOAT, true, "0" );
+
+    command.SetOption( "FWHM", "f", false, "FWHM in mm of the PSF, in all directions" );
+    command.SetOptionLongTag( "FWHM", "fwhm" );
+    command.AddOptionField( "FWHM", "mm", MetaCommand::FLOAT, true, "6" );
+
+    command.SetOption( "Methods", "p", false, "Comma-separated list of methods, or 'all'" );
+    command.SetOptionLongTag( "Methods", "methods" );
+    command.AddOptionField( "Methods", "list", MetaCommand::STRING, true, "all" );
+
+    command.SetOption( "Repeats", "t", false, "Number of timed runs of each method" );
+    command.SetOptionLongTag( "Repeats", "repeats" );
+    command.AddOptionField( "Repeats", "N", MetaCommand::INT, true, "3" );
+
+    command.SetOption( "Iterations", "n", false, "Number of iterations (IY, DIY and STC)" );
+    command.SetOptionLongTag( "Iterations", "iter" );
+    command.AddOptionField( "Iterations", "Val", MetaCommand::INT, true, "10" );
+
+    command.SetOption( "Deconvolution", "k", false, "Number of deconvolution iterations (RL, VC and combinations)" );
+    command.AddOptionField( "Deconvolution", "Val", MetaCommand::INT, true, "10" );
+
+    command.SetOption( "Output", "o", false, "Results file (.json for JSON, otherwise CSV)" );
+    command.SetOptionLongTag( "Output", "output" );
+    command.AddOptionField( "Output", "filename", MetaCommand::STRING, true, "" );
+
+    command.SetOption( "Threads", "j", false, "Maximum number of threads to use (0 for the default)" );
+    command.SetOptionLongTag( "Threads", "threads" );
+    command.AddOptionField( "Threads", "N", MetaCommand::INT, true, "0" );
+
+    command.SetOption( "Baseline", "b", false,
+                       "CSV results to compare against. Fails if a method is slower or uses more memory, and exits with 77 if a method has no baseline" );
+    command.SetOptionLongTag( "Baseline", "baseline" );
+    command.AddOptionField( "Baseline", "filename", MetaCommand::STRING, true, "" );
+
+    command.SetOption( "Tolerance", "l", false, "Allowed increase in time over the baseline, as a fraction" );
+    command.SetOptionLongTag( "Tolerance", "tolerance" );
+    command.AddOptionField( "Tolerance", "fraction", MetaCommand::FLOAT, true, "0.3" );
+
+    command.SetOption( "MemoryTolerance", "m", false, "Allowed increase in peak memory over the baseline, as a fraction" );
+    command.SetOptionLongTag( "MemoryTolerance", "memory-tolerance" );
+    command.AddOptionField( "MemoryTolerance", "fraction", MetaCommand::FLOAT, true, "0.1" );
+
+    if ( !command.Parse( argc, argv ) ) {
+        return EXIT_FAILURE;
+    }
+
+    petpvc::SetNumberOfThreads( command.GetValueAsInt( "Threads", "N" ) );
+
+    petpvc::PhantomSettings phantomSettings;
+    phantomSettings.size[0] = command.GetValueAsInt( "Size", "X" );
+    phantomSettings.size[1] = command.GetValueAsInt( "Size", "Y" );
+    phantomSettings.size[2] = command.GetValueAsInt( "Size", "Z" );
+    phantomSettings.spacing[0] = command.GetValueAsFloat( "Spacing", "X" );
+    phantomSettings.spacing[1] = command.GetValueAsFloat( "Spacing", "Y" );
+    phantomSettings.spacing[2] = command.GetValueAsFloat( "Spacing", "Z" );
+    phantomSettings.nRegions = command.GetValueAsInt( "Regions", "N" );
+    phantomSettings.fEdgeWidth = command.GetValueAsFloat( "Edge", "mm" );
+    phantomSettings.fFWHM = command.GetValueAsFloat( "FWHM", "mm" );
+
+    //MG uses the first two regions as GM and WM.
+    if ( phantomSettings.nRegions < 2 ) {
+        std::cerr << "[Error]\tAt least 2 regions are needed" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const int nRepeats = command.GetValueAsInt( "Repeats", "N" );
+    if ( nRepeats < 1 ) {
+        std::cerr << "[Error]\tNumber of repeats must be at least 1" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    BaselineMap mapBaseline;
+    const bool bCompare = command.GetOptionWasSet( "Baseline" );
+    if ( bCompare ) {
+        const std::string sBaselineFileName = command.GetValueAsString( "Baseline", "filename" );
+        if ( !ReadBenchBaseline( sBaselineFileName, phantomSettings, mapBaseline ) ) {
+            std::cerr << "[Error]\tCannot read baseline file: " << sBaselineFileName << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::vector<BenchMethod> vecMethods;
+    if ( !SelectBenchMethods( command.GetValueAsString( "Methods", "list" ), vecMethods ) ) {
+        return EXIT_FAILURE;
+    }
+
+    BenchSettings settings;
+    const float fSigma = phantomSettings.fFWHM / ( 2.0 * sqrt( 2.0 * log( 2.0 ) ) );
+    settings.vVariance.Fill( fSigma * fSigma );
+    settings.nIterations = command.GetValueAsInt( "Iterations", "Val" );
+    settings.nDeconvIterations = command.GetValueAsInt( "Deconvolution", "Val" );
+
+    std::cout << "Creating " << phantomSettings.size[0] << " x " << phantomSettings.size[1] << " x "
+              << phantomSettings.size[2] << " phantom with " << phantomSettings.nRegions << " regions..." << std::endl;
+
+    petpvc::Phantom phantom;
+    try {
+        phantom = petpvc::CreatePhantom( phantomSettings );
+    } catch (itk::ExceptionObject & err) {
+        std::cerr << "[Error]\tCannot create phantom" << std::endl << err << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const double fVoxels = (double) phantomSettings.size[0] * phantomSettings.size[1] * phantomSettings.size[2];
+
+    itk::RealTimeClock::Pointer clock = itk::RealTimeClock::New();
+    petpvc::AllocationTracker & tracker = petpvc::AllocationTracker::GetInstance();
+
+    std::vector<BenchResult> vecResults;
+
+    //Time the reference kernel as the methods are timed.
+    std::vector<double> vecReferenceTimes;
+    for ( int r = 0; r < nRepeats; r++ ) {
+        const double fStart = clock->GetTimeInSeconds();
+        try {
+            RunReference( phantom, settings );
+        } catch (itk::ExceptionObject & err) {
+            std::cerr << "[Error]\tfailure running the reference kernel" << std::endl << err << std::endl;
+            return EXIT_FAILURE;
+        }
+        vecReferenceTimes.push_back( clock->GetTimeInSeconds() - fStart );
+    }
+    const double fReference = GetMedian( vecReferenceTimes );
+
+    std::cout << "REFERENCE\t" << fReference << std::endl;
+    std::cout << "METHOD\tMEDIAN (s)\tVOXELS/s\tREGIONS/s" << std::endl;
+
+    for ( unsigned int m = 0; m < vecMethods.size(); m++ ) {
+        BenchResult result;
+        result.sName = vecMethods[m].sName;
+        result.nPeakBytes = 0;
+
+        for ( int r = 0; r < nRepeats; r++ ) {
+            const size_t nBaseBytes = tracker.GetCurrentBytes();
+            const size_t nOldPeak = tracker.ResetPeak();
+
+            const double fStart = clock->GetTimeInSeconds();
+
+            try {
+                RunMethod( vecMethods[m], phantom, settings );
+            } catch (itk::ExceptionObject & err) {
+                std::cerr << "[Error]\tfailure applying " << result.sName << std::endl << err << std::endl;
+                return EXIT_FAILURE;
+            }
+
+            result.vecTimes.push_back( clock->GetTimeInSeconds() - fStart );
+            result.nPeakBytes = std::max( result.nPeakBytes, tracker.GetPeakBytes() - nBaseBytes );
+            tracker.RestorePeak( nOldPeak );
+        }
+
+        const double fMedian = GetMedian( result.vecTimes );
+        std::cout << result.sName << "\t" << fMedian << "\t" << fVoxels / fMedian << "\t"
+                  << phantomSettings.nRegions / fMedian << std::endl;
+
+        vecResults.push_back( result );
+    }
+
+    if ( command.GetOptionWasSet( "Output" ) ) {
+        const std::string sOutputFileName = command.GetValueAsString( "Output", "filename" );
+        if ( !WriteBenchResults( sOutputFileName, phantomSettings, settings, vecResults, fReference ) ) {
+            std::cerr << "[Error]\tCannot write output file: " << sOutputFileName << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if ( bCompare ) {
+        const BaselineComparison comparison = CompareWithBaseline( vecResults, mapBaseline, fReference,
+                                                                   command.GetValueAsFloat( "Tolerance", "fraction" ),
+                                                                   command.GetValueAsFloat( "MemoryTolerance", "fraction" ) );
+        if ( comparison == EBaselineRegressed ) {
+            std::cerr << "[Error]\tPerformance is worse than the baseline" << std::endl;
+            return EXIT_FAILURE;
+        }
+        if ( comparison == EBaselineMissing ) {
+            std::cerr << "[Warning]\tSome methods have no baseline, so they were not checked" << std::endl;
+            return BENCH_SKIPPED;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,381 @@
+/*
+   CheckImage.cxx
+
+   Author:      Benjamin A. Thomas
+
+   Copyright 2026 Institute of Nuclear Medicine, University College London.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+   This program checks properties of an image that pvc_compareImages cannot,
+   for the tests. Each check is a mode given as the first argument.
+
+ */
+
+#include <itkImage.h>
+#include <itkImageFileReader.h>
+#include <itkImageIOFactory.h>
+#include <itkImageRegionConstIterator.h>
+#include <itkMetaDataObject.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+typedef itk::Image<float, 3> ImageType;
+typedef itk::ImageFileReader<ImageType> ReaderType;
+typedef itk::ImageRegionConstIterator<ImageType> ConstIteratorType;
+typedef itk::Image<float, 4> StackImageType;
+typedef itk::ImageFileReader<StackImageType> StackReaderType;
+
+void printUsage( const char * sName )
+{
+    std::cerr << "Usage: " << sName << " <mode> ..." << std::endl
+              << "  notes <image> <text>\tthe description of image contains text" << std::endl
+              << "  size <image> X Y Z [T]\timage has this size" << std::endl
+              << "  labels <image> N\timage has N distinct nonzero labels" << std::endl
+              << "  volume <stack> N <image> <threshold>\tvolume N of stack matches image" << std::endl
+              << "  summary <file> <stack> <mask> <tolerance>\tfile has the regional mean and variance of stack" << std::endl
+              << "  relabel <image> <source> <from=to,...>\timage is source with its labels mapped" << std::endl;
+}
+
+//The description of the image, which NIfTI keeps in its descrip field,
+//contains sText.
+int checkNotes( int argc, char *argv[] )
+{
+    if ( argc != 4 ) {
+        printUsage( argv[0] );
+        return EXIT_FAILURE;
+    }
+
+    ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName( argv[2] );
+    reader->UpdateOutputInformation();
+
+    std::string sNotes;
+    itk::ExposeMetaData< std::string >( reader->GetImageIO()->GetMetaDataDictionary(), "ITK_FileNotes", sNotes );
+    std::cerr << "notes \"" << sNotes << "\"" << std::endl;
+
+    if ( sNotes.find( argv[3] ) == std::string::npos ) {
+        std::cerr << "The description does not contain \"" << argv[3] << "\"" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+//The image has the given size, read from its header, with as many
+//dimensions as sizes are given.
+int checkSize( int argc, char *argv[] )
+{
+    if ( argc < 4 ) {
+        printUsage( argv[0] );
+        return EXIT_FAILURE;
+    }
+
+    itk::ImageIOBase::Pointer imageIO = itk::ImageIOFactory::CreateImageIO( argv[2], itk::ImageIOFactory::ReadMode );
+    if ( imageIO.IsNull() ) {
+        std::cerr << "Could not read " << argv[2] << std::endl;
+        return EXIT_FAILURE;
+    }
+    imageIO->SetFileName( argv[2] );
+    imageIO->ReadImageInformation();
+
+    const unsigned int nDims = argc - 3;
+    bool bOK = ( imageIO->GetNumberOfDimensions() == nDims );
+
+    std::cerr << "size";
+    for ( unsigned int i = 0; i < imageIO->GetNumberOfDimensions(); i++ ) {
+        std::cerr << " " << imageIO->GetDimensions( i );
+        if ( i < nDims && imageIO->GetDimensions( i ) != (unsigned int) atoi( argv[i + 3] ) ) {
+            bOK = false;
+        }
+    }
+    std::cerr << std::endl;
+
+    if ( !bOK ) {
+        std::cerr << "The image is not of the given size" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+//The image has nLabels distinct nonzero values.
+int checkLabels( int argc, char *argv[] )
+{
+    if ( argc != 4 ) {
+        printUsage( argv[0] );
+        return EXIT_FAILURE;
+    }
+
+    ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName( argv[2] );
+    reader->Update();
+
+    std::set<float> setLabels;
+    ConstIteratorType it( reader->GetOutput(), reader->GetOutput()->GetLargestPossibleRegion() );
+    for ( it.GoToBegin(); !it.IsAtEnd(); ++it ) {
+        if ( it.Get() != 0 ) {
+            setLabels.insert( it.Get() );
+        }
+    }
+
+    const unsigned int nLabels = atoi( argv[3] );
+    std::cerr << "labels " << setLabels.size() << std::endl;
+
+    if ( setLabels.size() != nLabels ) {
+        std::cerr << "The image does not have " << nLabels << " labels" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+//Volume nVolume (from 1) of a 4-D stack matches a 3-D image, with an
+//absolute difference of at most fThreshold.
+int checkVolume( int argc, char *argv[] )
+{
+    if ( argc != 6 ) {
+        printUsage( argv[0] );
+        return EXIT_FAILURE;
+    }
+
+    StackReaderType::Pointer stackReader = StackReaderType::New();
+    stackReader->SetFileName( argv[2] );
+    stackReader->Update();
+    ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName( argv[4] );
+    reader->Update();
+
+    const StackImageType::SizeType stackSize = stackReader->GetOutput()->GetLargestPossibleRegion().GetSize();
+    const ImageType::SizeType size = reader->GetOutput()->GetLargestPossibleRegion().GetSize();
+    const long nVolume = atoi( argv[3] );
+
+    if ( stackSize[0] != size[0] || stackSize[1] != size[1] || stackSize[2] != size[2] ) {
+        std::cerr << "The volumes of the stack are not the size of the image" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if ( nVolume < 1 || nVolume > (long) stackSize[3] ) {
+        std::cerr << "The stack does not have volume " << nVolume << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const itk::SizeValueType nVoxels = reader->GetOutput()->GetLargestPossibleRegion().GetNumberOfPixels();
+    const float * pVolume = stackReader->GetOutput()->GetBufferPointer() + ( nVolume - 1 ) * nVoxels;
+    const float * pImage = reader->GetOutput()->GetBufferPointer();
+
+    double fMaxDiff = 0.0;
+    for ( itk::SizeValueType i = 0; i < nVoxels; i++ ) {
+        fMaxDiff = std::max( fMaxDiff, (double) std::fabs( pVolume[i] - pImage[i] ) );
+    }
+    std::cerr << "max abs diff " << fMaxDiff << std::endl;
+
+    if ( fMaxDiff > atof( argv[5] ) ) {
+        std::cerr << "Volume " << nVolume << " does not match the image" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+//The summary file of a replicate correction holds, for each volume of the
+//mask, the mean and unbiased variance over the replicates in the stack of
+//the mask-weighted regional mean. Each value may differ from the one found
+//here by fTolerance times its size (or by fTolerance, if less than one).
+int checkSummary( int argc, char *argv[] )
+{
+    if ( argc != 6 ) {
+        printUsage( argv[0] );
+        return EXIT_FAILURE;
+    }
+
+    StackReaderType::Pointer stackReader = StackReaderType::New();
+    stackReader->SetFileName( argv[3] );
+    stackReader->Update();
+    StackReaderType::Pointer maskReader = StackReaderType::New();
+    maskReader->SetFileName( argv[4] );
+    maskReader->Update();
+
+    const StackImageType::SizeType stackSize = stackReader->GetOutput()->GetLargestPossibleRegion().GetSize();
+    const StackImageType::SizeType maskSize = maskReader->GetOutput()->GetLargestPossibleRegion().GetSize();
+
+    if ( stackSize[0] != maskSize[0] || stackSize[1] != maskSize[1] || stackSize[2] != maskSize[2] ) {
+        std::cerr << "The stack and the mask are not the same size" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const itk::SizeValueType nVoxels = stackSize[0] * stackSize[1] * stackSize[2];
+    const unsigned int nReplicates = stackSize[3];
+    const unsigned int nRegions = maskSize[3];
+    const float * pStack = stackReader->GetOutput()->GetBufferPointer();
+    const float * pMask = maskReader->GetOutput()->GetBufferPointer();
+
+    std::ifstream file( argv[2] );
+    std::string sHeader;
+    if ( !std::getline( file, sHeader ) || sHeader != "REGION\tMEAN\tVARIANCE" ) {
+        std::cerr << "Cannot read the header of " << argv[2] << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const double fTolerance = atof( argv[5] );
+    bool bOK = true;
+
+    for ( unsigned int n = 0; n < nRegions; n++ ) {
+        const float * pRegion = pMask + n * nVoxels;
+
+        double fRegionSum = 0.0;
+        for ( itk::SizeValueType i = 0; i < nVoxels; i++ ) {
+            fRegionSum += pRegion[i];
+        }
+
+        std::vector<double> vecMeans( nReplicates, 0.0 );
+        double fMean = 0.0;
+        for ( unsigned int r = 0; r < nReplicates; r++ ) {
+            const float * pVolume = pStack + r * nVoxels;
+            double fSum = 0.0;
+            for ( itk::SizeValueType i = 0; i < nVoxels; i++ ) {
+                fSum += pRegion[i] * pVolume[i];
+            }
+            vecMeans[r] = fRegionSum > 0.0 ? fSum / fRegionSum : 0.0;
+            fMean += vecMeans[r];
+        }
+        fMean /= std::max( nReplicates, 1u );
+
+        double fVariance = 0.0;
+        for ( unsigned int r = 0; r < nReplicates; r++ ) {
+            fVariance += ( vecMeans[r] - fMean ) * ( vecMeans[r] - fMean );
+        }
+        fVariance = nReplicates > 1 ? fVariance / ( nReplicates - 1 ) : 0.0;
+
+        unsigned int nRegion = 0;
+        double fFileMean = 0.0, fFileVariance = 0.0;
+        if ( !( file >> nRegion >> fFileMean >> fFileVariance ) || nRegion != n + 1 ) {
+            std::cerr << "Cannot read region " << n + 1 << " from " << argv[2] << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        std::cerr << n + 1 << "\t" << fMean << "\t" << fVariance << "\t("
+                  << fFileMean << "\t" << fFileVariance << ")" << std::endl;
+
+        if ( std::fabs( fFileMean - fMean ) > fTolerance * std::max( std::fabs( fMean ), 1.0 ) ||
+             std::fabs( fFileVariance - fVariance ) > fTolerance * std::max( fVariance, 1.0 ) ) {
+            std::cerr << "Region " << n + 1 << " does not match the summary" << std::endl;
+            bOK = false;
+        }
+    }
+
+    unsigned int nExtra = 0;
+    if ( file >> nExtra ) {
+        std::cerr << "The summary has more regions than the mask" << std::endl;
+        bOK = false;
+    }
+
+    return bOK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//Each voxel of the image is the label that the same voxel of the source
+//maps to. Every label of the source must be in the map.
+int checkRelabel( int argc, char *argv[] )
+{
+    if ( argc != 5 ) {
+        printUsage( argv[0] );
+        return EXIT_FAILURE;
+    }
+
+    std::map<float, float> mapLabels;
+    std::stringstream ss( argv[4] );
+    std::string sPair;
+    while ( std::getline( ss, sPair, ',' ) ) {
+        const std::string::size_type nEquals = sPair.find( '=' );
+        if ( nEquals == std::string::npos ) {
+            std::cerr << "Cannot read the mapping " << sPair << std::endl;
+            return EXIT_FAILURE;
+        }
+        mapLabels[ atof( sPair.substr( 0, nEquals ).c_str() ) ] = atof( sPair.substr( nEquals + 1 ).c_str() );
+    }
+
+    ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName( argv[2] );
+    reader->Update();
+    ReaderType::Pointer sourceReader = ReaderType::New();
+    sourceReader->SetFileName( argv[3] );
+    sourceReader->Update();
+
+    if ( reader->GetOutput()->GetLargestPossibleRegion().GetSize() !=
+         sourceReader->GetOutput()->GetLargestPossibleRegion().GetSize() ) {
+        std::cerr << "The image and the source are not the same size" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    ConstIteratorType it( reader->GetOutput(), reader->GetOutput()->GetLargestPossibleRegion() );
+    ConstIteratorType itSource( sourceReader->GetOutput(), sourceReader->GetOutput()->GetLargestPossibleRegion() );
+    itk::SizeValueType nWrong = 0;
+    for ( it.GoToBegin(), itSource.GoToBegin(); !it.IsAtEnd(); ++it, ++itSource ) {
+        std::map<float, float>::const_iterator found = mapLabels.find( itSource.Get() );
+        if ( found == mapLabels.end() ) {
+            std::cerr << "The source has label " << itSource.Get() << ", which is not in the map" << std::endl;
+            return EXIT_FAILURE;
+        }
+        if ( it.Get() != found->second ) {
+            nWrong++;
+        }
+    }
+    std::cerr << "wrong labels " << nWrong << std::endl;
+
+    if ( nWrong > 0 ) {
+        std::cerr << "The image is not the source relabelled" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int main( int argc, char *argv[] )
+{
+    if ( argc < 2 ) {
+        printUsage( argv[0] );
+        return EXIT_FAILURE;
+    }
+
+    const std::string sMode = argv[1];
+
+    try {
+        if ( sMode == "notes" ) {
+            return checkNotes( argc, argv );
+        } else if ( sMode == "size" ) {
+            return checkSize( argc, argv );
+        } else if ( sMode == "labels" ) {
+            return checkLabels( argc, argv );
+        } else if ( sMode == "volume" ) {
+            return checkVolume( argc, argv );
+        } else if ( sMode == "summary" ) {
+            return checkSummary( argc, argv );
+        } else if ( sMode == "relabel" ) {
+            return checkRelabel( argc, argv );
+        }
+    } catch( itk::ExceptionObject & excp ) {
+        std::cerr << excp << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    printUsage( argv[0] );
+    return EXIT_FAILURE;
+}
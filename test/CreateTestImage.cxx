@@ -31,6 +31,10 @@
    this file now creates an additionnal image: 3D parcellation of the original image 
    in which the regions are labelled with some random values.
 
+   Called with options instead of three file names, it writes a phantom of
+   any size from petpvcPhantom.h instead, e.g.
+      pvc_createTestImage --size 256 256 128 --regions 300 --edge 4 -o phantom.nii -m mask.nii
+
 */
 
 #include "itkSpatialObjectToImageFilter.h"
@@ -44,46 +48,154 @@
 #include "itkImageFileWriter.h"
 #include <itkBinaryThresholdImageFilter.h>
 
-#include "itkCastImageFilter.h"
-#include "itkPasteImageFilter.h"
+#include <metaCommand.h>
+
+#include "petpvcPhantom.h"
+
+#include <algorithm>
 #include <iostream>
 
 // helper function:
-// store a 3D image inside a 4D image at a particular index
-// at present, we return a new 4D image (as KT couldn't figure out how to run "in-place")
+// store a 3D image inside a 4D image at a particular index, in place.
+// The 4D image must have the same size as the 3D image in x, y and z.
 template <typename ImageType, typename Image4DType>
-typename Image4DType::Pointer
-copy_3d_to_4d(const ImageType * image, const Image4DType * image4d, int idx)
+void copy_3d_to_4d(const ImageType * image, Image4DType * image4d, int idx)
 {
-    // this works by first casting the 3d image to a 4d one (with a single "frame")
-    // then "pasting" this 4d image inside the image4d at the correct place
-
-    typedef itk::CastImageFilter<ImageType, Image4DType> castType;
-    typedef itk::PasteImageFilter<Image4DType, Image4DType> pasteType;
-
-    typename castType::Pointer castFilter = castType::New();
-    castFilter->SetInput(image);
-    castFilter->Update();
-    typename pasteType::Pointer pasteFilter = pasteType::New();
-    pasteFilter->SetSourceImage(castFilter->GetOutput());
-    pasteFilter->SetDestinationImage(image4d);
-    pasteFilter->SetSourceRegion(castFilter->GetOutput()->GetLargestPossibleRegion());
-    //pasteFilter->InPlaceOn(); // this doesn't work for some reason
-    typename Image4DType::IndexType destinationIndex;
-    destinationIndex[0] = 0;
-    destinationIndex[1] = 0;
-    destinationIndex[2] = 0;
-    destinationIndex[3] = idx;
-    pasteFilter->SetDestinationIndex(destinationIndex);
-    pasteFilter->Update();
-    typename Image4DType::Pointer newimage4d = pasteFilter->GetOutput();
-    return newimage4d;
+    const size_t nVoxels = image->GetBufferedRegion().GetNumberOfPixels();
+    const typename ImageType::PixelType * pSource = image->GetBufferPointer();
+    typename Image4DType::PixelType * pTarget = image4d->GetBufferPointer() + idx * nVoxels;
+
+    std::copy( pSource, pSource + nVoxels, pTarget );
+    image4d->Modified();
+}
+
+template <typename TImage>
+bool write_image(const TImage * image, const std::string & sFileName)
+{
+    typedef itk::ImageFileWriter< TImage > WriterType;
+    typename WriterType::Pointer writer = WriterType::New();
+    writer->SetFileName( sFileName );
+    writer->SetInput( image );
+
+    try {
+        writer->Update();
+    } catch( itk::ExceptionObject & excp ) {
+        std::cerr << "[Error]\tCannot write " << sFileName << ": " << excp << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// writes a phantom from petpvcPhantom.h, with its settings from the command line
+int create_phantom( int argc, char *argv[] )
+{
+    MetaCommand command;
+    command.SetName( "pvc_createTestImage" );
+    command.SetDescription( "Creates a synthetic phantom with any number of regions" );
+
+    command.SetOption( "Size", "s", false, "Matrix size" );
+    command.SetOptionLongTag( "Size", "size" );
+    command.AddOptionField( "Size", "X", MetaCommand::INT, true, "128" );
+    command.AddOptionField( "Size", "Y", MetaCommand::INT, true, "128" );
+    command.AddOptionField( "Size", "Z", MetaCommand::INT, true, "64" );
+
+    command.SetOption( "Spacing", "v", false, "Voxel size in mm" );
+    command.SetOptionLongTag( "Spacing", "spacing" );
+    command.AddOptionField( "Spacing", "X", MetaCommand::FLOAT, true, "2" );
+    command.AddOptionField( "Spacing", "Y", MetaCommand::FLOAT, true, "2" );
+    command.AddOptionField( "Spacing", "Z", MetaCommand::FLOAT, true, "2" );
+
+    command.SetOption( "Regions", "r", false, "Number of regions" );
+    command.SetOptionLongTag( "Regions", "regions" );
+    command.AddOptionField( "Regions", "N", MetaCommand::INT, true, "16" );
+
+    command.SetOption( "Edge", "e", false, "Width of the probabilistic region edges in mm (0 for binary regions)" );
+    command.SetOptionLongTag( "Edge", "edge" );
+    command.AddOptionField( "Edge", "mm", MetaCommand::FLOAT, true, "0" );
+
+    command.SetOption( "FWHM", "f", false, "FWHM in mm of the PSF applied to the blurred image" );
+    command.SetOptionLongTag( "FWHM", "fwhm" );
+    command.AddOptionField( "FWHM", "mm", MetaCommand::FLOAT, true, "6" );
+
+    command.SetOption( "Background", "g", false, "Background activity" );
+    command.SetOptionLongTag( "Background", "background" );
+    command.AddOptionField( "Background", "value", MetaCommand::FLOAT, true, "0.5" );
+
+    command.SetOption( "Seed", "d", false, "Seed for the region activities" );
+    command.SetOptionLongTag( "Seed", "seed" );
+    command.AddOptionField( "Seed", "N", MetaCommand::INT, true, "1" );
+
+    command.SetOption( "Output", "o", true, "Unblurred activity image" );
+    command.AddOptionField( "Output", "filename", MetaCommand::STRING, true, "" );
+
+    command.SetOption( "Blurred", "b", false, "Activity image blurred by the PSF" );
+    command.SetOptionLongTag( "Blurred", "blurred" );
+    command.AddOptionField( "Blurred", "filename", MetaCommand::STRING, true, "" );
+
+    command.SetOption( "Mask", "m", false, "4-D mask, one volume per region then the background" );
+    command.AddOptionField( "Mask", "filename", MetaCommand::STRING, true, "" );
+
+    command.SetOption( "Labels", "l", false, "3-D parcellation, regions labelled from 1 and background 0" );
+    command.SetOptionLongTag( "Labels", "labels" );
+    command.AddOptionField( "Labels", "filename", MetaCommand::STRING, true, "" );
+
+    command.SetOption( "Threads", "j", false, "Maximum number of threads to use (0 for the default)" );
+    command.SetOptionLongTag( "Threads", "threads" );
+    command.AddOptionField( "Threads", "N", MetaCommand::INT, true, "0" );
+
+    if ( !command.Parse( argc, argv ) ) {
+        return EXIT_FAILURE;
+    }
+
+    petpvc::SetNumberOfThreads( command.GetValueAsInt( "Threads", "N" ) );
+
+    petpvc::PhantomSettings settings;
+    settings.size[0] = command.GetValueAsInt( "Size", "X" );
+    settings.size[1] = command.GetValueAsInt( "Size", "Y" );
+    settings.size[2] = command.GetValueAsInt( "Size", "Z" );
+    settings.spacing[0] = command.GetValueAsFloat( "Spacing", "X" );
+    settings.spacing[1] = command.GetValueAsFloat( "Spacing", "Y" );
+    settings.spacing[2] = command.GetValueAsFloat( "Spacing", "Z" );
+    settings.nRegions = command.GetValueAsInt( "Regions", "N" );
+    settings.fEdgeWidth = command.GetValueAsFloat( "Edge", "mm" );
+    settings.fBackground = command.GetValueAsFloat( "Background", "value" );
+    settings.nSeed = command.GetValueAsInt( "Seed", "N" );
+    settings.bMask = command.GetOptionWasSet( "Mask" );
+
+    //Only blur if the blurred image is wanted.
+    settings.fFWHM = command.GetOptionWasSet( "Blurred" ) ? command.GetValueAsFloat( "FWHM", "mm" ) : 0.0f;
+
+    std::cout << "Creating a " << settings.size[0] << "x" << settings.size[1] << "x" << settings.size[2]
+              << " phantom with " << settings.nRegions << " regions" << std::endl;
+
+    const petpvc::Phantom phantom = petpvc::CreatePhantom( settings );
+
+    bool bOK = write_image( phantom.truth.GetPointer(), command.GetValueAsString( "Output", "filename" ) );
+
+    if ( command.GetOptionWasSet( "Blurred" ) ) {
+        bOK = write_image( phantom.image.GetPointer(), command.GetValueAsString( "Blurred", "filename" ) ) && bOK;
+    }
+    if ( command.GetOptionWasSet( "Mask" ) ) {
+        bOK = write_image( phantom.mask.GetPointer(), command.GetValueAsString( "Mask", "filename" ) ) && bOK;
+    }
+    if ( command.GetOptionWasSet( "Labels" ) ) {
+        bOK = write_image( phantom.labels.GetPointer(), command.GetValueAsString( "Labels", "filename" ) ) && bOK;
+    }
+
+    return bOK ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 int main( int argc, char *argv[] )
 {
+    if ( argc > 1 && argv[1][0] == '-' ) {
+        return create_phantom( argc, argv );
+    }
+
     if( argc != 4 ) {
         std::cerr << "Usage: " << argv[0] << " outputimagefile outputmaskfile outputparcellation" << std::endl;
+        std::cerr << "   or: " << argv[0] << " [--size X Y Z] [--spacing X Y Z] [--regions N] [--edge MM]"
+                  << " [--fwhm MM] [--seed N] -o IMAGE [--blurred IMAGE] [-m MASK] [--labels LABELS]" << std::endl;
         return EXIT_FAILURE;
     }
     //  We declare the pixel type and dimension of the image to be produced as
@@ -340,6 +452,7 @@ int main( int argc, char *argv[] )
             origin[3]=0;
             mask->SetOrigin(origin);
             mask->Allocate();
+            mask->FillBuffer(0);
         }
 
         // now fill the mask appropriately
@@ -355,7 +468,7 @@ int main( int argc, char *argv[] )
                 thresholdFilter->SetOutsideValue( 0 );
                 thresholdFilter->Update();
                 // copy to mask
-                mask=copy_3d_to_4d(thresholdFilter->GetOutput(), mask.GetPointer(), 0);
+                copy_3d_to_4d(thresholdFilter->GetOutput(), mask.GetPointer(), 0);
             }
 
             // find the mask for each object, just by reusing the original object as
@@ -367,15 +480,15 @@ int main( int argc, char *argv[] )
 
             imageFilter->SetInput( ellipse );
             imageFilter->Update();
-            mask=copy_3d_to_4d(imageFilter->GetOutput(), mask.GetPointer(), 1);
+            copy_3d_to_4d(imageFilter->GetOutput(), mask.GetPointer(), 1);
 
             imageFilter->SetInput( cylinder1 );
             imageFilter->Update();
-            mask=copy_3d_to_4d(imageFilter->GetOutput(), mask.GetPointer(), 2);
+            copy_3d_to_4d(imageFilter->GetOutput(), mask.GetPointer(), 2);
 
             imageFilter->SetInput( cylinder2 );
             imageFilter->Update();
-            mask=copy_3d_to_4d(imageFilter->GetOutput(), mask.GetPointer(), 3);
+            copy_3d_to_4d(imageFilter->GetOutput(), mask.GetPointer(), 3);
         }
 
 
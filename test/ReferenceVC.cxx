@@ -0,0 +1,216 @@
+/*
+   ReferenceVC.cxx
+
+   Author:      Benjamin A. Thomas
+
+   Copyright 2026 Institute of Nuclear Medicine, University College London.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+   This program is a plain reblurred Van-Cittert, built only from ITK
+   filters as the VC and intra-regional VC filters were before they were
+   optimised. The tests compare the filters against it.
+
+ */
+
+#include <itkImage.h>
+#include <itkImageFileReader.h>
+#include <itkImageFileWriter.h>
+#include <itkImageDuplicator.h>
+#include <itkImageRegionConstIterator.h>
+#include <itkExtractImageFilter.h>
+#include <itkDiscreteGaussianImageFilter.h>
+#include <itkAddImageFilter.h>
+#include <itkSubtractImageFilter.h>
+#include <itkMultiplyImageFilter.h>
+#include <itkDivideImageFilter.h>
+#include <itkThresholdImageFilter.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+typedef itk::Image<float, 3> ImageType;
+typedef itk::Image<float, 4> MaskImageType;
+typedef itk::ImageFileReader<ImageType> ReaderType;
+typedef itk::ImageFileReader<MaskImageType> MaskReaderType;
+typedef itk::ImageFileWriter<ImageType> WriterType;
+typedef itk::ImageDuplicator<ImageType> DuplicatorType;
+typedef itk::ImageRegionConstIterator<ImageType> ConstIteratorType;
+typedef itk::ExtractImageFilter<MaskImageType, ImageType> ExtractFilterType;
+typedef itk::DiscreteGaussianImageFilter<ImageType, ImageType> BlurringFilterType;
+typedef itk::AddImageFilter<ImageType, ImageType> AddFilterType;
+typedef itk::SubtractImageFilter<ImageType, ImageType> SubFilterType;
+typedef itk::MultiplyImageFilter<ImageType, ImageType> MultiplyFilterType;
+typedef itk::DivideImageFilter<ImageType, ImageType, ImageType> DivideFilterType;
+typedef itk::ThresholdImageFilter<ImageType> ThresholdFilterType;
+
+//Blurs image with the PSF. With a region, the blur is intra-regional:
+//region * blur( region * image ) / blur( region ).
+ImageType::Pointer blurImage( ImageType * image, ImageType * region, const BlurringFilterType::ArrayType & variance )
+{
+    BlurringFilterType::Pointer blurFilter = BlurringFilterType::New();
+    blurFilter->SetVariance( variance );
+
+    if ( region == NULL ) {
+        blurFilter->SetInput( image );
+        blurFilter->Update();
+        return blurFilter->GetOutput();
+    }
+
+    MultiplyFilterType::Pointer multiplyFilter = MultiplyFilterType::New();
+    multiplyFilter->SetInput1( region );
+    multiplyFilter->SetInput2( image );
+    blurFilter->SetInput( multiplyFilter->GetOutput() );
+
+    BlurringFilterType::Pointer blurFilter2 = BlurringFilterType::New();
+    blurFilter2->SetVariance( variance );
+    blurFilter2->SetInput( region );
+
+    DivideFilterType::Pointer divideFilter = DivideFilterType::New();
+    divideFilter->SetInput1( blurFilter->GetOutput() );
+    divideFilter->SetInput2( blurFilter2->GetOutput() );
+
+    MultiplyFilterType::Pointer multiplyFilter2 = MultiplyFilterType::New();
+    multiplyFilter2->SetInput1( region );
+    multiplyFilter2->SetInput2( divideFilter->GetOutput() );
+    multiplyFilter2->Update();
+    return multiplyFilter2->GetOutput();
+}
+
+//Runs up to nIterations of VC from imageEstimate, stopping early on fStop.
+ImageType::Pointer runVC( ImageType * pet, ImageType::Pointer imageEstimate, ImageType * region,
+                          const BlurringFilterType::ArrayType & variance, int nIterations, float fAlpha,
+                          float fStop, double fSumOfPETsq )
+{
+    for ( int n = 1; n <= nIterations; n++ ) {
+        ImageType::Pointer imageBlurred = blurImage( imageEstimate, region, variance );
+
+        SubFilterType::Pointer subFilter = SubFilterType::New();
+        subFilter->SetInput1( pet );
+        subFilter->SetInput2( imageBlurred );
+        subFilter->Update();
+
+        ImageType::Pointer imageResidual = blurImage( subFilter->GetOutput(), region, variance );
+
+        MultiplyFilterType::Pointer multiplyFilter = MultiplyFilterType::New();
+        multiplyFilter->SetConstant( fAlpha );
+        multiplyFilter->SetInput( imageResidual );
+
+        AddFilterType::Pointer addFilter = AddFilterType::New();
+        addFilter->SetInput1( imageEstimate );
+        addFilter->SetInput2( multiplyFilter->GetOutput() );
+
+        ThresholdFilterType::Pointer thresholdFilter = ThresholdFilterType::New();
+        thresholdFilter->ThresholdBelow( 0 );
+        thresholdFilter->SetOutsideValue( 0 );
+        thresholdFilter->SetInput( addFilter->GetOutput() );
+        thresholdFilter->Update();
+
+        ImageType::Pointer imagePrev = imageEstimate;
+        imageEstimate = thresholdFilter->GetOutput();
+        imageEstimate->DisconnectPipeline();
+
+        double fSumOfDiffsq = 0.0;
+        ConstIteratorType currIt( imageEstimate, imageEstimate->GetLargestPossibleRegion() );
+        ConstIteratorType prevIt( imagePrev, imagePrev->GetLargestPossibleRegion() );
+        for ( currIt.GoToBegin(), prevIt.GoToBegin(); !currIt.IsAtEnd(); ++currIt, ++prevIt ) {
+            const double fDiff = currIt.Get() - prevIt.Get();
+            fSumOfDiffsq += fDiff * fDiff;
+        }
+
+        if ( std::sqrt( fSumOfDiffsq ) / std::sqrt( fSumOfPETsq ) < fStop ) {
+            break;
+        }
+    }
+
+    return imageEstimate;
+}
+
+int main( int argc, char *argv[] )
+{
+    if ( argc != 9 && argc != 10 ) {
+        std::cerr << "Usage: " << argv[0]
+                  << " <input> <output> <fwhmx> <fwhmy> <fwhmz> <iterations> <alpha> <stop> [mask4d]" << std::endl
+                  << "With a 4-D mask, each region in turn is given the intra-regional VC." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    try {
+        ReaderType::Pointer reader = ReaderType::New();
+        reader->SetFileName( argv[1] );
+        reader->Update();
+        ImageType::Pointer pet = reader->GetOutput();
+
+        BlurringFilterType::ArrayType variance;
+        for ( unsigned int i = 0; i < 3; i++ ) {
+            const double fSigma = atof( argv[i + 3] ) / ( 2.0 * std::sqrt( 2.0 * std::log( 2.0 ) ) );
+            variance[i] = fSigma * fSigma;
+        }
+
+        const int nIterations = atoi( argv[6] );
+        const float fAlpha = atof( argv[7] );
+        const float fStop = atof( argv[8] );
+
+        double fSumOfPETsq = 0.0;
+        ConstIteratorType it( pet, pet->GetLargestPossibleRegion() );
+        for ( it.GoToBegin(); !it.IsAtEnd(); ++it ) {
+            fSumOfPETsq += it.Get() * it.Get();
+        }
+
+        DuplicatorType::Pointer duplicator = DuplicatorType::New();
+        duplicator->SetInputImage( pet );
+        duplicator->Update();
+        ImageType::Pointer imageEstimate = duplicator->GetOutput();
+
+        if ( argc == 9 ) {
+            imageEstimate = runVC( pet, imageEstimate, NULL, variance, nIterations, fAlpha, fStop, fSumOfPETsq );
+        } else {
+            MaskReaderType::Pointer maskReader = MaskReaderType::New();
+            maskReader->SetFileName( argv[9] );
+            maskReader->Update();
+
+            MaskImageType::RegionType maskRegion = maskReader->GetOutput()->GetLargestPossibleRegion();
+            const unsigned int nRegions = maskRegion.GetSize()[3];
+
+            //Each region is corrected in turn, starting from the estimate
+            //the regions before it left.
+            for ( unsigned int n = 0; n < nRegions; n++ ) {
+                MaskImageType::RegionType volume = maskRegion;
+                volume.SetIndex( 3, n );
+                volume.SetSize( 3, 0 );
+
+                ExtractFilterType::Pointer extractFilter = ExtractFilterType::New();
+                extractFilter->SetInput( maskReader->GetOutput() );
+                extractFilter->SetDirectionCollapseToIdentity();
+                extractFilter->SetExtractionRegion( volume );
+                extractFilter->Update();
+
+                ImageType::Pointer region = extractFilter->GetOutput();
+                region->SetDirection( pet->GetDirection() );
+
+                imageEstimate = runVC( pet, imageEstimate, region, variance, nIterations, fAlpha, fStop, fSumOfPETsq );
+            }
+        }
+
+        WriterType::Pointer writer = WriterType::New();
+        writer->SetFileName( argv[2] );
+        writer->SetInput( imageEstimate );
+        writer->Update();
+    } catch( itk::ExceptionObject & excp ) {
+        std::cerr << excp << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,307 @@
+/*
+   petpvcPhantom.h
+
+   Author:      Benjamin A. Thomas
+
+   Copyright 2026 Institute of Nuclear Medicine, University College London.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+ */
+
+/*
+   Synthetic phantoms of any size for tests and benchmarks.
+
+   Regions are ellipsoids placed on a regular grid, one per cell, so any
+   number of regions fits in any matrix. Edges can be probabilistic: the
+   mask falls linearly from 1 to 0 over the given width (in mm), as in a
+   segmentation of a blurred MR image. The last mask volume is the
+   background, so the volumes of each voxel sum to one.
+
+   Regions do not overlap, so they are drawn in parallel, each straight
+   into its own volume of the mask. For very large phantoms the 4-D mask
+   can be left out and only the label image made.
+ */
+
+#ifndef __PETPVCPHANTOM_H
+#define __PETPVCPHANTOM_H
+
+#include <itkImage.h>
+#include <itkDiscreteGaussianImageFilter.h>
+
+#include "petpvcParallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace petpvc
+{
+
+struct PhantomSettings {
+    itk::Size<3> size;
+    double spacing[3];
+    unsigned int nRegions;
+    //Width of the probabilistic edge in mm. Zero gives binary regions.
+    float fEdgeWidth;
+    //FWHM in mm of the PSF applied to the activity. Zero for no blurring.
+    float fFWHM;
+    float fBackground;
+    unsigned int nSeed;
+    //Make the 4-D mask, which holds one image per region.
+    bool bMask;
+
+    PhantomSettings() {
+        size[0] = 128;
+        size[1] = 128;
+        size[2] = 64;
+        spacing[0] = spacing[1] = spacing[2] = 2.0;
+        nRegions = 16;
+        fEdgeWidth = 0.0f;
+        fFWHM = 6.0f;
+        fBackground = 0.5f;
+        nSeed = 1;
+        bMask = true;
+    }
+};
+
+struct Phantom {
+    typedef itk::Image<float, 3> ImageType;
+    typedef itk::Image<float, 4> MaskImageType;
+    typedef itk::Image<short, 3> LabelImageType;
+
+    //Blurred activity.
+    ImageType::Pointer image;
+    //Unblurred activity.
+    ImageType::Pointer truth;
+    //One volume per region, then the background. Null if bMask is off.
+    MaskImageType::Pointer mask;
+    //Region n has label n+1, background is 0.
+    LabelImageType::Pointer labels;
+    //True mean activity of each region.
+    std::vector<float> vecActivities;
+};
+
+//Small deterministic generator, so phantoms are the same on all platforms.
+inline float NextPhantomRandom( unsigned int & nState )
+{
+    nState = nState * 1664525u + 1013904223u;
+    return ( nState >> 8 ) / 16777216.0f;
+}
+
+template< class TImage >
+typename TImage::Pointer AllocatePhantomImage( const PhantomSettings & settings, unsigned int nVolumes )
+{
+    const unsigned int nDims = TImage::ImageDimension;
+
+    typename TImage::RegionType region;
+    typename TImage::SpacingType spacing;
+    for ( unsigned int i = 0; i < 3; i++ ) {
+        region.SetIndex( i, 0 );
+        region.SetSize( i, settings.size[i] );
+        spacing[i] = settings.spacing[i];
+    }
+    if ( nDims > 3 ) {
+        region.SetIndex( 3, 0 );
+        region.SetSize( 3, nVolumes );
+        spacing[3] = 1.0;
+    }
+
+    typename TImage::Pointer image = TImage::New();
+    image->SetRegions( region );
+    image->SetSpacing( spacing );
+    image->Allocate();
+    image->FillBuffer( 0 );
+
+    return image;
+}
+
+//Draws regions nFirst to nLast - 1. Each region only writes the voxels
+//inside its own grid cell.
+struct PhantomRegionFunctor {
+    const PhantomSettings * settings;
+    const std::vector<float> * vecActivities;
+    unsigned int nGrid[3];
+    double fCell[3];
+    double fEdge;
+    size_t nVoxels;
+    float * pTruth;
+    //Null if there is no mask.
+    float * pMask;
+    float * pBackground;
+    short * pLabels;
+
+    void operator()( itk::SizeValueType nFirst, itk::SizeValueType nLast, itk::SizeValueType ) const {
+        for ( itk::SizeValueType n = nFirst; n < nLast; n++ ) {
+            this->DrawRegion( n );
+        }
+    }
+
+    void DrawRegion( unsigned int n ) const {
+        const PhantomSettings & settings = *this->settings;
+        const unsigned int nCell[3] = { n % nGrid[0], ( n / nGrid[0] ) % nGrid[1], n / ( nGrid[0] * nGrid[1] ) };
+
+        const float fActivity = ( *this->vecActivities )[n];
+
+        double fCentre[3], fRadius[3];
+        long nStart[3], nEnd[3];
+        for ( unsigned int i = 0; i < 3; i++ ) {
+            fCentre[i] = ( nCell[i] + 0.5 ) * fCell[i];
+            fRadius[i] = 0.35 * fCell[i];
+
+            //Bounding box in voxels, including the outer half of the edge.
+            const double fHalf = fRadius[i] + 0.5 * fEdge + settings.spacing[i];
+            nStart[i] = std::max( 0L, (long) std::floor( ( fCentre[i] - fHalf ) / settings.spacing[i] ) );
+            nEnd[i] = std::min( (long) settings.size[i], (long) std::ceil( ( fCentre[i] + fHalf ) / settings.spacing[i] ) );
+        }
+
+        const double fMinRadius = std::min( fRadius[0], std::min( fRadius[1], fRadius[2] ) );
+        float * pRegion = ( this->pMask != NULL ) ? this->pMask + n * this->nVoxels : NULL;
+
+        for ( long z = nStart[2]; z < nEnd[2]; z++ ) {
+            for ( long y = nStart[1]; y < nEnd[1]; y++ ) {
+                for ( long x = nStart[0]; x < nEnd[0]; x++ ) {
+                    //Voxel centres, in mm from the image corner.
+                    const double dx = ( ( x + 0.5 ) * settings.spacing[0] - fCentre[0] ) / fRadius[0];
+                    const double dy = ( ( y + 0.5 ) * settings.spacing[1] - fCentre[1] ) / fRadius[1];
+                    const double dz = ( ( z + 0.5 ) * settings.spacing[2] - fCentre[2] ) / fRadius[2];
+
+                    //Approximate distance outside the surface, in mm.
+                    const double fDist = ( std::sqrt( dx * dx + dy * dy + dz * dz ) - 1.0 ) * fMinRadius;
+
+                    float fWeight;
+                    if ( fEdge > 0.0 ) {
+                        fWeight = (float) std::max( 0.0, std::min( 1.0, 0.5 - fDist / fEdge ) );
+                    } else {
+                        fWeight = ( fDist <= 0.0 ) ? 1.0f : 0.0f;
+                    }
+
+                    if ( fWeight <= 0.0f ) {
+                        continue;
+                    }
+
+                    const size_t nIndex = ( (size_t) z * settings.size[1] + y ) * settings.size[0] + x;
+                    if ( pRegion != NULL ) {
+                        pRegion[nIndex] = fWeight;
+                    }
+                    this->pBackground[nIndex] -= fWeight;
+                    this->pTruth[nIndex] += fWeight * fActivity;
+
+                    if ( fWeight >= 0.5f ) {
+                        this->pLabels[nIndex] = n + 1;
+                    }
+                }
+            }
+        }
+    }
+};
+
+//Adds the background activity to the truth.
+struct PhantomBackgroundFunctor {
+    const float * pBackground;
+    float * pTruth;
+    float fBackground;
+
+    void operator()( itk::SizeValueType nFirst, itk::SizeValueType nLast, itk::SizeValueType ) const {
+        for ( itk::SizeValueType i = nFirst; i < nLast; i++ ) {
+            this->pTruth[i] += this->pBackground[i] * this->fBackground;
+        }
+    }
+};
+
+inline Phantom CreatePhantom( const PhantomSettings & settings )
+{
+    typedef Phantom::ImageType ImageType;
+    typedef Phantom::MaskImageType MaskImageType;
+    typedef Phantom::LabelImageType LabelImageType;
+
+    const unsigned int nRegions = std::max( settings.nRegions, 1u );
+    const size_t nVoxels = (size_t) settings.size[0] * settings.size[1] * settings.size[2];
+
+    Phantom phantom;
+    phantom.truth = AllocatePhantomImage< ImageType >( settings, 1 );
+    phantom.labels = AllocatePhantomImage< LabelImageType >( settings, 1 );
+
+    //Without a mask, the background weight is kept on its own.
+    std::vector<float> vecBackground;
+    float * pMask = NULL;
+    float * pBackground = NULL;
+    if ( settings.bMask ) {
+        phantom.mask = AllocatePhantomImage< MaskImageType >( settings, nRegions + 1 );
+        pMask = phantom.mask->GetBufferPointer();
+        pBackground = pMask + nRegions * nVoxels;
+        std::fill( pBackground, pBackground + nVoxels, 1.0f );
+    } else {
+        vecBackground.assign( nVoxels, 1.0f );
+        pBackground = &vecBackground[0];
+    }
+
+    PhantomRegionFunctor regionFunctor;
+    regionFunctor.settings = &settings;
+    regionFunctor.vecActivities = &phantom.vecActivities;
+    regionFunctor.nVoxels = nVoxels;
+    regionFunctor.pTruth = phantom.truth->GetBufferPointer();
+    regionFunctor.pMask = pMask;
+    regionFunctor.pBackground = pBackground;
+    regionFunctor.pLabels = phantom.labels->GetBufferPointer();
+
+    //Grid of cells, n x n in-plane and as many planes as needed.
+    unsigned int * nGrid = regionFunctor.nGrid;
+    nGrid[0] = nGrid[1] = (unsigned int) std::ceil( std::pow( (double) nRegions, 1.0 / 3.0 ) - 1e-9 );
+    nGrid[2] = ( nRegions + nGrid[0] * nGrid[1] - 1 ) / ( nGrid[0] * nGrid[1] );
+
+    double fMinCell = 0.0;
+    for ( unsigned int i = 0; i < 3; i++ ) {
+        regionFunctor.fCell[i] = settings.size[i] * settings.spacing[i] / nGrid[i];
+        fMinCell = ( i == 0 ) ? regionFunctor.fCell[i] : std::min( fMinCell, regionFunctor.fCell[i] );
+    }
+
+    //Keeps the edges of neighbouring regions apart.
+    regionFunctor.fEdge = std::min( (double) settings.fEdgeWidth, 0.25 * fMinCell );
+
+    //Activities are drawn in order, so they do not depend on the threads.
+    unsigned int nState = settings.nSeed;
+    for ( unsigned int n = 0; n < nRegions; n++ ) {
+        phantom.vecActivities.push_back( 1.0f + 9.0f * NextPhantomRandom( nState ) );
+    }
+
+    ParallelFor( 0, nRegions, regionFunctor );
+
+    PhantomBackgroundFunctor backgroundFunctor;
+    backgroundFunctor.pBackground = pBackground;
+    backgroundFunctor.pTruth = phantom.truth->GetBufferPointer();
+    backgroundFunctor.fBackground = settings.fBackground;
+    ParallelFor( 0, nVoxels, backgroundFunctor );
+
+    if ( settings.fFWHM > 0.0f ) {
+        typedef itk::DiscreteGaussianImageFilter< ImageType, ImageType > BlurType;
+        const double fVariance = std::pow( settings.fFWHM / ( 2.0 * std::sqrt( 2.0 * std::log( 2.0 ) ) ), 2.0 );
+
+        BlurType::Pointer blurFilter = BlurType::New();
+        blurFilter->SetInput( phantom.truth );
+        blurFilter->SetVariance( fVariance );
+        blurFilter->SetUseImageSpacingOn();
+        blurFilter->Update();
+
+        phantom.image = blurFilter->GetOutput();
+        phantom.image->DisconnectPipeline();
+    } else {
+        phantom.image = phantom.truth;
+    }
+
+    return phantom;
+}
+
+} //namespace petpvc
+
+#endif // __PETPVCPHANTOM_H